@@ -1,4 +1,7 @@
 mkdir dist
 cd tools/mdif_png && build.bat && cd ../..
 cd tools/mdif_jpg && build.bat && cd ../..
+cd tools/mdif_stats && build.bat && cd ../..
+cd tools/mdif_diff && build.bat && cd ../..
+cd tools/mdif_catalog && build.bat && cd ../..
 cd tools/mdif_viewer_win && build.bat && cd ../..
\ No newline at end of file
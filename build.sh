@@ -7,6 +7,9 @@ mkdir -p dist \
 
 cd tools/mdif_png && ./build.sh && cd ../..
 cd tools/mdif_jpg && ./build.sh && cd ../..
+cd tools/mdif_stats && ./build.sh && cd ../..
+cd tools/mdif_diff && ./build.sh && cd ../..
+cd tools/mdif_catalog && ./build.sh && cd ../..
 cd tools/mdif_viewer_linux && ./build.sh && cd ../..
 
 cd tools/mdif_png && ./build.sh && cd ../..
@@ -15,6 +18,9 @@ cd tools/mdif_viewer_linux && ./build.sh && cd ../..
 cp tools/mdif_viewer_linux/build/mdif_viewer dist/mdif_1.0.2-1_amd64/usr/local/bin/mdif_viewer
 cp dist/mdif_jpg dist/mdif_1.0.2-1_amd64/usr/local/bin/
 cp dist/mdif_png dist/mdif_1.0.2-1_amd64/usr/local/bin/
+cp dist/mdif_stats dist/mdif_1.0.2-1_amd64/usr/local/bin/
+cp dist/mdif_diff dist/mdif_1.0.2-1_amd64/usr/local/bin/
+cp dist/mdif_catalog dist/mdif_1.0.2-1_amd64/usr/local/bin/
 
 touch dist/mdif_1.0.2-1_amd64/DEBIAN/control
 echo "Package: MDIF" >> dist/mdif_1.0.2-1_amd64/DEBIAN/control
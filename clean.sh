@@ -1,3 +1,3 @@
-rm dist/mdif_jpg dist/mdif_png
+rm dist/mdif_jpg dist/mdif_png dist/mdif_stats dist/mdif_diff dist/mdif_catalog
 rm -rf dist/mdif_1.0.1-2_amd64
 rm -rf tools/mdif_viewer_linux/build
\ No newline at end of file
@@ -1 +1 @@
-g++ -o ../../dist/aliased_circle -I../../src ../../src/mdif.cpp aliased_circle.cpp
\ No newline at end of file
+g++ -o ../../dist/aliased_circle -I../../src ../../src/mdif.cpp aliased_circle.cpp -pthread
\ No newline at end of file
@@ -1 +1 @@
-g++ -x c++ -o ../../dist/generate_gradient -I../../src ../../src/mdif.cpp generate_gradient.ino
\ No newline at end of file
+g++ -x c++ -o ../../dist/generate_gradient -I../../src ../../src/mdif.cpp generate_gradient.ino -pthread
\ No newline at end of file
@@ -1 +1 @@
-g++ -x c++ -o ../../dist/grayscale_dump -I../../src ../../src/mdif.cpp grayscale_dump.ino
\ No newline at end of file
+g++ -x c++ -o ../../dist/grayscale_dump -I../../src ../../src/mdif.cpp grayscale_dump.ino -pthread
\ No newline at end of file
@@ -1 +1 @@
-g++ -x c++ -o ../../dist/load_mdif -I../../src ../../src/mdif.cpp load_mdif.ino
\ No newline at end of file
+g++ -x c++ -o ../../dist/load_mdif -I../../src ../../src/mdif.cpp load_mdif.ino -pthread
\ No newline at end of file
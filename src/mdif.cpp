@@ -1,368 +1,9256 @@
-/* 
- * Copyright 2024 Nathanne Isip
- * 
- * Licensed under the Apache License, Version 2.0 (the "License");
- * you may not use this file except in compliance with the License.
- * You may obtain a copy of the License at
- * 
- *     http://www.apache.org/licenses/LICENSE-2.0
- * 
- * Unless required by applicable law or agreed to in writing, software
- * distributed under the License is distributed on an "AS IS" BASIS,
- * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
- * See the License for the specific language governing permissions and
- * limitations under the License.
- */
-
-#ifdef ARDUINO
-#   include <SD.h>
-#   include <SPI.h>
-#else
-#   include <stdio.h>
-#   include <stdlib.h>
-#   include <string.h>
-#endif
-
-#include "mdif.h"
-
-void mdif_init(mdif_t* image, short width, short height) {
-    image->signature[0] = 'N';
-    image->signature[1] = 'T';
-
-    image->width = width;
-    image->height = height;
-
-    int pixel_count = width * height;
-    image->red   = (unsigned char*) malloc(pixel_count);
-    image->green = (unsigned char*) malloc(pixel_count);
-    image->blue  = (unsigned char*) malloc(pixel_count);
-    image->alpha = (unsigned char*) malloc(pixel_count);
-}
-
-void mdif_free(mdif_t* image) {
-    free(image->red);
-    free(image->green);
-    free(image->blue);
-    free(image->alpha);
-}
-
-mdif_error_t mdif_read(const char* filename, mdif_t* image) {
-    #ifndef ARDUINO
-
-    FILE *file = fopen(filename, "rb");
-    if(!file)
-        return MDIF_ERROR_INVALID_FILE_HANDLE;
-
-    if(fread(image->signature, sizeof(char), 2, file) != 2) {
-        fclose(file);
-        return MDIF_ERROR_READ;
-    }
-
-    if(strcmp(image->signature, "NT") != 0) {
-        fclose(file);
-        return MDIF_ERROR_INVALID_SIGNATURE;
-    }
-
-    if(fread(&image->width, sizeof(short), 1, file) != 1) {
-        fclose(file);
-        return MDIF_ERROR_READ;
-    }
-
-    if(fread(&image->height, sizeof(short), 1, file) != 1) {
-        fclose(file);
-        return MDIF_ERROR_READ;
-    }
-
-    if(image->width < 1 || image->width > 1024) {
-        fclose(file);
-        return MDIF_ERROR_INVALID_WIDTH;
-    }
-
-    if(image->height < 1 || image->height > 1024) {
-        fclose(file);
-        return MDIF_ERROR_INVALID_HEIGHT;
-    }
-
-    size_t pixel_count = image->width * image->height;
-    image->red      = (unsigned char*) malloc(pixel_count);
-    image->blue     = (unsigned char*) malloc(pixel_count);
-    image->green    = (unsigned char*) malloc(pixel_count);
-    image->alpha    = (unsigned char*) malloc(pixel_count);
-
-    if(!image->red ||
-        !image->blue ||
-        !image->green ||
-        !image->alpha
-    ) {
-        fclose(file);
-        return MDIF_ERROR_CANNOT_ALLOCATE;
-    }
-
-    if(fread(image->red,    sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fread(image->blue,  sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fread(image->green, sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fread(image->alpha, sizeof(unsigned char), pixel_count, file)
-            != pixel_count
-    ) {
-        fclose(file);
-        return MDIF_ERROR_READ;
-    }
-
-    fclose(file);
-
-    #else
-
-    File file = SD.open(filename, FILE_READ);
-    if(!file)
-        return MDIF_ERROR_INVALID_FILE_HANDLE;
-
-    if(file.read((uint8_t*) image->signature, 2) != 2) {
-        file.close();
-        return MDIF_ERROR_READ;
-    }
-
-    if(strncmp(image->signature, "NT", 2) != 0) {
-        file.close();
-        return MDIF_ERROR_INVALID_SIGNATURE;
-    }
-
-    if(file.read((uint8_t*) &image->width, sizeof(short))
-        != sizeof(short)) {
-        file.close();
-        return MDIF_ERROR_READ;
-    }
-
-    if(file.read((uint8_t*) &image->height, sizeof(short))
-        != sizeof(short)) {
-        file.close();
-        return MDIF_ERROR_READ;
-    }
-
-    if(image->width < 1 || image->width > 1024) {
-        file.close();
-        return MDIF_ERROR_INVALID_WIDTH;
-    }
-
-    if(image->height < 1 || image->height > 1024) {
-        file.close();
-        return MDIF_ERROR_INVALID_HEIGHT;
-    }
-
-    size_t pixel_count = image->width * image->height;
-    image->red   = (unsigned char*) malloc(pixel_count);
-    image->green = (unsigned char*) malloc(pixel_count);
-    image->blue  = (unsigned char*) malloc(pixel_count);
-    image->alpha = (unsigned char*) malloc(pixel_count);
-
-    if(!image->red      ||
-        !image->green   ||
-        !image->blue    ||
-        !image->alpha) {
-        file.close();
-        return MDIF_ERROR_CANNOT_ALLOCATE;
-    }
-
-    if(file.read(image->red, pixel_count)    != pixel_count ||
-        file.read(image->green, pixel_count) != pixel_count ||
-        file.read(image->blue, pixel_count)  != pixel_count ||
-        file.read(image->alpha, pixel_count) != pixel_count) {
-        file.close();
-        return MDIF_ERROR_READ;
-    }
-
-    file.close();
-
-    #endif
-
-    return MDIF_ERROR_NONE;
-}
-
-mdif_error_t mdif_write(const char* filename, mdif_t* image) {
-    #ifndef ARDUINO
-
-    if(image->width < 1 || image->width > 1024)
-        return MDIF_ERROR_INVALID_WIDTH;
-
-    if(image->height < 1 || image->height > 1024)
-        return MDIF_ERROR_INVALID_HEIGHT;
-
-    FILE *file = fopen(filename, "wb");
-    if(!file)
-        return MDIF_ERROR_INVALID_FILE_HANDLE;
-
-    if(fwrite(image->signature, sizeof(char), 2, file) != 2) {
-        fclose(file);
-        return MDIF_ERROR_WRITE;
-    }
-
-    if(fwrite(&image->width, sizeof(short), 1, file) != 1) {
-        fclose(file);
-        return MDIF_ERROR_WRITE;
-    }
-
-    if(fwrite(&image->height, sizeof(short), 1, file) != 1) {
-        fclose(file);
-        return MDIF_ERROR_WRITE;
-    }
-
-    size_t pixel_count = image->width * image->height;
-    if(fwrite(image->red,    sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fwrite(image->blue,  sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fwrite(image->green, sizeof(unsigned char), pixel_count, file)
-            != pixel_count ||
-        fwrite(image->alpha, sizeof(unsigned char), pixel_count, file)
-            != pixel_count) {
-        fclose(file);
-        return MDIF_ERROR_WRITE;
-    }
-
-    fclose(file);
-
-    #else
-
-    if(image->width < 1 || image->width > 1024)
-        return MDIF_ERROR_INVALID_WIDTH;
-
-    if(image->height < 1 || image->height > 1024)
-        return MDIF_ERROR_INVALID_HEIGHT;
-
-    File file = SD.open(filename, FILE_WRITE);
-    if(!file)
-        return MDIF_ERROR_INVALID_FILE_HANDLE;
-
-    if(file.write((const uint8_t*) image->signature, 2) != 2) {
-        file.close();
-        return MDIF_ERROR_WRITE;
-    }
-
-    if(file.write((const uint8_t*) &image->width, sizeof(short)) != sizeof(short)) {
-        file.close();
-        return MDIF_ERROR_WRITE;
-    }
-
-    if(file.write((const uint8_t*) &image->height, sizeof(short)) != sizeof(short)) {
-        file.close();
-        return MDIF_ERROR_WRITE;
-    }
-
-    size_t pixel_count = image->width * image->height;
-    if(file.write(image->red, pixel_count)    != pixel_count ||
-        file.write(image->green, pixel_count) != pixel_count ||
-        file.write(image->blue, pixel_count)  != pixel_count ||
-        file.write(image->alpha, pixel_count) != pixel_count) {
-        file.close();
-        return MDIF_ERROR_WRITE;
-    }
-
-    file.close();
-
-    #endif
-
-    return MDIF_ERROR_NONE;
-}
-
-mdif_error_t mdif_grayscale(mdif_t* image, float* grayscale) {
-    if(!image)
-        return MDIF_ERROR_IMAGE;
-
-    if(!grayscale)
-        return MDIF_ERROR_GRAYSCALE;
-
-    int pixel_count = image->width * image->height;
-    for(int i = 0; i < pixel_count; i++) {
-        float brightness =
-            0.299 * (unsigned char) image->red[i] +
-            0.587 * (unsigned char) image->green[i] +
-            0.114 * (unsigned char) image->blue[i];
-
-        grayscale[i] = brightness / 255.0;
-    }
-
-    return MDIF_ERROR_NONE;
-}
-
-mdif_error_t mdif_antialias(mdif_t* image, mdif_t* aliased_image) {
-    mdif_init(aliased_image, image->width, image->height);
-    if(aliased_image == NULL)
-        return MDIF_ERROR_INVALID_FILE_HANDLE;
-
-    #define mdif_aliasing_clamp(value, min, max) \
-        (value < min ? min : (value > max ? max : value))
-
-    short width = image->width,
-        height = image->height;
-
-    for(short i = 0; i < height; i++) {
-        for(short j = 0; j < width; j++) {
-            int r_sum = 0,
-                g_sum = 0,
-                b_sum = 0,
-                count = 0;
-
-            for(short k = -1; k <= 1; k++) {
-                for(short l = -1; l <= 1; l++) {
-                    short x = mdif_aliasing_clamp(j + l, 0, width - 1),
-                        y = mdif_aliasing_clamp(i + k, 0, height - 1);
-
-                    r_sum += image->red[y * width + x];
-                    g_sum += image->green[y * width + x];
-                    b_sum += image->blue[y * width + x];
-
-                    count++;
-                }
-            }
-
-            aliased_image->red[i * width + j] = r_sum / count;
-            aliased_image->green[i * width + j] = g_sum / count;
-            aliased_image->blue[i * width + j] = b_sum / count;
-            aliased_image->alpha[i * width + j] = image->alpha[i * width + j];
-        }
-    }
-    #undef mdif_aliasing_clamp
-
-    return MDIF_ERROR_NONE;
-}
-
-const char* mdif_error_message(mdif_error_t error_num) {
-    switch(error_num) {
-        case MDIF_ERROR_IO:
-            return "I/O error";
-
-        case MDIF_ERROR_NONE:
-            return "None";
-
-        case MDIF_ERROR_INVALID_SIGNATURE:
-            return "Invalid MDIF signature";
-
-        case MDIF_ERROR_CANNOT_ALLOCATE:
-            return "Canot allocate memory for channels";
-
-        case MDIF_ERROR_INVALID_WIDTH:
-            return "Invalid image width (> 1024)";
-
-        case MDIF_ERROR_INVALID_HEIGHT:
-            return "Invalid image height (> 1024)";
-
-        case MDIF_ERROR_READ:
-            return "Error reading MDIF file";
-
-        case MDIF_ERROR_WRITE:
-            return "Error writing MDIF file";
-
-        case MDIF_ERROR_INVALID_FILE_HANDLE:
-            return "Invalid file handle";
-
-        case MDIF_ERROR_IMAGE:
-            return "Image error";
-
-        case MDIF_ERROR_GRAYSCALE:
-            return "Invalid grayscale pointer";
-    }
-
-    return "Unknown error";
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef ARDUINO
+#   include <SD.h>
+#   include <SPI.h>
+#   if defined(ESP32) && defined(MDIF_STATIC_ARENA)
+#       include <esp_attr.h>
+#   endif
+#else
+#   include <stdio.h>
+#   include <stdlib.h>
+#   include <string.h>
+#   include <math.h>
+#   include <errno.h>
+#   include <time.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   ifdef _WIN32
+#       include <windows.h>
+#       include <io.h>
+#       include <direct.h>
+#       include <sys/utime.h>
+#   else
+#       include <pthread.h>
+#       include <unistd.h>
+#       include <fcntl.h>
+#       include <dirent.h>
+#       include <utime.h>
+#       include <sys/file.h>
+#   endif
+#   if !defined(MDIF_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#       define MDIF_SSE2
+#       include <emmintrin.h>
+#   endif
+#endif
+
+#include "mdif.h"
+
+#define mdif_clamp(value, min, max) \
+    ((value) < (min) ? (min) : ((value) > (max) ? (max) : (value)))
+
+#define MDIF_PALETTE_BYTES (4 * MDIF_PALETTE_SIZE)
+
+typedef struct mdif_file_struct {
+    #ifndef ARDUINO
+    FILE *handle;
+    #else
+    File handle;
+    #endif
+} mdif_file_t;
+
+static bool mdif_file_open(mdif_file_t* file, const char* filename, bool writing) {
+    #ifndef ARDUINO
+    file->handle = fopen(filename, writing ? "wb" : "rb");
+    return file->handle != NULL;
+    #else
+    file->handle = SD.open(filename, writing ? FILE_WRITE : FILE_READ);
+    return (bool) file->handle;
+    #endif
+}
+
+static bool mdif_file_read(mdif_file_t* file, void* data, size_t size) {
+    #ifndef ARDUINO
+    return fread(data, sizeof(unsigned char), size, file->handle) == size;
+    #else
+    return (size_t) file->handle.read((uint8_t*) data, size) == size;
+    #endif
+}
+
+static bool mdif_file_write(mdif_file_t* file, const void* data, size_t size) {
+    #ifndef ARDUINO
+    return fwrite(data, sizeof(unsigned char), size, file->handle) == size;
+    #else
+    return file->handle.write((const uint8_t*) data, size) == size;
+    #endif
+}
+
+static bool mdif_file_seek(mdif_file_t* file, unsigned long offset) {
+    #ifndef ARDUINO
+    return fseek(file->handle, (long) offset, SEEK_SET) == 0;
+    #else
+    return file->handle.seek(offset);
+    #endif
+}
+
+static bool mdif_file_read_at(mdif_file_t* file, unsigned long offset, void* data, size_t size) {
+    #if defined(ARDUINO) || defined(_WIN32)
+    return mdif_file_seek(file, offset) && mdif_file_read(file, data, size);
+    #else
+    return pread(fileno(file->handle), data, size, (off_t) offset) == (ssize_t) size;
+    #endif
+}
+
+static void mdif_file_close(mdif_file_t* file) {
+    #ifndef ARDUINO
+    fclose(file->handle);
+    #else
+    file->handle.close();
+    #endif
+}
+
+static void* mdif_lock_create() {
+    #if defined(ARDUINO)
+    return NULL;
+    #elif defined(_WIN32)
+    CRITICAL_SECTION* section = (CRITICAL_SECTION*) malloc(sizeof(CRITICAL_SECTION));
+    if(section)
+        InitializeCriticalSection(section);
+
+    return section;
+    #else
+    pthread_mutex_t* mutex = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
+    if(mutex && pthread_mutex_init(mutex, NULL) != 0) {
+        free(mutex);
+        return NULL;
+    }
+
+    return mutex;
+    #endif
+}
+
+static void mdif_lock_acquire(void* lock) {
+    if(!lock)
+        return;
+
+    #if defined(_WIN32) && !defined(ARDUINO)
+    EnterCriticalSection((CRITICAL_SECTION*) lock);
+    #elif !defined(ARDUINO)
+    pthread_mutex_lock((pthread_mutex_t*) lock);
+    #endif
+}
+
+static void mdif_lock_release(void* lock) {
+    if(!lock)
+        return;
+
+    #if defined(_WIN32) && !defined(ARDUINO)
+    LeaveCriticalSection((CRITICAL_SECTION*) lock);
+    #elif !defined(ARDUINO)
+    pthread_mutex_unlock((pthread_mutex_t*) lock);
+    #endif
+}
+
+static void mdif_lock_destroy(void* lock) {
+    if(!lock)
+        return;
+
+    #if defined(_WIN32) && !defined(ARDUINO)
+    DeleteCriticalSection((CRITICAL_SECTION*) lock);
+    #elif !defined(ARDUINO)
+    pthread_mutex_destroy((pthread_mutex_t*) lock);
+    #endif
+
+    free(lock);
+}
+
+typedef void (*mdif_task_t)(void* context, int begin, int end);
+
+typedef struct mdif_job_struct {
+    mdif_task_t task;
+    void *context;
+
+    int begin;
+    int end;
+} mdif_job_t;
+
+#define MDIF_MAX_THREADS 64
+
+#if !defined(ARDUINO) && !defined(MDIF_STATIC_ARENA)
+#   ifdef _WIN32
+static DWORD WINAPI mdif_job_run(LPVOID argument) {
+    mdif_job_t* job = (mdif_job_t*) argument;
+    job->task(job->context, job->begin, job->end);
+
+    return 0;
+}
+#   else
+static void* mdif_job_run(void* argument) {
+    mdif_job_t* job = (mdif_job_t*) argument;
+    job->task(job->context, job->begin, job->end);
+
+    return NULL;
+}
+#   endif
+#endif
+
+static int mdif_thread_count(int threads) {
+    #if defined(ARDUINO) || defined(MDIF_STATIC_ARENA)
+    (void) threads;
+    return 1;
+    #else
+    if(threads <= 0) {
+        #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = (int) info.dwNumberOfProcessors;
+        #else
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        #endif
+    }
+
+    return mdif_clamp(threads, 1, MDIF_MAX_THREADS);
+    #endif
+}
+
+static void mdif_parallel(int count, int threads, mdif_task_t task, void* context) {
+    threads = mdif_thread_count(threads);
+    if(threads > count)
+        threads = count;
+
+    if(threads <= 1) {
+        if(count > 0)
+            task(context, 0, count);
+
+        return;
+    }
+
+    #if !defined(ARDUINO) && !defined(MDIF_STATIC_ARENA)
+    mdif_job_t jobs[MDIF_MAX_THREADS];
+    #   ifdef _WIN32
+    HANDLE handles[MDIF_MAX_THREADS];
+    #   else
+    pthread_t handles[MDIF_MAX_THREADS];
+    #   endif
+    bool started[MDIF_MAX_THREADS];
+
+    for(int t = 0; t < threads; t++) {
+        jobs[t].task = task;
+        jobs[t].context = context;
+        jobs[t].begin = (int) ((long long) count * t / threads);
+        jobs[t].end = (int) ((long long) count * (t + 1) / threads);
+    }
+
+    for(int t = 1; t < threads; t++) {
+        #ifdef _WIN32
+        handles[t] = CreateThread(NULL, 0, mdif_job_run, &jobs[t], 0, NULL);
+        started[t] = handles[t] != NULL;
+        #else
+        started[t] = pthread_create(&handles[t], NULL, mdif_job_run, &jobs[t]) == 0;
+        #endif
+    }
+
+    task(context, jobs[0].begin, jobs[0].end);
+    for(int t = 1; t < threads; t++) {
+        if(!started[t]) {
+            task(context, jobs[t].begin, jobs[t].end);
+            continue;
+        }
+
+        #ifdef _WIN32
+        WaitForSingleObject(handles[t], INFINITE);
+        CloseHandle(handles[t]);
+        #else
+        pthread_join(handles[t], NULL);
+        #endif
+    }
+    #endif
+}
+
+#ifdef MDIF_STATIC_ARENA
+
+static constexpr bool mdif_arena_fits(unsigned long long a, unsigned long long b) {
+    return b == 0 || a <= ((size_t) -1) / b;
+}
+
+static constexpr size_t mdif_arena_align(size_t size) {
+    return (size + 15) & ~((size_t) 15);
+}
+
+static_assert(MDIF_MAX_WIDTH >= 1 && MDIF_MAX_WIDTH <= 1024,
+    "MDIF_MAX_WIDTH must be between 1 and 1024");
+static_assert(MDIF_MAX_HEIGHT >= 1 && MDIF_MAX_HEIGHT <= 1024,
+    "MDIF_MAX_HEIGHT must be between 1 and 1024");
+static_assert(MDIF_MAX_CHANNELS >= 1 && MDIF_MAX_CHANNELS <= 4,
+    "MDIF_MAX_CHANNELS must be between 1 and 4");
+static_assert(MDIF_ARENA_SLOTS >= 0 && MDIF_ARENA_SLOTS <= MDIF_ARENA_MAX_SLOTS,
+    "MDIF_ARENA_SLOTS must be between 0 and MDIF_ARENA_MAX_SLOTS");
+static_assert(mdif_arena_fits(MDIF_MAX_WIDTH, MDIF_MAX_HEIGHT) &&
+    mdif_arena_fits((unsigned long long) MDIF_MAX_WIDTH * MDIF_MAX_HEIGHT, MDIF_MAX_CHANNELS),
+    "MDIF arena slot size overflows size_t");
+
+static constexpr size_t mdif_arena_slot_size =
+    mdif_arena_align((size_t) MDIF_ARENA_SLOT_BYTES);
+
+static_assert(mdif_arena_fits(mdif_arena_slot_size, MDIF_ARENA_SLOTS),
+    "MDIF arena size overflows size_t");
+
+#if MDIF_ARENA_SLOTS > 0
+static constexpr size_t mdif_arena_size = mdif_arena_slot_size * MDIF_ARENA_SLOTS;
+
+#   if defined(ESP32) && defined(MDIF_ARENA_IN_PSRAM)
+#       ifdef EXT_RAM_BSS_ATTR
+EXT_RAM_BSS_ATTR
+#       else
+EXT_RAM_ATTR
+#       endif
+#   endif
+static unsigned char mdif_static_arena[mdif_arena_size] __attribute__((aligned(16)));
+
+static unsigned char* mdif_arena_base = mdif_static_arena;
+static unsigned int mdif_arena_slot_count = MDIF_ARENA_SLOTS;
+#else
+static unsigned char* mdif_arena_base = NULL;
+static unsigned int mdif_arena_slot_count = 0;
+#endif
+
+static unsigned long mdif_arena_used = 0;
+
+#ifdef ESP32
+static portMUX_TYPE mdif_arena_mux = portMUX_INITIALIZER_UNLOCKED;
+#   define mdif_arena_enter()   portENTER_CRITICAL(&mdif_arena_mux)
+#   define mdif_arena_leave()   portEXIT_CRITICAL(&mdif_arena_mux)
+#else
+#   define mdif_arena_enter()
+#   define mdif_arena_leave()
+#endif
+
+mdif_error_t mdif_arena_register(void* region, unsigned long size) {
+    size_t offset = (16 - ((size_t) region & 15)) & 15;
+    if(!region || size < offset + mdif_arena_slot_size)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    size_t slots = (size - offset) / mdif_arena_slot_size;
+    if(slots > MDIF_ARENA_MAX_SLOTS)
+        slots = MDIF_ARENA_MAX_SLOTS;
+
+    mdif_error_t result = MDIF_ERROR_NONE;
+    mdif_arena_enter();
+
+    if(mdif_arena_used != 0)
+        result = MDIF_ERROR_ARENA_BUSY;
+    else {
+        mdif_arena_base = (unsigned char*) region + offset;
+        mdif_arena_slot_count = (unsigned int) slots;
+    }
+
+    mdif_arena_leave();
+    return result;
+}
+
+unsigned int mdif_arena_available() {
+    unsigned int available = 0;
+
+    mdif_arena_enter();
+    for(unsigned int i = 0; i < mdif_arena_slot_count; i++)
+        if(!(mdif_arena_used & (1ul << i)))
+            available++;
+    mdif_arena_leave();
+
+    return available;
+}
+
+#endif
+
+static void* mdif_mem_alloc(size_t size) {
+    #ifdef MDIF_STATIC_ARENA
+    if(size > mdif_arena_slot_size)
+        return NULL;
+
+    void* block = NULL;
+    mdif_arena_enter();
+
+    for(unsigned int i = 0; i < mdif_arena_slot_count; i++)
+        if(!(mdif_arena_used & (1ul << i))) {
+            mdif_arena_used |= 1ul << i;
+            block = mdif_arena_base + i * mdif_arena_slot_size;
+            break;
+        }
+
+    mdif_arena_leave();
+    return block;
+    #else
+    return malloc(size);
+    #endif
+}
+
+static void mdif_mem_free(void* block) {
+    #ifdef MDIF_STATIC_ARENA
+    if(!block)
+        return;
+
+    size_t slot = (size_t) ((unsigned char*) block - mdif_arena_base) /
+        mdif_arena_slot_size;
+
+    mdif_arena_enter();
+    mdif_arena_used &= ~(1ul << slot);
+    mdif_arena_leave();
+    #else
+    free(block);
+    #endif
+}
+
+#ifdef MDIF_STATIC_ARENA
+static unsigned char mdif_arena_scratch[MDIF_ARENA_SCRATCH_BYTES] __attribute__((aligned(16)));
+static size_t mdif_arena_scratch_top = 0;
+#endif
+
+static void* mdif_scratch_alloc(size_t size) {
+    #ifdef MDIF_STATIC_ARENA
+    size = mdif_arena_align(size);
+
+    void* block = NULL;
+    mdif_arena_enter();
+
+    if(size <= sizeof(mdif_arena_scratch) - mdif_arena_scratch_top) {
+        block = mdif_arena_scratch + mdif_arena_scratch_top;
+        mdif_arena_scratch_top += size;
+    }
+
+    mdif_arena_leave();
+    return block;
+    #else
+    return malloc(size);
+    #endif
+}
+
+static void mdif_scratch_free(void* block) {
+    #ifdef MDIF_STATIC_ARENA
+    if(!block)
+        return;
+
+    mdif_arena_enter();
+    mdif_arena_scratch_top = (size_t) ((unsigned char*) block - mdif_arena_scratch);
+    mdif_arena_leave();
+    #else
+    free(block);
+    #endif
+}
+
+#ifdef MDIF_STATIC_ARENA
+static size_t mdif_scratch_available() {
+    mdif_arena_enter();
+    size_t available = sizeof(mdif_arena_scratch) - mdif_arena_scratch_top;
+    mdif_arena_leave();
+
+    return available;
+}
+#endif
+
+static bool mdif_alloc_planes(mdif_t* image, size_t pixel_count) {
+    #ifdef MDIF_STATIC_ARENA
+    unsigned char* block = (unsigned char*) mdif_mem_alloc(4 * pixel_count);
+
+    image->red   = block;
+    image->green = block ? block + pixel_count : NULL;
+    image->blue  = block ? block + 2 * pixel_count : NULL;
+    image->alpha = block ? block + 3 * pixel_count : NULL;
+    #else
+    image->red   = (unsigned char*) malloc(pixel_count);
+    image->green = (unsigned char*) malloc(pixel_count);
+    image->blue  = (unsigned char*) malloc(pixel_count);
+    image->alpha = (unsigned char*) malloc(pixel_count);
+    #endif
+
+    image->capacity = (unsigned int) pixel_count;
+    image->pool = NULL;
+
+    if(!image->red ||
+        !image->green ||
+        !image->blue ||
+        !image->alpha) {
+        mdif_free(image);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t mdif_plane_capacity(const mdif_t* header) {
+    size_t pixel_count = (size_t) header->width * header->height;
+
+    if(header->layout == MDIF_LAYOUT_INDEXED && pixel_count < MDIF_PALETTE_BYTES)
+        return MDIF_PALETTE_BYTES;
+
+    return pixel_count;
+}
+
+void mdif_init(mdif_t* image, short width, short height) {
+    image->signature[0] = 'N';
+    image->signature[1] = 'T';
+
+    image->width = width;
+    image->height = height;
+    image->layout = MDIF_LAYOUT_RGBA;
+    image->levels = 0;
+
+    mdif_alloc_planes(image, width * height);
+}
+
+mdif_error_t mdif_init_layout(mdif_t* image, short width, short height, mdif_layout_t layout) {
+    if(!image)
+        return MDIF_ERROR_IMAGE;
+
+    if(layout < MDIF_LAYOUT_RGBA || layout > MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    image->signature[0] = 'N';
+    image->signature[1] = layout != MDIF_LAYOUT_RGBA ? 'X' : 'T';
+
+    image->width = width;
+    image->height = height;
+    image->layout = layout;
+    image->levels = 0;
+
+    if(!mdif_alloc_planes(image, mdif_plane_capacity(image)))
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    if(layout == MDIF_LAYOUT_INDEXED)
+        memset(image->alpha, 0, MDIF_PALETTE_BYTES);
+
+    return MDIF_ERROR_NONE;
+}
+
+static void mdif_pool_put(mdif_pool_t* pool, unsigned char* block, unsigned int capacity);
+
+void mdif_free(mdif_t* image) {
+    if(image->pool)
+        mdif_pool_put(image->pool, image->red, image->capacity);
+    else {
+        #ifdef MDIF_STATIC_ARENA
+        mdif_mem_free(image->red);
+        #else
+        free(image->red);
+        free(image->green);
+        free(image->blue);
+        free(image->alpha);
+        #endif
+    }
+
+    image->red = image->green = image->blue = image->alpha = NULL;
+    image->capacity = 0;
+    image->pool = NULL;
+}
+
+static void mdif_plane_sizes(const mdif_t* image, size_t sizes[4]) {
+    size_t pixel_count = (size_t) image->width * image->height;
+
+    sizes[0] = sizes[1] = sizes[2] = sizes[3] = pixel_count;
+    if(image->layout == MDIF_LAYOUT_RGBA)
+        return;
+
+    if(image->layout == MDIF_LAYOUT_YCBCR420)
+        sizes[1] = sizes[2] = (size_t) ((image->width + 1) / 2) * ((image->height + 1) / 2);
+    else if(image->layout == MDIF_LAYOUT_INDEXED)
+        sizes[1] = sizes[2] = 0;
+
+    sizes[3] = 0;
+}
+
+static void mdif_file_planes(const mdif_t* image, unsigned char* planes[4], size_t sizes[4]) {
+    size_t plane_sizes[4];
+    mdif_plane_sizes(image, plane_sizes);
+
+    planes[0] = image->red;
+    sizes[0] = plane_sizes[0];
+
+    #ifndef ARDUINO
+    bool swapped = image->layout == MDIF_LAYOUT_RGBA;
+    #else
+    bool swapped = false;
+    #endif
+
+    planes[1] = swapped ? image->blue : image->green;
+    planes[2] = swapped ? image->green : image->blue;
+    planes[3] = image->layout == MDIF_LAYOUT_RGBA ? image->alpha : NULL;
+
+    sizes[1] = plane_sizes[2];
+    sizes[2] = plane_sizes[1];
+    sizes[3] = plane_sizes[3];
+}
+
+static void mdif_plane_dims(const mdif_t* image, int plane, int* width, int* height) {
+    bool chroma = image->layout == MDIF_LAYOUT_YCBCR420 && (plane == 1 || plane == 2);
+
+    *width = chroma ? (image->width + 1) / 2 : image->width;
+    *height = chroma ? (image->height + 1) / 2 : image->height;
+}
+
+static int mdif_max_levels(int width, int height) {
+    int levels = 0;
+
+    while(width > 1 || height > 1) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        levels++;
+    }
+
+    return levels;
+}
+
+static unsigned long mdif_header_size(const mdif_t* header) {
+    return header->layout != MDIF_LAYOUT_RGBA || header->levels > 0 ? 8 : 6;
+}
+
+static mdif_error_t mdif_check_header(const mdif_t* header) {
+    if(header->width < 1 || header->width > 1024)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(header->height < 1 || header->height > 1024)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(header->layout > MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    if(header->levels > mdif_max_levels(header->width, header->height) ||
+        (header->layout == MDIF_LAYOUT_INDEXED && header->levels > 0))
+        return MDIF_ERROR_LEVEL;
+
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_read_header(mdif_file_t* file, mdif_t* header) {
+    if(!mdif_file_read(file, header->signature, 2))
+        return MDIF_ERROR_READ;
+
+    bool extended = strncmp(header->signature, "NX", 2) == 0;
+    if(!extended && strncmp(header->signature, "NT", 2) != 0)
+        return MDIF_ERROR_INVALID_SIGNATURE;
+
+    if(!mdif_file_read(file, &header->width, sizeof(short)) ||
+        !mdif_file_read(file, &header->height, sizeof(short)))
+        return MDIF_ERROR_READ;
+
+    header->layout = MDIF_LAYOUT_RGBA;
+    header->levels = 0;
+
+    if(extended) {
+        unsigned char fields[2];
+        if(!mdif_file_read(file, fields, 2))
+            return MDIF_ERROR_READ;
+
+        header->layout = fields[0];
+        header->levels = fields[1];
+    }
+
+    return mdif_check_header(header);
+}
+
+static mdif_error_t mdif_read_planes(mdif_file_t* file, mdif_t* image) {
+    unsigned char* planes[4];
+    size_t sizes[4];
+    mdif_file_planes(image, planes, sizes);
+
+    for(int c = 0; c < 4; c++)
+        if(sizes[c] && !mdif_file_read(file, planes[c], sizes[c]))
+            return MDIF_ERROR_READ;
+
+    if(image->layout != MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_NONE;
+
+    unsigned char count;
+    if(!mdif_file_read(file, &count, 1) ||
+        !mdif_file_read(file, image->alpha, 4 * ((size_t) count + 1)))
+        return MDIF_ERROR_READ;
+
+    memset(image->alpha + 4 * ((size_t) count + 1), 0, 4 * (MDIF_PALETTE_SIZE - 1 - (size_t) count));
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_read(const char* filename, mdif_t* image) {
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_error_t result = mdif_read_header(&file, image);
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    if(!mdif_alloc_planes(image, mdif_plane_capacity(image))) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    result = mdif_read_planes(&file, image);
+    mdif_file_close(&file);
+
+    return result;
+}
+
+static mdif_error_t mdif_pool_take(mdif_pool_t* pool, mdif_t* image, unsigned int pixel_count);
+
+static mdif_error_t mdif_reserve_planes(mdif_t* image, size_t pixel_count) {
+    if(pixel_count <= image->capacity && image->red)
+        return MDIF_ERROR_NONE;
+
+    mdif_pool_t* pool = image->pool;
+    mdif_free(image);
+
+    if(pool)
+        return mdif_pool_take(pool, image, (unsigned int) pixel_count);
+
+    if(!mdif_alloc_planes(image, pixel_count))
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_read_into(const char* filename, mdif_t* image) {
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_t header;
+    mdif_error_t result = mdif_read_header(&file, &header);
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    result = mdif_reserve_planes(image, mdif_plane_capacity(&header));
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    image->signature[0] = header.signature[0];
+    image->signature[1] = header.signature[1];
+    image->width = header.width;
+    image->height = header.height;
+    image->layout = header.layout;
+    image->levels = header.levels;
+
+    result = mdif_read_planes(&file, image);
+    mdif_file_close(&file);
+
+    return result;
+}
+
+static bool mdif_write_base(mdif_file_t* file, const mdif_t* image, unsigned char levels) {
+    bool written;
+    if(image->layout != MDIF_LAYOUT_RGBA || levels > 0) {
+        unsigned char fields[2] = {image->layout, levels};
+
+        written = mdif_file_write(file, "NX", 2) &&
+            mdif_file_write(file, &image->width, sizeof(short)) &&
+            mdif_file_write(file, &image->height, sizeof(short)) &&
+            mdif_file_write(file, fields, 2);
+    }
+    else written = mdif_file_write(file, "NT", 2) &&
+        mdif_file_write(file, &image->width, sizeof(short)) &&
+        mdif_file_write(file, &image->height, sizeof(short));
+
+    unsigned char* planes[4];
+    size_t sizes[4];
+    mdif_file_planes(image, planes, sizes);
+
+    for(int c = 0; c < 4 && written; c++)
+        if(sizes[c])
+            written = mdif_file_write(file, planes[c], sizes[c]);
+
+    if(written && image->layout == MDIF_LAYOUT_INDEXED) {
+        unsigned char count = 0;
+        for(size_t i = 0; i < sizes[0]; i++)
+            if(image->red[i] > count)
+                count = image->red[i];
+
+        written = mdif_file_write(file, &count, 1) &&
+            mdif_file_write(file, image->alpha, 4 * ((size_t) count + 1));
+    }
+
+    return written;
+}
+
+mdif_error_t mdif_write(const char* filename, mdif_t* image) {
+    return mdif_write_pyramid(filename, image, 0);
+}
+
+static void mdif_reduce_row(
+    const unsigned char* above,
+    const unsigned char* below,
+    int width,
+    unsigned char* out
+) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128(),
+        ones = _mm_set1_epi16(1),
+        rounding = _mm_set1_epi16(2);
+
+    for(; 2 * x + 32 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) (above + 2 * x)),
+            a1 = _mm_loadu_si128((const __m128i*) (above + 2 * x + 16)),
+            b0 = _mm_loadu_si128((const __m128i*) (below + 2 * x)),
+            b1 = _mm_loadu_si128((const __m128i*) (below + 2 * x + 16));
+
+        __m128i s0 = _mm_madd_epi16(
+                _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)),
+                ones
+            ),
+            s1 = _mm_madd_epi16(
+                _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)),
+                ones
+            ),
+            s2 = _mm_madd_epi16(
+                _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)),
+                ones
+            ),
+            s3 = _mm_madd_epi16(
+                _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero)),
+                ones
+            );
+
+        __m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(s0, s1), rounding), 2),
+            high = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(s2, s3), rounding), 2);
+
+        _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(low, high));
+    }
+    #endif
+
+    for(; 2 * x + 1 < width; x++)
+        out[x] = (unsigned char) ((
+            above[2 * x] + above[2 * x + 1] +
+            below[2 * x] + below[2 * x + 1] + 2) >> 2);
+
+    if(width & 1)
+        out[x] = (unsigned char) ((above[width - 1] + below[width - 1] + 1) >> 1);
+}
+
+static void mdif_reduce_plane(const unsigned char* plane, int width, int height, unsigned char* out) {
+    int out_width = (width + 1) / 2;
+
+    for(int y = 0; y < height; y += 2)
+        mdif_reduce_row(
+            plane + (size_t) y * width,
+            plane + (size_t) (y + 1 < height ? y + 1 : y) * width,
+            width,
+            out + (size_t) (y / 2) * out_width
+        );
+}
+
+static unsigned long mdif_level_offset(const mdif_t* header, int level, int plane, mdif_t* dimensions) {
+    unsigned long offset = mdif_header_size(header);
+    size_t sizes[4];
+
+    dimensions->width = header->width;
+    dimensions->height = header->height;
+    dimensions->layout = header->layout;
+
+    for(int i = 0; i < level; i++) {
+        mdif_plane_sizes(dimensions, sizes);
+
+        offset += sizes[0] + sizes[1] + sizes[2] + sizes[3];
+        dimensions->width = (short) ((dimensions->width + 1) / 2);
+        dimensions->height = (short) ((dimensions->height + 1) / 2);
+    }
+
+    mdif_plane_sizes(dimensions, sizes);
+    for(int c = 0; c < plane; c++)
+        offset += sizes[c];
+
+    return offset;
+}
+
+mdif_error_t mdif_write_pyramid(const char* filename, mdif_t* image, unsigned char levels) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_t header = *image;
+    header.levels = levels;
+
+    mdif_error_t result = mdif_check_header(&header);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, true))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    if(!mdif_write_base(&file, image, levels)) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_WRITE;
+    }
+
+    unsigned char* buffer = NULL;
+    size_t first_size = 0;
+
+    if(levels > 0) {
+        mdif_t level;
+        size_t sizes[4], second_size = 0;
+
+        mdif_level_offset(&header, 1, 0, &level);
+        mdif_plane_sizes(&level, sizes);
+        first_size = sizes[0] + sizes[1] + sizes[2] + sizes[3];
+
+        if(levels > 1) {
+            mdif_level_offset(&header, 2, 0, &level);
+            mdif_plane_sizes(&level, sizes);
+            second_size = sizes[0] + sizes[1] + sizes[2] + sizes[3];
+        }
+
+        buffer = (unsigned char*) mdif_mem_alloc(first_size + second_size);
+        if(!buffer) {
+            mdif_file_close(&file);
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+        }
+    }
+
+    unsigned char* planes[4];
+    size_t sizes[4];
+    mdif_file_planes(image, planes, sizes);
+
+    int widths[4], heights[4];
+    for(int c = 0; c < 4; c++) {
+        bool chroma = image->layout == MDIF_LAYOUT_YCBCR420 && (c == 1 || c == 2);
+
+        widths[c] = chroma ? (image->width + 1) / 2 : image->width;
+        heights[c] = chroma ? (image->height + 1) / 2 : image->height;
+    }
+
+    for(int i = 1; i <= levels && result == MDIF_ERROR_NONE; i++) {
+        unsigned char* target = i & 1 ? buffer : buffer + first_size;
+
+        for(int c = 0; c < 4; c++) {
+            if(!sizes[c])
+                continue;
+
+            mdif_reduce_plane(planes[c], widths[c], heights[c], target);
+
+            widths[c] = (widths[c] + 1) / 2;
+            heights[c] = (heights[c] + 1) / 2;
+            planes[c] = target;
+            target += (size_t) widths[c] * heights[c];
+
+            if(!mdif_file_write(&file, planes[c], (size_t) widths[c] * heights[c])) {
+                result = MDIF_ERROR_WRITE;
+                break;
+            }
+        }
+    }
+
+    mdif_mem_free(buffer);
+    mdif_file_close(&file);
+
+    return result;
+}
+
+static void mdif_subsample_row(const unsigned char* row, int width, int factor, unsigned char* out) {
+    int x = 0, out_width = (width + factor - 1) / factor;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128();
+
+    if(factor == 2) {
+        __m128i ones = _mm_set1_epi16(1), rounding = _mm_set1_epi16(1);
+
+        for(; 2 * x + 32 <= width; x += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (row + 2 * x)),
+                b = _mm_loadu_si128((const __m128i*) (row + 2 * x + 16));
+
+            __m128i low = _mm_packs_epi32(
+                    _mm_madd_epi16(_mm_unpacklo_epi8(a, zero), ones),
+                    _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), ones)
+                ),
+                high = _mm_packs_epi32(
+                    _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), ones),
+                    _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), ones)
+                );
+
+            low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 1);
+            high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 1);
+            _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(low, high));
+        }
+    }
+    else if(factor == 4) {
+        __m128i mask = _mm_set_epi32(0, -1, 0, -1), rounding = _mm_set1_epi32(2);
+
+        for(; 4 * x + 16 <= width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (row + 4 * x));
+            __m128i even = _mm_sad_epu8(_mm_and_si128(v, mask), zero),
+                odd = _mm_sad_epu8(_mm_andnot_si128(mask, v), zero);
+
+            __m128i sums = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+            sums = _mm_srli_epi32(_mm_add_epi32(sums, rounding), 2);
+
+            out[x] = (unsigned char) _mm_cvtsi128_si32(sums);
+            out[x + 1] = (unsigned char) _mm_cvtsi128_si32(_mm_srli_si128(sums, 4));
+            out[x + 2] = (unsigned char) _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+            out[x + 3] = (unsigned char) _mm_cvtsi128_si32(_mm_srli_si128(sums, 12));
+        }
+    }
+    else if(factor == 8) {
+        for(; 8 * x + 16 <= width; x += 2) {
+            __m128i sums = _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (row + 8 * x)), zero);
+
+            out[x] = (unsigned char) ((_mm_cvtsi128_si32(sums) + 4) >> 3);
+            out[x + 1] = (unsigned char) ((_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)) + 4) >> 3);
+        }
+    }
+    #endif
+
+    for(; x < out_width; x++) {
+        int first = x * factor,
+            count = width - first < factor ? width - first : factor,
+            sum = 0;
+
+        for(int i = 0; i < count; i++)
+            sum += row[first + i];
+
+        out[x] = (unsigned char) ((sum + count / 2) / count);
+    }
+}
+
+mdif_error_t mdif_read_subsampled(const char* filename, unsigned char factor, mdif_t* image) {
+    if(!image)
+        return MDIF_ERROR_IMAGE;
+
+    if(factor < 1)
+        return MDIF_ERROR_FACTOR;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_t header;
+    mdif_error_t result = mdif_read_header(&file, &header);
+
+    if(result == MDIF_ERROR_NONE && header.layout == MDIF_LAYOUT_INDEXED)
+        result = MDIF_ERROR_LAYOUT;
+
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    unsigned char* row = (unsigned char*) mdif_scratch_alloc(header.width);
+    if(!row) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    image->signature[0] = header.signature[0];
+    image->signature[1] = header.signature[1];
+    image->width = (short) ((header.width + factor - 1) / factor);
+    image->height = (short) ((header.height + factor - 1) / factor);
+    image->layout = header.layout;
+    image->levels = 0;
+
+    if(!mdif_alloc_planes(image, (size_t) image->width * image->height)) {
+        mdif_scratch_free(row);
+        mdif_file_close(&file);
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    unsigned char* planes[4];
+    size_t sizes[4];
+    mdif_file_planes(image, planes, sizes);
+
+    unsigned long offset = mdif_header_size(&header);
+    for(int c = 0; c < 4 && result == MDIF_ERROR_NONE; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(&header, c, &width, &height);
+
+        int out_width = (width + factor - 1) / factor;
+
+        for(int y = 0; y < height; y += factor) {
+            if(!mdif_file_read_at(&file, offset + (unsigned long) y * width, row, width)) {
+                result = MDIF_ERROR_READ;
+                break;
+            }
+
+            mdif_subsample_row(row, width, factor, planes[c] + (size_t) (y / factor) * out_width);
+        }
+
+        offset += (unsigned long) width * height;
+    }
+
+    mdif_scratch_free(row);
+    mdif_file_close(&file);
+
+    if(result != MDIF_ERROR_NONE)
+        mdif_free(image);
+
+    return result;
+}
+
+mdif_error_t mdif_read_level(const char* filename, unsigned char level, mdif_t* image) {
+    if(!image)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_error_t result = mdif_read_header(&file, image);
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    if(level > image->levels)
+        level = image->levels;
+
+    mdif_t dimensions;
+    unsigned long offset = mdif_level_offset(image, level, 0, &dimensions);
+
+    if(!mdif_file_seek(&file, offset)) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_READ;
+    }
+
+    image->width = dimensions.width;
+    image->height = dimensions.height;
+
+    if(!mdif_alloc_planes(image, mdif_plane_capacity(image))) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    result = mdif_read_planes(&file, image);
+    mdif_file_close(&file);
+
+    return result;
+}
+
+static bool mdif_file_size(mdif_file_t* file, unsigned long* size) {
+    #ifndef ARDUINO
+    if(fseek(file->handle, 0, SEEK_END) != 0)
+        return false;
+
+    long position = ftell(file->handle);
+    if(position < 0)
+        return false;
+
+    *size = (unsigned long) position;
+    return true;
+    #else
+    *size = (unsigned long) file->handle.size();
+    return true;
+    #endif
+}
+
+mdif_error_t mdif_probe(const char* filename, mdif_info_t* info) {
+    if(!info)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_t header;
+    mdif_error_t result = mdif_read_header(&file, &header);
+
+    unsigned long size = 0, expected = 0;
+    if(result == MDIF_ERROR_NONE && !mdif_file_size(&file, &size))
+        result = MDIF_ERROR_READ;
+
+    if(result == MDIF_ERROR_NONE) {
+        mdif_t dimensions;
+        expected = mdif_level_offset(&header, header.levels + 1, 0, &dimensions);
+
+        unsigned char count;
+        if(header.layout == MDIF_LAYOUT_INDEXED)
+            expected += size > expected && mdif_file_read_at(&file, expected, &count, 1) ?
+                4ul * count + 5 : 1;
+    }
+
+    mdif_file_close(&file);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    if(size != expected)
+        return MDIF_ERROR_SIZE;
+
+    info->width = header.width;
+    info->height = header.height;
+    info->layout = header.layout;
+    info->levels = header.levels;
+    info->size = size;
+    info->hash = 0;
+
+    return MDIF_ERROR_NONE;
+}
+
+#define MDIF_PRIME64_1 0x9E3779B185EBCA87ull
+#define MDIF_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define MDIF_PRIME64_3 0x165667B19E3779F9ull
+#define MDIF_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define MDIF_PRIME64_5 0x27D4EB2F165667C5ull
+
+typedef struct mdif_hash_state_struct {
+    unsigned long long lanes[4];
+    unsigned long long total;
+    unsigned long long seed;
+
+    unsigned char buffer[32];
+    size_t buffered;
+} mdif_hash_state_t;
+
+static unsigned long long mdif_rotl64(unsigned long long value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static unsigned long long mdif_hash_round(unsigned long long lane, const unsigned char* input) {
+    unsigned long long value;
+    memcpy(&value, input, 8);
+
+    return mdif_rotl64(lane + value * MDIF_PRIME64_2, 31) * MDIF_PRIME64_1;
+}
+
+static void mdif_hash_init(mdif_hash_state_t* state, unsigned long long seed) {
+    state->lanes[0] = seed + MDIF_PRIME64_1 + MDIF_PRIME64_2;
+    state->lanes[1] = seed + MDIF_PRIME64_2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - MDIF_PRIME64_1;
+
+    state->total = 0;
+    state->seed = seed;
+    state->buffered = 0;
+}
+
+static void mdif_hash_update(mdif_hash_state_t* state, const unsigned char* data, size_t size) {
+    if(size == 0)
+        return;
+
+    state->total += size;
+
+    if(state->buffered > 0) {
+        size_t fill = 32 - state->buffered;
+        if(fill > size)
+            fill = size;
+
+        memcpy(state->buffer + state->buffered, data, fill);
+        state->buffered += fill;
+        data += fill;
+        size -= fill;
+
+        if(state->buffered < 32)
+            return;
+
+        for(int lane = 0; lane < 4; lane++)
+            state->lanes[lane] = mdif_hash_round(state->lanes[lane], state->buffer + lane * 8);
+
+        state->buffered = 0;
+    }
+
+    unsigned long long v0 = state->lanes[0], v1 = state->lanes[1],
+        v2 = state->lanes[2], v3 = state->lanes[3];
+
+    for(; size >= 32; data += 32, size -= 32) {
+        v0 = mdif_hash_round(v0, data);
+        v1 = mdif_hash_round(v1, data + 8);
+        v2 = mdif_hash_round(v2, data + 16);
+        v3 = mdif_hash_round(v3, data + 24);
+    }
+
+    state->lanes[0] = v0;
+    state->lanes[1] = v1;
+    state->lanes[2] = v2;
+    state->lanes[3] = v3;
+
+    memcpy(state->buffer, data, size);
+    state->buffered = size;
+}
+
+static unsigned long long mdif_hash_digest(const mdif_hash_state_t* state) {
+    unsigned long long hash;
+
+    if(state->total >= 32) {
+        hash = mdif_rotl64(state->lanes[0], 1) + mdif_rotl64(state->lanes[1], 7) +
+            mdif_rotl64(state->lanes[2], 12) + mdif_rotl64(state->lanes[3], 18);
+
+        for(int lane = 0; lane < 4; lane++) {
+            unsigned long long merged = mdif_rotl64(state->lanes[lane] * MDIF_PRIME64_2, 31) * MDIF_PRIME64_1;
+            hash = (hash ^ merged) * MDIF_PRIME64_1 + MDIF_PRIME64_4;
+        }
+    }
+    else hash = state->seed + MDIF_PRIME64_5;
+
+    hash += state->total;
+
+    const unsigned char* tail = state->buffer;
+    size_t size = state->buffered;
+
+    for(; size >= 8; tail += 8, size -= 8)
+        hash = mdif_rotl64(hash ^ mdif_hash_round(0, tail), 27) * MDIF_PRIME64_1 + MDIF_PRIME64_4;
+
+    if(size >= 4) {
+        unsigned int value;
+        memcpy(&value, tail, 4);
+
+        hash = mdif_rotl64(hash ^ (value * MDIF_PRIME64_1), 23) * MDIF_PRIME64_2 + MDIF_PRIME64_3;
+        tail += 4;
+        size -= 4;
+    }
+
+    for(; size > 0; tail++, size--)
+        hash = mdif_rotl64(hash ^ (*tail * MDIF_PRIME64_5), 11) * MDIF_PRIME64_1;
+
+    hash ^= hash >> 33;
+    hash *= MDIF_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= MDIF_PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+unsigned long long mdif_hash64(const void* data, unsigned long size, unsigned long long seed) {
+    mdif_hash_state_t state;
+    mdif_hash_init(&state, seed);
+    mdif_hash_update(&state, (const unsigned char*) data, size);
+
+    return mdif_hash_digest(&state);
+}
+
+#ifndef ARDUINO
+#   define MDIF_HASH_CHUNK 65536
+#else
+#   define MDIF_HASH_CHUNK 512
+#endif
+
+mdif_error_t mdif_hash_file(const char* filename, unsigned long long* hash) {
+    if(!hash)
+        return MDIF_ERROR_IMAGE;
+
+    size_t chunk_size = MDIF_HASH_CHUNK;
+
+    #ifdef MDIF_STATIC_ARENA
+    if(chunk_size > (mdif_scratch_available() & ~(size_t) 15))
+        chunk_size = mdif_scratch_available() & ~(size_t) 15;
+    #endif
+
+    unsigned char* chunk = chunk_size > 0 ? (unsigned char*) mdif_scratch_alloc(chunk_size) : NULL;
+    if(!chunk)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false)) {
+        mdif_scratch_free(chunk);
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+    }
+
+    unsigned long size = 0, offset = 0;
+    mdif_error_t result = mdif_file_size(&file, &size) ? MDIF_ERROR_NONE : MDIF_ERROR_READ;
+
+    mdif_hash_state_t state;
+    mdif_hash_init(&state, 0);
+
+    while(result == MDIF_ERROR_NONE && offset < size) {
+        size_t length = size - offset < chunk_size ? size - offset : chunk_size;
+
+        if(!mdif_file_read_at(&file, offset, chunk, length))
+            result = MDIF_ERROR_READ;
+        else {
+            mdif_hash_update(&state, chunk, length);
+            offset += length;
+        }
+    }
+
+    mdif_file_close(&file);
+    mdif_scratch_free(chunk);
+
+    if(result == MDIF_ERROR_NONE)
+        *hash = mdif_hash_digest(&state);
+
+    return result;
+}
+
+typedef struct mdif_probe_job_struct {
+    const char* const *filenames;
+    mdif_info_t *infos;
+    mdif_error_t *results;
+    unsigned char flags;
+
+    volatile mdif_error_t result;
+} mdif_probe_job_t;
+
+static void mdif_probe_task(void* context, int begin, int end) {
+    mdif_probe_job_t* job = (mdif_probe_job_t*) context;
+
+    for(int i = begin; i < end; i++) {
+        mdif_info_t* info = &job->infos[i];
+        mdif_error_t result = mdif_probe(job->filenames[i], info);
+
+        if(result == MDIF_ERROR_NONE && (job->flags & MDIF_PROBE_HASH))
+            result = mdif_hash_file(job->filenames[i], &info->hash);
+
+        if(result != MDIF_ERROR_NONE) {
+            memset(info, 0, sizeof(mdif_info_t));
+            job->result = result;
+        }
+
+        if(job->results)
+            job->results[i] = result;
+    }
+}
+
+mdif_error_t mdif_probe_files(
+    const char* const* filenames,
+    int count,
+    mdif_info_t* infos,
+    mdif_error_t* results,
+    unsigned char flags,
+    int threads
+) {
+    if((!filenames || !infos) && count > 0)
+        return MDIF_ERROR_IMAGE;
+
+    if(count < 0)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_probe_job_t job = {filenames, infos, results, flags, MDIF_ERROR_NONE};
+    mdif_parallel(count, threads, mdif_probe_task, &job);
+
+    return job.result;
+}
+
+typedef struct mdif_rect_struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} mdif_rect_t;
+
+#ifndef ARDUINO
+
+typedef struct mdif_run_struct {
+    unsigned int offset;
+    unsigned int length;
+} mdif_run_t;
+
+#define MDIF_JOURNAL_HEADER_SIZE 10
+
+static bool mdif_file_open_update(mdif_file_t* file, const char* filename) {
+    file->handle = fopen(filename, "r+b");
+    return file->handle != NULL;
+}
+
+static bool mdif_file_write_at(mdif_file_t* file, unsigned long offset, const void* data, size_t size) {
+    #ifdef _WIN32
+    return mdif_file_seek(file, offset) && mdif_file_write(file, data, size);
+    #else
+    return pwrite(fileno(file->handle), data, size, (off_t) offset) == (ssize_t) size;
+    #endif
+}
+
+static bool mdif_file_sync(mdif_file_t* file) {
+    if(fflush(file->handle) != 0)
+        return false;
+
+    #ifdef _WIN32
+    return _commit(_fileno(file->handle)) == 0;
+    #else
+    return fsync(fileno(file->handle)) == 0;
+    #endif
+}
+
+static char* mdif_journal_name(const char* filename) {
+    size_t length = strlen(filename);
+    char* name = (char*) malloc(length + 9);
+
+    if(name) {
+        memcpy(name, filename, length);
+        memcpy(name + length, ".journal", 9);
+    }
+
+    return name;
+}
+
+static mdif_error_t mdif_apply_runs(
+    const char* filename,
+    const mdif_run_t* runs,
+    unsigned int count,
+    const unsigned char* data
+) {
+    mdif_file_t file;
+    if(!mdif_file_open_update(&file, filename))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_error_t result = MDIF_ERROR_NONE;
+    for(unsigned int i = 0; i < count && result == MDIF_ERROR_NONE; i++) {
+        if(!mdif_file_write_at(&file, runs[i].offset, data, runs[i].length))
+            result = MDIF_ERROR_WRITE;
+
+        data += runs[i].length;
+    }
+
+    if(result == MDIF_ERROR_NONE && !mdif_file_sync(&file))
+        result = MDIF_ERROR_WRITE;
+
+    mdif_file_close(&file);
+    return result;
+}
+
+mdif_error_t mdif_recover(const char* filename) {
+    char* journal_name = mdif_journal_name(filename);
+    if(!journal_name)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_file_t journal;
+    if(!mdif_file_open(&journal, journal_name, false)) {
+        free(journal_name);
+        return MDIF_ERROR_NONE;
+    }
+
+    unsigned long size = 0;
+    unsigned char* buffer = NULL;
+
+    mdif_error_t result = MDIF_ERROR_NONE;
+    if(!mdif_file_size(&journal, &size))
+        result = MDIF_ERROR_READ;
+    else if(size >= MDIF_JOURNAL_HEADER_SIZE + 8) {
+        buffer = (unsigned char*) mdif_mem_alloc(size);
+
+        if(!buffer)
+            result = MDIF_ERROR_CANNOT_ALLOCATE;
+        else if(!mdif_file_read_at(&journal, 0, buffer, size))
+            result = MDIF_ERROR_READ;
+    }
+
+    mdif_file_close(&journal);
+
+    bool complete = false;
+    unsigned int count = 0, data_size = 0;
+
+    if(result == MDIF_ERROR_NONE && buffer && strncmp((const char*) buffer, "NJ", 2) == 0) {
+        memcpy(&count, buffer + 2, 4);
+        memcpy(&data_size, buffer + 6, 4);
+
+        unsigned long long hash;
+        memcpy(&hash, buffer + size - 8, 8);
+
+        complete = count <= size / sizeof(mdif_run_t) &&
+            MDIF_JOURNAL_HEADER_SIZE + (unsigned long long) count * sizeof(mdif_run_t) + data_size + 8 == size &&
+            mdif_hash64(buffer, size - 8, 0) == hash;
+    }
+
+    if(complete) {
+        mdif_run_t* runs = (mdif_run_t*) mdif_scratch_alloc(count * sizeof(mdif_run_t) + 1);
+
+        if(!runs)
+            result = MDIF_ERROR_CANNOT_ALLOCATE;
+        else {
+            memcpy(runs, buffer + MDIF_JOURNAL_HEADER_SIZE, count * sizeof(mdif_run_t));
+            result = mdif_apply_runs(
+                filename, runs, count,
+                buffer + MDIF_JOURNAL_HEADER_SIZE + count * sizeof(mdif_run_t)
+            );
+
+            mdif_scratch_free(runs);
+        }
+    }
+
+    mdif_mem_free(buffer);
+    if(result == MDIF_ERROR_NONE && remove(journal_name) != 0)
+        result = MDIF_ERROR_WRITE;
+
+    free(journal_name);
+    return result;
+}
+
+static mdif_error_t mdif_write_journal(
+    const char* journal_name,
+    const mdif_run_t* runs,
+    unsigned int count,
+    const unsigned char* data,
+    unsigned int data_size
+) {
+    mdif_file_t journal;
+    if(!mdif_file_open(&journal, journal_name, true))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    unsigned char header[MDIF_JOURNAL_HEADER_SIZE] = {'N', 'J'};
+    memcpy(header + 2, &count, 4);
+    memcpy(header + 6, &data_size, 4);
+
+    mdif_hash_state_t state;
+    mdif_hash_init(&state, 0);
+    mdif_hash_update(&state, header, sizeof(header));
+    mdif_hash_update(&state, (const unsigned char*) runs, count * sizeof(mdif_run_t));
+    mdif_hash_update(&state, data, data_size);
+
+    unsigned long long hash = mdif_hash_digest(&state);
+    bool written = mdif_file_write(&journal, header, sizeof(header)) &&
+        mdif_file_write(&journal, runs, count * sizeof(mdif_run_t)) &&
+        mdif_file_write(&journal, data, data_size) &&
+        mdif_file_write(&journal, &hash, 8) &&
+        mdif_file_sync(&journal);
+
+    mdif_file_close(&journal);
+    if(!written) {
+        remove(journal_name);
+        return MDIF_ERROR_WRITE;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_check_region(
+    const mdif_t* header,
+    int x,
+    int y,
+    int width,
+    int height,
+    const mdif_t* source
+) {
+    if(source->layout != header->layout || header->layout == MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    if(x < 0 || width < 1 || x + width > header->width || width > source->width)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(y < 0 || height < 1 || y + height > header->height || height > source->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(header->layout == MDIF_LAYOUT_YCBCR420) {
+        if((x & 1) || ((x + width) & 1 && x + width != header->width))
+            return MDIF_ERROR_INVALID_WIDTH;
+
+        if((y & 1) || ((y + height) & 1 && y + height != header->height))
+            return MDIF_ERROR_INVALID_HEIGHT;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_write_region(
+    const char* filename,
+    int x,
+    int y,
+    int width,
+    int height,
+    const mdif_t* source
+) {
+    if(!source || !source->red)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_error_t result = mdif_recover(filename);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    mdif_t header;
+    result = mdif_read_header(&file, &header);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_check_region(&header, x, y, width, height, source);
+
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        return result;
+    }
+
+    mdif_rect_t rects[16][4], expanded[16][4];
+    unsigned long offsets[16][4];
+    int plane_widths[16][4], plane_heights[16][4];
+
+    size_t sizes[4];
+    mdif_plane_sizes(&header, sizes);
+
+    unsigned long data_size = 0, scratch_size = 0;
+    unsigned int max_runs = 0;
+
+    for(int level = 0; level <= header.levels; level++)
+        for(int c = 0; c < 4; c++) {
+            if(!sizes[c])
+                continue;
+
+            mdif_t dimensions;
+            offsets[level][c] = mdif_level_offset(&header, level, c, &dimensions);
+            mdif_plane_dims(&dimensions, c, &plane_widths[level][c], &plane_heights[level][c]);
+
+            mdif_rect_t* rect = &rects[level][c];
+            if(level == 0) {
+                bool chroma = header.layout == MDIF_LAYOUT_YCBCR420 && (c == 1 || c == 2);
+
+                rect->x = chroma ? x / 2 : x;
+                rect->y = chroma ? y / 2 : y;
+                rect->width = chroma ? (x + width + 1) / 2 - rect->x : width;
+                rect->height = chroma ? (y + height + 1) / 2 - rect->y : height;
+            }
+            else {
+                const mdif_rect_t* parent = &rects[level - 1][c];
+                mdif_rect_t* area = &expanded[level][c];
+                int parent_width = plane_widths[level - 1][c],
+                    parent_height = plane_heights[level - 1][c];
+
+                int right = (parent->x + parent->width + 1) & ~1,
+                    bottom = (parent->y + parent->height + 1) & ~1;
+
+                area->x = parent->x & ~1;
+                area->y = parent->y & ~1;
+                area->width = (right < parent_width ? right : parent_width) - area->x;
+                area->height = (bottom < parent_height ? bottom : parent_height) - area->y;
+
+                rect->x = area->x / 2;
+                rect->y = area->y / 2;
+                rect->width = (area->width + 1) / 2;
+                rect->height = (area->height + 1) / 2;
+
+                unsigned long area_size = (unsigned long) area->width * area->height;
+                if(area_size > scratch_size)
+                    scratch_size = area_size;
+            }
+
+            data_size += (unsigned long) rect->width * rect->height;
+            max_runs += rect->height;
+        }
+
+    unsigned char* data = (unsigned char*) mdif_mem_alloc(data_size);
+    unsigned char* scratch = scratch_size ? (unsigned char*) mdif_mem_alloc(scratch_size) : NULL;
+    mdif_run_t* runs = (mdif_run_t*) mdif_scratch_alloc(max_runs * sizeof(mdif_run_t));
+
+    if(!data || (scratch_size && !scratch) || !runs)
+        result = MDIF_ERROR_CANNOT_ALLOCATE;
+
+    unsigned char* source_planes[4];
+    size_t source_sizes[4];
+    mdif_file_planes(source, source_planes, source_sizes);
+
+    unsigned char* previous[4] = {NULL, NULL, NULL, NULL};
+    unsigned char* out = data;
+    unsigned int count = 0;
+
+    for(int level = 0; level <= header.levels && result == MDIF_ERROR_NONE; level++)
+        for(int c = 0; c < 4 && result == MDIF_ERROR_NONE; c++) {
+            if(!sizes[c])
+                continue;
+
+            const mdif_rect_t* rect = &rects[level][c];
+            if(level == 0) {
+                int source_width, source_height;
+                mdif_plane_dims(source, c, &source_width, &source_height);
+
+                for(int row = 0; row < rect->height; row++)
+                    memcpy(
+                        out + (size_t) row * rect->width,
+                        source_planes[c] + (size_t) row * source_width,
+                        rect->width
+                    );
+            }
+            else {
+                const mdif_rect_t* area = &expanded[level][c];
+                const mdif_rect_t* parent = &rects[level - 1][c];
+                int parent_width = plane_widths[level - 1][c];
+
+                for(int row = 0; row < area->height && result == MDIF_ERROR_NONE; row++) {
+                    unsigned long offset = offsets[level - 1][c] +
+                        (unsigned long) (area->y + row) * parent_width + area->x;
+
+                    if(!mdif_file_read_at(&file, offset, scratch + (size_t) row * area->width, area->width))
+                        result = MDIF_ERROR_READ;
+                }
+
+                for(int row = 0; row < parent->height; row++)
+                    memcpy(
+                        scratch + (size_t) (parent->y - area->y + row) * area->width + parent->x - area->x,
+                        previous[c] + (size_t) row * parent->width,
+                        parent->width
+                    );
+
+                mdif_reduce_plane(scratch, area->width, area->height, out);
+            }
+
+            for(int row = 0; row < rect->height; row++) {
+                unsigned int offset = (unsigned int) (offsets[level][c] +
+                    (unsigned long) (rect->y + row) * plane_widths[level][c] + rect->x);
+
+                if(count > 0 && runs[count - 1].offset + runs[count - 1].length == offset)
+                    runs[count - 1].length += rect->width;
+                else {
+                    runs[count].offset = offset;
+                    runs[count].length = rect->width;
+                    count++;
+                }
+            }
+
+            previous[c] = out;
+            out += (size_t) rect->width * rect->height;
+        }
+
+    mdif_file_close(&file);
+
+    char* journal_name = result == MDIF_ERROR_NONE ? mdif_journal_name(filename) : NULL;
+    if(result == MDIF_ERROR_NONE && !journal_name)
+        result = MDIF_ERROR_CANNOT_ALLOCATE;
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_write_journal(journal_name, runs, count, data, (unsigned int) data_size);
+
+    if(result == MDIF_ERROR_NONE) {
+        result = mdif_apply_runs(filename, runs, count, data);
+
+        if(result == MDIF_ERROR_NONE && remove(journal_name) != 0)
+            result = MDIF_ERROR_WRITE;
+    }
+
+    free(journal_name);
+    mdif_scratch_free(runs);
+    mdif_mem_free(scratch);
+    mdif_mem_free(data);
+
+    return result;
+}
+
+#endif
+
+#ifndef ARDUINO
+
+#define MDIF_CACHE_HEADER_SIZE 18
+#define MDIF_CACHE_ENTRY_OVERHEAD (MDIF_CACHE_HEADER_SIZE + 8)
+#define MDIF_CACHE_STALE_SECONDS 3600
+#define MDIF_CACHE_UNKNOWN (~0ULL)
+
+typedef struct mdif_cache_part_struct {
+    unsigned char *data;
+    size_t size;
+} mdif_cache_part_t;
+
+typedef struct mdif_cache_lock_struct {
+    #ifdef _WIN32
+    HANDLE handle;
+    #else
+    int handle;
+    #endif
+    unsigned long long total;
+} mdif_cache_lock_t;
+
+typedef struct mdif_cache_entry_struct {
+    long long time;
+    unsigned long long size;
+    char name[24];
+} mdif_cache_entry_t;
+
+typedef struct mdif_cache_scan_struct {
+    mdif_cache_entry_t *entries;
+    int count;
+    int capacity;
+    unsigned long long total;
+} mdif_cache_scan_t;
+
+static char* mdif_cache_path(const mdif_cache_t* cache, const char* name) {
+    size_t directory_length = strlen(cache->directory), name_length = strlen(name);
+    char* path = (char*) malloc(directory_length + name_length + 2);
+
+    if(path) {
+        memcpy(path, cache->directory, directory_length);
+        path[directory_length] = '/';
+        memcpy(path + directory_length + 1, name, name_length + 1);
+    }
+
+    return path;
+}
+
+static char* mdif_cache_entry_path(const mdif_cache_t* cache, unsigned long long key) {
+    char name[24];
+    sprintf(name, "%016llx.mdc", key);
+
+    return mdif_cache_path(cache, name);
+}
+
+static bool mdif_cache_file_size(const char* path, unsigned long long* size) {
+    #ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path, &info) != 0)
+        return false;
+    #else
+    struct stat info;
+    if(stat(path, &info) != 0)
+        return false;
+    #endif
+
+    *size = (unsigned long long) info.st_size;
+    return true;
+}
+
+static bool mdif_cache_lock(const mdif_cache_t* cache, mdif_cache_lock_t* lock) {
+    char* path = mdif_cache_path(cache, "lock");
+    if(!path)
+        return false;
+
+    unsigned char ledger[8];
+    bool locked = false, known = false;
+
+    #ifdef _WIN32
+    lock->handle = CreateFileA(
+        path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+
+    if(lock->handle != INVALID_HANDLE_VALUE) {
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+
+        locked = LockFileEx(lock->handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != 0;
+        if(!locked)
+            CloseHandle(lock->handle);
+    }
+
+    DWORD count = 0;
+    known = locked && ReadFile(lock->handle, ledger, 8, &count, NULL) && count == 8;
+    #else
+    lock->handle = open(path, O_RDWR | O_CREAT, 0644);
+
+    if(lock->handle >= 0) {
+        int status;
+        do status = flock(lock->handle, LOCK_EX);
+        while(status != 0 && errno == EINTR);
+
+        locked = status == 0;
+        if(!locked)
+            close(lock->handle);
+    }
+
+    known = locked && pread(lock->handle, ledger, 8, 0) == 8;
+    #endif
+
+    free(path);
+    if(known)
+        memcpy(&lock->total, ledger, 8);
+    else lock->total = MDIF_CACHE_UNKNOWN;
+
+    return locked;
+}
+
+static bool mdif_cache_unlock(mdif_cache_lock_t* lock, bool update) {
+    unsigned char ledger[8];
+    memcpy(ledger, &lock->total, 8);
+
+    #ifdef _WIN32
+    DWORD count = 0;
+    bool written = !update || (
+        SetFilePointer(lock->handle, 0, NULL, FILE_BEGIN) == 0 &&
+        WriteFile(lock->handle, ledger, 8, &count, NULL) && count == 8
+    );
+
+    CloseHandle(lock->handle);
+    #else
+    bool written = !update || pwrite(lock->handle, ledger, 8, 0) == 8;
+    close(lock->handle);
+    #endif
+
+    return written;
+}
+
+static int mdif_cache_name_kind(const char* name) {
+    size_t length = strlen(name);
+
+    if(length == 20 && strcmp(name + 16, ".mdc") == 0)
+        return 1;
+
+    return strncmp(name, "mdc", 3) == 0 ? 2 : 0;
+}
+
+static void mdif_cache_scan_add(
+    const mdif_cache_t* cache,
+    mdif_cache_scan_t* scan,
+    const char* name,
+    unsigned long long size,
+    long long modified,
+    long long now
+) {
+    int kind = mdif_cache_name_kind(name);
+
+    if(kind == 2 && now - modified > MDIF_CACHE_STALE_SECONDS) {
+        char* path = mdif_cache_path(cache, name);
+        if(path)
+            remove(path);
+
+        free(path);
+    }
+
+    if(kind != 1)
+        return;
+
+    if(scan->count == scan->capacity) {
+        int capacity = scan->capacity ? scan->capacity * 2 : 256;
+        mdif_cache_entry_t* entries = (mdif_cache_entry_t*) realloc(
+            scan->entries,
+            capacity * sizeof(mdif_cache_entry_t)
+        );
+
+        if(!entries)
+            return;
+
+        scan->entries = entries;
+        scan->capacity = capacity;
+    }
+
+    mdif_cache_entry_t* entry = &scan->entries[scan->count++];
+    entry->time = modified;
+    entry->size = size;
+    memcpy(entry->name, name, 21);
+
+    scan->total += size;
+}
+
+static int mdif_cache_compare_entries(const void* a, const void* b) {
+    const mdif_cache_entry_t* first = (const mdif_cache_entry_t*) a;
+    const mdif_cache_entry_t* second = (const mdif_cache_entry_t*) b;
+
+    if(first->time != second->time)
+        return first->time < second->time ? -1 : 1;
+
+    return strcmp(first->name, second->name);
+}
+
+static void mdif_cache_evict(const mdif_cache_t* cache, mdif_cache_lock_t* lock) {
+    mdif_cache_scan_t scan = {NULL, 0, 0, 0};
+    long long now = (long long) time(NULL);
+
+    #ifdef _WIN32
+    char* pattern = mdif_cache_path(cache, "*");
+    WIN32_FIND_DATAA found;
+    HANDLE search = pattern ? FindFirstFileA(pattern, &found) : INVALID_HANDLE_VALUE;
+
+    if(search != INVALID_HANDLE_VALUE) {
+        do {
+            if(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+
+            ULARGE_INTEGER stamp;
+            stamp.LowPart = found.ftLastWriteTime.dwLowDateTime;
+            stamp.HighPart = found.ftLastWriteTime.dwHighDateTime;
+
+            mdif_cache_scan_add(
+                cache, &scan, found.cFileName,
+                ((unsigned long long) found.nFileSizeHigh << 32) | found.nFileSizeLow,
+                (long long) ((stamp.QuadPart - 116444736000000000ULL) / 10000000ULL),
+                now
+            );
+        } while(FindNextFileA(search, &found));
+
+        FindClose(search);
+    }
+
+    free(pattern);
+    #else
+    DIR* directory = opendir(cache->directory);
+    struct dirent* found;
+
+    while(directory && (found = readdir(directory)) != NULL) {
+        if(!mdif_cache_name_kind(found->d_name))
+            continue;
+
+        char* path = mdif_cache_path(cache, found->d_name);
+        struct stat info;
+
+        if(path && stat(path, &info) == 0 && S_ISREG(info.st_mode))
+            mdif_cache_scan_add(
+                cache, &scan, found->d_name,
+                (unsigned long long) info.st_size,
+                (long long) info.st_mtime,
+                now
+            );
+
+        free(path);
+    }
+
+    if(directory)
+        closedir(directory);
+    #endif
+
+    if(scan.count > 1)
+        qsort(scan.entries, scan.count, sizeof(mdif_cache_entry_t), mdif_cache_compare_entries);
+
+    unsigned long long bound = cache->max_bytes / 4 * 3;
+    for(int i = 0; i < scan.count && scan.total > bound; i++) {
+        char* path = mdif_cache_path(cache, scan.entries[i].name);
+
+        if(path && remove(path) == 0)
+            scan.total -= scan.entries[i].size;
+
+        free(path);
+    }
+
+    free(scan.entries);
+    lock->total = scan.total;
+}
+
+static void mdif_cache_discard(const mdif_cache_t* cache, const char* path, unsigned long long size) {
+    mdif_cache_lock_t lock;
+    bool locked = mdif_cache_lock(cache, &lock);
+
+    if(remove(path) == 0 && locked && lock.total != MDIF_CACHE_UNKNOWN)
+        lock.total = lock.total > size ? lock.total - size : 0;
+
+    if(locked)
+        mdif_cache_unlock(&lock, true);
+}
+
+static mdif_error_t mdif_cache_fetch(
+    const mdif_cache_t* cache,
+    unsigned long long key,
+    unsigned char** entry,
+    unsigned long long* size
+) {
+    if(!cache || !cache->directory)
+        return MDIF_ERROR_CACHE;
+
+    char* path = mdif_cache_entry_path(cache, key);
+    if(!path)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, path, false)) {
+        free(path);
+        return MDIF_ERROR_CACHE_MISS;
+    }
+
+    unsigned long length = 0;
+    unsigned char* data = NULL;
+    mdif_error_t result = mdif_file_size(&file, &length) ? MDIF_ERROR_NONE : MDIF_ERROR_READ;
+
+    if(result == MDIF_ERROR_NONE && length >= MDIF_CACHE_ENTRY_OVERHEAD) {
+        data = (unsigned char*) malloc(length);
+
+        if(!data)
+            result = MDIF_ERROR_CANNOT_ALLOCATE;
+        else if(!mdif_file_read_at(&file, 0, data, length))
+            result = MDIF_ERROR_READ;
+    }
+
+    mdif_file_close(&file);
+
+    unsigned long long stored_key = 0, payload = 0, hash = 0;
+    if(data) {
+        memcpy(&stored_key, data + 2, 8);
+        memcpy(&payload, data + 10, 8);
+        memcpy(&hash, data + length - 8, 8);
+    }
+
+    bool valid = data && memcmp(data, "NC", 2) == 0 && stored_key == key &&
+        payload == length - MDIF_CACHE_ENTRY_OVERHEAD &&
+        mdif_hash64(data, length - 8, 0) == hash;
+
+    if(result == MDIF_ERROR_NONE && !valid) {
+        mdif_cache_discard(cache, path, length);
+        result = MDIF_ERROR_CACHE_MISS;
+    }
+    else if(result == MDIF_ERROR_NONE) {
+        #ifdef _WIN32
+        _utime(path, NULL);
+        #else
+        utime(path, NULL);
+        #endif
+
+        *entry = data;
+        *size = payload;
+        data = NULL;
+    }
+
+    free(data);
+    free(path);
+
+    return result;
+}
+
+static mdif_error_t mdif_cache_read(
+    const mdif_cache_t* cache,
+    unsigned long long key,
+    const mdif_cache_part_t* parts,
+    int count
+) {
+    unsigned char* entry = NULL;
+    unsigned long long size = 0, expected = 0;
+
+    mdif_error_t result = mdif_cache_fetch(cache, key, &entry, &size);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    for(int i = 0; i < count; i++)
+        expected += parts[i].size;
+
+    if(size == expected) {
+        const unsigned char* payload = entry + MDIF_CACHE_HEADER_SIZE;
+
+        for(int i = 0; i < count; i++) {
+            if(parts[i].size)
+                memcpy(parts[i].data, payload, parts[i].size);
+
+            payload += parts[i].size;
+        }
+    }
+    else result = MDIF_ERROR_CACHE_MISS;
+
+    free(entry);
+    return result;
+}
+
+static mdif_error_t mdif_cache_write(
+    const mdif_cache_t* cache,
+    unsigned long long key,
+    const mdif_cache_part_t* parts,
+    int count
+) {
+    if(!cache || !cache->directory)
+        return MDIF_ERROR_CACHE;
+
+    unsigned long long size = 0;
+    for(int i = 0; i < count; i++)
+        size += parts[i].size;
+
+    unsigned long long entry_size = size + MDIF_CACHE_ENTRY_OVERHEAD;
+    if(entry_size > cache->max_bytes)
+        return MDIF_ERROR_NONE;
+
+    char* path = mdif_cache_entry_path(cache, key);
+    mdif_file_t file;
+
+    #ifdef _WIN32
+    char* temp = (char*) malloc(MAX_PATH);
+    bool opened = path && temp && GetTempFileNameA(cache->directory, "mdc", 0, temp) != 0;
+
+    if(opened && !mdif_file_open(&file, temp, true)) {
+        remove(temp);
+        opened = false;
+    }
+    #else
+    char* temp = mdif_cache_path(cache, "mdcXXXXXX");
+    int descriptor = path && temp ? mkstemp(temp) : -1;
+
+    file.handle = descriptor >= 0 && fchmod(descriptor, 0644) == 0 ?
+        fdopen(descriptor, "wb") : NULL;
+
+    bool opened = file.handle != NULL;
+    if(descriptor >= 0 && !opened) {
+        close(descriptor);
+        remove(temp);
+    }
+    #endif
+
+    if(!opened) {
+        free(path);
+        free(temp);
+
+        return path && temp ? MDIF_ERROR_INVALID_FILE_HANDLE : MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    unsigned char header[MDIF_CACHE_HEADER_SIZE];
+    memcpy(header, "NC", 2);
+    memcpy(header + 2, &key, 8);
+    memcpy(header + 10, &size, 8);
+
+    mdif_hash_state_t state;
+    mdif_hash_init(&state, 0);
+    mdif_hash_update(&state, header, MDIF_CACHE_HEADER_SIZE);
+
+    bool written = mdif_file_write(&file, header, MDIF_CACHE_HEADER_SIZE);
+    for(int i = 0; i < count && written; i++) {
+        if(!parts[i].size)
+            continue;
+
+        mdif_hash_update(&state, parts[i].data, parts[i].size);
+        written = mdif_file_write(&file, parts[i].data, parts[i].size);
+    }
+
+    unsigned long long hash = mdif_hash_digest(&state);
+    written = written && mdif_file_write(&file, &hash, 8);
+    written = fclose(file.handle) == 0 && written;
+
+    mdif_cache_lock_t lock;
+    if(!written || !mdif_cache_lock(cache, &lock)) {
+        remove(temp);
+        free(path);
+        free(temp);
+
+        return written ? MDIF_ERROR_CACHE : MDIF_ERROR_WRITE;
+    }
+
+    unsigned long long previous = 0;
+    if(!mdif_cache_file_size(path, &previous))
+        previous = 0;
+
+    #ifdef _WIN32
+    bool renamed = MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+    #else
+    bool renamed = rename(temp, path) == 0;
+    #endif
+
+    if(renamed && lock.total != MDIF_CACHE_UNKNOWN)
+        lock.total = lock.total + entry_size > previous ?
+            lock.total + entry_size - previous : 0;
+
+    if(!renamed)
+        remove(temp);
+    else if(lock.total == MDIF_CACHE_UNKNOWN || lock.total > cache->max_bytes)
+        mdif_cache_evict(cache, &lock);
+
+    mdif_cache_unlock(&lock, renamed);
+    free(path);
+    free(temp);
+
+    return renamed ? MDIF_ERROR_NONE : MDIF_ERROR_WRITE;
+}
+
+mdif_error_t mdif_cache_open(mdif_cache_t* cache, const char* directory, unsigned long long max_bytes) {
+    if(!cache)
+        return MDIF_ERROR_CACHE;
+
+    cache->directory = NULL;
+    cache->max_bytes = max_bytes;
+
+    if(!directory || !directory[0] || max_bytes == 0)
+        return MDIF_ERROR_CACHE;
+
+    size_t length = strlen(directory);
+    while(length > 1 && (directory[length - 1] == '/' || directory[length - 1] == '\\'))
+        length--;
+
+    cache->directory = (char*) malloc(length + 1);
+    if(!cache->directory)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    memcpy(cache->directory, directory, length);
+    cache->directory[length] = '\0';
+
+    #ifdef _WIN32
+    bool created = _mkdir(cache->directory) == 0 || errno == EEXIST;
+    #else
+    bool created = mkdir(cache->directory, 0755) == 0 || errno == EEXIST;
+    #endif
+
+    if(!created) {
+        free(cache->directory);
+        cache->directory = NULL;
+
+        return MDIF_ERROR_CACHE;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_cache_close(mdif_cache_t* cache) {
+    if(!cache)
+        return;
+
+    free(cache->directory);
+    cache->directory = NULL;
+}
+
+mdif_error_t mdif_cache_key(
+    const char* filename,
+    const void* params,
+    unsigned long size,
+    unsigned long long* key
+) {
+    if(!key || (!params && size > 0))
+        return MDIF_ERROR_CACHE;
+
+    unsigned long long hash = 0;
+    mdif_error_t result = mdif_hash_file(filename, &hash);
+
+    if(result == MDIF_ERROR_NONE)
+        *key = mdif_hash64(params, size, hash);
+
+    return result;
+}
+
+mdif_error_t mdif_cache_load(const mdif_cache_t* cache, unsigned long long key, void* data, unsigned long size) {
+    if(!data && size > 0)
+        return MDIF_ERROR_CACHE;
+
+    mdif_cache_part_t part = {(unsigned char*) data, size};
+    return mdif_cache_read(cache, key, &part, 1);
+}
+
+mdif_error_t mdif_cache_store(
+    const mdif_cache_t* cache,
+    unsigned long long key,
+    const void* data,
+    unsigned long size
+) {
+    if(!data && size > 0)
+        return MDIF_ERROR_CACHE;
+
+    mdif_cache_part_t part = {(unsigned char*) data, size};
+    return mdif_cache_write(cache, key, &part, 1);
+}
+
+mdif_error_t mdif_cache_load_file(const mdif_cache_t* cache, unsigned long long key, const char* filename) {
+    unsigned char* entry = NULL;
+    unsigned long long size = 0;
+
+    mdif_error_t result = mdif_cache_fetch(cache, key, &entry, &size);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    mdif_file_t file;
+    if(mdif_file_open(&file, filename, true)) {
+        bool written = mdif_file_write(&file, entry + MDIF_CACHE_HEADER_SIZE, size);
+
+        if(fclose(file.handle) != 0 || !written)
+            result = MDIF_ERROR_WRITE;
+    }
+    else result = MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    free(entry);
+    return result;
+}
+
+mdif_error_t mdif_cache_store_file(const mdif_cache_t* cache, unsigned long long key, const char* filename) {
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    unsigned long size = 0;
+    unsigned char* data = NULL;
+    mdif_error_t result = mdif_file_size(&file, &size) ? MDIF_ERROR_NONE : MDIF_ERROR_READ;
+
+    if(result == MDIF_ERROR_NONE) {
+        data = (unsigned char*) malloc(size ? size : 1);
+
+        if(!data)
+            result = MDIF_ERROR_CANNOT_ALLOCATE;
+        else if(size > 0 && !mdif_file_read_at(&file, 0, data, size))
+            result = MDIF_ERROR_READ;
+    }
+
+    mdif_file_close(&file);
+
+    if(result == MDIF_ERROR_NONE) {
+        mdif_cache_part_t part = {data, size};
+        result = mdif_cache_write(cache, key, &part, 1);
+    }
+
+    free(data);
+    return result;
+}
+
+#endif
+
+static int mdif_pool_class(unsigned int pixel_count, unsigned int* capacity) {
+    for(int index = 0; index < MDIF_POOL_CLASS_COUNT; index++) {
+        int shift = MDIF_POOL_MIN_SHIFT + index / 4;
+        unsigned int size = (unsigned int) (4 + index % 4) << (shift - 2);
+
+        if(size >= pixel_count) {
+            #ifdef MDIF_STATIC_ARENA
+            if(size > mdif_arena_slot_size / 4 && pixel_count <= mdif_arena_slot_size / 4)
+                size = (unsigned int) (mdif_arena_slot_size / 4);
+            #endif
+
+            *capacity = size;
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+static void mdif_pool_put(mdif_pool_t* pool, unsigned char* block, unsigned int capacity) {
+    if(!block)
+        return;
+
+    unsigned int class_capacity;
+    int index = mdif_pool_class(capacity, &class_capacity);
+    unsigned long bytes = 4ul * capacity;
+
+    mdif_lock_acquire(pool->lock);
+    if(index >= 0 &&
+        class_capacity == capacity &&
+        (pool->max_cached_bytes == 0 ||
+            pool->cached_bytes + bytes <= pool->max_cached_bytes)) {
+        *(void**) block = pool->buckets[index];
+        pool->buckets[index] = block;
+        pool->cached_bytes += bytes;
+
+        block = NULL;
+    }
+    mdif_lock_release(pool->lock);
+
+    mdif_mem_free(block);
+}
+
+mdif_error_t mdif_pool_init(mdif_pool_t* pool, unsigned long max_cached_bytes, unsigned char flags) {
+    if(!pool)
+        return MDIF_ERROR_POOL;
+
+    for(int i = 0; i < MDIF_POOL_CLASS_COUNT; i++)
+        pool->buckets[i] = NULL;
+
+    pool->cached_bytes = 0;
+    pool->max_cached_bytes = max_cached_bytes;
+    pool->flags = flags;
+    pool->lock = NULL;
+
+    if(flags & MDIF_POOL_THREAD_SAFE) {
+        pool->lock = mdif_lock_create();
+
+        #ifndef ARDUINO
+        if(!pool->lock)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+        #endif
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_pool_destroy(mdif_pool_t* pool) {
+    if(!pool)
+        return;
+
+    for(int i = 0; i < MDIF_POOL_CLASS_COUNT; i++)
+        while(pool->buckets[i]) {
+            void* next = *(void**) pool->buckets[i];
+
+            mdif_mem_free(pool->buckets[i]);
+            pool->buckets[i] = next;
+        }
+
+    pool->cached_bytes = 0;
+    mdif_lock_destroy(pool->lock);
+    pool->lock = NULL;
+}
+
+mdif_error_t mdif_pool_reserve(mdif_pool_t* pool, short width, short height, int count) {
+    if(!pool)
+        return MDIF_ERROR_POOL;
+
+    if(width < 1 || width > 1024)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1 || height > 1024)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    unsigned int capacity;
+    if(mdif_pool_class(width * height, &capacity) < 0)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    for(int i = 0; i < count; i++) {
+        unsigned char* block = (unsigned char*) mdif_mem_alloc(4ul * capacity);
+        if(!block)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        mdif_pool_put(pool, block, capacity);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_pool_take(mdif_pool_t* pool, mdif_t* image, unsigned int pixel_count) {
+    unsigned int capacity;
+    int index = mdif_pool_class(pixel_count, &capacity);
+    if(index < 0)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_lock_acquire(pool->lock);
+    unsigned char* block = (unsigned char*) pool->buckets[index];
+    if(block) {
+        pool->buckets[index] = *(void**) block;
+        pool->cached_bytes -= 4ul * capacity;
+    }
+    mdif_lock_release(pool->lock);
+
+    if(!block) {
+        block = (unsigned char*) mdif_mem_alloc(4ul * capacity);
+        if(!block)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    image->red   = block;
+    image->green = block + capacity;
+    image->blue  = block + 2 * capacity;
+    image->alpha = block + 3 * capacity;
+
+    image->capacity = capacity;
+    image->pool = pool;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_init_from_pool(mdif_pool_t* pool, mdif_t* image, short width, short height) {
+    if(!pool)
+        return MDIF_ERROR_POOL;
+
+    if(width < 1 || width > 1024)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1 || height > 1024)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    mdif_error_t result = mdif_pool_take(pool, image, width * height);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    image->signature[0] = 'N';
+    image->signature[1] = 'T';
+
+    image->width = width;
+    image->height = height;
+    image->layout = MDIF_LAYOUT_RGBA;
+    image->levels = 0;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_grayscale(mdif_t* image, float* grayscale) {
+    if(!image)
+        return MDIF_ERROR_IMAGE;
+
+    if(!grayscale)
+        return MDIF_ERROR_GRAYSCALE;
+
+    int pixel_count = image->width * image->height;
+    if(image->layout == MDIF_LAYOUT_INDEXED) {
+        float levels[MDIF_PALETTE_SIZE];
+        for(int i = 0; i < MDIF_PALETTE_SIZE; i++) {
+            const unsigned char* color = image->alpha + 4 * i;
+            levels[i] = (0.299 * color[0] + 0.587 * color[1] + 0.114 * color[2]) / 255.0;
+        }
+
+        for(int i = 0; i < pixel_count; i++)
+            grayscale[i] = levels[image->red[i]];
+
+        return MDIF_ERROR_NONE;
+    }
+
+    if(image->layout != MDIF_LAYOUT_RGBA) {
+        for(int i = 0; i < pixel_count; i++)
+            grayscale[i] = image->red[i] / 255.0;
+
+        return MDIF_ERROR_NONE;
+    }
+
+    for(int i = 0; i < pixel_count; i++) {
+        float brightness =
+            0.299 * (unsigned char) image->red[i] +
+            0.587 * (unsigned char) image->green[i] +
+            0.114 * (unsigned char) image->blue[i];
+
+        grayscale[i] = brightness / 255.0;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+static unsigned char mdif_luma(int red, int green, int blue) {
+    return (unsigned char) ((19595 * red + 38470 * green + 7471 * blue + 32768) >> 16);
+}
+
+static unsigned char mdif_chroma(int a, int b, int c) {
+    return (unsigned char) ((a * 32768 - b - c + (128 << 16) + 32767) >> 16);
+}
+
+mdif_error_t mdif_luminance(const mdif_t* image, unsigned char* luminance) {
+    if(!image || !image->red || !luminance)
+        return MDIF_ERROR_IMAGE;
+
+    size_t pixel_count = (size_t) image->width * image->height;
+    if(image->layout == MDIF_LAYOUT_INDEXED) {
+        unsigned char levels[MDIF_PALETTE_SIZE];
+        for(int i = 0; i < MDIF_PALETTE_SIZE; i++) {
+            const unsigned char* color = image->alpha + 4 * i;
+            levels[i] = mdif_luma(color[0], color[1], color[2]);
+        }
+
+        for(size_t i = 0; i < pixel_count; i++)
+            luminance[i] = levels[image->red[i]];
+
+        return MDIF_ERROR_NONE;
+    }
+
+    if(image->layout != MDIF_LAYOUT_RGBA) {
+        memcpy(luminance, image->red, pixel_count);
+        return MDIF_ERROR_NONE;
+    }
+
+    for(size_t i = 0; i < pixel_count; i++)
+        luminance[i] = mdif_luma(image->red[i], image->green[i], image->blue[i]);
+
+    return MDIF_ERROR_NONE;
+}
+
+static void mdif_rgb_to_ycbcr(const mdif_t* image, mdif_t* output) {
+    int width = image->width, height = image->height;
+
+    if(output->layout == MDIF_LAYOUT_YCBCR444) {
+        size_t pixel_count = (size_t) width * height;
+
+        for(size_t i = 0; i < pixel_count; i++) {
+            int red = image->red[i], green = image->green[i], blue = image->blue[i];
+
+            output->red[i] = mdif_luma(red, green, blue);
+            output->green[i] = mdif_chroma(blue, 11059 * red, 21709 * green);
+            output->blue[i] = mdif_chroma(red, 27439 * green, 5329 * blue);
+        }
+
+        return;
+    }
+
+    int chroma_width = (width + 1) / 2;
+    for(int y = 0; y < height; y += 2) {
+        int below = y + 1 < height ? y + 1 : y;
+
+        for(int x = 0; x < width; x += 2) {
+            int right = x + 1 < width ? x + 1 : x;
+            size_t indices[4] = {
+                (size_t) y * width + x, (size_t) y * width + right,
+                (size_t) below * width + x, (size_t) below * width + right
+            };
+
+            int cb = 0, cr = 0;
+            for(int k = 0; k < 4; k++) {
+                size_t i = indices[k];
+                int red = image->red[i], green = image->green[i], blue = image->blue[i];
+
+                output->red[i] = mdif_luma(red, green, blue);
+                cb += mdif_chroma(blue, 11059 * red, 21709 * green);
+                cr += mdif_chroma(red, 27439 * green, 5329 * blue);
+            }
+
+            size_t chroma = (size_t) (y / 2) * chroma_width + x / 2;
+            output->green[chroma] = (unsigned char) ((cb + 2) >> 2);
+            output->blue[chroma] = (unsigned char) ((cr + 2) >> 2);
+        }
+    }
+}
+
+static void mdif_upsample_row(
+    const unsigned char* near_row,
+    const unsigned char* far_row,
+    int chroma_width,
+    int width,
+    unsigned char* out
+) {
+    for(int x = 0; x < width; x++) {
+        int column = x / 2,
+            neighbour = x & 1 ?
+                (column + 1 < chroma_width ? column + 1 : column) :
+                (column > 0 ? column - 1 : 0);
+
+        int near_sum = 3 * near_row[column] + far_row[column],
+            far_sum = 3 * near_row[neighbour] + far_row[neighbour];
+
+        out[x] = (unsigned char) ((3 * near_sum + far_sum + 8) >> 4);
+    }
+}
+
+static void mdif_ycbcr_to_rgb(const mdif_t* image, mdif_t* output, unsigned char* chroma_rows) {
+    int width = image->width, height = image->height,
+        chroma_width = (width + 1) / 2,
+        chroma_height = (height + 1) / 2;
+
+    for(int y = 0; y < height; y++) {
+        const unsigned char* cb = image->green + (size_t) y * width;
+        const unsigned char* cr = image->blue + (size_t) y * width;
+
+        if(image->layout == MDIF_LAYOUT_YCBCR420) {
+            int row = y / 2,
+                neighbour = y & 1 ?
+                    (row + 1 < chroma_height ? row + 1 : row) :
+                    (row > 0 ? row - 1 : 0);
+
+            mdif_upsample_row(
+                image->green + (size_t) row * chroma_width,
+                image->green + (size_t) neighbour * chroma_width,
+                chroma_width, width, chroma_rows
+            );
+            mdif_upsample_row(
+                image->blue + (size_t) row * chroma_width,
+                image->blue + (size_t) neighbour * chroma_width,
+                chroma_width, width, chroma_rows + width
+            );
+
+            cb = chroma_rows;
+            cr = chroma_rows + width;
+        }
+
+        size_t offset = (size_t) y * width;
+        for(int x = 0; x < width; x++) {
+            int luma = image->red[offset + x] << 16,
+                blue_diff = cb[x] - 128,
+                red_diff = cr[x] - 128;
+
+            int red = (luma + 91881 * red_diff + 32768) >> 16,
+                green = (luma - 22554 * blue_diff - 46802 * red_diff + 32768) >> 16,
+                blue = (luma + 116130 * blue_diff + 32768) >> 16;
+
+            output->red[offset + x] = (unsigned char) mdif_clamp(red, 0, 255);
+            output->green[offset + x] = (unsigned char) mdif_clamp(green, 0, 255);
+            output->blue[offset + x] = (unsigned char) mdif_clamp(blue, 0, 255);
+        }
+
+        memset(output->alpha + offset, 255, width);
+    }
+}
+
+static void mdif_expand_planes(const mdif_t* image, mdif_t* output) {
+    size_t pixel_count = (size_t) image->width * image->height;
+
+    for(size_t i = 0; i < pixel_count; i++) {
+        const unsigned char* color = image->alpha + 4 * image->red[i];
+
+        output->red[i] = color[0];
+        output->green[i] = color[1];
+        output->blue[i] = color[2];
+        output->alpha[i] = color[3];
+    }
+}
+
+mdif_error_t mdif_convert(const mdif_t* image, mdif_t* output) {
+    if(!image || !output || !image->red || !output->red || image->red == output->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(output->width != image->width)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(output->height != image->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(image->layout > MDIF_LAYOUT_INDEXED || output->layout > MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    if((image->layout == MDIF_LAYOUT_INDEXED || output->layout == MDIF_LAYOUT_INDEXED) &&
+        image->layout != output->layout &&
+        output->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    size_t sizes[4];
+    mdif_plane_sizes(image, sizes);
+
+    if(image->layout == output->layout) {
+        memcpy(output->red, image->red, sizes[0]);
+        memcpy(output->green, image->green, sizes[1]);
+        memcpy(output->blue, image->blue, sizes[2]);
+        memcpy(output->alpha, image->alpha, sizes[3]);
+
+        if(image->layout == MDIF_LAYOUT_INDEXED)
+            memcpy(output->alpha, image->alpha, MDIF_PALETTE_BYTES);
+
+        return MDIF_ERROR_NONE;
+    }
+
+    if(image->layout == MDIF_LAYOUT_INDEXED) {
+        mdif_expand_planes(image, output);
+        return MDIF_ERROR_NONE;
+    }
+
+    if(image->layout == MDIF_LAYOUT_RGBA) {
+        mdif_rgb_to_ycbcr(image, output);
+        return MDIF_ERROR_NONE;
+    }
+
+    if(output->layout == MDIF_LAYOUT_RGBA) {
+        unsigned char* chroma_rows = (unsigned char*) mdif_scratch_alloc(2 * (size_t) image->width);
+        if(!chroma_rows)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        mdif_ycbcr_to_rgb(image, output, chroma_rows);
+        mdif_scratch_free(chroma_rows);
+
+        return MDIF_ERROR_NONE;
+    }
+
+    memcpy(output->red, image->red, sizes[0]);
+
+    int width = image->width, height = image->height,
+        chroma_width = (width + 1) / 2;
+
+    if(output->layout == MDIF_LAYOUT_YCBCR420) {
+        for(int y = 0; y < height; y += 2) {
+            size_t above = (size_t) y * width,
+                below = (size_t) (y + 1 < height ? y + 1 : y) * width;
+
+            for(int x = 0; x < width; x += 2) {
+                int right = x + 1 < width ? x + 1 : x;
+                size_t chroma = (size_t) (y / 2) * chroma_width + x / 2;
+
+                output->green[chroma] = (unsigned char) ((
+                    image->green[above + x] + image->green[above + right] +
+                    image->green[below + x] + image->green[below + right] + 2) >> 2);
+                output->blue[chroma] = (unsigned char) ((
+                    image->blue[above + x] + image->blue[above + right] +
+                    image->blue[below + x] + image->blue[below + right] + 2) >> 2);
+            }
+        }
+
+        return MDIF_ERROR_NONE;
+    }
+
+    int chroma_height = (height + 1) / 2;
+    for(int y = 0; y < height; y++) {
+        int row = y / 2,
+            neighbour = y & 1 ?
+                (row + 1 < chroma_height ? row + 1 : row) :
+                (row > 0 ? row - 1 : 0);
+
+        mdif_upsample_row(
+            image->green + (size_t) row * chroma_width,
+            image->green + (size_t) neighbour * chroma_width,
+            chroma_width, width, output->green + (size_t) y * width
+        );
+        mdif_upsample_row(
+            image->blue + (size_t) row * chroma_width,
+            image->blue + (size_t) neighbour * chroma_width,
+            chroma_width, width, output->blue + (size_t) y * width
+        );
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+static void mdif_antialias_row(
+    const unsigned char* above,
+    const unsigned char* row,
+    const unsigned char* below,
+    unsigned char* out,
+    short width
+) {
+    int left = above[0] + row[0] + below[0],
+        center = left;
+
+    for(short j = 0; j < width; j++) {
+        int right = j + 1 < width ?
+            above[j + 1] + row[j + 1] + below[j + 1] :
+            center;
+
+        out[j] = (left + center + right) / 9;
+        left = center;
+        center = right;
+    }
+}
+
+static void mdif_antialias_rows(const mdif_t* image, short first, short last, mdif_t* out, short out_y) {
+    short width = image->width,
+        height = image->height;
+
+    unsigned char* src_planes[3] = {image->red, image->green, image->blue};
+    unsigned char* dst_planes[3] = {out->red, out->green, out->blue};
+
+    for(short i = first; i < last; i++, out_y++) {
+        size_t above = (size_t) mdif_clamp(i - 1, 0, height - 1) * width,
+            row = (size_t) i * width,
+            below = (size_t) mdif_clamp(i + 1, 0, height - 1) * width,
+            dst = (size_t) out_y * width;
+
+        for(int c = 0; c < 3; c++)
+            mdif_antialias_row(
+                src_planes[c] + above,
+                src_planes[c] + row,
+                src_planes[c] + below,
+                dst_planes[c] + dst,
+                width
+            );
+
+        memcpy(out->alpha + dst, image->alpha + row, width);
+    }
+}
+
+mdif_error_t mdif_antialias(mdif_t* image, mdif_t* aliased_image) {
+    if(!image || !aliased_image)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    mdif_init(aliased_image, image->width, image->height);
+    if(!aliased_image->red)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_antialias_rows(image, 0, image->height, aliased_image, 0);
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_antialias_band(mdif_t* image, short y, short rows, mdif_t* band) {
+    if(!image || !band)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA || band->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    if(band->width != image->width)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(y < 0 || rows < 1 || rows > band->height || y + rows > image->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    mdif_antialias_rows(image, y, y + rows, band, 0);
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_antialias_inplace(mdif_t* image) {
+    if(!image)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    short width = image->width,
+        height = image->height;
+
+    unsigned char* ring = (unsigned char*) mdif_scratch_alloc(6 * (size_t) width);
+    if(!ring)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    unsigned char* planes[3] = {image->red, image->green, image->blue};
+    for(int c = 0; c < 3; c++) {
+        unsigned char* previous = ring + 2 * c * width;
+        unsigned char* current = previous + width;
+
+        memcpy(previous, planes[c], width);
+        for(short i = 0; i < height; i++) {
+            unsigned char* row = planes[c] + (size_t) i * width;
+            const unsigned char* below = i + 1 < height ? row + width : current;
+
+            memcpy(current, row, width);
+            mdif_antialias_row(previous, current, below, row, width);
+
+            unsigned char* swap = previous;
+            previous = current;
+            current = swap;
+        }
+    }
+
+    mdif_scratch_free(ring);
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_antialias_stream_init(
+    mdif_antialias_stream_t* stream,
+    short width,
+    short height,
+    mdif_row_callback_t callback,
+    void* user_data
+) {
+    if(!stream || !callback)
+        return MDIF_ERROR_IMAGE;
+
+    if(width < 1 || width > 1024)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1 || height > 1024)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    stream->ring = (unsigned char*) mdif_scratch_alloc(16 * (size_t) width);
+    if(!stream->ring)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    stream->width = width;
+    stream->height = height;
+    stream->rows = 0;
+    stream->callback = callback;
+    stream->user_data = user_data;
+
+    return MDIF_ERROR_NONE;
+}
+
+static void mdif_antialias_stream_emit(mdif_antialias_stream_t* stream, short y) {
+    short width = stream->width;
+    unsigned char* out = stream->ring + 12 * (size_t) width;
+
+    unsigned char* above = stream->ring + 4 * (size_t) width * (mdif_clamp(y - 1, 0, y) % 3);
+    unsigned char* row = stream->ring + 4 * (size_t) width * (y % 3);
+    unsigned char* below = stream->ring + 4 * (size_t) width *
+        (mdif_clamp(y + 1, 0, stream->height - 1) % 3);
+
+    for(int c = 0; c < 3; c++)
+        mdif_antialias_row(
+            above + c * width,
+            row + c * width,
+            below + c * width,
+            out + c * width,
+            width
+        );
+
+    stream->callback(
+        y,
+        out,
+        out + width,
+        out + 2 * width,
+        row + 3 * width,
+        width,
+        stream->user_data
+    );
+}
+
+mdif_error_t mdif_antialias_stream_push(
+    mdif_antialias_stream_t* stream,
+    const unsigned char* red,
+    const unsigned char* green,
+    const unsigned char* blue,
+    const unsigned char* alpha
+) {
+    if(!stream || !stream->ring)
+        return MDIF_ERROR_IMAGE;
+
+    if(stream->rows >= stream->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    short y = stream->rows++;
+    size_t width = stream->width;
+    unsigned char* slot = stream->ring + 4 * width * (y % 3);
+
+    memcpy(slot, red, width);
+    memcpy(slot + width, green, width);
+    memcpy(slot + 2 * width, blue, width);
+    memcpy(slot + 3 * width, alpha, width);
+
+    if(y > 0)
+        mdif_antialias_stream_emit(stream, y - 1);
+
+    if(y == stream->height - 1)
+        mdif_antialias_stream_emit(stream, y);
+
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_antialias_stream_free(mdif_antialias_stream_t* stream) {
+    if(!stream)
+        return;
+
+    mdif_scratch_free(stream->ring);
+    stream->ring = NULL;
+}
+
+static void mdif_planes(const mdif_t* image, unsigned char* planes[4]) {
+    planes[0] = image->red;
+    planes[1] = image->green;
+    planes[2] = image->blue;
+    planes[3] = image->alpha;
+}
+
+static mdif_error_t mdif_check_output(const mdif_t* image, const mdif_t* output) {
+    if(!image || !output || !image->red || !output->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA || output->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    if(output->width != image->width)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(output->height != image->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    return MDIF_ERROR_NONE;
+}
+
+static int mdif_border_index(int index, int size, mdif_border_t border) {
+    if(index >= 0 && index < size)
+        return index;
+
+    switch(border) {
+        case MDIF_BORDER_ZERO:
+            return -1;
+
+        case MDIF_BORDER_WRAP:
+            index %= size;
+            return index < 0 ? index + size : index;
+
+        case MDIF_BORDER_REFLECT:
+            if(size == 1)
+                return 0;
+
+            index %= 2 * size - 2;
+            if(index < 0)
+                index = -index;
+
+            return index < size ? index : 2 * size - 2 - index;
+
+        default:
+            return mdif_clamp(index, 0, size - 1);
+    }
+}
+
+static int mdif_fixed_shift(const float* weights, int count, int max_shift, long limit) {
+    float largest = 0.0f, total = 0.0f;
+    for(int i = 0; i < count; i++) {
+        float magnitude = weights[i] < 0 ? -weights[i] : weights[i];
+
+        total += magnitude;
+        if(magnitude > largest)
+            largest = magnitude;
+    }
+
+    int shift = max_shift;
+    while(shift > 0 &&
+        (largest * (float) (1l << shift) > 32767.0f ||
+            total * (float) (1l << shift) > (float) limit))
+        shift--;
+
+    return shift;
+}
+
+static void mdif_fixed_taps(const float* weights, int count, int shift, short* taps) {
+    for(int i = 0; i < count; i++)
+        taps[i] = (short) lrintf(weights[i] * (float) (1l << shift));
+
+    if(count & 1)
+        taps[count] = 0;
+}
+
+static void mdif_pad_source(
+    const unsigned char* row,
+    int width,
+    int radius,
+    mdif_border_t border,
+    unsigned char* padded
+) {
+    if(!row) {
+        memset(padded, 0, width + 2 * radius + 1);
+        return;
+    }
+
+    memcpy(padded + radius, row, width);
+
+    for(int i = 1; i <= radius; i++) {
+        int left = mdif_border_index(-i, width, border),
+            right = mdif_border_index(width - 1 + i, width, border);
+
+        padded[radius - i] = left < 0 ? 0 : row[left];
+        padded[radius + width - 1 + i] = right < 0 ? 0 : row[right];
+    }
+
+    padded[width + 2 * radius] = 0;
+}
+
+static void mdif_pad_row(
+    const unsigned char* plane,
+    int y,
+    int width,
+    int height,
+    int radius,
+    mdif_border_t border,
+    unsigned char* padded
+) {
+    y = mdif_border_index(y, height, border);
+    mdif_pad_source(
+        y < 0 ? NULL : plane + (size_t) y * width,
+        width, radius, border, padded
+    );
+}
+
+static void mdif_accumulate_row(
+    const unsigned char* padded,
+    int width,
+    const short* taps,
+    int count,
+    int* acc
+) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for(; x + 8 <= width; x += 8) {
+        __m128i low = _mm_loadu_si128((const __m128i*) (acc + x)),
+            high = _mm_loadu_si128((const __m128i*) (acc + x + 4));
+
+        for(int i = 0; i < count; i += 2) {
+            __m128i pair = _mm_set1_epi32(
+                (int) (unsigned short) taps[i] |
+                ((int) (unsigned short) taps[i + 1] << 16)
+            );
+
+            __m128i a = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i*) (padded + x + i)),
+                    zero
+                ),
+                b = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i*) (padded + x + i + 1)),
+                    zero
+                );
+
+            low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+        }
+
+        _mm_storeu_si128((__m128i*) (acc + x), low);
+        _mm_storeu_si128((__m128i*) (acc + x + 4), high);
+    }
+    #endif
+
+    for(; x < width; x++) {
+        int sum = acc[x];
+        for(int i = 0; i < count; i++)
+            sum += taps[i] * padded[x + i];
+
+        acc[x] = sum;
+    }
+}
+
+static void mdif_store_row(const int* acc, int width, int shift, int offset, unsigned char* out) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i rounding = _mm_set1_epi32(offset);
+    for(; x + 8 <= width; x += 8) {
+        __m128i low = _mm_srai_epi32(
+                _mm_add_epi32(_mm_loadu_si128((const __m128i*) (acc + x)), rounding),
+                shift
+            ),
+            high = _mm_srai_epi32(
+                _mm_add_epi32(_mm_loadu_si128((const __m128i*) (acc + x + 4)), rounding),
+                shift
+            );
+
+        __m128i packed = _mm_packs_epi32(low, high);
+        _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(packed, packed));
+    }
+    #endif
+
+    for(; x < width; x++) {
+        int value = (acc[x] + offset) >> shift;
+        out[x] = (unsigned char) mdif_clamp(value, 0, 255);
+    }
+}
+
+static void mdif_store_intermediate(const int* acc, int width, int shift, short* out) {
+    int x = 0, offset = shift > 0 ? 1 << (shift - 1) : 0;
+
+    #ifdef MDIF_SSE2
+    __m128i rounding = _mm_set1_epi32(offset);
+    for(; x + 8 <= width; x += 8) {
+        __m128i low = _mm_srai_epi32(
+                _mm_add_epi32(_mm_loadu_si128((const __m128i*) (acc + x)), rounding),
+                shift
+            ),
+            high = _mm_srai_epi32(
+                _mm_add_epi32(_mm_loadu_si128((const __m128i*) (acc + x + 4)), rounding),
+                shift
+            );
+
+        _mm_storeu_si128((__m128i*) (out + x), _mm_packs_epi32(low, high));
+    }
+    #endif
+
+    for(; x < width; x++) {
+        int value = (acc[x] + offset) >> shift;
+        out[x] = (short) mdif_clamp(value, -32768, 32767);
+    }
+}
+
+static void mdif_accumulate_column(
+    const short* const* rows,
+    int width,
+    const short* taps,
+    int count,
+    int* acc
+) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    for(; x + 8 <= width; x += 8) {
+        __m128i low = _mm_setzero_si128(),
+            high = _mm_setzero_si128();
+
+        for(int i = 0; i < count; i += 2) {
+            __m128i pair = _mm_set1_epi32(
+                (int) (unsigned short) taps[i] |
+                ((int) (unsigned short) taps[i + 1] << 16)
+            );
+
+            __m128i a = _mm_loadu_si128((const __m128i*) (rows[i] + x)),
+                b = _mm_loadu_si128((const __m128i*) (rows[i + 1] + x));
+
+            low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+        }
+
+        _mm_storeu_si128((__m128i*) (acc + x), low);
+        _mm_storeu_si128((__m128i*) (acc + x + 4), high);
+    }
+    #endif
+
+    for(; x < width; x++) {
+        int sum = 0;
+        for(int i = 0; i < count; i++)
+            sum += taps[i] * rows[i][x];
+
+        acc[x] = sum;
+    }
+}
+
+#define MDIF_CONVOLVE_BAND 32
+
+typedef struct mdif_convolve_job_struct {
+    const mdif_t *image;
+    mdif_t *output;
+    unsigned char channels;
+    mdif_border_t border;
+
+    bool separable;
+    int size_x;
+    int size_y;
+
+    short taps_x[MDIF_KERNEL_MAX_SIZE * (MDIF_KERNEL_MAX_SIZE + 1)];
+    short taps_y[MDIF_KERNEL_MAX_SIZE + 1];
+
+    int shift_x;
+    int shift_y;
+    int intermediate;
+    int offset;
+
+    volatile bool failed;
+} mdif_convolve_job_t;
+
+static const unsigned char* mdif_convolve_row(
+    const unsigned char* plane,
+    int y,
+    int y0,
+    int width,
+    int height,
+    int radius,
+    mdif_border_t border,
+    const unsigned char* history,
+    const unsigned char* head
+) {
+    y = mdif_border_index(y, height, border);
+    if(y < 0)
+        return NULL;
+
+    if(!history || y >= y0)
+        return plane + (size_t) y * width;
+
+    if(y >= y0 - radius)
+        return history + (size_t) (y - y0 + radius) * width;
+
+    return head + (size_t) y * width;
+}
+
+static void mdif_convolve_task(void* context, int begin, int end) {
+    mdif_convolve_job_t* job = (mdif_convolve_job_t*) context;
+
+    int width = job->image->width,
+        height = job->image->height,
+        radius_x = job->size_x / 2,
+        radius_y = job->size_y / 2,
+        taps_x = (job->size_x + 1) & ~1,
+        taps_y = (job->size_y + 1) & ~1,
+        padded_width = width + 2 * radius_x + 1,
+        head_rows = radius_y + 1 < height ? radius_y + 1 : height,
+        band = MDIF_CONVOLVE_BAND;
+
+    bool streaming = job->image->red == job->output->red;
+    size_t padded_size = (size_t) (padded_width + 15) & ~(size_t) 15,
+        acc_size = (size_t) width * sizeof(int),
+        row_size = job->separable ? (size_t) width * sizeof(short) : 0,
+        out_size = streaming ? (size_t) width : 0,
+        history_size = streaming ? (size_t) radius_y * width : 0,
+        head_size = streaming ? (size_t) head_rows * width : 0;
+
+    #ifdef MDIF_STATIC_ARENA
+    size_t fixed = padded_size + acc_size + row_size * taps_y +
+            history_size + head_size + 15,
+        available = mdif_scratch_available();
+
+    if(row_size + out_size > 0) {
+        size_t fit = available > fixed ?
+            (available - fixed) / (row_size + out_size) : 0;
+
+        if(fit < (size_t) band)
+            band = (int) fit;
+    }
+
+    if(band < 1) {
+        job->failed = true;
+        return;
+    }
+    #endif
+
+    unsigned char* scratch = (unsigned char*) mdif_scratch_alloc(
+        padded_size + acc_size + row_size * (band + taps_y) +
+        history_size + head_size + out_size * band
+    );
+    if(!scratch) {
+        job->failed = true;
+        return;
+    }
+
+    unsigned char* padded = scratch;
+    int* acc = (int*) (scratch + padded_size);
+    short* rows = (short*) (scratch + padded_size + acc_size);
+    unsigned char* history = (unsigned char*) rows + row_size * (band + taps_y);
+    unsigned char* head = history + history_size;
+    unsigned char* out = head + head_size;
+
+    unsigned char* src_planes[4];
+    unsigned char* dst_planes[4];
+    mdif_planes(job->image, src_planes);
+    mdif_planes(job->output, dst_planes);
+
+    for(int c = 0; c < 4; c++) {
+        if(!(job->channels & (1 << c))) {
+            if(src_planes[c] != dst_planes[c])
+                memcpy(
+                    dst_planes[c] + (size_t) begin * width,
+                    src_planes[c] + (size_t) begin * width,
+                    (size_t) (end - begin) * width
+                );
+            continue;
+        }
+
+        if(streaming)
+            memcpy(head, src_planes[c], head_size);
+
+        for(int y0 = begin; y0 < end; y0 += band) {
+            int y1 = y0 + band < end ? y0 + band : end;
+
+            if(!job->separable)
+                for(int y = y0; y < y1; y++) {
+                    memset(acc, 0, acc_size);
+
+                    for(int k = 0; k < job->size_y; k++) {
+                        mdif_pad_source(
+                            mdif_convolve_row(
+                                src_planes[c], y + k - radius_y, y0,
+                                width, height, radius_y, job->border,
+                                streaming ? history : NULL, head
+                            ),
+                            width, radius_x, job->border, padded
+                        );
+                        mdif_accumulate_row(
+                            padded, width,
+                            job->taps_x + k * taps_x,
+                            taps_x, acc
+                        );
+                    }
+
+                    mdif_store_row(
+                        acc, width, job->shift_x, job->offset,
+                        streaming ? out + (size_t) (y - y0) * width :
+                            dst_planes[c] + (size_t) y * width
+                    );
+                }
+            else {
+                int first = y0 - radius_y,
+                    count = y1 - y0 + job->size_y - 1;
+
+                for(int r = 0; r < count; r++) {
+                    const unsigned char* source = mdif_convolve_row(
+                        src_planes[c], first + r, y0,
+                        width, height, radius_y, job->border,
+                        streaming ? history : NULL, head
+                    );
+
+                    memset(acc, 0, acc_size);
+                    if(!source) {
+                        memset(rows + (size_t) r * width, 0, width * sizeof(short));
+                        continue;
+                    }
+
+                    mdif_pad_source(source, width, radius_x, job->border, padded);
+                    mdif_accumulate_row(padded, width, job->taps_x, taps_x, acc);
+                    mdif_store_intermediate(
+                        acc, width,
+                        job->shift_x - job->intermediate,
+                        rows + (size_t) r * width
+                    );
+                }
+
+                for(int y = y0; y < y1; y++) {
+                    const short* window[MDIF_KERNEL_MAX_SIZE + 1];
+                    for(int k = 0; k < taps_y; k++)
+                        window[k] = rows + (size_t) mdif_clamp(y - y0 + k, 0, count - 1) * width;
+
+                    mdif_accumulate_column(window, width, job->taps_y, taps_y, acc);
+                    mdif_store_row(
+                        acc, width,
+                        job->shift_y + job->intermediate,
+                        job->offset,
+                        streaming ? out + (size_t) (y - y0) * width :
+                            dst_planes[c] + (size_t) y * width
+                    );
+                }
+            }
+
+            if(!streaming)
+                continue;
+
+            int done = y1 - y0, keep = radius_y - done;
+            if(keep > 0)
+                memmove(history, history + (size_t) done * width, (size_t) keep * width);
+
+            for(int i = keep > 0 ? keep : 0; i < radius_y; i++)
+                if(y1 - radius_y + i >= 0)
+                    memcpy(
+                        history + (size_t) i * width,
+                        src_planes[c] + (size_t) (y1 - radius_y + i) * width,
+                        width
+                    );
+
+            memcpy(dst_planes[c] + (size_t) y0 * width, out, (size_t) done * width);
+        }
+    }
+
+    mdif_scratch_free(scratch);
+}
+
+static bool mdif_kernel_factor(const mdif_kernel_t* kernel, float* kernel_x, float* kernel_y) {
+    int width = kernel->width, height = kernel->height;
+    int pivot_row = 0, pivot_column = 0;
+    float largest = 0.0f;
+
+    for(int i = 0; i < height; i++)
+        for(int j = 0; j < width; j++) {
+            float value = fabsf(kernel->weights[i * width + j]);
+
+            if(value > largest) {
+                largest = value;
+                pivot_row = i;
+                pivot_column = j;
+            }
+        }
+
+    if(largest == 0.0f)
+        return false;
+
+    float pivot = kernel->weights[pivot_row * width + pivot_column];
+    for(int i = 0; i < height; i++)
+        kernel_y[i] = kernel->weights[i * width + pivot_column];
+
+    for(int j = 0; j < width; j++)
+        kernel_x[j] = kernel->weights[pivot_row * width + j] / pivot;
+
+    for(int i = 0; i < height; i++)
+        for(int j = 0; j < width; j++)
+            if(fabsf(kernel->weights[i * width + j] - kernel_y[i] * kernel_x[j]) >
+                largest * 1e-5f)
+                return false;
+
+    return true;
+}
+
+static mdif_error_t mdif_convolve_run(
+    mdif_convolve_job_t* job,
+    const mdif_t* image,
+    mdif_t* output,
+    mdif_border_t border,
+    unsigned char channels,
+    int threads
+) {
+    mdif_error_t result = mdif_check_output(image, output);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    job->image = image;
+    job->output = output;
+    job->border = border;
+    job->channels = channels;
+    job->failed = false;
+
+    #ifndef MDIF_STATIC_ARENA
+    if(image->red == output->red) {
+        mdif_t copy;
+        if(!mdif_alloc_planes(&copy, (size_t) image->width * image->height))
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        copy.width = image->width;
+        copy.height = image->height;
+        copy.layout = MDIF_LAYOUT_RGBA;
+
+        size_t pixel_count = (size_t) image->width * image->height;
+        memcpy(copy.red, image->red, pixel_count);
+        memcpy(copy.green, image->green, pixel_count);
+        memcpy(copy.blue, image->blue, pixel_count);
+        memcpy(copy.alpha, image->alpha, pixel_count);
+
+        job->image = &copy;
+        mdif_parallel(image->height, threads, mdif_convolve_task, job);
+        mdif_free(&copy);
+    }
+    else mdif_parallel(image->height, threads, mdif_convolve_task, job);
+    #else
+    mdif_parallel(image->height, threads, mdif_convolve_task, job);
+    #endif
+
+    return job->failed ? MDIF_ERROR_CANNOT_ALLOCATE : MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_convolve_prepare_separable(
+    mdif_convolve_job_t* job,
+    const float* kernel_x,
+    int size_x,
+    const float* kernel_y,
+    int size_y,
+    float bias
+) {
+    if(!kernel_x || !kernel_y ||
+        size_x < 1 || size_x > MDIF_KERNEL_MAX_SIZE || !(size_x & 1) ||
+        size_y < 1 || size_y > MDIF_KERNEL_MAX_SIZE || !(size_y & 1))
+        return MDIF_ERROR_KERNEL;
+
+    job->separable = true;
+    job->size_x = size_x;
+    job->size_y = size_y;
+
+    float total_x = 0.0f;
+    for(int i = 0; i < size_x; i++)
+        total_x += fabsf(kernel_x[i]);
+
+    job->intermediate = 6;
+    while(job->intermediate > 0 &&
+        total_x * 255.0f * (float) (1 << job->intermediate) > 32767.0f)
+        job->intermediate--;
+
+    job->shift_x = mdif_fixed_shift(kernel_x, size_x, 14, 0x7fffffffl / 255);
+    if(job->shift_x <= job->intermediate)
+        job->intermediate = job->shift_x > 0 ? job->shift_x - 1 : 0;
+
+    job->shift_y = mdif_fixed_shift(kernel_y, size_y, 14, 0x7fffffffl / 32768);
+    mdif_fixed_taps(kernel_x, size_x, job->shift_x, job->taps_x);
+    mdif_fixed_taps(kernel_y, size_y, job->shift_y, job->taps_y);
+
+    int shift = job->shift_y + job->intermediate;
+    job->offset = (int) lrintf(bias * (float) (1l << shift)) +
+        (shift > 0 ? 1 << (shift - 1) : 0);
+
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_convolve_prepare(mdif_convolve_job_t* job, const mdif_kernel_t* kernel) {
+    if(!kernel ||
+        kernel->width < 1 || kernel->width > MDIF_KERNEL_MAX_SIZE || !(kernel->width & 1) ||
+        kernel->height < 1 || kernel->height > MDIF_KERNEL_MAX_SIZE || !(kernel->height & 1))
+        return MDIF_ERROR_KERNEL;
+
+    float kernel_x[MDIF_KERNEL_MAX_SIZE], kernel_y[MDIF_KERNEL_MAX_SIZE];
+    if(mdif_kernel_factor(kernel, kernel_x, kernel_y))
+        return mdif_convolve_prepare_separable(
+            job,
+            kernel_x, kernel->width,
+            kernel_y, kernel->height,
+            kernel->bias
+        );
+
+    int count = kernel->width * kernel->height,
+        taps = (kernel->width + 1) & ~1;
+
+    job->separable = false;
+    job->size_x = kernel->width;
+    job->size_y = kernel->height;
+    job->intermediate = 0;
+    job->shift_y = 0;
+    job->shift_x = mdif_fixed_shift(kernel->weights, count, 14, 0x7fffffffl / 255);
+
+    for(int k = 0; k < kernel->height; k++)
+        mdif_fixed_taps(
+            kernel->weights + k * kernel->width,
+            kernel->width,
+            job->shift_x,
+            job->taps_x + k * taps
+        );
+
+    job->offset = (int) lrintf(kernel->bias * (float) (1l << job->shift_x)) +
+        (job->shift_x > 0 ? 1 << (job->shift_x - 1) : 0);
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_convolve(
+    const mdif_t* image,
+    mdif_t* output,
+    const mdif_kernel_t* kernel,
+    mdif_border_t border,
+    unsigned char channels,
+    int threads
+) {
+    mdif_convolve_job_t job;
+    mdif_error_t result = mdif_convolve_prepare(&job, kernel);
+
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    return mdif_convolve_run(&job, image, output, border, channels, threads);
+}
+
+mdif_error_t mdif_convolve_separable(
+    const mdif_t* image,
+    mdif_t* output,
+    const float* kernel_x,
+    unsigned char size_x,
+    const float* kernel_y,
+    unsigned char size_y,
+    float bias,
+    mdif_border_t border,
+    unsigned char channels,
+    int threads
+) {
+    mdif_convolve_job_t job;
+    mdif_error_t result = mdif_convolve_prepare_separable(
+        &job,
+        kernel_x, size_x,
+        kernel_y, size_y,
+        bias
+    );
+
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    return mdif_convolve_run(&job, image, output, border, channels, threads);
+}
+
+mdif_error_t mdif_kernel_box(mdif_kernel_t* kernel, unsigned char size) {
+    if(!kernel || size < 1 || size > MDIF_KERNEL_MAX_SIZE || !(size & 1))
+        return MDIF_ERROR_KERNEL;
+
+    kernel->width = kernel->height = size;
+    kernel->bias = 0.0f;
+
+    for(int i = 0; i < size * size; i++)
+        kernel->weights[i] = 1.0f / (float) (size * size);
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_kernel_gaussian(mdif_kernel_t* kernel, unsigned char size, float sigma) {
+    if(!kernel || size < 1 || size > MDIF_KERNEL_MAX_SIZE || !(size & 1) || sigma <= 0.0f)
+        return MDIF_ERROR_KERNEL;
+
+    float weights[MDIF_KERNEL_MAX_SIZE], total = 0.0f;
+    int radius = size / 2;
+
+    for(int i = 0; i < size; i++) {
+        float distance = (float) (i - radius);
+
+        weights[i] = expf(-(distance * distance) / (2.0f * sigma * sigma));
+        total += weights[i];
+    }
+
+    kernel->width = kernel->height = size;
+    kernel->bias = 0.0f;
+
+    for(int i = 0; i < size; i++)
+        for(int j = 0; j < size; j++)
+            kernel->weights[i * size + j] = weights[i] * weights[j] / (total * total);
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_kernel_sharpen(mdif_kernel_t* kernel, float amount) {
+    if(!kernel)
+        return MDIF_ERROR_KERNEL;
+
+    static const float laplacian[9] = {
+        0.0f, -1.0f, 0.0f,
+        -1.0f, 4.0f, -1.0f,
+        0.0f, -1.0f, 0.0f
+    };
+
+    kernel->width = kernel->height = 3;
+    kernel->bias = 0.0f;
+
+    for(int i = 0; i < 9; i++)
+        kernel->weights[i] = (i == 4 ? 1.0f : 0.0f) + amount * laplacian[i];
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_kernel_sobel(mdif_kernel_t* kernel, unsigned char vertical) {
+    if(!kernel)
+        return MDIF_ERROR_KERNEL;
+
+    static const float sobel[9] = {
+        -1.0f, 0.0f, 1.0f,
+        -2.0f, 0.0f, 2.0f,
+        -1.0f, 0.0f, 1.0f
+    };
+
+    kernel->width = kernel->height = 3;
+    kernel->bias = 128.0f;
+
+    for(int i = 0; i < 3; i++)
+        for(int j = 0; j < 3; j++)
+            kernel->weights[i * 3 + j] = (vertical ? sobel[j * 3 + i] : sobel[i * 3 + j]) / 8.0f;
+
+    return MDIF_ERROR_NONE;
+}
+
+typedef struct mdif_morph_job_struct {
+    const unsigned char *source;
+    unsigned char *output;
+    int width;
+    int height;
+    int size;
+    bool dilate;
+
+    int source_stride;
+    int output_stride;
+
+    volatile bool failed;
+} mdif_morph_job_t;
+
+static void mdif_morph_span(
+    const unsigned char* a,
+    const unsigned char* b,
+    unsigned char* out,
+    int count,
+    bool dilate
+) {
+    int i = 0;
+
+    #ifdef MDIF_SSE2
+    if(dilate)
+        for(; i + 16 <= count; i += 16)
+            _mm_storeu_si128((__m128i*) (out + i), _mm_max_epu8(
+                _mm_loadu_si128((const __m128i*) (a + i)),
+                _mm_loadu_si128((const __m128i*) (b + i))
+            ));
+    else
+        for(; i + 16 <= count; i += 16)
+            _mm_storeu_si128((__m128i*) (out + i), _mm_min_epu8(
+                _mm_loadu_si128((const __m128i*) (a + i)),
+                _mm_loadu_si128((const __m128i*) (b + i))
+            ));
+    #endif
+
+    if(dilate)
+        for(; i < count; i++)
+            out[i] = a[i] > b[i] ? a[i] : b[i];
+    else
+        for(; i < count; i++)
+            out[i] = a[i] < b[i] ? a[i] : b[i];
+}
+
+static void mdif_morph_scan(
+    const unsigned char* in,
+    int count,
+    int size,
+    bool dilate,
+    unsigned char* prefix,
+    unsigned char* suffix
+) {
+    for(int start = 0; start < count; start += size) {
+        int stop = start + size < count ? start + size : count;
+
+        prefix[start] = in[start];
+        suffix[stop - 1] = in[stop - 1];
+
+        if(dilate) {
+            for(int i = start + 1; i < stop; i++)
+                prefix[i] = in[i] > prefix[i - 1] ? in[i] : prefix[i - 1];
+
+            for(int i = stop - 2; i >= start; i--)
+                suffix[i] = in[i] > suffix[i + 1] ? in[i] : suffix[i + 1];
+        }
+        else {
+            for(int i = start + 1; i < stop; i++)
+                prefix[i] = in[i] < prefix[i - 1] ? in[i] : prefix[i - 1];
+
+            for(int i = stop - 2; i >= start; i--)
+                suffix[i] = in[i] < suffix[i + 1] ? in[i] : suffix[i + 1];
+        }
+    }
+}
+
+static void mdif_morph_rows_task(void* context, int begin, int end) {
+    mdif_morph_job_t* job = (mdif_morph_job_t*) context;
+
+    int width = job->width,
+        size = job->size,
+        radius = size / 2,
+        padded_width = width + 2 * radius + 1;
+
+    if(size == 1) {
+        memcpy(
+            job->output + (size_t) begin * width,
+            job->source + (size_t) begin * width,
+            (size_t) (end - begin) * width
+        );
+        return;
+    }
+
+    unsigned char* padded = (unsigned char*) mdif_scratch_alloc((size_t) padded_width * 3);
+    if(!padded) {
+        job->failed = true;
+        return;
+    }
+
+    unsigned char* prefix = padded + padded_width;
+    unsigned char* suffix = prefix + padded_width;
+
+    for(int y = begin; y < end; y++) {
+        mdif_pad_row(job->source, y, width, job->height, radius, MDIF_BORDER_CLAMP, padded);
+        mdif_morph_scan(padded, width + size - 1, size, job->dilate, prefix, suffix);
+        mdif_morph_span(
+            suffix, prefix + size - 1,
+            job->output + (size_t) y * width,
+            width, job->dilate
+        );
+    }
+
+    mdif_scratch_free(padded);
+}
+
+static const unsigned char* mdif_morph_row(const mdif_morph_job_t* job, int padded_y) {
+    return job->source +
+        (size_t) mdif_clamp(padded_y - job->size / 2, 0, job->height - 1) * job->source_stride;
+}
+
+static void mdif_morph_columns_task(void* context, int begin, int end) {
+    mdif_morph_job_t* job = (mdif_morph_job_t*) context;
+
+    int width = job->width,
+        size = job->size;
+
+    unsigned char* scratch = (unsigned char*) mdif_scratch_alloc((size_t) width * 2);
+    if(!scratch) {
+        job->failed = true;
+        return;
+    }
+
+    unsigned char* suffix = scratch;
+    unsigned char* prefix = scratch + width;
+
+    for(int block = begin - begin % size; block < end; block += size) {
+        int low = block > begin ? block : begin,
+            high = block + size < end ? block + size : end;
+
+        const unsigned char* current = mdif_morph_row(job, block + size - 1);
+        if(block + size - 1 < high)
+            memcpy(job->output + (size_t) (block + size - 1) * job->output_stride, current, width);
+
+        for(int q = block + size - 2; q >= low; q--) {
+            unsigned char* out = q < high ?
+                job->output + (size_t) q * job->output_stride :
+                suffix;
+
+            mdif_morph_span(current, mdif_morph_row(job, q), out, width, job->dilate);
+            current = out;
+        }
+
+        current = mdif_morph_row(job, block + size);
+        for(int q = block + size; q <= high + size - 2; q++) {
+            if(q > block + size) {
+                mdif_morph_span(current, mdif_morph_row(job, q), prefix, width, job->dilate);
+                current = prefix;
+            }
+
+            int y = q - size + 1;
+            if(y >= low) {
+                unsigned char* out = job->output + (size_t) y * job->output_stride;
+                mdif_morph_span(out, current, out, width, job->dilate);
+            }
+        }
+    }
+
+    mdif_scratch_free(scratch);
+}
+
+static mdif_error_t mdif_morphology(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    bool dilate,
+    int threads
+) {
+    mdif_error_t result = mdif_check_output(image, output);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    if(size_x < 1 || size_x > MDIF_MORPH_MAX_SIZE || !(size_x & 1) ||
+        size_y < 1 || size_y > MDIF_MORPH_MAX_SIZE || !(size_y & 1))
+        return MDIF_ERROR_KERNEL;
+
+    int width = image->width, height = image->height;
+    size_t plane_size = (size_t) width * height;
+    bool inplace = image->red == output->red;
+
+    unsigned char* temporary = NULL;
+    int strip = width;
+
+    if(inplace && size_y > 1) {
+        #ifdef MDIF_STATIC_ARENA
+        size_t available = mdif_scratch_available(),
+            reserved = 48 + (size_x > 1 ? 3 * ((size_t) width + size_x) : 0);
+
+        if(available > reserved && (available - reserved) / ((size_t) height + 2) < (size_t) width)
+            strip = (int) ((available - reserved) / ((size_t) height + 2));
+        else if(available <= reserved)
+            strip = 0;
+
+        temporary = strip > 0 ?
+            (unsigned char*) mdif_scratch_alloc((size_t) strip * height) :
+            NULL;
+        #else
+        temporary = (unsigned char*) mdif_mem_alloc(plane_size);
+        #endif
+
+        if(!temporary)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    unsigned char* src_planes[4];
+    unsigned char* dst_planes[4];
+    mdif_planes(image, src_planes);
+    mdif_planes(output, dst_planes);
+
+    mdif_morph_job_t job;
+    job.height = height;
+    job.dilate = dilate;
+    job.failed = false;
+
+    for(int c = 0; c < 4 && !job.failed; c++) {
+        if(!(channels & (1 << c))) {
+            if(src_planes[c] != dst_planes[c])
+                memcpy(dst_planes[c], src_planes[c], plane_size);
+            continue;
+        }
+
+        job.source = src_planes[c];
+        job.output = dst_planes[c];
+        job.width = job.source_stride = job.output_stride = width;
+
+        if(size_y > 1 && !inplace) {
+            job.size = size_y;
+            mdif_parallel(height, threads, mdif_morph_columns_task, &job);
+            job.source = dst_planes[c];
+        }
+
+        if(size_x > 1) {
+            job.size = size_x;
+
+            if(!job.failed)
+                mdif_parallel(height, threads, mdif_morph_rows_task, &job);
+        }
+        else if(job.source != dst_planes[c])
+            memcpy(dst_planes[c], job.source, plane_size);
+
+        if(!temporary)
+            continue;
+
+        job.size = size_y;
+        for(int x0 = 0; x0 < width && !job.failed; x0 += strip) {
+            int span = x0 + strip < width ? strip : width - x0;
+
+            for(int y = 0; y < height; y++)
+                memcpy(
+                    temporary + (size_t) y * span,
+                    dst_planes[c] + (size_t) y * width + x0,
+                    span
+                );
+
+            job.source = temporary;
+            job.output = dst_planes[c] + x0;
+            job.width = job.source_stride = span;
+
+            mdif_parallel(height, threads, mdif_morph_columns_task, &job);
+        }
+    }
+
+    #ifdef MDIF_STATIC_ARENA
+    mdif_scratch_free(temporary);
+    #else
+    mdif_mem_free(temporary);
+    #endif
+
+    return job.failed ? MDIF_ERROR_CANNOT_ALLOCATE : MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_erode(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+) {
+    return mdif_morphology(image, output, size_x, size_y, channels, false, threads);
+}
+
+mdif_error_t mdif_dilate(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+) {
+    return mdif_morphology(image, output, size_x, size_y, channels, true, threads);
+}
+
+mdif_error_t mdif_open(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+) {
+    mdif_error_t result = mdif_morphology(image, output, size_x, size_y, channels, false, threads);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    return mdif_morphology(output, output, size_x, size_y, channels, true, threads);
+}
+
+mdif_error_t mdif_close(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+) {
+    mdif_error_t result = mdif_morphology(image, output, size_x, size_y, channels, true, threads);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    return mdif_morphology(output, output, size_x, size_y, channels, false, threads);
+}
+
+static void mdif_mask_set(unsigned char* row, int x, unsigned char flags, bool set) {
+    if(flags & MDIF_MASK_PACKED) {
+        if(set)
+            row[x >> 3] |= (unsigned char) (1 << (x & 7));
+    }
+    else row[x] = set ? 255 : 0;
+}
+
+static size_t mdif_mask_stride(int width, unsigned char flags) {
+    return flags & MDIF_MASK_PACKED ? (size_t) (width + 7) / 8 : (size_t) width;
+}
+
+mdif_error_t mdif_threshold(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char level,
+    unsigned char* mask,
+    unsigned char flags
+) {
+    if(!gray || !mask)
+        return MDIF_ERROR_IMAGE;
+
+    if(width < 1)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    bool invert = (flags & MDIF_MASK_INVERT) != 0;
+    size_t stride = mdif_mask_stride(width, flags);
+
+    #ifdef MDIF_SSE2
+    __m128i bias = _mm_set1_epi8((char) 0x80),
+        limit = _mm_set1_epi8((char) (level ^ 0x80)),
+        ones = _mm_set1_epi8((char) 0xFF);
+    #endif
+
+    for(int y = 0; y < height; y++) {
+        const unsigned char* row = gray + (size_t) y * width;
+        unsigned char* out = mask + (size_t) y * stride;
+        int x = 0;
+
+        if(flags & MDIF_MASK_PACKED)
+            memset(out, 0, stride);
+
+        #ifdef MDIF_SSE2
+        for(; x + 16 <= width; x += 16) {
+            __m128i above = _mm_cmpgt_epi8(
+                _mm_xor_si128(_mm_loadu_si128((const __m128i*) (row + x)), bias),
+                limit
+            );
+
+            if(invert)
+                above = _mm_xor_si128(above, ones);
+
+            if(flags & MDIF_MASK_PACKED) {
+                int bits = _mm_movemask_epi8(above);
+
+                out[x >> 3] = (unsigned char) bits;
+                out[(x >> 3) + 1] = (unsigned char) (bits >> 8);
+            }
+            else _mm_storeu_si128((__m128i*) (out + x), above);
+        }
+        #endif
+
+        for(; x < width; x++)
+            mdif_mask_set(out, x, flags, (row[x] > level) != invert);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_threshold_otsu(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char* level
+) {
+    if(!gray || !level)
+        return MDIF_ERROR_IMAGE;
+
+    if(width < 1)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    unsigned long histogram[256];
+    memset(histogram, 0, sizeof(histogram));
+
+    size_t pixel_count = (size_t) width * height;
+    for(size_t i = 0; i < pixel_count; i++)
+        histogram[gray[i]]++;
+
+    double total = 0.0;
+    for(int i = 0; i < 256; i++)
+        total += (double) i * histogram[i];
+
+    double below_sum = 0.0, best = -1.0;
+    unsigned long below = 0;
+
+    *level = gray[0];
+    for(int t = 0; t < 255; t++) {
+        below += histogram[t];
+        below_sum += (double) t * histogram[t];
+
+        if(below == 0)
+            continue;
+
+        unsigned long above = (unsigned long) pixel_count - below;
+        if(above == 0)
+            break;
+
+        double difference = below_sum / below - (total - below_sum) / above,
+            variance = (double) below * above * difference * difference;
+
+        if(variance > best) {
+            best = variance;
+            *level = (unsigned char) t;
+        }
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_threshold_adaptive(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char size,
+    short offset,
+    unsigned char* mask,
+    unsigned char flags
+) {
+    if(!gray || !mask)
+        return MDIF_ERROR_IMAGE;
+
+    if(width < 1)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(size < 3 || !(size & 1))
+        return MDIF_ERROR_THRESHOLD;
+
+    unsigned long* columns = (unsigned long*) mdif_scratch_alloc(
+        (2 * (size_t) width + 1) * sizeof(unsigned long)
+    );
+    if(!columns)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    unsigned long* integral = columns + width;
+    memset(columns, 0, (size_t) width * sizeof(unsigned long));
+    integral[0] = 0;
+
+    int radius = size / 2;
+    long bias = mdif_clamp((long) offset, -255l, 255l);
+    bool invert = (flags & MDIF_MASK_INVERT) != 0;
+    size_t stride = mdif_mask_stride(width, flags);
+
+    for(int y = 0; y < radius && y < height; y++)
+        for(int x = 0; x < width; x++)
+            columns[x] += gray[(size_t) y * width + x];
+
+    for(int y = 0; y < height; y++) {
+        if(y + radius < height) {
+            const unsigned char* entering = gray + (size_t) (y + radius) * width;
+            for(int x = 0; x < width; x++)
+                columns[x] += entering[x];
+        }
+
+        if(y - radius - 1 >= 0) {
+            const unsigned char* leaving = gray + (size_t) (y - radius - 1) * width;
+            for(int x = 0; x < width; x++)
+                columns[x] -= leaving[x];
+        }
+
+        for(int x = 0; x < width; x++)
+            integral[x + 1] = integral[x] + columns[x];
+
+        int top = y - radius > 0 ? y - radius : 0,
+            bottom = y + radius < height - 1 ? y + radius : height - 1;
+        long rows = bottom - top + 1;
+
+        const unsigned char* row = gray + (size_t) y * width;
+        unsigned char* out = mask + (size_t) y * stride;
+
+        if(flags & MDIF_MASK_PACKED)
+            memset(out, 0, stride);
+
+        for(int x = 0; x < width; x++) {
+            int left = x - radius > 0 ? x - radius : 0,
+                right = x + radius < width - 1 ? x + radius : width - 1;
+
+            long count = rows * (right - left + 1),
+                sum = (long) (integral[right + 1] - integral[left]);
+
+            mdif_mask_set(out, x, flags, (row[x] * count > sum - bias * count) != invert);
+        }
+    }
+
+    mdif_scratch_free(columns);
+    return MDIF_ERROR_NONE;
+}
+
+typedef struct mdif_label_run_struct {
+    short start;
+    short end;
+    int slot;
+} mdif_label_run_t;
+
+typedef struct mdif_label_slot_struct {
+    int parent;
+    int live;
+    bool used;
+
+    short min_x;
+    short min_y;
+    short max_x;
+    short max_y;
+
+    unsigned long area;
+    unsigned long long sum_x;
+    unsigned long long sum_y;
+} mdif_label_slot_t;
+
+typedef struct mdif_label_state_struct {
+    mdif_label_slot_t *slots;
+    int *free_slots;
+    int slot_count;
+    int free_count;
+
+    mdif_component_t *components;
+    int max_components;
+    int stored;
+    int found;
+    unsigned long min_area;
+} mdif_label_state_t;
+
+static int mdif_mask_runs(
+    const unsigned char* row,
+    int width,
+    bool packed,
+    mdif_label_run_t* runs
+) {
+    int count = 0, x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128();
+    #endif
+
+    while(x < width) {
+        if(packed)
+            while(x < width) {
+                if(!(x & 7) && row[x >> 3] == 0)
+                    x += 8;
+                else if(!(row[x >> 3] & (1 << (x & 7))))
+                    x++;
+                else break;
+            }
+        else {
+            #ifdef MDIF_SSE2
+            while(x + 16 <= width && _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*) (row + x)), zero)) == 0xFFFF)
+                x += 16;
+            #endif
+
+            while(x < width && !row[x])
+                x++;
+        }
+
+        if(x >= width)
+            break;
+
+        int start = x;
+        if(packed)
+            while(x < width) {
+                if(!(x & 7) && x + 8 <= width && row[x >> 3] == 0xFF)
+                    x += 8;
+                else if(row[x >> 3] & (1 << (x & 7)))
+                    x++;
+                else break;
+            }
+        else {
+            #ifdef MDIF_SSE2
+            while(x + 16 <= width && _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*) (row + x)), zero)) == 0)
+                x += 16;
+            #endif
+
+            while(x < width && row[x])
+                x++;
+        }
+
+        runs[count].start = (short) start;
+        runs[count].end = (short) x;
+        count++;
+    }
+
+    return count;
+}
+
+static int mdif_label_find(mdif_label_slot_t* slots, int slot) {
+    int root = slot;
+    while(slots[root].parent != root)
+        root = slots[root].parent;
+
+    while(slots[slot].parent != root) {
+        int next = slots[slot].parent;
+        slots[slot].parent = root;
+        slot = next;
+    }
+
+    return root;
+}
+
+static int mdif_label_union(mdif_label_slot_t* slots, int a, int b) {
+    if(a == b)
+        return a;
+
+    if(b < a) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+
+    mdif_label_slot_t* root = &slots[a];
+    const mdif_label_slot_t* other = &slots[b];
+
+    root->min_x = other->min_x < root->min_x ? other->min_x : root->min_x;
+    root->min_y = other->min_y < root->min_y ? other->min_y : root->min_y;
+    root->max_x = other->max_x > root->max_x ? other->max_x : root->max_x;
+    root->max_y = other->max_y > root->max_y ? other->max_y : root->max_y;
+    root->area += other->area;
+    root->sum_x += other->sum_x;
+    root->sum_y += other->sum_y;
+
+    slots[b].parent = a;
+    return a;
+}
+
+static void mdif_label_emit(mdif_label_state_t* state, const mdif_label_slot_t* slot) {
+    if(slot->area < state->min_area)
+        return;
+
+    state->found++;
+    if(state->stored >= state->max_components)
+        return;
+
+    mdif_component_t* component = &state->components[state->stored++];
+    component->x = slot->min_x;
+    component->y = slot->min_y;
+    component->width = (short) (slot->max_x - slot->min_x + 1);
+    component->height = (short) (slot->max_y - slot->min_y + 1);
+    component->area = slot->area;
+    component->centroid_x = (float) ((double) slot->sum_x / slot->area);
+    component->centroid_y = (float) ((double) slot->sum_y / slot->area);
+}
+
+static void mdif_label_sweep(mdif_label_state_t* state, int y) {
+    state->free_count = 0;
+
+    for(int i = state->slot_count - 1; i >= 0; i--) {
+        mdif_label_slot_t* slot = &state->slots[i];
+
+        if(slot->used && slot->live != y) {
+            if(slot->parent == i)
+                mdif_label_emit(state, slot);
+
+            slot->used = false;
+        }
+
+        if(!slot->used)
+            state->free_slots[state->free_count++] = i;
+    }
+}
+
+static int mdif_compare_components(const void* a, const void* b) {
+    const mdif_component_t* first = (const mdif_component_t*) a;
+    const mdif_component_t* second = (const mdif_component_t*) b;
+
+    if(first->y != second->y)
+        return first->y - second->y;
+
+    if(first->x != second->x)
+        return first->x - second->x;
+
+    if(first->centroid_y != second->centroid_y)
+        return first->centroid_y < second->centroid_y ? -1 : 1;
+
+    if(first->centroid_x != second->centroid_x)
+        return first->centroid_x < second->centroid_x ? -1 : 1;
+
+    return first->area < second->area ? -1 : first->area > second->area;
+}
+
+mdif_error_t mdif_label(
+    const unsigned char* mask,
+    short width,
+    short height,
+    unsigned char flags,
+    unsigned char connectivity,
+    unsigned long min_area,
+    mdif_component_t* components,
+    int max_components,
+    int* count
+) {
+    if(!mask || !count || (!components && max_components > 0))
+        return MDIF_ERROR_IMAGE;
+
+    if(width < 1)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if((connectivity != 4 && connectivity != 8) || max_components < 0)
+        return MDIF_ERROR_THRESHOLD;
+
+    int max_runs = (width + 1) / 2,
+        slot_count = width + 2;
+
+    unsigned char* scratch = (unsigned char*) mdif_scratch_alloc(
+        2 * (size_t) max_runs * sizeof(mdif_label_run_t) +
+        (size_t) slot_count * (sizeof(mdif_label_slot_t) + sizeof(int))
+    );
+    if(!scratch)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    mdif_label_run_t* previous = (mdif_label_run_t*) scratch;
+    mdif_label_run_t* current = previous + max_runs;
+
+    mdif_label_state_t state;
+    state.slots = (mdif_label_slot_t*) (current + max_runs);
+    state.free_slots = (int*) (state.slots + slot_count);
+    state.slot_count = slot_count;
+    state.components = components;
+    state.max_components = max_components;
+    state.stored = 0;
+    state.found = 0;
+    state.min_area = min_area;
+
+    for(int i = 0; i < slot_count; i++)
+        state.slots[i].used = false;
+
+    mdif_label_sweep(&state, -1);
+
+    int reach = connectivity == 8 ? 1 : 0,
+        previous_count = 0;
+
+    size_t stride = mdif_mask_stride(width, flags);
+    for(int y = 0; y < height; y++) {
+        int current_count = mdif_mask_runs(
+            mask + (size_t) y * stride, width,
+            (flags & MDIF_MASK_PACKED) != 0,
+            current
+        );
+
+        for(int i = 0, j = 0; i < current_count; i++) {
+            mdif_label_run_t* run = &current[i];
+            int label = -1;
+
+            while(j < previous_count && previous[j].end + reach <= run->start)
+                j++;
+
+            for(int k = j; k < previous_count && previous[k].start < run->end + reach; k++) {
+                int root = mdif_label_find(state.slots, previous[k].slot);
+                label = label < 0 ? root : mdif_label_union(state.slots, label, root);
+            }
+
+            if(label < 0) {
+                label = state.free_slots[--state.free_count];
+
+                mdif_label_slot_t* slot = &state.slots[label];
+                slot->parent = label;
+                slot->live = -1;
+                slot->used = true;
+                slot->min_x = run->start;
+                slot->min_y = (short) y;
+                slot->max_x = (short) (run->end - 1);
+                slot->max_y = (short) y;
+                slot->area = 0;
+                slot->sum_x = 0;
+                slot->sum_y = 0;
+            }
+
+            mdif_label_slot_t* slot = &state.slots[label];
+            unsigned long length = (unsigned long) (run->end - run->start);
+
+            if(run->start < slot->min_x)
+                slot->min_x = run->start;
+
+            if(run->end - 1 > slot->max_x)
+                slot->max_x = (short) (run->end - 1);
+
+            slot->max_y = (short) y;
+            slot->area += length;
+            slot->sum_x += (unsigned long long) (run->start + run->end - 1) * length / 2;
+            slot->sum_y += (unsigned long long) y * length;
+
+            run->slot = label;
+        }
+
+        for(int i = 0; i < current_count; i++) {
+            current[i].slot = mdif_label_find(state.slots, current[i].slot);
+            state.slots[current[i].slot].live = y;
+        }
+
+        if(previous_count > 0 || current_count > 0)
+            mdif_label_sweep(&state, y);
+
+        mdif_label_run_t* swap = previous;
+        previous = current;
+        current = swap;
+        previous_count = current_count;
+    }
+
+    mdif_label_sweep(&state, height);
+    mdif_scratch_free(scratch);
+
+    if(state.stored > 1)
+        qsort(components, state.stored, sizeof(mdif_component_t), mdif_compare_components);
+
+    *count = state.found;
+    return state.found > max_components ? MDIF_ERROR_COMPONENTS : MDIF_ERROR_NONE;
+}
+
+static const unsigned char mdif_atan_octant[65] = {
+     0,  1,  1,  2,  3,  3,  4,  4,  5,  6,  6,  7,  8,  8,  9,  9,
+    10, 11, 11, 12, 12, 13, 13, 14, 15, 15, 16, 16, 17, 17, 18, 18,
+    19, 19, 20, 20, 21, 21, 22, 22, 23, 23, 24, 24, 25, 25, 25, 26,
+    26, 27, 27, 27, 28, 28, 29, 29, 29, 30, 30, 30, 31, 31, 31, 32,
+    32
+};
+
+typedef struct mdif_luma_rows_struct {
+    const mdif_t *image;
+    unsigned char *buffer;
+    int loaded;
+} mdif_luma_rows_t;
+
+static const unsigned char* mdif_luma_rows_get(mdif_luma_rows_t* rows, int y) {
+    const mdif_t* image = rows->image;
+    int width = image->width;
+
+    y = mdif_clamp(y, 0, image->height - 1);
+    if(!rows->buffer)
+        return image->red + (size_t) y * width;
+
+    unsigned char* row = rows->buffer + (size_t) (y % 3) * width;
+    if(y > rows->loaded) {
+        size_t offset = (size_t) y * width;
+
+        if(image->layout == MDIF_LAYOUT_INDEXED)
+            for(int x = 0; x < width; x++) {
+                const unsigned char* color = image->alpha + 4 * image->red[offset + x];
+                row[x] = mdif_luma(color[0], color[1], color[2]);
+            }
+        else for(int x = 0; x < width; x++)
+            row[x] = mdif_luma(
+                image->red[offset + x],
+                image->green[offset + x],
+                image->blue[offset + x]
+            );
+
+        rows->loaded = y;
+    }
+
+    return row;
+}
+
+static unsigned short mdif_isqrt(unsigned long value) {
+    unsigned long root = 0, bit = 1ul << 20;
+
+    while(bit > value)
+        bit >>= 2;
+
+    while(bit) {
+        if(value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else root >>= 1;
+
+        bit >>= 2;
+    }
+
+    return (unsigned short) root;
+}
+
+static unsigned char mdif_orientation(int gx, int gy, int ratio) {
+    int ax = gx < 0 ? -gx : gx,
+        ay = gy < 0 ? -gy : gy,
+        angle = mdif_atan_octant[ratio];
+
+    if(ay > ax)
+        angle = 64 - angle;
+
+    if(gx < 0)
+        angle = 128 - angle;
+
+    if(gy < 0)
+        angle = 256 - angle;
+
+    return (unsigned char) angle;
+}
+
+static void mdif_gradient_pixel(
+    const unsigned char* above,
+    const unsigned char* row,
+    const unsigned char* below,
+    int width,
+    int x,
+    unsigned short* magnitude,
+    unsigned char* orientation
+) {
+    int left = x > 0 ? x - 1 : 0,
+        right = x + 1 < width ? x + 1 : width - 1;
+
+    int gx = (above[right] - above[left]) + 2 * (row[right] - row[left]) + (below[right] - below[left]),
+        gy = (below[left] + 2 * below[x] + below[right]) - (above[left] + 2 * above[x] + above[right]),
+        ax = gx < 0 ? -gx : gx,
+        ay = gy < 0 ? -gy : gy,
+        low = ax < ay ? ax : ay,
+        high = ax < ay ? ay : ax;
+
+    magnitude[x] = mdif_isqrt((unsigned long) (gx * gx + gy * gy));
+    orientation[x] = high == 0 ?
+        0 : mdif_orientation(gx, gy, (low * 128 + high) / (2 * high));
+}
+
+static void mdif_gradient_row(
+    const unsigned char* above,
+    const unsigned char* row,
+    const unsigned char* below,
+    int width,
+    unsigned short* magnitude,
+    unsigned char* orientation
+) {
+    int x = 0;
+
+    mdif_gradient_pixel(above, row, below, width, x++, magnitude, orientation);
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128();
+
+    for(; x + 9 <= width; x += 8) {
+        __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (above + x - 1)), zero),
+            a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (above + x)), zero),
+            a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (above + x + 1)), zero),
+            r0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (row + x - 1)), zero),
+            r2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (row + x + 1)), zero),
+            b0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (below + x - 1)), zero),
+            b1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (below + x)), zero),
+            b2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (below + x + 1)), zero);
+
+        __m128i gx = _mm_add_epi16(
+            _mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(b2, b0)),
+            _mm_slli_epi16(_mm_sub_epi16(r2, r0), 1)
+        );
+        __m128i gy = _mm_sub_epi16(
+            _mm_add_epi16(_mm_add_epi16(b0, b2), _mm_slli_epi16(b1, 1)),
+            _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_slli_epi16(a1, 1))
+        );
+
+        __m128i lo = _mm_unpacklo_epi16(gx, gy),
+            hi = _mm_unpackhi_epi16(gx, gy);
+        __m128i squares_lo = _mm_madd_epi16(lo, lo),
+            squares_hi = _mm_madd_epi16(hi, hi);
+
+        _mm_storeu_si128((__m128i*) (magnitude + x), _mm_packs_epi32(
+            _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(squares_lo))),
+            _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(squares_hi)))
+        ));
+
+        __m128i ax = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx)),
+            ay = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+        __m128i low = _mm_min_epi16(ax, ay),
+            high = _mm_max_epi16(_mm_max_epi16(ax, ay), _mm_set1_epi16(1));
+
+        __m128 low_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)),
+            low_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)),
+            high_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)),
+            high_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)),
+            scale = _mm_set1_ps(128.0f);
+
+        __m128i ratio = _mm_packs_epi32(
+            _mm_cvttps_epi32(_mm_div_ps(
+                _mm_add_ps(_mm_mul_ps(low_lo, scale), high_lo),
+                _mm_add_ps(high_lo, high_lo)
+            )),
+            _mm_cvttps_epi32(_mm_div_ps(
+                _mm_add_ps(_mm_mul_ps(low_hi, scale), high_hi),
+                _mm_add_ps(high_hi, high_hi)
+            ))
+        );
+
+        short gxs[8], gys[8], ratios[8];
+        _mm_storeu_si128((__m128i*) gxs, gx);
+        _mm_storeu_si128((__m128i*) gys, gy);
+        _mm_storeu_si128((__m128i*) ratios, ratio);
+
+        for(int i = 0; i < 8; i++)
+            orientation[x + i] = gxs[i] == 0 && gys[i] == 0 ?
+                0 : mdif_orientation(gxs[i], gys[i], ratios[i]);
+    }
+    #endif
+
+    for(; x < width; x++)
+        mdif_gradient_pixel(above, row, below, width, x, magnitude, orientation);
+}
+
+mdif_error_t mdif_gradients(const mdif_t* image, unsigned short* magnitude, unsigned char* orientation) {
+    if(!image || !image->red || !magnitude || !orientation)
+        return MDIF_ERROR_IMAGE;
+
+    int width = image->width, height = image->height;
+
+    mdif_luma_rows_t rows;
+    rows.image = image;
+    rows.buffer = NULL;
+    rows.loaded = -1;
+
+    if(image->layout == MDIF_LAYOUT_RGBA || image->layout == MDIF_LAYOUT_INDEXED) {
+        rows.buffer = (unsigned char*) mdif_scratch_alloc(3 * (size_t) width);
+        if(!rows.buffer)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    for(int y = 0; y < height; y++) {
+        const unsigned char* above = mdif_luma_rows_get(&rows, y - 1);
+        const unsigned char* row = mdif_luma_rows_get(&rows, y);
+        const unsigned char* below = mdif_luma_rows_get(&rows, y + 1);
+
+        mdif_gradient_row(
+            above, row, below, width,
+            magnitude + (size_t) y * width,
+            orientation + (size_t) y * width
+        );
+    }
+
+    if(rows.buffer)
+        mdif_scratch_free(rows.buffer);
+
+    return MDIF_ERROR_NONE;
+}
+
+unsigned long mdif_hog_size(short width, short height, unsigned char cell, unsigned char block, unsigned char bins) {
+    if(cell < 1 || cell > MDIF_HOG_MAX_CELL || block < 1 || bins < 2 || width < 1 || height < 1)
+        return 0;
+
+    int cells_x = width / cell,
+        cells_y = height / cell;
+
+    if(cells_x < block || cells_y < block)
+        return 0;
+
+    return (unsigned long) (cells_x - block + 1) * (cells_y - block + 1) *
+        block * block * bins;
+}
+
+static void mdif_hog_normalize(float* values, int count) {
+    for(int pass = 0; pass < 2; pass++) {
+        float sum = 1e-10f;
+        for(int i = 0; i < count; i++)
+            sum += values[i] * values[i];
+
+        float scale = 1.0f / sqrtf(sum);
+        for(int i = 0; i < count; i++) {
+            values[i] *= scale;
+
+            if(pass == 0 && values[i] > 0.2f)
+                values[i] = 0.2f;
+        }
+    }
+}
+
+mdif_error_t mdif_hog(
+    const mdif_t* image,
+    unsigned char cell,
+    unsigned char block,
+    unsigned char bins,
+    float* out
+) {
+    if(!image || !image->red || !out)
+        return MDIF_ERROR_IMAGE;
+
+    int width = image->width,
+        height = image->height;
+
+    if(mdif_hog_size(width, height, cell, block, bins) == 0)
+        return MDIF_ERROR_FEATURE;
+
+    int cells_x = width / cell,
+        cells_y = height / cell,
+        blocks_x = cells_x - block + 1,
+        block_size = block * block * bins;
+
+    bool ycbcr = image->layout == MDIF_LAYOUT_YCBCR444 || image->layout == MDIF_LAYOUT_YCBCR420;
+    size_t luma_size = ycbcr ? 0 : 3 * (size_t) width,
+        histogram_size = (size_t) block * cells_x * bins * sizeof(unsigned long),
+        row_size = ((size_t) width * sizeof(unsigned short) + width + 3) & ~(size_t) 3;
+
+    unsigned char* scratch = (unsigned char*) mdif_scratch_alloc(histogram_size + row_size + luma_size);
+    if(!scratch)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    unsigned long* histograms = (unsigned long*) scratch;
+    unsigned short* magnitude = (unsigned short*) (scratch + histogram_size);
+    unsigned char* orientation = (unsigned char*) (magnitude + width);
+
+    mdif_luma_rows_t rows;
+    rows.image = image;
+    rows.buffer = ycbcr ? NULL : scratch + histogram_size + row_size;
+    rows.loaded = -1;
+
+    unsigned char first_bin[128], second_bin[128];
+    unsigned short weight[128];
+
+    for(int angle = 0; angle < 128; angle++) {
+        int position = angle * bins * 2 + 128,
+            bin = (position >> 8) - 1;
+
+        first_bin[angle] = (unsigned char) (bin < 0 ? bins - 1 : bin);
+        second_bin[angle] = (unsigned char) (bin + 1 < bins ? bin + 1 : 0);
+        weight[angle] = (unsigned short) (position & 255);
+    }
+
+    float scale = 1.0f / (256.0f * 255.0f);
+    for(int cy = 0; cy < cells_y; cy++) {
+        unsigned long* ring = histograms + (size_t) (cy % block) * cells_x * bins;
+        memset(ring, 0, (size_t) cells_x * bins * sizeof(unsigned long));
+
+        for(int y = cy * cell; y < (cy + 1) * cell; y++) {
+            const unsigned char* above = mdif_luma_rows_get(&rows, y - 1);
+            const unsigned char* row = mdif_luma_rows_get(&rows, y);
+            const unsigned char* below = mdif_luma_rows_get(&rows, y + 1);
+
+            mdif_gradient_row(above, row, below, width, magnitude, orientation);
+
+            for(int cx = 0, x = 0; cx < cells_x; cx++) {
+                unsigned long* histogram = ring + (size_t) cx * bins;
+
+                for(int end = x + cell; x < end; x++) {
+                    int angle = orientation[x] & 127;
+                    unsigned long value = magnitude[x],
+                        upper = value * weight[angle];
+
+                    histogram[first_bin[angle]] += (value << 8) - upper;
+                    histogram[second_bin[angle]] += upper;
+                }
+            }
+        }
+
+        if(cy < block - 1)
+            continue;
+
+        int by = cy - block + 1;
+        for(int bx = 0; bx < blocks_x; bx++) {
+            float* values = out + ((size_t) by * blocks_x + bx) * block_size;
+
+            for(int i = 0; i < block; i++) {
+                const unsigned long* source = histograms +
+                    ((size_t) ((by + i) % block) * cells_x + bx) * bins;
+
+                for(int j = 0; j < block * bins; j++)
+                    *values++ = (float) source[j] * scale;
+            }
+
+            mdif_hog_normalize(values - block_size, block_size);
+        }
+    }
+
+    mdif_scratch_free(scratch);
+    return MDIF_ERROR_NONE;
+}
+
+static unsigned long long mdif_random_next(unsigned long long* state) {
+    unsigned long long value = (*state += 0x9E3779B97F4A7C15ull);
+
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+static float mdif_random_float(unsigned long long* state) {
+    return (float) (mdif_random_next(state) >> 40) / (float) (1ull << 24);
+}
+
+static float mdif_random_range(unsigned long long* state, float min, float max) {
+    return min + (max - min) * mdif_random_float(state);
+}
+
+static void mdif_affine_then(double* matrix, const double* step) {
+    double result[6] = {
+        matrix[0] * step[0] + matrix[1] * step[3],
+        matrix[0] * step[1] + matrix[1] * step[4],
+        matrix[0] * step[2] + matrix[1] * step[5] + matrix[2],
+        matrix[3] * step[0] + matrix[4] * step[3],
+        matrix[3] * step[1] + matrix[4] * step[4],
+        matrix[3] * step[2] + matrix[4] * step[5] + matrix[5]
+    };
+
+    memcpy(matrix, result, sizeof(result));
+}
+
+static void mdif_color_then(float* color, const float* step) {
+    float result[12];
+
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 4; j++)
+            result[i * 4 + j] =
+                step[i * 4] * color[j] +
+                step[i * 4 + 1] * color[4 + j] +
+                step[i * 4 + 2] * color[8 + j];
+
+        result[i * 4 + 3] += step[i * 4 + 3];
+    }
+
+    memcpy(color, result, sizeof(result));
+}
+
+typedef struct mdif_augment_plan_struct {
+    double matrix[6];
+    int color[12];
+
+    bool nearest;
+    bool recolor;
+} mdif_augment_plan_t;
+
+static void mdif_augment_prepare(
+    const mdif_t* image,
+    const mdif_t* output,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed,
+    mdif_augment_plan_t* plan
+) {
+    unsigned long long state = seed;
+    double* matrix = plan->matrix;
+    double width = image->width, height = image->height;
+    bool rotated = false;
+
+    float color[12] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f
+    };
+
+    matrix[0] = 1.0; matrix[1] = 0.0; matrix[2] = 0.0;
+    matrix[3] = 0.0; matrix[4] = 1.0; matrix[5] = 0.0;
+    plan->recolor = false;
+
+    for(int i = 0; i < op_count; i++) {
+        const mdif_augment_op_t* op = &ops[i];
+        float amount = mdif_random_range(&state, op->min, op->max);
+        unsigned long long choice = mdif_random_next(&state);
+
+        if(mdif_random_float(&state) >= op->probability)
+            continue;
+
+        switch(op->type) {
+            case MDIF_AUGMENT_CROP: {
+                amount = mdif_clamp(amount, 0.0f, 1.0f);
+
+                double crop_width = floor(width * amount + 0.5),
+                    crop_height = floor(height * amount + 0.5);
+
+                if(crop_width < 1.0)
+                    crop_width = 1.0;
+                if(crop_height < 1.0)
+                    crop_height = 1.0;
+
+                double step[6] = {
+                    1.0, 0.0, floor(mdif_random_float(&state) * (width - crop_width + 1.0)),
+                    0.0, 1.0, floor(mdif_random_float(&state) * (height - crop_height + 1.0))
+                };
+
+                mdif_affine_then(matrix, step);
+                width = crop_width;
+                height = crop_height;
+                break;
+            }
+
+            case MDIF_AUGMENT_FLIP_HORIZONTAL: {
+                double step[6] = {-1.0, 0.0, width - 1.0, 0.0, 1.0, 0.0};
+                mdif_affine_then(matrix, step);
+                break;
+            }
+
+            case MDIF_AUGMENT_FLIP_VERTICAL: {
+                double step[6] = {1.0, 0.0, 0.0, 0.0, -1.0, height - 1.0};
+                mdif_affine_then(matrix, step);
+                break;
+            }
+
+            case MDIF_AUGMENT_ROTATE_90: {
+                int turns = (int) (choice % 3) + 1;
+                double swap;
+
+                if(turns == 1) {
+                    double step[6] = {0.0, 1.0, 0.0, -1.0, 0.0, height - 1.0};
+                    mdif_affine_then(matrix, step);
+                }
+                else if(turns == 2) {
+                    double step[6] = {-1.0, 0.0, width - 1.0, 0.0, -1.0, height - 1.0};
+                    mdif_affine_then(matrix, step);
+                }
+                else {
+                    double step[6] = {0.0, -1.0, width - 1.0, 1.0, 0.0, 0.0};
+                    mdif_affine_then(matrix, step);
+                }
+
+                if(turns != 2) {
+                    swap = width;
+                    width = height;
+                    height = swap;
+                }
+                break;
+            }
+
+            case MDIF_AUGMENT_AFFINE: {
+                double angle = amount * 3.14159265358979323846 / 180.0,
+                    cosine = cos(angle),
+                    sine = sin(angle),
+                    center_x = (width - 1.0) / 2.0,
+                    center_y = (height - 1.0) / 2.0;
+
+                double step[6] = {
+                    cosine, -sine, center_x - cosine * center_x + sine * center_y,
+                    sine, cosine, center_y - sine * center_x - cosine * center_y
+                };
+
+                mdif_affine_then(matrix, step);
+                rotated = true;
+                break;
+            }
+
+            case MDIF_AUGMENT_BRIGHTNESS: {
+                float step[12] = {
+                    amount, 0.0f, 0.0f, 0.0f,
+                    0.0f, amount, 0.0f, 0.0f,
+                    0.0f, 0.0f, amount, 0.0f
+                };
+
+                mdif_color_then(color, step);
+                plan->recolor = true;
+                break;
+            }
+
+            case MDIF_AUGMENT_CONTRAST: {
+                float offset = 128.0f * (1.0f - amount);
+                float step[12] = {
+                    amount, 0.0f, 0.0f, offset,
+                    0.0f, amount, 0.0f, offset,
+                    0.0f, 0.0f, amount, offset
+                };
+
+                mdif_color_then(color, step);
+                plan->recolor = true;
+                break;
+            }
+
+            case MDIF_AUGMENT_SATURATION: {
+                float gray = 1.0f - amount;
+                float step[12] = {
+                    gray * 0.299f + amount, gray * 0.587f, gray * 0.114f, 0.0f,
+                    gray * 0.299f, gray * 0.587f + amount, gray * 0.114f, 0.0f,
+                    gray * 0.299f, gray * 0.587f, gray * 0.114f + amount, 0.0f
+                };
+
+                mdif_color_then(color, step);
+                plan->recolor = true;
+                break;
+            }
+        }
+    }
+
+    double scale_x = width / output->width,
+        scale_y = height / output->height;
+
+    double step[6] = {
+        scale_x, 0.0, 0.5 * scale_x - 0.5,
+        0.0, scale_y, 0.5 * scale_y - 0.5
+    };
+    mdif_affine_then(matrix, step);
+
+    plan->nearest = !rotated &&
+        scale_x == 1.0 &&
+        scale_y == 1.0;
+
+    for(int i = 0; i < 12; i++)
+        plan->color[i] = (int) lrintf(color[i] * 4096.0f);
+}
+
+static void mdif_augment_apply(
+    const mdif_t* image,
+    mdif_t* output,
+    const mdif_augment_plan_t* plan
+) {
+    int width = image->width,
+        height = image->height;
+
+    unsigned char* src[4];
+    unsigned char* dst[4];
+    mdif_planes(image, src);
+    mdif_planes(output, dst);
+
+    const double* m = plan->matrix;
+    long limit_x = (long) width << 16,
+        limit_y = (long) height << 16;
+
+    for(int y = 0; y < output->height; y++) {
+        size_t row = (size_t) y * output->width;
+
+        long sx = lround((m[1] * y + m[2] + 0.5) * 65536.0),
+            sy = lround((m[4] * y + m[5] + 0.5) * 65536.0),
+            dx = lround(m[0] * 65536.0),
+            dy = lround(m[3] * 65536.0);
+
+        for(int x = 0; x < output->width; x++, sx += dx, sy += dy) {
+            size_t index = row + x;
+
+            if(sx < 0 || sy < 0 || sx >= limit_x || sy >= limit_y) {
+                dst[0][index] = dst[1][index] = dst[2][index] = dst[3][index] = 0;
+                continue;
+            }
+
+            if(plan->nearest) {
+                size_t source = (size_t) (sy >> 16) * width + (sx >> 16);
+
+                for(int c = 0; c < 4; c++)
+                    dst[c][index] = src[c][source];
+            }
+            else {
+                long px = sx - 32768, py = sy - 32768;
+                int x0 = (int) (px >> 16), y0 = (int) (py >> 16),
+                    fx = (int) ((px >> 8) & 0xFF), fy = (int) ((py >> 8) & 0xFF);
+
+                int x1 = mdif_clamp(x0 + 1, 0, width - 1),
+                    y1 = mdif_clamp(y0 + 1, 0, height - 1);
+
+                x0 = mdif_clamp(x0, 0, width - 1);
+                y0 = mdif_clamp(y0, 0, height - 1);
+
+                size_t top = (size_t) y0 * width, bottom = (size_t) y1 * width;
+                for(int c = 0; c < 4; c++) {
+                    int upper = src[c][top + x0] * (256 - fx) + src[c][top + x1] * fx,
+                        lower = src[c][bottom + x0] * (256 - fx) + src[c][bottom + x1] * fx;
+
+                    dst[c][index] = (unsigned char) ((upper * (256 - fy) + lower * fy + 32768) >> 16);
+                }
+            }
+
+            if(plan->recolor) {
+                int r = dst[0][index], g = dst[1][index], b = dst[2][index];
+
+                for(int c = 0; c < 3; c++) {
+                    const int* k = plan->color + c * 4;
+                    int value = (k[0] * r + k[1] * g + k[2] * b + k[3] + 2048) >> 12;
+
+                    dst[c][index] = (unsigned char) mdif_clamp(value, 0, 255);
+                }
+            }
+        }
+    }
+}
+
+static unsigned long long mdif_augment_seed(unsigned long long seed, int index) {
+    unsigned long long state = seed ^ ((unsigned long long) index * 0xD1B54A32D192ED03ull);
+    return mdif_random_next(&state);
+}
+
+mdif_error_t mdif_augment(
+    const mdif_t* image,
+    mdif_t* output,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed
+) {
+    if(!image || !output || !image->red || !output->red || image->red == output->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA || output->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    if(op_count < 0 || (op_count > 0 && !ops))
+        return MDIF_ERROR_AUGMENT;
+
+    mdif_augment_plan_t plan;
+    mdif_augment_prepare(image, output, ops, op_count, mdif_augment_seed(seed, 0), &plan);
+    mdif_augment_apply(image, output, &plan);
+
+    return MDIF_ERROR_NONE;
+}
+
+typedef struct mdif_augment_job_struct {
+    const mdif_t *images;
+    const char* const *filenames;
+    mdif_pool_t *pool;
+
+    mdif_t *outputs;
+    const mdif_augment_op_t *ops;
+    int op_count;
+    unsigned long long seed;
+
+    volatile mdif_error_t result;
+} mdif_augment_job_t;
+
+static void mdif_augment_task(void* context, int begin, int end) {
+    mdif_augment_job_t* job = (mdif_augment_job_t*) context;
+    mdif_augment_plan_t plan;
+
+    mdif_t image;
+    image.red = image.green = image.blue = image.alpha = NULL;
+    image.capacity = 0;
+    image.pool = job->pool;
+
+    for(int i = begin; i < end; i++) {
+        const mdif_t* source = job->images ? &job->images[i] : &image;
+
+        if(job->filenames) {
+            mdif_error_t result = mdif_read_into(job->filenames[i], &image);
+            if(result == MDIF_ERROR_NONE && image.layout != MDIF_LAYOUT_RGBA)
+                result = MDIF_ERROR_LAYOUT;
+
+            if(result != MDIF_ERROR_NONE) {
+                job->result = result;
+                continue;
+            }
+        }
+
+        mdif_augment_prepare(
+            source, &job->outputs[i],
+            job->ops, job->op_count,
+            mdif_augment_seed(job->seed, i),
+            &plan
+        );
+        mdif_augment_apply(source, &job->outputs[i], &plan);
+    }
+
+    if(image.red)
+        mdif_free(&image);
+}
+
+mdif_error_t mdif_augment_batch(
+    const mdif_t* images,
+    mdif_t* outputs,
+    int count,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed,
+    int threads
+) {
+    if(!images || !outputs || count < 0)
+        return MDIF_ERROR_IMAGE;
+
+    if(op_count < 0 || (op_count > 0 && !ops))
+        return MDIF_ERROR_AUGMENT;
+
+    for(int i = 0; i < count; i++) {
+        if(!images[i].red || !outputs[i].red || images[i].red == outputs[i].red)
+            return MDIF_ERROR_IMAGE;
+
+        if(images[i].layout != MDIF_LAYOUT_RGBA || outputs[i].layout != MDIF_LAYOUT_RGBA)
+            return MDIF_ERROR_LAYOUT;
+    }
+
+    mdif_augment_job_t job = {
+        images, NULL, NULL,
+        outputs, ops, op_count, seed,
+        MDIF_ERROR_NONE
+    };
+
+    mdif_parallel(count, threads, mdif_augment_task, &job);
+    return job.result;
+}
+
+mdif_error_t mdif_augment_files(
+    const char* const* filenames,
+    mdif_t* outputs,
+    int count,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed,
+    mdif_pool_t* pool,
+    int threads
+) {
+    if(!filenames || !outputs || count < 0)
+        return MDIF_ERROR_IMAGE;
+
+    if(op_count < 0 || (op_count > 0 && !ops))
+        return MDIF_ERROR_AUGMENT;
+
+    for(int i = 0; i < count; i++) {
+        if(!outputs[i].red)
+            return MDIF_ERROR_IMAGE;
+
+        if(outputs[i].layout != MDIF_LAYOUT_RGBA)
+            return MDIF_ERROR_LAYOUT;
+    }
+
+    if(pool && !(pool->flags & MDIF_POOL_THREAD_SAFE) && mdif_thread_count(threads) > 1)
+        return MDIF_ERROR_POOL;
+
+    mdif_augment_job_t job = {
+        NULL, filenames, pool,
+        outputs, ops, op_count, seed,
+        MDIF_ERROR_NONE
+    };
+
+    mdif_parallel(count, threads, mdif_augment_task, &job);
+    return job.result;
+}
+
+static void mdif_histogram_accumulate(const unsigned char* plane, size_t count, unsigned int* partial) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        unsigned int low, high;
+
+        memcpy(&low, plane + i, 4);
+        memcpy(&high, plane + i + 4, 4);
+
+        partial[low & 0xFF]++;
+        partial[256 + ((low >> 8) & 0xFF)]++;
+        partial[512 + ((low >> 16) & 0xFF)]++;
+        partial[768 + (low >> 24)]++;
+
+        partial[high & 0xFF]++;
+        partial[256 + ((high >> 8) & 0xFF)]++;
+        partial[512 + ((high >> 16) & 0xFF)]++;
+        partial[768 + (high >> 24)]++;
+    }
+
+    for(; i < count; i++)
+        partial[plane[i]]++;
+}
+
+static void mdif_histogram_sum(const unsigned int* partial, unsigned long* counts) {
+    for(int value = 0; value < 256; value++)
+        counts[value] = (unsigned long) partial[value] +
+            partial[256 + value] +
+            partial[512 + value] +
+            partial[768 + value];
+}
+
+static void mdif_histogram_plane(
+    const unsigned char* plane,
+    size_t count,
+    unsigned int* partial,
+    unsigned long* counts
+) {
+    memset(partial, 0, 4 * 256 * sizeof(unsigned int));
+    mdif_histogram_accumulate(plane, count, partial);
+    mdif_histogram_sum(partial, counts);
+}
+
+mdif_error_t mdif_histogram(const mdif_t* image, mdif_histogram_t* histogram) {
+    if(!image || !image->red || !histogram)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    unsigned int* partial = (unsigned int*) mdif_scratch_alloc(4 * 256 * sizeof(unsigned int));
+    if(!partial)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    unsigned char* planes[4];
+    mdif_planes(image, planes);
+
+    size_t pixel_count = (size_t) image->width * image->height;
+    for(int c = 0; c < 4; c++)
+        mdif_histogram_plane(planes[c], pixel_count, partial, histogram->counts[c]);
+
+    mdif_scratch_free(partial);
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_stats_init(mdif_stats_t* stats) {
+    memset(stats, 0, sizeof(mdif_stats_t));
+}
+
+mdif_error_t mdif_stats(const mdif_t* image, mdif_stats_t* stats) {
+    if(!stats)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_histogram_t histogram;
+    mdif_error_t result = mdif_histogram(image, &histogram);
+
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    for(int c = 0; c < 4; c++)
+        for(int value = 0; value < 256; value++)
+            stats->counts[c][value] += histogram.counts[c][value];
+
+    stats->images++;
+    stats->pixels += (unsigned long long) image->width * image->height;
+
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_stats_merge(mdif_stats_t* stats, const mdif_stats_t* other) {
+    for(int c = 0; c < 4; c++)
+        for(int value = 0; value < 256; value++)
+            stats->counts[c][value] += other->counts[c][value];
+
+    stats->images += other->images;
+    stats->pixels += other->pixels;
+}
+
+mdif_error_t mdif_stats_summary(const mdif_stats_t* stats, int channel, mdif_summary_t* summary) {
+    if(!stats || !summary || channel < 0 || channel > 3)
+        return MDIF_ERROR_IMAGE;
+
+    const unsigned long long* counts = stats->counts[channel];
+    double total = 0.0, sum = 0.0, squares = 0.0;
+
+    summary->min = 255;
+    summary->max = 0;
+
+    for(int value = 0; value < 256; value++) {
+        if(!counts[value])
+            continue;
+
+        if(value < summary->min)
+            summary->min = (unsigned char) value;
+        summary->max = (unsigned char) value;
+
+        total += (double) counts[value];
+        sum += (double) counts[value] * value;
+        squares += (double) counts[value] * value * value;
+    }
+
+    if(total == 0.0) {
+        summary->min = summary->max = 0;
+        summary->mean = summary->stddev = 0.0;
+
+        return MDIF_ERROR_NONE;
+    }
+
+    summary->mean = sum / total;
+
+    double variance = squares / total - summary->mean * summary->mean;
+    summary->stddev = variance > 0.0 ? sqrt(variance) : 0.0;
+
+    return MDIF_ERROR_NONE;
+}
+
+typedef struct mdif_stats_job_struct {
+    const char* const *filenames;
+    mdif_stats_t *stats;
+    void *lock;
+
+    volatile mdif_error_t result;
+} mdif_stats_job_t;
+
+static void mdif_stats_task(void* context, int begin, int end) {
+    mdif_stats_job_t* job = (mdif_stats_job_t*) context;
+    mdif_stats_t* local = (mdif_stats_t*) mdif_scratch_alloc(sizeof(mdif_stats_t));
+
+    if(!local) {
+        job->result = MDIF_ERROR_CANNOT_ALLOCATE;
+        return;
+    }
+
+    mdif_t image;
+    image.red = image.green = image.blue = image.alpha = NULL;
+    image.capacity = 0;
+    image.pool = NULL;
+
+    mdif_stats_init(local);
+    for(int i = begin; i < end; i++) {
+        mdif_error_t result = mdif_read_into(job->filenames[i], &image);
+
+        if(result == MDIF_ERROR_NONE)
+            result = mdif_stats(&image, local);
+
+        if(result != MDIF_ERROR_NONE)
+            job->result = result;
+    }
+
+    if(image.red)
+        mdif_free(&image);
+
+    mdif_lock_acquire(job->lock);
+    mdif_stats_merge(job->stats, local);
+    mdif_lock_release(job->lock);
+
+    mdif_scratch_free(local);
+}
+
+mdif_error_t mdif_stats_files(
+    const char* const* filenames,
+    int count,
+    mdif_stats_t* stats,
+    int threads
+) {
+    if((!filenames && count > 0) || count < 0 || !stats)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_stats_job_t job = {filenames, stats, NULL, MDIF_ERROR_NONE};
+    if(mdif_thread_count(threads) > 1) {
+        job.lock = mdif_lock_create();
+
+        if(!job.lock)
+            threads = 1;
+    }
+
+    mdif_parallel(count, threads, mdif_stats_task, &job);
+    mdif_lock_destroy(job.lock);
+
+    return job.result;
+}
+
+#ifndef ARDUINO
+
+mdif_error_t mdif_stats_save(const char* filename, const mdif_stats_t* stats) {
+    FILE* file = fopen(filename, "w");
+    if(!file)
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    bool failed = fprintf(file, "mdif_stats 1\n%llu %llu\n", stats->images, stats->pixels) < 0;
+    for(int c = 0; c < 4 && !failed; c++)
+        for(int value = 0; value < 256 && !failed; value++)
+            failed = fprintf(
+                file, "%llu%c",
+                stats->counts[c][value],
+                value == 255 ? '\n' : ' '
+            ) < 0;
+
+    if(fclose(file) != 0 || failed)
+        return MDIF_ERROR_WRITE;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_stats_load(const char* filename, mdif_stats_t* stats) {
+    FILE* file = fopen(filename, "r");
+    if(!file)
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    int version = 0;
+    if(fscanf(file, "mdif_stats %d", &version) != 1 || version != 1 ||
+        fscanf(file, "%llu %llu", &stats->images, &stats->pixels) != 2) {
+        fclose(file);
+        return MDIF_ERROR_READ;
+    }
+
+    for(int c = 0; c < 4; c++)
+        for(int value = 0; value < 256; value++)
+            if(fscanf(file, "%llu", &stats->counts[c][value]) != 1) {
+                fclose(file);
+                return MDIF_ERROR_READ;
+            }
+
+    fclose(file);
+    return MDIF_ERROR_NONE;
+}
+
+#endif
+
+typedef struct mdif_tile_struct {
+    mdif_rect_t rect;
+    int stride;
+    unsigned char *planes[4];
+} mdif_tile_t;
+
+typedef struct mdif_pipeline_stage_struct {
+    mdif_pipeline_type_t type;
+
+    int in_width;
+    int in_height;
+    int out_width;
+    int out_height;
+
+    mdif_convolve_job_t convolve;
+} mdif_pipeline_stage_t;
+
+typedef struct mdif_pipeline_job_struct {
+    const mdif_t *image;
+    mdif_t *output;
+
+    float *values;
+    unsigned char channels;
+    float lut[4][256];
+
+    int count;
+    mdif_pipeline_stage_t stages[MDIF_PIPELINE_MAX_OPS];
+
+    int tiles_x;
+    int max_width;
+    int max_height;
+    size_t max_area[MDIF_PIPELINE_MAX_OPS];
+
+    volatile bool failed;
+} mdif_pipeline_job_t;
+
+static const unsigned char* mdif_tile_row(const mdif_tile_t* tile, int c, int y) {
+    return tile->planes[c] + (size_t) (y - tile->rect.y) * tile->stride - tile->rect.x;
+}
+
+static void mdif_border_span(int first, int last, int size, mdif_border_t border, int* low, int* high) {
+    if(first >= 0 && last <= size) {
+        *low = first;
+        *high = last;
+        return;
+    }
+
+    *low = size;
+    *high = 0;
+
+    for(int i = first; i < last; i++) {
+        int index = mdif_border_index(i, size, border);
+        if(index < 0)
+            continue;
+
+        if(index < *low)
+            *low = index;
+        if(index + 1 > *high)
+            *high = index + 1;
+    }
+}
+
+static int mdif_resize_coord(int x, int in_size, int out_size, int* fraction) {
+    long long position = ((long long) (2 * x + 1) * in_size << 15) / out_size - 32768;
+    if(position < 0)
+        position = 0;
+
+    int index = (int) (position >> 16);
+    *fraction = (int) (position >> 8) & 255;
+
+    if(index >= in_size - 1) {
+        index = in_size - 1;
+        *fraction = 0;
+    }
+
+    return index;
+}
+
+static mdif_rect_t mdif_pipeline_source_rect(const mdif_pipeline_stage_t* stage, mdif_rect_t rect) {
+    mdif_rect_t source = rect;
+    int low, high, fraction;
+
+    switch(stage->type) {
+        case MDIF_PIPELINE_ANTIALIAS:
+            mdif_border_span(rect.x - 1, rect.x + rect.width + 1, stage->in_width, MDIF_BORDER_CLAMP, &low, &high);
+            source.x = low;
+            source.width = high - low;
+
+            mdif_border_span(rect.y - 1, rect.y + rect.height + 1, stage->in_height, MDIF_BORDER_CLAMP, &low, &high);
+            source.y = low;
+            source.height = high - low;
+            break;
+
+        case MDIF_PIPELINE_CONVOLVE: {
+            const mdif_convolve_job_t* job = &stage->convolve;
+            int radius_x = job->size_x / 2, radius_y = job->size_y / 2;
+
+            mdif_border_span(
+                rect.x - radius_x, rect.x + rect.width + radius_x,
+                stage->in_width, job->border, &low, &high
+            );
+            source.x = low;
+            source.width = high - low;
+
+            mdif_border_span(
+                rect.y - radius_y, rect.y + rect.height + radius_y,
+                stage->in_height, job->border, &low, &high
+            );
+            source.y = low;
+            source.height = high - low;
+            break;
+        }
+
+        case MDIF_PIPELINE_RESIZE:
+            low = mdif_resize_coord(rect.x, stage->in_width, stage->out_width, &fraction);
+            high = mdif_resize_coord(rect.x + rect.width - 1, stage->in_width, stage->out_width, &fraction) + 2;
+            source.x = low;
+            source.width = (high < stage->in_width ? high : stage->in_width) - low;
+
+            low = mdif_resize_coord(rect.y, stage->in_height, stage->out_height, &fraction);
+            high = mdif_resize_coord(rect.y + rect.height - 1, stage->in_height, stage->out_height, &fraction) + 2;
+            source.y = low;
+            source.height = (high < stage->in_height ? high : stage->in_height) - low;
+            break;
+
+        default:
+            break;
+    }
+
+    return source;
+}
+
+static mdif_rect_t mdif_pipeline_tile_rect(const mdif_pipeline_job_t* job, int index) {
+    mdif_rect_t rect;
+    int width = job->count ? job->stages[job->count - 1].out_width : job->image->width,
+        height = job->count ? job->stages[job->count - 1].out_height : job->image->height;
+
+    rect.x = (index % job->tiles_x) * MDIF_PIPELINE_TILE;
+    rect.y = (index / job->tiles_x) * MDIF_PIPELINE_TILE;
+    rect.width = width - rect.x < MDIF_PIPELINE_TILE ? width - rect.x : MDIF_PIPELINE_TILE;
+    rect.height = height - rect.y < MDIF_PIPELINE_TILE ? height - rect.y : MDIF_PIPELINE_TILE;
+
+    return rect;
+}
+
+static void mdif_pipeline_antialias_tile(
+    const mdif_pipeline_stage_t* stage,
+    const mdif_tile_t* in,
+    mdif_tile_t* out
+) {
+    const mdif_rect_t* rect = &out->rect;
+    int width = stage->in_width, height = stage->in_height;
+
+    for(int y = rect->y; y < rect->y + rect->height; y++) {
+        int above = mdif_clamp(y - 1, 0, height - 1),
+            below = mdif_clamp(y + 1, 0, height - 1);
+        unsigned char* dst_alpha = out->planes[3] + (size_t) (y - rect->y) * out->stride;
+
+        for(int c = 0; c < 3; c++) {
+            const unsigned char* top = mdif_tile_row(in, c, above);
+            const unsigned char* row = mdif_tile_row(in, c, y);
+            const unsigned char* bottom = mdif_tile_row(in, c, below);
+            unsigned char* dst = out->planes[c] + (size_t) (y - rect->y) * out->stride;
+
+            int x = rect->x,
+                previous = x > 0 ? x - 1 : 0,
+                left = top[previous] + row[previous] + bottom[previous],
+                center = top[x] + row[x] + bottom[x];
+
+            for(int i = 0; i < rect->width; i++, x++) {
+                int right = x + 1 < width ?
+                    top[x + 1] + row[x + 1] + bottom[x + 1] :
+                    center;
+
+                dst[i] = (unsigned char) ((left + center + right) / 9);
+                left = center;
+                center = right;
+            }
+        }
+
+        memcpy(dst_alpha, mdif_tile_row(in, 3, y) + rect->x, rect->width);
+    }
+}
+
+static void mdif_pipeline_pad(
+    const mdif_tile_t* in,
+    int c,
+    int y,
+    int first,
+    int count,
+    int width,
+    mdif_border_t border,
+    unsigned char* padded
+) {
+    const unsigned char* row = mdif_tile_row(in, c, y);
+
+    if(first >= 0 && first + count <= width)
+        memcpy(padded, row + first, count);
+    else for(int i = 0; i < count; i++) {
+        int x = mdif_border_index(first + i, width, border);
+        padded[i] = x < 0 ? 0 : row[x];
+    }
+
+    padded[count] = 0;
+}
+
+static void mdif_pipeline_convolve_tile(
+    const mdif_pipeline_stage_t* stage,
+    const mdif_tile_t* in,
+    mdif_tile_t* out,
+    unsigned char* padded,
+    int* acc,
+    short* rows
+) {
+    const mdif_convolve_job_t* job = &stage->convolve;
+    const mdif_rect_t* rect = &out->rect;
+
+    int radius_x = job->size_x / 2,
+        radius_y = job->size_y / 2,
+        taps_x = (job->size_x + 1) & ~1,
+        taps_y = (job->size_y + 1) & ~1,
+        padded_width = rect->width + 2 * radius_x;
+
+    for(int c = 0; c < 4; c++) {
+        if(!(job->channels & (1 << c))) {
+            for(int y = rect->y; y < rect->y + rect->height; y++)
+                memcpy(
+                    out->planes[c] + (size_t) (y - rect->y) * out->stride,
+                    mdif_tile_row(in, c, y) + rect->x,
+                    rect->width
+                );
+            continue;
+        }
+
+        if(!job->separable) {
+            for(int y = rect->y; y < rect->y + rect->height; y++) {
+                memset(acc, 0, rect->width * sizeof(int));
+
+                for(int k = 0; k < job->size_y; k++) {
+                    int source = mdif_border_index(y + k - radius_y, stage->in_height, job->border);
+
+                    if(source < 0)
+                        memset(padded, 0, padded_width + 1);
+                    else mdif_pipeline_pad(
+                        in, c, source,
+                        rect->x - radius_x, padded_width,
+                        stage->in_width, job->border, padded
+                    );
+
+                    mdif_accumulate_row(padded, rect->width, job->taps_x + k * taps_x, taps_x, acc);
+                }
+
+                mdif_store_row(
+                    acc, rect->width, job->shift_x, job->offset,
+                    out->planes[c] + (size_t) (y - rect->y) * out->stride
+                );
+            }
+
+            continue;
+        }
+
+        int count = rect->height + job->size_y - 1;
+        for(int r = 0; r < count; r++) {
+            int source = mdif_border_index(rect->y - radius_y + r, stage->in_height, job->border);
+            if(source < 0) {
+                memset(rows + (size_t) r * rect->width, 0, rect->width * sizeof(short));
+                continue;
+            }
+
+            memset(acc, 0, rect->width * sizeof(int));
+            mdif_pipeline_pad(
+                in, c, source,
+                rect->x - radius_x, padded_width,
+                stage->in_width, job->border, padded
+            );
+            mdif_accumulate_row(padded, rect->width, job->taps_x, taps_x, acc);
+            mdif_store_intermediate(
+                acc, rect->width,
+                job->shift_x - job->intermediate,
+                rows + (size_t) r * rect->width
+            );
+        }
+
+        for(int y = 0; y < rect->height; y++) {
+            const short* window[MDIF_KERNEL_MAX_SIZE + 1];
+            for(int k = 0; k < taps_y; k++)
+                window[k] = rows + (size_t) mdif_clamp(y + k, 0, count - 1) * rect->width;
+
+            mdif_accumulate_column(window, rect->width, job->taps_y, taps_y, acc);
+            mdif_store_row(
+                acc, rect->width,
+                job->shift_y + job->intermediate,
+                job->offset,
+                out->planes[c] + (size_t) y * out->stride
+            );
+        }
+    }
+}
+
+static void mdif_pipeline_resize_tile(
+    const mdif_pipeline_stage_t* stage,
+    const mdif_tile_t* in,
+    mdif_tile_t* out,
+    int* columns
+) {
+    const mdif_rect_t* rect = &out->rect;
+    int* fractions = columns + rect->width;
+
+    for(int i = 0; i < rect->width; i++)
+        columns[i] = mdif_resize_coord(rect->x + i, stage->in_width, stage->out_width, &fractions[i]);
+
+    for(int y = rect->y; y < rect->y + rect->height; y++) {
+        int fy, top = mdif_resize_coord(y, stage->in_height, stage->out_height, &fy),
+            bottom = top + 1 < stage->in_height ? top + 1 : top;
+
+        for(int c = 0; c < 4; c++) {
+            const unsigned char* upper = mdif_tile_row(in, c, top);
+            const unsigned char* lower = mdif_tile_row(in, c, bottom);
+            unsigned char* dst = out->planes[c] + (size_t) (y - rect->y) * out->stride;
+
+            for(int i = 0; i < rect->width; i++) {
+                int x = columns[i], fx = fractions[i],
+                    next = x + 1 < stage->in_width ? x + 1 : x;
+
+                int a = upper[x] * (256 - fx) + upper[next] * fx,
+                    b = lower[x] * (256 - fx) + lower[next] * fx;
+
+                dst[i] = (unsigned char) ((a * (256 - fy) + b * fy + 32768) >> 16);
+            }
+        }
+    }
+}
+
+static void mdif_pipeline_grayscale_tile(const mdif_tile_t* in, mdif_tile_t* out) {
+    const mdif_rect_t* rect = &out->rect;
+
+    for(int y = rect->y; y < rect->y + rect->height; y++) {
+        const unsigned char* red = mdif_tile_row(in, 0, y) + rect->x;
+        const unsigned char* green = mdif_tile_row(in, 1, y) + rect->x;
+        const unsigned char* blue = mdif_tile_row(in, 2, y) + rect->x;
+        size_t offset = (size_t) (y - rect->y) * out->stride;
+
+        for(int i = 0; i < rect->width; i++) {
+            unsigned char luma = mdif_luma(red[i], green[i], blue[i]);
+
+            out->planes[0][offset + i] = luma;
+            out->planes[1][offset + i] = luma;
+            out->planes[2][offset + i] = luma;
+        }
+
+        memcpy(out->planes[3] + offset, mdif_tile_row(in, 3, y) + rect->x, rect->width);
+    }
+}
+
+static void mdif_pipeline_task(void* context, int begin, int end) {
+    mdif_pipeline_job_t* job = (mdif_pipeline_job_t*) context;
+
+    size_t buffers_size = 0;
+    for(int i = 0; i < job->count; i++)
+        buffers_size += 4 * ((job->max_area[i] + 15) & ~(size_t) 15);
+
+    size_t padded_size = (size_t) (job->max_width + 2 * MDIF_KERNEL_MAX_SIZE + 16) & ~(size_t) 15,
+        acc_size = (size_t) 2 * (job->max_width + 2) * sizeof(int),
+        rows_size = (size_t) (job->max_height + MDIF_KERNEL_MAX_SIZE + 1) * job->max_width * sizeof(short);
+
+    unsigned char* scratch = (unsigned char*) mdif_scratch_alloc(
+        buffers_size + padded_size + acc_size + rows_size
+    );
+    if(!scratch) {
+        job->failed = true;
+        return;
+    }
+
+    unsigned char* padded = scratch + buffers_size;
+    int* acc = (int*) (padded + padded_size);
+    short* rows = (short*) ((unsigned char*) acc + acc_size);
+
+    mdif_tile_t source;
+    source.rect.x = 0;
+    source.rect.y = 0;
+    source.rect.width = job->image->width;
+    source.rect.height = job->image->height;
+    source.stride = job->image->width;
+    mdif_planes(job->image, source.planes);
+
+    mdif_rect_t rects[MDIF_PIPELINE_MAX_OPS + 1];
+    mdif_tile_t tiles[MDIF_PIPELINE_MAX_OPS];
+
+    for(int index = begin; index < end; index++) {
+        rects[job->count] = mdif_pipeline_tile_rect(job, index);
+        for(int i = job->count - 1; i >= 0; i--)
+            rects[i] = mdif_pipeline_source_rect(&job->stages[i], rects[i + 1]);
+
+        unsigned char* buffer = scratch;
+        for(int i = 0; i < job->count; i++) {
+            mdif_tile_t* tile = &tiles[i];
+            tile->rect = rects[i + 1];
+            if(i == job->count - 1 && job->output) {
+                size_t offset = (size_t) tile->rect.y * job->output->width + tile->rect.x;
+
+                tile->stride = job->output->width;
+                mdif_planes(job->output, tile->planes);
+                for(int c = 0; c < 4; c++)
+                    tile->planes[c] += offset;
+                continue;
+            }
+
+            tile->stride = tile->rect.width;
+            for(int c = 0; c < 4; c++)
+                tile->planes[c] = buffer + c * ((job->max_area[i] + 15) & ~(size_t) 15);
+
+            buffer += 4 * ((job->max_area[i] + 15) & ~(size_t) 15);
+        }
+
+        const mdif_tile_t* in = &source;
+        for(int i = 0; i < job->count; i++) {
+            const mdif_pipeline_stage_t* stage = &job->stages[i];
+
+            switch(stage->type) {
+                case MDIF_PIPELINE_ANTIALIAS:
+                    mdif_pipeline_antialias_tile(stage, in, &tiles[i]);
+                    break;
+
+                case MDIF_PIPELINE_CONVOLVE:
+                    mdif_pipeline_convolve_tile(stage, in, &tiles[i], padded, acc, rows);
+                    break;
+
+                case MDIF_PIPELINE_RESIZE:
+                    mdif_pipeline_resize_tile(stage, in, &tiles[i], acc);
+                    break;
+
+                case MDIF_PIPELINE_GRAYSCALE:
+                    mdif_pipeline_grayscale_tile(in, &tiles[i]);
+                    break;
+            }
+
+            in = &tiles[i];
+        }
+
+        if(job->output)
+            continue;
+
+        const mdif_rect_t* rect = &rects[job->count];
+
+        int out_width = job->count ? job->stages[job->count - 1].out_width : job->image->width,
+            out_height = job->count ? job->stages[job->count - 1].out_height : job->image->height;
+        size_t plane_size = (size_t) out_width * out_height;
+
+        float* plane = job->values;
+        for(int c = 0; c < 4; c++) {
+            if(!(job->channels & (1 << c)))
+                continue;
+
+            for(int y = rect->y; y < rect->y + rect->height; y++) {
+                const unsigned char* row = mdif_tile_row(in, c, y) + rect->x;
+                float* dst = plane + (size_t) y * out_width + rect->x;
+
+                for(int i = 0; i < rect->width; i++)
+                    dst[i] = job->lut[c][row[i]];
+            }
+
+            plane += plane_size;
+        }
+    }
+
+    mdif_scratch_free(scratch);
+}
+
+#ifndef ARDUINO
+
+static unsigned long long mdif_pipeline_key(
+    const mdif_pipeline_t* pipeline,
+    bool planes,
+    unsigned char channels,
+    const float* mean,
+    const float* stddev
+) {
+    const mdif_t* image = pipeline->image;
+    size_t pixel_count = (size_t) image->width * image->height;
+
+    int fields[7] = {
+        image->width, image->height, pipeline->count,
+        planes, channels, mean != NULL, stddev != NULL
+    };
+
+    mdif_hash_state_t state;
+    mdif_hash_init(&state, 0);
+    mdif_hash_update(&state, (const unsigned char*) fields, sizeof(fields));
+
+    unsigned char* source[4];
+    mdif_planes(image, source);
+
+    for(int c = 0; c < 4; c++)
+        mdif_hash_update(&state, source[c], pixel_count);
+
+    for(int i = 0; i < pipeline->count; i++) {
+        const mdif_pipeline_op_t* op = &pipeline->ops[i];
+        const mdif_kernel_t* kernel = op->type == MDIF_PIPELINE_CONVOLVE ? op->kernel : NULL;
+
+        int op_fields[7] = {
+            op->type, op->border, op->channels, op->width, op->height,
+            kernel ? kernel->width : 0, kernel ? kernel->height : 0
+        };
+
+        mdif_hash_update(&state, (const unsigned char*) op_fields, sizeof(op_fields));
+        if(kernel) {
+            mdif_hash_update(
+                &state, (const unsigned char*) kernel->weights,
+                (size_t) kernel->width * kernel->height * sizeof(float)
+            );
+            mdif_hash_update(&state, (const unsigned char*) &kernel->bias, sizeof(float));
+        }
+    }
+
+    if(!planes) {
+        int count = 0;
+        for(int c = 0; c < 4; c++)
+            count += (channels >> c) & 1;
+
+        if(mean)
+            mdif_hash_update(&state, (const unsigned char*) mean, count * sizeof(float));
+
+        if(stddev)
+            mdif_hash_update(&state, (const unsigned char*) stddev, count * sizeof(float));
+    }
+
+    return mdif_hash_digest(&state);
+}
+
+static int mdif_pipeline_cache_parts(
+    mdif_t* output,
+    float* values,
+    unsigned char channels,
+    int width,
+    int height,
+    mdif_cache_part_t parts[4]
+) {
+    size_t pixel_count = (size_t) width * height;
+
+    if(output) {
+        unsigned char* planes[4];
+        mdif_planes(output, planes);
+
+        for(int c = 0; c < 4; c++) {
+            parts[c].data = planes[c];
+            parts[c].size = pixel_count;
+        }
+
+        return 4;
+    }
+
+    int count = 0;
+    for(int c = 0; c < 4; c++)
+        count += (channels >> c) & 1;
+
+    parts[0].data = (unsigned char*) values;
+    parts[0].size = count * pixel_count * sizeof(float);
+
+    return 1;
+}
+
+#endif
+
+static mdif_error_t mdif_pipeline_execute(
+    const mdif_pipeline_t* pipeline,
+    mdif_t* output,
+    float* values,
+    unsigned char channels,
+    const float* mean,
+    const float* stddev,
+    int threads
+) {
+    if(!pipeline || !pipeline->image || !pipeline->image->red ||
+        pipeline->count < 0 || pipeline->count > MDIF_PIPELINE_MAX_OPS)
+        return MDIF_ERROR_PIPELINE;
+
+    mdif_pipeline_job_t* job = (mdif_pipeline_job_t*) mdif_scratch_alloc(sizeof(mdif_pipeline_job_t));
+    if(!job)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    job->image = pipeline->image;
+    job->output = output;
+    job->values = values;
+    job->channels = channels;
+    job->count = pipeline->count;
+    job->failed = false;
+
+    mdif_error_t result = MDIF_ERROR_NONE;
+    int width = pipeline->image->width, height = pipeline->image->height;
+
+    for(int i = 0; i < job->count && result == MDIF_ERROR_NONE; i++) {
+        const mdif_pipeline_op_t* op = &pipeline->ops[i];
+        mdif_pipeline_stage_t* stage = &job->stages[i];
+
+        stage->type = op->type;
+        stage->in_width = width;
+        stage->in_height = height;
+
+        if(op->type == MDIF_PIPELINE_RESIZE) {
+            width = op->width;
+            height = op->height;
+        }
+        else if(op->type == MDIF_PIPELINE_CONVOLVE) {
+            result = mdif_convolve_prepare(&stage->convolve, op->kernel);
+
+            stage->convolve.border = op->border;
+            stage->convolve.channels = op->channels;
+        }
+
+        stage->out_width = width;
+        stage->out_height = height;
+    }
+
+    if(result == MDIF_ERROR_NONE && (width != pipeline->width || height != pipeline->height))
+        result = MDIF_ERROR_PIPELINE;
+
+    if(result == MDIF_ERROR_NONE && output) {
+        if(!output->red)
+            result = MDIF_ERROR_IMAGE;
+        else if(output->layout != MDIF_LAYOUT_RGBA)
+            result = MDIF_ERROR_LAYOUT;
+        else if(output->width != width)
+            result = MDIF_ERROR_INVALID_WIDTH;
+        else if(output->height != height)
+            result = MDIF_ERROR_INVALID_HEIGHT;
+    }
+
+    if(result != MDIF_ERROR_NONE) {
+        mdif_scratch_free(job);
+        return result;
+    }
+
+    #ifndef ARDUINO
+    unsigned long long key = 0;
+    mdif_cache_part_t parts[4];
+    int part_count = 0;
+
+    if(pipeline->cache) {
+        key = mdif_pipeline_key(pipeline, output != NULL, channels, mean, stddev);
+        part_count = mdif_pipeline_cache_parts(output, values, channels, width, height, parts);
+
+        if(mdif_cache_read(pipeline->cache, key, parts, part_count) == MDIF_ERROR_NONE) {
+            mdif_scratch_free(job);
+            return MDIF_ERROR_NONE;
+        }
+    }
+    #endif
+
+    if(values) {
+        int plane = 0;
+
+        for(int c = 0; c < 4; c++) {
+            if(!(channels & (1 << c)))
+                continue;
+
+            float offset = mean ? mean[plane] : 0.0f,
+                scale = stddev ? 1.0f / stddev[plane] : 1.0f;
+
+            for(int v = 0; v < 256; v++)
+                job->lut[c][v] = ((float) v / 255.0f - offset) * scale;
+
+            plane++;
+        }
+    }
+
+    job->tiles_x = (width + MDIF_PIPELINE_TILE - 1) / MDIF_PIPELINE_TILE;
+    int tiles = job->tiles_x * ((height + MDIF_PIPELINE_TILE - 1) / MDIF_PIPELINE_TILE);
+
+    job->max_width = 0;
+    job->max_height = 0;
+    for(int i = 0; i < job->count; i++)
+        job->max_area[i] = 0;
+
+    for(int index = 0; index < tiles; index++) {
+        mdif_rect_t rect = mdif_pipeline_tile_rect(job, index);
+
+        for(int i = job->count - 1; i >= 0; i--) {
+            size_t area = (size_t) rect.width * rect.height;
+
+            if(area > job->max_area[i])
+                job->max_area[i] = area;
+            if(rect.width > job->max_width)
+                job->max_width = rect.width;
+            if(rect.height > job->max_height)
+                job->max_height = rect.height;
+
+            rect = mdif_pipeline_source_rect(&job->stages[i], rect);
+        }
+    }
+
+    if(output && job->count > 0)
+        job->max_area[job->count - 1] = 0;
+
+    mdif_t copy;
+    copy.red = NULL;
+
+    if(output && output->red == pipeline->image->red) {
+        if(job->count == 0) {
+            mdif_scratch_free(job);
+            return MDIF_ERROR_NONE;
+        }
+
+        size_t pixel_count = (size_t) pipeline->image->width * pipeline->image->height;
+        if(!mdif_alloc_planes(&copy, pixel_count)) {
+            mdif_scratch_free(job);
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+        }
+
+        copy.width = pipeline->image->width;
+        copy.height = pipeline->image->height;
+        copy.layout = MDIF_LAYOUT_RGBA;
+
+        memcpy(copy.red, pipeline->image->red, pixel_count);
+        memcpy(copy.green, pipeline->image->green, pixel_count);
+        memcpy(copy.blue, pipeline->image->blue, pixel_count);
+        memcpy(copy.alpha, pipeline->image->alpha, pixel_count);
+
+        job->image = &copy;
+    }
+
+    if(output && job->count == 0) {
+        size_t pixel_count = (size_t) width * height;
+
+        memcpy(output->red, job->image->red, pixel_count);
+        memcpy(output->green, job->image->green, pixel_count);
+        memcpy(output->blue, job->image->blue, pixel_count);
+        memcpy(output->alpha, job->image->alpha, pixel_count);
+    }
+    else mdif_parallel(tiles, threads, mdif_pipeline_task, job);
+
+    if(copy.red)
+        mdif_free(&copy);
+
+    result = job->failed ? MDIF_ERROR_CANNOT_ALLOCATE : MDIF_ERROR_NONE;
+    mdif_scratch_free(job);
+
+    #ifndef ARDUINO
+    if(result == MDIF_ERROR_NONE && pipeline->cache)
+        mdif_cache_write(pipeline->cache, key, parts, part_count);
+    #endif
+
+    return result;
+}
+
+static mdif_pipeline_op_t* mdif_pipeline_push(mdif_pipeline_t* pipeline, mdif_pipeline_type_t type) {
+    if(!pipeline || pipeline->count < 0 || pipeline->count >= MDIF_PIPELINE_MAX_OPS)
+        return NULL;
+
+    mdif_pipeline_op_t* op = &pipeline->ops[pipeline->count++];
+    op->type = type;
+    op->kernel = NULL;
+    op->border = MDIF_BORDER_CLAMP;
+    op->channels = MDIF_CHANNEL_ALL;
+    op->width = pipeline->width;
+    op->height = pipeline->height;
+
+    return op;
+}
+
+mdif_error_t mdif_pipeline_init(mdif_pipeline_t* pipeline, const mdif_t* image) {
+    if(!pipeline || !image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    pipeline->image = image;
+    pipeline->width = image->width;
+    pipeline->height = image->height;
+    pipeline->count = 0;
+    pipeline->cache = NULL;
+
+    return MDIF_ERROR_NONE;
+}
+
+#ifndef ARDUINO
+
+mdif_error_t mdif_pipeline_use_cache(mdif_pipeline_t* pipeline, const mdif_cache_t* cache) {
+    if(!pipeline)
+        return MDIF_ERROR_PIPELINE;
+
+    if(cache && !cache->directory)
+        return MDIF_ERROR_CACHE;
+
+    pipeline->cache = cache;
+    return MDIF_ERROR_NONE;
+}
+
+#endif
+
+mdif_error_t mdif_pipeline_antialias(mdif_pipeline_t* pipeline) {
+    return mdif_pipeline_push(pipeline, MDIF_PIPELINE_ANTIALIAS) ?
+        MDIF_ERROR_NONE : MDIF_ERROR_PIPELINE;
+}
+
+mdif_error_t mdif_pipeline_convolve(
+    mdif_pipeline_t* pipeline,
+    const mdif_kernel_t* kernel,
+    mdif_border_t border,
+    unsigned char channels
+) {
+    if(!kernel ||
+        kernel->width < 1 || kernel->width > MDIF_KERNEL_MAX_SIZE || !(kernel->width & 1) ||
+        kernel->height < 1 || kernel->height > MDIF_KERNEL_MAX_SIZE || !(kernel->height & 1))
+        return MDIF_ERROR_KERNEL;
+
+    mdif_pipeline_op_t* op = mdif_pipeline_push(pipeline, MDIF_PIPELINE_CONVOLVE);
+    if(!op)
+        return MDIF_ERROR_PIPELINE;
+
+    op->kernel = kernel;
+    op->border = border;
+    op->channels = channels;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_pipeline_resize(mdif_pipeline_t* pipeline, short width, short height) {
+    if(width < 1)
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(height < 1)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    mdif_pipeline_op_t* op = mdif_pipeline_push(pipeline, MDIF_PIPELINE_RESIZE);
+    if(!op)
+        return MDIF_ERROR_PIPELINE;
+
+    op->width = pipeline->width = width;
+    op->height = pipeline->height = height;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_pipeline_grayscale(mdif_pipeline_t* pipeline) {
+    return mdif_pipeline_push(pipeline, MDIF_PIPELINE_GRAYSCALE) ?
+        MDIF_ERROR_NONE : MDIF_ERROR_PIPELINE;
+}
+
+mdif_error_t mdif_pipeline_run(const mdif_pipeline_t* pipeline, mdif_t* output, int threads) {
+    if(!output)
+        return MDIF_ERROR_IMAGE;
+
+    return mdif_pipeline_execute(pipeline, output, NULL, 0, NULL, NULL, threads);
+}
+
+mdif_error_t mdif_pipeline_run_normalized(
+    const mdif_pipeline_t* pipeline,
+    float* output,
+    unsigned char channels,
+    const float* mean,
+    const float* stddev,
+    int threads
+) {
+    if(!output)
+        return MDIF_ERROR_IMAGE;
+
+    return mdif_pipeline_execute(pipeline, NULL, output, channels, mean, stddev, threads);
+}
+
+mdif_error_t mdif_resize(const mdif_t* image, mdif_t* output, int threads) {
+    if(!output || !output->red)
+        return MDIF_ERROR_IMAGE;
+
+    mdif_pipeline_t pipeline;
+    mdif_error_t result = mdif_pipeline_init(&pipeline, image);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_pipeline_resize(&pipeline, output->width, output->height);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_pipeline_run(&pipeline, output, threads);
+
+    return result;
+}
+
+#define MDIF_LUT_CHUNK 65536
+
+typedef struct mdif_lut_job_struct {
+    unsigned char *planes[4];
+    const unsigned char *luts[4];
+    size_t sizes[4];
+    size_t chunks[4];
+} mdif_lut_job_t;
+
+static void mdif_lut_apply_row(const unsigned char* lut, unsigned char* data, size_t count) {
+    size_t x = 0;
+
+    for(; x + 4 <= count; x += 4) {
+        unsigned char a = lut[data[x]], b = lut[data[x + 1]],
+            c = lut[data[x + 2]], d = lut[data[x + 3]];
+
+        data[x] = a;
+        data[x + 1] = b;
+        data[x + 2] = c;
+        data[x + 3] = d;
+    }
+
+    for(; x < count; x++)
+        data[x] = lut[data[x]];
+}
+
+static void mdif_lut_task(void* context, int begin, int end) {
+    mdif_lut_job_t* job = (mdif_lut_job_t*) context;
+
+    for(int chunk = begin; chunk < end; chunk++) {
+        size_t index = (size_t) chunk;
+        int c = 0;
+
+        while(index >= job->chunks[c])
+            index -= job->chunks[c++];
+
+        size_t offset = index * MDIF_LUT_CHUNK,
+            count = job->sizes[c] - offset < MDIF_LUT_CHUNK ? job->sizes[c] - offset : MDIF_LUT_CHUNK;
+
+        mdif_lut_apply_row(job->luts[c], job->planes[c] + offset, count);
+    }
+}
+
+mdif_error_t mdif_apply_lut(
+    mdif_t* image,
+    const unsigned char* lut_r,
+    const unsigned char* lut_g,
+    const unsigned char* lut_b,
+    const unsigned char* lut_a,
+    int threads
+) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout == MDIF_LAYOUT_INDEXED) {
+        const unsigned char* luts[4] = {lut_r, lut_g, lut_b, lut_a};
+
+        for(int i = 0; i < MDIF_PALETTE_BYTES; i++)
+            if(luts[i & 3])
+                image->alpha[i] = luts[i & 3][image->alpha[i]];
+
+        return MDIF_ERROR_NONE;
+    }
+
+    mdif_lut_job_t job;
+    mdif_planes(image, job.planes);
+    mdif_plane_sizes(image, job.sizes);
+
+    job.luts[0] = lut_r;
+    job.luts[1] = lut_g;
+    job.luts[2] = lut_b;
+    job.luts[3] = lut_a;
+
+    int count = 0;
+    for(int c = 0; c < 4; c++) {
+        job.chunks[c] = job.luts[c] && job.sizes[c] ?
+            (job.sizes[c] + MDIF_LUT_CHUNK - 1) / MDIF_LUT_CHUNK : 0;
+        count += (int) job.chunks[c];
+    }
+
+    mdif_parallel(count, threads, mdif_lut_task, &job);
+    return MDIF_ERROR_NONE;
+}
+
+void mdif_lut_identity(unsigned char* lut) {
+    for(int i = 0; i < 256; i++)
+        lut[i] = (unsigned char) i;
+}
+
+void mdif_lut_invert(unsigned char* lut) {
+    for(int i = 0; i < 256; i++)
+        lut[i] = (unsigned char) (255 - i);
+}
+
+void mdif_lut_threshold(unsigned char* lut, unsigned char threshold) {
+    for(int i = 0; i < 256; i++)
+        lut[i] = i >= threshold ? 255 : 0;
+}
+
+mdif_error_t mdif_lut_gamma(unsigned char* lut, float gamma) {
+    return mdif_lut_levels(lut, 0, 255, gamma, 0, 255);
+}
+
+mdif_error_t mdif_lut_levels(
+    unsigned char* lut,
+    unsigned char in_black,
+    unsigned char in_white,
+    float gamma,
+    unsigned char out_black,
+    unsigned char out_white
+) {
+    if(!lut || in_white <= in_black || !(gamma > 0.0f))
+        return MDIF_ERROR_LUT;
+
+    for(int i = 0; i < 256; i++) {
+        float t = (float) (mdif_clamp(i, in_black, in_white) - in_black) / (in_white - in_black);
+        float value = out_black + (out_white - out_black) * powf(t, 1.0f / gamma);
+
+        lut[i] = (unsigned char) mdif_clamp((int) (value + 0.5f), 0, 255);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_lut_curve(
+    unsigned char* lut,
+    const unsigned char* x,
+    const unsigned char* y,
+    int count
+) {
+    if(!lut || !x || !y || count < 1)
+        return MDIF_ERROR_LUT;
+
+    for(int i = 1; i < count; i++)
+        if(x[i] <= x[i - 1])
+            return MDIF_ERROR_LUT;
+
+    int segment = 0;
+    for(int i = 0; i < 256; i++) {
+        while(segment + 1 < count && i > x[segment + 1])
+            segment++;
+
+        if(i <= x[0])
+            lut[i] = y[0];
+        else if(segment + 1 >= count)
+            lut[i] = y[count - 1];
+        else {
+            int span = x[segment + 1] - x[segment],
+                rise = y[segment + 1] - y[segment],
+                offset = i - x[segment];
+
+            lut[i] = (unsigned char) (y[segment] +
+                (rise * offset + (rise >= 0 ? span / 2 : -span / 2)) / span);
+        }
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+typedef struct mdif_clahe_job_struct {
+    const mdif_t *image;
+    unsigned char *planes[4];
+    int widths[4];
+    int heights[4];
+    int tiles_x[4];
+    int tiles_y[4];
+    int first_tile[4];
+    int plane_count;
+
+    float clip;
+    bool stretch;
+    bool luminance;
+
+    unsigned char *luts;
+    volatile bool failed;
+} mdif_clahe_job_t;
+
+static int mdif_clahe_plane(int* index, const int* counts) {
+    int p = 0;
+
+    while(*index >= counts[p])
+        *index -= counts[p++];
+
+    return p;
+}
+
+static void mdif_clahe_lut(
+    unsigned long* histogram,
+    unsigned long area,
+    float clip,
+    bool stretch,
+    unsigned char* lut
+) {
+    if(clip > 0.0f) {
+        unsigned long limit = (unsigned long) (clip * area / 256.0f), excess = 0;
+        if(limit < 1)
+            limit = 1;
+
+        for(int i = 0; i < 256; i++)
+            if(histogram[i] > limit) {
+                excess += histogram[i] - limit;
+                histogram[i] = limit;
+            }
+
+        unsigned long share = excess / 256, residual = excess % 256;
+        for(int i = 0; i < 256; i++)
+            histogram[i] += share;
+
+        if(residual > 0)
+            for(unsigned long i = 0, step = 256 / residual; i < 256 && residual > 0; i += step, residual--)
+                histogram[i]++;
+    }
+
+    unsigned long base = 0;
+    if(stretch) {
+        int first = 0;
+        while(histogram[first] == 0)
+            first++;
+
+        if(histogram[first] == area) {
+            mdif_lut_identity(lut);
+            return;
+        }
+
+        base = histogram[first];
+    }
+
+    unsigned long long total = 0, range = area - base;
+    for(int i = 0; i < 256; i++) {
+        total += histogram[i];
+
+        lut[i] = total <= base ? 0 :
+            (unsigned char) (((total - base) * 255 + range / 2) / range);
+    }
+}
+
+static void mdif_clahe_tile_task(void* context, int begin, int end) {
+    mdif_clahe_job_t* job = (mdif_clahe_job_t*) context;
+
+    int counts[4];
+    for(int p = 0; p < job->plane_count; p++)
+        counts[p] = job->tiles_x[p] * job->tiles_y[p];
+
+    unsigned int* partial = (unsigned int*) mdif_scratch_alloc(4 * 256 * sizeof(unsigned int));
+    if(!partial) {
+        job->failed = true;
+        return;
+    }
+
+    for(int index = begin; index < end; index++) {
+        int tile = index,
+            p = mdif_clahe_plane(&tile, counts),
+            width = job->widths[p],
+            height = job->heights[p],
+            tx = tile % job->tiles_x[p],
+            ty = tile / job->tiles_x[p];
+
+        int left = (int) ((long) tx * width / job->tiles_x[p]),
+            right = (int) ((long) (tx + 1) * width / job->tiles_x[p]),
+            top = (int) ((long) ty * height / job->tiles_y[p]),
+            bottom = (int) ((long) (ty + 1) * height / job->tiles_y[p]);
+
+        memset(partial, 0, 4 * 256 * sizeof(unsigned int));
+        for(int y = top; y < bottom; y++)
+            mdif_histogram_accumulate(job->planes[p] + (size_t) y * width + left, right - left, partial);
+
+        unsigned long histogram[256];
+        mdif_histogram_sum(partial, histogram);
+
+        mdif_clahe_lut(
+            histogram,
+            (unsigned long) (right - left) * (bottom - top),
+            job->clip, job->stretch,
+            job->luts + (size_t) (job->first_tile[p] + tile) * 256
+        );
+    }
+
+    mdif_scratch_free(partial);
+}
+
+static int mdif_clahe_center(int tile, int size, int tiles) {
+    return (int) ((long) tile * size / tiles + (long) (tile + 1) * size / tiles) - 1;
+}
+
+static int mdif_clahe_weight(int position, int size, int tiles, int* tile) {
+    int doubled = 2 * position;
+
+    while(*tile + 1 < tiles && mdif_clahe_center(*tile + 1, size, tiles) <= doubled)
+        (*tile)++;
+
+    if(*tile + 1 >= tiles)
+        return 0;
+
+    int first = mdif_clahe_center(*tile, size, tiles),
+        second = mdif_clahe_center(*tile + 1, size, tiles);
+
+    return doubled <= first ? 0 : (doubled - first) * 256 / (second - first);
+}
+
+static unsigned char mdif_clahe_scale(unsigned char value, unsigned long gain) {
+    unsigned long scaled = (value * gain + 32768) >> 16;
+    return (unsigned char) (scaled > 255 ? 255 : scaled);
+}
+
+static void mdif_clahe_map_task(void* context, int begin, int end) {
+    mdif_clahe_job_t* job = (mdif_clahe_job_t*) context;
+
+    int* columns = (int*) mdif_scratch_alloc((size_t) job->widths[0] * 2 * sizeof(int));
+    if(!columns) {
+        job->failed = true;
+        return;
+    }
+
+    unsigned int reciprocal[256];
+    if(job->luminance)
+        for(int i = 1; i < 256; i++)
+            reciprocal[i] = 65536u / i;
+
+    int remaining = end - begin,
+        p = mdif_clahe_plane(&begin, job->heights);
+
+    for(; p < job->plane_count && remaining > 0; p++) {
+        int width = job->widths[p],
+            tiles_x = job->tiles_x[p],
+            tiles_y = job->tiles_y[p],
+            rows = job->heights[p] - begin < remaining ? job->heights[p] - begin : remaining;
+
+        const unsigned char* luts = job->luts + (size_t) job->first_tile[p] * 256;
+        unsigned char* plane = job->planes[p];
+
+        for(int x = 0, tile = 0; x < width; x++) {
+            int weight = mdif_clahe_weight(x, width, tiles_x, &tile);
+
+            columns[2 * x] = tile * 256;
+            columns[2 * x + 1] = weight;
+        }
+
+        int tile_y = 0;
+        for(int y = begin; y < begin + rows; y++) {
+            int weight_y = mdif_clahe_weight(y, job->heights[p], tiles_y, &tile_y),
+                next_y = tile_y + 1 < tiles_y ? tile_y + 1 : tile_y;
+
+            const unsigned char* upper = luts + (size_t) tile_y * tiles_x * 256;
+            const unsigned char* lower = luts + (size_t) next_y * tiles_x * 256;
+
+            size_t offset = (size_t) y * width;
+            for(int x = 0; x < width; x++) {
+                int value = plane[offset + x],
+                    left = columns[2 * x] + value,
+                    right = left + (columns[2 * x] + 256 < tiles_x * 256 ? 256 : 0),
+                    weight_x = columns[2 * x + 1];
+
+                int top = upper[left] * (256 - weight_x) + upper[right] * weight_x,
+                    bottom = lower[left] * (256 - weight_x) + lower[right] * weight_x,
+                    mapped = (top * (256 - weight_y) + bottom * weight_y + 32768) >> 16;
+
+                if(!job->luminance) {
+                    plane[offset + x] = (unsigned char) mapped;
+                    continue;
+                }
+
+                const mdif_t* image = job->image;
+                if(value == 0) {
+                    image->red[offset + x] = image->green[offset + x] =
+                        image->blue[offset + x] = (unsigned char) mapped;
+                    continue;
+                }
+
+                unsigned long gain = (unsigned long) mapped * reciprocal[value];
+                image->red[offset + x] = mdif_clahe_scale(image->red[offset + x], gain);
+                image->green[offset + x] = mdif_clahe_scale(image->green[offset + x], gain);
+                image->blue[offset + x] = mdif_clahe_scale(image->blue[offset + x], gain);
+            }
+        }
+
+        remaining -= rows;
+        begin = 0;
+    }
+
+    mdif_scratch_free(columns);
+}
+
+static mdif_error_t mdif_clahe_run(
+    mdif_t* image,
+    int tiles_x,
+    int tiles_y,
+    float clip,
+    unsigned char channels,
+    bool stretch,
+    int threads
+) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout == MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    if(tiles_x < 1 || tiles_y < 1)
+        return MDIF_ERROR_LUT;
+
+    mdif_clahe_job_t job;
+    job.image = image;
+    job.plane_count = 0;
+    job.clip = clip;
+    job.stretch = stretch;
+    job.luminance = false;
+    job.failed = false;
+
+    unsigned char* luma = NULL;
+    if(channels & MDIF_CHANNEL_LUMINANCE) {
+        if(image->layout == MDIF_LAYOUT_RGBA) {
+            luma = (unsigned char*) mdif_mem_alloc((size_t) image->width * image->height);
+            if(!luma)
+                return MDIF_ERROR_CANNOT_ALLOCATE;
+
+            mdif_luminance(image, luma);
+            job.luminance = true;
+        }
+
+        job.planes[0] = luma ? luma : image->red;
+        mdif_plane_dims(image, 0, &job.widths[0], &job.heights[0]);
+        job.plane_count = 1;
+    }
+    else {
+        unsigned char* planes[4];
+        size_t sizes[4];
+
+        mdif_planes(image, planes);
+        mdif_plane_sizes(image, sizes);
+
+        for(int c = 0; c < 4; c++)
+            if((channels & (1 << c)) && sizes[c] > 0) {
+                job.planes[job.plane_count] = planes[c];
+                mdif_plane_dims(image, c, &job.widths[job.plane_count], &job.heights[job.plane_count]);
+                job.plane_count++;
+            }
+    }
+
+    int tile_count = 0, row_count = 0;
+    for(int p = 0; p < job.plane_count; p++) {
+        job.tiles_x[p] = tiles_x < job.widths[p] ? tiles_x : job.widths[p];
+        job.tiles_y[p] = tiles_y < job.heights[p] ? tiles_y : job.heights[p];
+        job.first_tile[p] = tile_count;
+
+        tile_count += job.tiles_x[p] * job.tiles_y[p];
+        row_count += job.heights[p];
+    }
+
+    size_t lut_size = (size_t) tile_count * 256;
+    bool lut_slot = false;
+
+    #ifdef MDIF_STATIC_ARENA
+    size_t reserved = 32 + (job.widths[0] > 512 ? 8 * (size_t) job.widths[0] : 4096);
+    if(lut_size + reserved > mdif_scratch_available()) {
+        if(lut_size > mdif_arena_slot_size) {
+            if(luma)
+                mdif_mem_free(luma);
+
+            return MDIF_ERROR_LUT;
+        }
+
+        lut_slot = true;
+    }
+    #endif
+
+    job.luts = tile_count > 0 ?
+        (unsigned char*) (lut_slot ? mdif_mem_alloc(lut_size) : mdif_scratch_alloc(lut_size)) :
+        NULL;
+    if(tile_count > 0 && !job.luts) {
+        if(luma)
+            mdif_mem_free(luma);
+
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    mdif_parallel(tile_count, threads, mdif_clahe_tile_task, &job);
+    if(!job.failed) {
+        if(tiles_x == 1 && tiles_y == 1 && !job.luminance) {
+            const unsigned char* luts[4] = {NULL, NULL, NULL, NULL};
+            unsigned char* planes[4];
+
+            mdif_planes(image, planes);
+            for(int p = 0; p < job.plane_count; p++)
+                for(int c = 0; c < 4; c++)
+                    if(planes[c] == job.planes[p])
+                        luts[c] = job.luts + (size_t) p * 256;
+
+            mdif_apply_lut(image, luts[0], luts[1], luts[2], luts[3], threads);
+        }
+        else mdif_parallel(row_count, threads, mdif_clahe_map_task, &job);
+    }
+
+    if(lut_slot)
+        mdif_mem_free(job.luts);
+    else if(job.luts)
+        mdif_scratch_free(job.luts);
+
+    if(luma)
+        mdif_mem_free(luma);
+
+    return job.failed ? MDIF_ERROR_CANNOT_ALLOCATE : MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_equalize(mdif_t* image, unsigned char channels, int threads) {
+    return mdif_clahe_run(image, 1, 1, 0.0f, channels, true, threads);
+}
+
+mdif_error_t mdif_clahe(
+    mdif_t* image,
+    unsigned char tiles_x,
+    unsigned char tiles_y,
+    float clip,
+    unsigned char channels,
+    int threads
+) {
+    return mdif_clahe_run(image, tiles_x, tiles_y, clip, channels, false, threads);
+}
+
+#define MDIF_CUBE_CELLS 32768
+#define MDIF_QUANTIZE_CUBE_BYTES ((size_t) MDIF_CUBE_CELLS * (sizeof(unsigned int) + 1))
+
+typedef struct mdif_box_struct {
+    unsigned int begin;
+    unsigned int end;
+    unsigned long score;
+    int channel;
+    unsigned char low;
+    unsigned char high;
+} mdif_box_t;
+
+static const unsigned char mdif_bayer[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+static unsigned int mdif_pack_color(int red, int green, int blue, int alpha) {
+    if(!alpha)
+        return 0;
+
+    return (unsigned int) red | (unsigned int) green << 8 |
+        (unsigned int) blue << 16 | (unsigned int) alpha << 24;
+}
+
+static void mdif_box_measure(const unsigned int* colors, mdif_box_t* box) {
+    unsigned char low[4] = {255, 255, 255, 255}, high[4] = {0, 0, 0, 0};
+    unsigned int i = box->begin;
+
+    #ifdef MDIF_SSE2
+    if(box->end - i >= 4) {
+        __m128i minimum = _mm_set1_epi8((char) 0xFF), maximum = _mm_setzero_si128();
+
+        for(; i + 4 <= box->end; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (colors + i));
+
+            minimum = _mm_min_epu8(minimum, v);
+            maximum = _mm_max_epu8(maximum, v);
+        }
+
+        minimum = _mm_min_epu8(minimum, _mm_srli_si128(minimum, 8));
+        minimum = _mm_min_epu8(minimum, _mm_srli_si128(minimum, 4));
+        maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 8));
+        maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 4));
+
+        unsigned int packed_low = (unsigned int) _mm_cvtsi128_si32(minimum),
+            packed_high = (unsigned int) _mm_cvtsi128_si32(maximum);
+
+        for(int c = 0; c < 4; c++) {
+            low[c] = (unsigned char) (packed_low >> (8 * c));
+            high[c] = (unsigned char) (packed_high >> (8 * c));
+        }
+    }
+    #endif
+
+    for(; i < box->end; i++)
+        for(int c = 0; c < 4; c++) {
+            unsigned char value = (unsigned char) (colors[i] >> (8 * c));
+
+            if(value < low[c])
+                low[c] = value;
+
+            if(value > high[c])
+                high[c] = value;
+        }
+
+    box->channel = 0;
+    for(int c = 1; c < 4; c++)
+        if(high[c] - low[c] > high[box->channel] - low[box->channel])
+            box->channel = c;
+
+    box->low = low[box->channel];
+    box->high = high[box->channel];
+    box->score = (unsigned long) (box->high - box->low) * (box->end - box->begin);
+}
+
+static unsigned int mdif_box_split(unsigned int* colors, const mdif_box_t* box) {
+    unsigned int counts[256];
+    int shift = 8 * box->channel;
+
+    memset(counts, 0, sizeof(counts));
+    for(unsigned int i = box->begin; i < box->end; i++)
+        counts[(colors[i] >> shift) & 255]++;
+
+    unsigned int half = (box->end - box->begin) / 2, total = 0;
+    int split = box->low;
+
+    while(split < box->high - 1 && total + counts[split] < half)
+        total += counts[split++];
+
+    unsigned int i = box->begin, end = box->end;
+    while(i < end)
+        if((int) ((colors[i] >> shift) & 255) <= split)
+            i++;
+        else {
+            unsigned int color = colors[i];
+            colors[i] = colors[--end];
+            colors[end] = color;
+        }
+
+    return i;
+}
+
+static int mdif_median_cut(unsigned int* colors, unsigned int count, int max_colors, unsigned char* palette) {
+    mdif_box_t boxes[MDIF_PALETTE_SIZE];
+    int box_count = 1;
+
+    boxes[0].begin = 0;
+    boxes[0].end = count;
+    mdif_box_measure(colors, &boxes[0]);
+
+    while(box_count < max_colors) {
+        int best = -1;
+        for(int i = 0; i < box_count; i++)
+            if(boxes[i].score > 0 && (best < 0 || boxes[i].score > boxes[best].score))
+                best = i;
+
+        if(best < 0)
+            break;
+
+        mdif_box_t* box = &boxes[best];
+        mdif_box_t* other = &boxes[box_count++];
+        unsigned int middle = mdif_box_split(colors, box);
+
+        other->begin = middle;
+        other->end = box->end;
+        box->end = middle;
+
+        mdif_box_measure(colors, box);
+        mdif_box_measure(colors, other);
+    }
+
+    memset(palette, 0, MDIF_PALETTE_BYTES);
+    for(int b = 0; b < box_count; b++) {
+        unsigned long sums[4] = {0, 0, 0, 0};
+        unsigned int size = boxes[b].end - boxes[b].begin;
+
+        for(unsigned int i = boxes[b].begin; i < boxes[b].end; i++)
+            for(int c = 0; c < 4; c++)
+                sums[c] += (colors[i] >> (8 * c)) & 255;
+
+        for(int c = 0; c < 4; c++)
+            palette[4 * b + c] = (unsigned char) ((sums[c] + size / 2) / size);
+    }
+
+    return box_count;
+}
+
+typedef struct mdif_cube_struct {
+    const unsigned char *palette;
+    int colors;
+
+    unsigned char order[MDIF_PALETTE_SIZE];
+    unsigned short first[256];
+
+    unsigned int *keys;
+    unsigned char *indices;
+} mdif_cube_t;
+
+static void mdif_cube_init(mdif_cube_t* cube, unsigned char* cells) {
+    int count = 0;
+    for(int green = 0; green < 256; green++) {
+        cube->first[green] = (unsigned short) count;
+
+        for(int i = 0; i < cube->colors; i++)
+            if(cube->palette[4 * i + 1] == green)
+                cube->order[count++] = (unsigned char) i;
+    }
+
+    cube->keys = (unsigned int*) cells;
+    cube->indices = cells + MDIF_CUBE_CELLS * sizeof(unsigned int);
+
+    memset(cube->keys, 0, MDIF_CUBE_CELLS * sizeof(unsigned int));
+    memset(cube->indices, 0, MDIF_CUBE_CELLS);
+    cube->keys[0] = 0xFFFFFFFFu;
+}
+
+static int mdif_color_distance(const unsigned char* entry, int red, int green, int blue, int alpha) {
+    return (entry[0] - red) * (entry[0] - red) + (entry[1] - green) * (entry[1] - green) +
+        (entry[2] - blue) * (entry[2] - blue) + (entry[3] - alpha) * (entry[3] - alpha);
+}
+
+static unsigned char mdif_cube_lookup(mdif_cube_t* cube, unsigned int color) {
+    unsigned int cell = (color >> 3 & 0x1F) << 10 | (color >> 11 & 0x1F) << 5 | (color >> 19 & 0x1F);
+    if(cube->keys[cell] == color)
+        return cube->indices[cell];
+
+    int red = color & 255, green = color >> 8 & 255, blue = color >> 16 & 255, alpha = color >> 24;
+    int best = cube->indices[cell],
+        best_distance = mdif_color_distance(cube->palette + 4 * best, red, green, blue, alpha);
+
+    for(int i = cube->first[green]; i < cube->colors && best_distance > 0; i++) {
+        const unsigned char* entry = cube->palette + 4 * cube->order[i];
+        if((entry[1] - green) * (entry[1] - green) >= best_distance)
+            break;
+
+        int distance = mdif_color_distance(entry, red, green, blue, alpha);
+        if(distance < best_distance) {
+            best_distance = distance;
+            best = cube->order[i];
+        }
+    }
+
+    for(int i = cube->first[green] - 1; i >= 0 && best_distance > 0; i--) {
+        const unsigned char* entry = cube->palette + 4 * cube->order[i];
+        if((entry[1] - green) * (entry[1] - green) >= best_distance)
+            break;
+
+        int distance = mdif_color_distance(entry, red, green, blue, alpha);
+        if(distance < best_distance) {
+            best_distance = distance;
+            best = cube->order[i];
+        }
+    }
+
+    cube->keys[cell] = color;
+    cube->indices[cell] = (unsigned char) best;
+
+    return (unsigned char) best;
+}
+
+static void mdif_quantize_map(mdif_t* image, mdif_cube_t* cube, mdif_dither_t dither, int* errors) {
+    int width = image->width, height = image->height, levels = 1;
+    while(levels * levels * levels < cube->colors)
+        levels++;
+
+    int step = 256 / levels, stride = 3 * (width + 2);
+    if(errors)
+        memset(errors, 0, 2 * stride * sizeof(int));
+
+    for(int y = 0; y < height; y++) {
+        int* current = errors ? errors + (y & 1) * stride : NULL;
+        int* next = errors ? errors + (~y & 1) * stride : NULL;
+
+        if(errors)
+            memset(next, 0, stride * sizeof(int));
+
+        for(int x = 0; x < width; x++) {
+            size_t i = (size_t) y * width + x;
+            int channels[3] = {image->red[i], image->green[i], image->blue[i]},
+                alpha = image->alpha[i];
+
+            if(alpha && dither == MDIF_DITHER_ORDERED) {
+                int offset = (2 * mdif_bayer[(y & 7) * 8 + (x & 7)] - 63) * step / 128;
+
+                for(int c = 0; c < 3; c++)
+                    channels[c] = mdif_clamp(channels[c] + offset, 0, 255);
+            }
+            else if(alpha && errors)
+                for(int c = 0; c < 3; c++)
+                    channels[c] = mdif_clamp(channels[c] + current[3 * (x + 1) + c] / 16, 0, 255);
+
+            unsigned char index = mdif_cube_lookup(
+                cube,
+                mdif_pack_color(channels[0], channels[1], channels[2], alpha)
+            );
+            image->red[i] = index;
+
+            if(!alpha || !errors)
+                continue;
+
+            const unsigned char* entry = cube->palette + 4 * index;
+            for(int c = 0; c < 3; c++) {
+                int error = channels[c] - entry[c];
+
+                current[3 * (x + 2) + c] += 7 * error;
+                next[3 * x + c] += 3 * error;
+                next[3 * (x + 1) + c] += 5 * error;
+                next[3 * (x + 2) + c] += error;
+            }
+        }
+    }
+}
+
+mdif_error_t mdif_quantize(mdif_t* image, int max_colors, mdif_dither_t dither) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    if(max_colors < 1 || max_colors > MDIF_PALETTE_SIZE ||
+        dither < MDIF_DITHER_NONE || dither > MDIF_DITHER_FLOYD_STEINBERG)
+        return MDIF_ERROR_PALETTE;
+
+    #ifdef MDIF_STATIC_ARENA
+    if(MDIF_ARENA_SLOT_BYTES < MDIF_QUANTIZE_CUBE_BYTES)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    #endif
+
+    int width = image->width;
+    unsigned int pixel_count = (unsigned int) width * image->height;
+
+    size_t color_bytes = pixel_count * sizeof(unsigned int);
+    unsigned int* colors = (unsigned int*) mdif_mem_alloc(
+        color_bytes > MDIF_QUANTIZE_CUBE_BYTES ? color_bytes : MDIF_QUANTIZE_CUBE_BYTES
+    );
+
+    int* errors = dither == MDIF_DITHER_FLOYD_STEINBERG && colors ?
+        (int*) mdif_scratch_alloc(6 * ((size_t) width + 2) * sizeof(int)) : NULL;
+
+    if(!colors || (dither == MDIF_DITHER_FLOYD_STEINBERG && !errors)) {
+        mdif_mem_free(colors);
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+    }
+
+    for(unsigned int i = 0; i < pixel_count; i++)
+        colors[i] = mdif_pack_color(image->red[i], image->green[i], image->blue[i], image->alpha[i]);
+
+    unsigned char palette[MDIF_PALETTE_BYTES];
+    mdif_cube_t cube;
+
+    cube.palette = palette;
+    cube.colors = mdif_median_cut(colors, pixel_count, max_colors, palette);
+    mdif_cube_init(&cube, (unsigned char*) colors);
+
+    mdif_quantize_map(image, &cube, dither, errors);
+    mdif_scratch_free(errors);
+
+    mdif_error_t result = MDIF_ERROR_NONE;
+    if(image->capacity < MDIF_PALETTE_BYTES) {
+        memcpy(colors, image->red, pixel_count);
+
+        result = mdif_reserve_planes(image, MDIF_PALETTE_BYTES);
+        if(result == MDIF_ERROR_NONE)
+            memcpy(image->red, colors, pixel_count);
+    }
+
+    mdif_mem_free(colors);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    memcpy(image->alpha, palette, MDIF_PALETTE_BYTES);
+    image->signature[0] = 'N';
+    image->signature[1] = 'X';
+    image->layout = MDIF_LAYOUT_INDEXED;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_expand_rows(const mdif_t* image, short y, short rows, unsigned char* pixels) {
+    if(!image || !image->red || !pixels)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    if(y < 0 || rows < 1 || y + rows > image->height)
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    size_t begin = (size_t) y * image->width, end = begin + (size_t) rows * image->width;
+    for(size_t i = begin; i < end; i++)
+        memcpy(pixels + 4 * (i - begin), image->alpha + 4 * image->red[i], 4);
+
+    return MDIF_ERROR_NONE;
+}
+
+#define MDIF_TRANSPOSE_BLOCK 64
+#define MDIF_TRANSPOSE ((mdif_rotation_t) (MDIF_ROTATE_270 + 1))
+
+static void mdif_transpose_plane(
+    const unsigned char* source,
+    long source_stride,
+    int width,
+    int height,
+    unsigned char* dest,
+    long dest_stride
+) {
+    for(int top = 0; top < height; top += MDIF_TRANSPOSE_BLOCK)
+        for(int left = 0; left < width; left += MDIF_TRANSPOSE_BLOCK) {
+            int bottom = top + MDIF_TRANSPOSE_BLOCK < height ? top + MDIF_TRANSPOSE_BLOCK : height,
+                right = left + MDIF_TRANSPOSE_BLOCK < width ? left + MDIF_TRANSPOSE_BLOCK : width;
+
+            for(int y = top; y < bottom; y += 16)
+                for(int x = left; x < right; x += 16) {
+                    const unsigned char* in = source + y * source_stride + x;
+                    unsigned char* out = dest + x * dest_stride + y;
+
+                    #ifdef MDIF_SSE2
+                    if(y + 16 <= bottom && x + 16 <= right) {
+                        __m128i rows[16], next[16];
+                        for(int i = 0; i < 16; i++)
+                            rows[i] = _mm_loadu_si128((const __m128i*) (in + i * source_stride));
+
+                        for(int pass = 0; pass < 4; pass++) {
+                            for(int i = 0; i < 8; i++) {
+                                next[2 * i] = _mm_unpacklo_epi8(rows[i], rows[i + 8]);
+                                next[2 * i + 1] = _mm_unpackhi_epi8(rows[i], rows[i + 8]);
+                            }
+
+                            memcpy(rows, next, sizeof(rows));
+                        }
+
+                        for(int i = 0; i < 16; i++)
+                            _mm_storeu_si128((__m128i*) (out + i * dest_stride), rows[i]);
+
+                        continue;
+                    }
+                    #endif
+
+                    int rows = bottom - y < 16 ? bottom - y : 16,
+                        columns = right - x < 16 ? right - x : 16;
+
+                    for(int i = 0; i < columns; i++)
+                        for(int j = 0; j < rows; j++)
+                            out[i * dest_stride + j] = in[j * source_stride + i];
+                }
+        }
+}
+
+#ifdef MDIF_SSE2
+static __m128i mdif_reverse_vector(__m128i v) {
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+static void mdif_reverse_copy(const unsigned char* source, unsigned char* dest, size_t count) {
+    size_t x = 0;
+
+    #ifdef MDIF_SSE2
+    for(; x + 16 <= count; x += 16)
+        _mm_storeu_si128((__m128i*) (dest + x), mdif_reverse_vector(
+            _mm_loadu_si128((const __m128i*) (source + count - 16 - x))
+        ));
+    #endif
+
+    for(; x < count; x++)
+        dest[x] = source[count - 1 - x];
+}
+
+static void mdif_reverse(unsigned char* data, size_t count) {
+    size_t low = 0, high = count;
+
+    #ifdef MDIF_SSE2
+    for(; high - low >= 32; low += 16, high -= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (data + low)),
+            b = _mm_loadu_si128((const __m128i*) (data + high - 16));
+
+        _mm_storeu_si128((__m128i*) (data + low), mdif_reverse_vector(b));
+        _mm_storeu_si128((__m128i*) (data + high - 16), mdif_reverse_vector(a));
+    }
+    #endif
+
+    for(; high - low >= 2; low++, high--) {
+        unsigned char value = data[low];
+
+        data[low] = data[high - 1];
+        data[high - 1] = value;
+    }
+}
+
+static void mdif_swap(unsigned char* a, unsigned char* b, size_t count) {
+    size_t x = 0;
+
+    #ifdef MDIF_SSE2
+    for(; x + 16 <= count; x += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i*) (a + x));
+
+        _mm_storeu_si128((__m128i*) (a + x), _mm_loadu_si128((const __m128i*) (b + x)));
+        _mm_storeu_si128((__m128i*) (b + x), value);
+    }
+    #endif
+
+    for(; x < count; x++) {
+        unsigned char value = a[x];
+
+        a[x] = b[x];
+        b[x] = value;
+    }
+}
+
+static void mdif_rotate_plane(
+    const unsigned char* source,
+    int width,
+    int height,
+    unsigned char* dest,
+    mdif_rotation_t rotation
+) {
+    switch(rotation) {
+        case MDIF_ROTATE_90:
+            mdif_transpose_plane(
+                source + (size_t) (height - 1) * width, -(long) width,
+                width, height, dest, height
+            );
+            break;
+
+        case MDIF_ROTATE_180:
+            mdif_reverse_copy(source, dest, (size_t) width * height);
+            break;
+
+        case MDIF_ROTATE_270:
+            mdif_transpose_plane(
+                source, width, width, height,
+                dest + (size_t) (width - 1) * height, -(long) height
+            );
+            break;
+
+        default:
+            mdif_transpose_plane(source, width, width, height, dest, height);
+            break;
+    }
+}
+
+static mdif_error_t mdif_check_transform(const mdif_t* image, const mdif_t* output, bool swapped) {
+    if(!image || !output || !image->red || !output->red || image == output)
+        return MDIF_ERROR_IMAGE;
+
+    if(output->width != (swapped ? image->height : image->width))
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(output->height != (swapped ? image->width : image->height))
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(image->layout == MDIF_LAYOUT_INDEXED && output->capacity < MDIF_PALETTE_BYTES)
+        return MDIF_ERROR_LAYOUT;
+
+    return MDIF_ERROR_NONE;
+}
+
+static void mdif_copy_header(const mdif_t* image, mdif_t* output) {
+    output->signature[0] = image->signature[0];
+    output->signature[1] = image->signature[1];
+    output->layout = image->layout;
+    output->levels = 0;
+
+    if(image->layout == MDIF_LAYOUT_INDEXED)
+        memcpy(output->alpha, image->alpha, MDIF_PALETTE_BYTES);
+}
+
+static mdif_error_t mdif_rotate_planes(const mdif_t* image, mdif_t* output, mdif_rotation_t rotation) {
+    mdif_error_t result = mdif_check_transform(image, output, rotation != MDIF_ROTATE_180);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    unsigned char *source[4], *dest[4];
+    size_t sizes[4];
+
+    mdif_planes(image, source);
+    mdif_planes(output, dest);
+    mdif_plane_sizes(image, sizes);
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(image, c, &width, &height);
+        mdif_rotate_plane(source[c], width, height, dest[c], rotation);
+    }
+
+    mdif_copy_header(image, output);
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_rotate_planes_inplace(mdif_t* image, mdif_rotation_t rotation) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    unsigned char* planes[4];
+    size_t sizes[4];
+
+    mdif_planes(image, planes);
+    mdif_plane_sizes(image, sizes);
+
+    if(rotation == MDIF_ROTATE_180) {
+        for(int c = 0; c < 4; c++)
+            mdif_reverse(planes[c], sizes[c]);
+
+        return MDIF_ERROR_NONE;
+    }
+
+    unsigned char* scratch = (unsigned char*) mdif_mem_alloc(sizes[0]);
+    if(!scratch)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(image, c, &width, &height);
+
+        mdif_rotate_plane(planes[c], width, height, scratch, rotation);
+        memcpy(planes[c], scratch, sizes[c]);
+    }
+
+    mdif_mem_free(scratch);
+
+    short width = image->width;
+    image->width = image->height;
+    image->height = width;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_transpose(const mdif_t* image, mdif_t* output) {
+    return mdif_rotate_planes(image, output, MDIF_TRANSPOSE);
+}
+
+mdif_error_t mdif_transpose_inplace(mdif_t* image) {
+    return mdif_rotate_planes_inplace(image, MDIF_TRANSPOSE);
+}
+
+mdif_error_t mdif_rotate(const mdif_t* image, mdif_t* output, mdif_rotation_t rotation) {
+    if(rotation < MDIF_ROTATE_90 || rotation > MDIF_ROTATE_270)
+        return MDIF_ERROR_IMAGE;
+
+    return mdif_rotate_planes(image, output, rotation);
+}
+
+mdif_error_t mdif_rotate_inplace(mdif_t* image, mdif_rotation_t rotation) {
+    if(rotation < MDIF_ROTATE_90 || rotation > MDIF_ROTATE_270)
+        return MDIF_ERROR_IMAGE;
+
+    return mdif_rotate_planes_inplace(image, rotation);
+}
+
+mdif_error_t mdif_flip(const mdif_t* image, mdif_t* output, unsigned char vertical) {
+    mdif_error_t result = mdif_check_transform(image, output, false);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    unsigned char *source[4], *dest[4];
+    size_t sizes[4];
+
+    mdif_planes(image, source);
+    mdif_planes(output, dest);
+    mdif_plane_sizes(image, sizes);
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(image, c, &width, &height);
+
+        for(int y = 0; y < height; y++) {
+            const unsigned char* in = source[c] + (size_t) y * width;
+
+            if(vertical)
+                memcpy(dest[c] + (size_t) (height - 1 - y) * width, in, width);
+            else mdif_reverse_copy(in, dest[c] + (size_t) y * width, width);
+        }
+    }
+
+    mdif_copy_header(image, output);
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_flip_inplace(mdif_t* image, unsigned char vertical) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    unsigned char* planes[4];
+    size_t sizes[4];
+
+    mdif_planes(image, planes);
+    mdif_plane_sizes(image, sizes);
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(image, c, &width, &height);
+
+        if(vertical)
+            for(int y = 0; y < height / 2; y++)
+                mdif_swap(
+                    planes[c] + (size_t) y * width,
+                    planes[c] + (size_t) (height - 1 - y) * width,
+                    width
+                );
+        else for(int y = 0; y < height; y++)
+            mdif_reverse(planes[c] + (size_t) y * width, width);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+#define MDIF_SSIM_C1 (0.01 * 255 * 0.01 * 255)
+#define MDIF_SSIM_C2 (0.03 * 255 * 0.03 * 255)
+
+typedef struct mdif_block_sums_struct {
+    unsigned int a;
+    unsigned int b;
+    unsigned int aa;
+    unsigned int bb;
+    unsigned int ab;
+} mdif_block_sums_t;
+
+typedef struct mdif_compare_plane_struct {
+    const unsigned char *a;
+    const unsigned char *b;
+    unsigned char *diff;
+
+    int width;
+    int height;
+    int first;
+    bool windowed;
+} mdif_compare_plane_t;
+
+typedef struct mdif_compare_job_struct {
+    mdif_compare_plane_t planes[4];
+    int count;
+
+    unsigned char metrics;
+    void *lock;
+
+    volatile mdif_error_t result;
+    unsigned long long squares[4];
+    int max_diff[4];
+    double ssim[4];
+    unsigned long long windows[4];
+} mdif_compare_job_t;
+
+static int mdif_diff_row(
+    const unsigned char* a,
+    const unsigned char* b,
+    unsigned char* diff,
+    int count,
+    unsigned long long* squares
+) {
+    int x = 0, max_diff = 0;
+    unsigned long long sum = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128(),
+        maximum = zero,
+        total = zero;
+
+    for(; x + 16 <= count; x += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + x)),
+            vb = _mm_loadu_si128((const __m128i*) (b + x));
+        __m128i delta = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+
+        if(diff)
+            _mm_storeu_si128((__m128i*) (diff + x), delta);
+
+        maximum = _mm_max_epu8(maximum, delta);
+
+        __m128i low = _mm_unpacklo_epi8(delta, zero),
+            high = _mm_unpackhi_epi8(delta, zero);
+
+        total = _mm_add_epi32(total, _mm_add_epi32(
+            _mm_madd_epi16(low, low),
+            _mm_madd_epi16(high, high)
+        ));
+    }
+
+    maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 8));
+    maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 4));
+    maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 2));
+    maximum = _mm_max_epu8(maximum, _mm_srli_si128(maximum, 1));
+    max_diff = _mm_cvtsi128_si32(maximum) & 0xFF;
+
+    total = _mm_add_epi32(total, _mm_srli_si128(total, 8));
+    total = _mm_add_epi32(total, _mm_srli_si128(total, 4));
+    sum = (unsigned int) _mm_cvtsi128_si32(total);
+    #endif
+
+    for(; x < count; x++) {
+        int delta = a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+
+        if(diff)
+            diff[x] = (unsigned char) delta;
+
+        if(delta > max_diff)
+            max_diff = delta;
+
+        sum += (unsigned int) (delta * delta);
+    }
+
+    *squares += sum;
+    return max_diff;
+}
+
+static void mdif_block_sums(
+    const unsigned char* a,
+    const unsigned char* b,
+    int stride,
+    int rows,
+    int width,
+    mdif_block_sums_t* sums
+) {
+    int blocks = width / 4, i = 0;
+
+    #ifdef MDIF_SSE2
+    if(rows == 4) {
+        __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+
+        for(; i + 4 <= blocks; i += 4) {
+            __m128i acc[10];
+            for(int k = 0; k < 10; k++)
+                acc[k] = zero;
+
+            for(int r = 0; r < 4; r++) {
+                __m128i va = _mm_loadu_si128((const __m128i*) (a + r * stride + 4 * i)),
+                    vb = _mm_loadu_si128((const __m128i*) (b + r * stride + 4 * i));
+                __m128i halves[4] = {
+                    _mm_unpacklo_epi8(va, zero), _mm_unpackhi_epi8(va, zero),
+                    _mm_unpacklo_epi8(vb, zero), _mm_unpackhi_epi8(vb, zero)
+                };
+
+                for(int h = 0; h < 2; h++) {
+                    acc[h] = _mm_add_epi32(acc[h], _mm_madd_epi16(halves[h], ones));
+                    acc[2 + h] = _mm_add_epi32(acc[2 + h], _mm_madd_epi16(halves[2 + h], ones));
+                    acc[4 + h] = _mm_add_epi32(acc[4 + h], _mm_madd_epi16(halves[h], halves[h]));
+                    acc[6 + h] = _mm_add_epi32(acc[6 + h], _mm_madd_epi16(halves[2 + h], halves[2 + h]));
+                    acc[8 + h] = _mm_add_epi32(acc[8 + h], _mm_madd_epi16(halves[h], halves[2 + h]));
+                }
+            }
+
+            unsigned int values[10][2];
+            for(int k = 0; k < 10; k++) {
+                __m128i pairs = _mm_add_epi32(acc[k], _mm_srli_epi64(acc[k], 32));
+
+                values[k][0] = (unsigned int) _mm_cvtsi128_si32(pairs);
+                values[k][1] = (unsigned int) _mm_cvtsi128_si32(_mm_srli_si128(pairs, 8));
+            }
+
+            for(int j = 0; j < 4; j++) {
+                int h = j / 2, lane = j % 2;
+
+                sums[i + j].a = values[h][lane];
+                sums[i + j].b = values[2 + h][lane];
+                sums[i + j].aa = values[4 + h][lane];
+                sums[i + j].bb = values[6 + h][lane];
+                sums[i + j].ab = values[8 + h][lane];
+            }
+        }
+    }
+    #endif
+
+    for(; i < blocks; i++) {
+        mdif_block_sums_t block = {0, 0, 0, 0, 0};
+
+        for(int r = 0; r < rows; r++)
+            for(int x = 4 * i; x < 4 * i + 4; x++) {
+                unsigned int va = a[r * stride + x], vb = b[r * stride + x];
+
+                block.a += va;
+                block.b += vb;
+                block.aa += va * va;
+                block.bb += vb * vb;
+                block.ab += va * vb;
+            }
+
+        sums[i] = block;
+    }
+}
+
+static double mdif_ssim_window(
+    unsigned long long a,
+    unsigned long long b,
+    unsigned long long aa,
+    unsigned long long bb,
+    unsigned long long ab,
+    unsigned long long count
+) {
+    double mean_a = (double) a / count, mean_b = (double) b / count;
+    double var_a = (double) aa / count - mean_a * mean_a,
+        var_b = (double) bb / count - mean_b * mean_b,
+        covariance = (double) ab / count - mean_a * mean_b;
+
+    return ((2.0 * mean_a * mean_b + MDIF_SSIM_C1) * (2.0 * covariance + MDIF_SSIM_C2)) /
+        ((mean_a * mean_a + mean_b * mean_b + MDIF_SSIM_C1) * (var_a + var_b + MDIF_SSIM_C2));
+}
+
+static double mdif_ssim_row(const mdif_block_sums_t* above, const mdif_block_sums_t* below, int blocks) {
+    double total = 0.0;
+
+    for(int i = 0; i + 1 < blocks; i++)
+        total += mdif_ssim_window(
+            above[i].a + above[i + 1].a + below[i].a + below[i + 1].a,
+            above[i].b + above[i + 1].b + below[i].b + below[i + 1].b,
+            above[i].aa + above[i + 1].aa + below[i].aa + below[i + 1].aa,
+            above[i].bb + above[i + 1].bb + below[i].bb + below[i + 1].bb,
+            above[i].ab + above[i + 1].ab + below[i].ab + below[i + 1].ab,
+            64
+        );
+
+    return total;
+}
+
+static double mdif_ssim_plane(const unsigned char* a, const unsigned char* b, int width, int height) {
+    unsigned long long sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+
+    for(int i = 0; i < width * height; i++) {
+        sa += a[i];
+        sb += b[i];
+        saa += a[i] * a[i];
+        sbb += b[i] * b[i];
+        sab += a[i] * b[i];
+    }
+
+    return mdif_ssim_window(sa, sb, saa, sbb, sab, (unsigned long long) width * height);
+}
+
+static void mdif_compare_task(void* context, int begin, int end) {
+    mdif_compare_job_t* job = (mdif_compare_job_t*) context;
+
+    int max_width = 0;
+    for(int p = 0; p < job->count; p++)
+        if(job->planes[p].width > max_width)
+            max_width = job->planes[p].width;
+
+    mdif_block_sums_t* sums = NULL;
+    if(job->metrics & MDIF_METRIC_SSIM) {
+        sums = (mdif_block_sums_t*) mdif_scratch_alloc(2 * (max_width / 4 + 1) * sizeof(mdif_block_sums_t));
+
+        if(!sums) {
+            job->result = MDIF_ERROR_CANNOT_ALLOCATE;
+            return;
+        }
+    }
+
+    unsigned long long squares[4] = {0, 0, 0, 0}, windows[4] = {0, 0, 0, 0};
+    int max_diff[4] = {0, 0, 0, 0};
+    double ssim[4] = {0.0, 0.0, 0.0, 0.0};
+
+    int p = 0, previous = -1;
+    bool error = (job->metrics & MDIF_METRIC_ERROR) || job->planes[0].diff;
+
+    for(int unit = begin; unit < end; unit++) {
+        while(p + 1 < job->count && unit >= job->planes[p + 1].first)
+            p++;
+
+        const mdif_compare_plane_t* plane = &job->planes[p];
+        int band = unit - plane->first, top = 4 * band,
+            rows = plane->height - top < 4 ? plane->height - top : 4,
+            blocks = plane->width / 4;
+
+        if(error)
+            for(int y = top; y < top + rows; y++) {
+                size_t offset = (size_t) y * plane->width;
+                int row_max = mdif_diff_row(
+                    plane->a + offset,
+                    plane->b + offset,
+                    plane->diff ? plane->diff + offset : NULL,
+                    plane->width,
+                    &squares[p]
+                );
+
+                if(row_max > max_diff[p])
+                    max_diff[p] = row_max;
+            }
+
+        if(!sums)
+            continue;
+
+        if(!plane->windowed) {
+            if(band == 0) {
+                ssim[p] += mdif_ssim_plane(plane->a, plane->b, plane->width, plane->height);
+                windows[p]++;
+            }
+
+            continue;
+        }
+
+        if(rows < 4)
+            continue;
+
+        mdif_block_sums_t *current = sums + (band & 1) * (blocks + 1),
+            *above = sums + ((band + 1) & 1) * (blocks + 1);
+
+        if(band > 0 && previous != unit - 1)
+            mdif_block_sums(
+                plane->a + (size_t) (top - 4) * plane->width,
+                plane->b + (size_t) (top - 4) * plane->width,
+                plane->width, 4, plane->width, above
+            );
+
+        mdif_block_sums(
+            plane->a + (size_t) top * plane->width,
+            plane->b + (size_t) top * plane->width,
+            plane->width, 4, plane->width, current
+        );
+
+        if(band > 0) {
+            ssim[p] += mdif_ssim_row(above, current, blocks);
+            windows[p] += blocks - 1;
+        }
+
+        previous = unit;
+    }
+
+    if(sums)
+        mdif_scratch_free(sums);
+
+    mdif_lock_acquire(job->lock);
+    for(int c = 0; c < job->count; c++) {
+        job->squares[c] += squares[c];
+        job->ssim[c] += ssim[c];
+        job->windows[c] += windows[c];
+
+        if(max_diff[c] > job->max_diff[c])
+            job->max_diff[c] = max_diff[c];
+    }
+    mdif_lock_release(job->lock);
+}
+
+mdif_error_t mdif_compare(
+    const mdif_t* a,
+    const mdif_t* b,
+    unsigned char metrics,
+    mdif_metrics_t* results,
+    mdif_t* diff,
+    int threads
+) {
+    if(!a || !b || !a->red || !b->red || !results || (diff && !diff->red))
+        return MDIF_ERROR_IMAGE;
+
+    if(a->width != b->width || (diff && diff->width != a->width))
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(a->height != b->height || (diff && diff->height != a->height))
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    if(a->layout != b->layout || a->layout == MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_LAYOUT;
+
+    memset(results, 0, sizeof(mdif_metrics_t));
+
+    mdif_compare_job_t job;
+    memset(&job, 0, sizeof(job));
+
+    job.metrics = metrics;
+    job.result = MDIF_ERROR_NONE;
+
+    unsigned char *planes_a[4], *planes_b[4], *planes_diff[4];
+    size_t sizes[4];
+
+    mdif_planes(a, planes_a);
+    mdif_planes(b, planes_b);
+    mdif_plane_sizes(a, sizes);
+
+    if(diff)
+        mdif_planes(diff, planes_diff);
+
+    int units = 0;
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        mdif_compare_plane_t* plane = &job.planes[c];
+        mdif_plane_dims(a, c, &plane->width, &plane->height);
+
+        plane->a = planes_a[c];
+        plane->b = planes_b[c];
+        plane->diff = diff ? planes_diff[c] : NULL;
+        plane->first = units;
+        plane->windowed = plane->width >= 8 && plane->height >= 8;
+
+        units += (plane->height + 3) / 4;
+        job.count = c + 1;
+    }
+
+    job.lock = mdif_lock_create();
+    mdif_parallel(units, threads, mdif_compare_task, &job);
+    mdif_lock_destroy(job.lock);
+
+    if(job.result != MDIF_ERROR_NONE)
+        return job.result;
+
+    for(int c = 0; c < job.count; c++) {
+        size_t pixel_count = (size_t) job.planes[c].width * job.planes[c].height;
+
+        if((metrics & MDIF_METRIC_ERROR) || diff) {
+            results->max_diff[c] = job.max_diff[c];
+            results->mse[c] = (double) job.squares[c] / pixel_count;
+            results->psnr[c] = job.squares[c] ?
+                10.0 * log10(255.0 * 255.0 / results->mse[c]) : INFINITY;
+        }
+
+        if(metrics & MDIF_METRIC_SSIM)
+            results->ssim[c] = job.windows[c] ? job.ssim[c] / job.windows[c] : 1.0;
+    }
+
+    if(diff) {
+        diff->signature[0] = a->signature[0];
+        diff->signature[1] = a->signature[1];
+        diff->layout = a->layout;
+        diff->levels = 0;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+static unsigned int mdif_div255(unsigned int value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+#ifdef MDIF_SSE2
+static __m128i mdif_div255_epu16(__m128i value) {
+    return _mm_mulhi_epu16(_mm_adds_epu16(value, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+static __m128i mdif_mul255_epu8(__m128i a, __m128i b) {
+    __m128i zero = _mm_setzero_si128();
+
+    return _mm_packus_epi16(
+        mdif_div255_epu16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero))),
+        mdif_div255_epu16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)))
+    );
+}
+#endif
+
+static bool mdif_uniform_run(const unsigned char* alpha, int count, unsigned char value) {
+    unsigned int word = value * 0x01010101u, chunk;
+
+    int x = 0;
+    for(; x + 4 <= count; x += 4) {
+        memcpy(&chunk, alpha + x, 4);
+
+        if(chunk != word)
+            return false;
+    }
+
+    for(; x < count; x++)
+        if(alpha[x] != value)
+            return false;
+
+    return true;
+}
+
+static void mdif_premultiply_row(unsigned char* planes[3], const unsigned char* alpha, int count) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+    for(; x + 16 <= count; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (alpha + x));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(a, opaque)) == 0xFFFF)
+            continue;
+
+        for(int c = 0; c < 3; c++)
+            _mm_storeu_si128((__m128i*) (planes[c] + x), mdif_mul255_epu8(
+                _mm_loadu_si128((const __m128i*) (planes[c] + x)), a
+            ));
+    }
+    #endif
+
+    for(; x < count; x += 4) {
+        int run = count - x < 4 ? count - x : 4;
+        if(mdif_uniform_run(alpha + x, run, 255))
+            continue;
+
+        for(int i = x; i < x + run; i++)
+            for(int c = 0; c < 3; c++)
+                planes[c][i] = (unsigned char) mdif_div255(planes[c][i] * alpha[i]);
+    }
+}
+
+static void mdif_unpremultiply_row(unsigned char* planes[3], const unsigned char* alpha, int count) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i opaque = _mm_set1_epi8((char) 0xFF), zero = _mm_setzero_si128();
+    __m128 scale = _mm_set1_ps(255.0f), one = _mm_set1_ps(1.0f);
+
+    for(; x + 16 <= count; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (alpha + x));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(a, opaque)) == 0xFFFF)
+            continue;
+
+        __m128i transparent = _mm_cmpeq_epi8(a, zero);
+        __m128 bias[4], divisor[4];
+
+        __m128i a16[2] = {_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero)};
+        for(int q = 0; q < 4; q++) {
+            __m128i a32 = q % 2 == 0 ?
+                _mm_unpacklo_epi16(a16[q / 2], zero) :
+                _mm_unpackhi_epi16(a16[q / 2], zero);
+
+            divisor[q] = _mm_max_ps(_mm_cvtepi32_ps(a32), one);
+            bias[q] = _mm_cvtepi32_ps(_mm_srli_epi32(a32, 1));
+        }
+
+        for(int c = 0; c < 3; c++) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (planes[c] + x));
+            __m128i v16[2] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)}, out32[4];
+
+            for(int q = 0; q < 4; q++) {
+                __m128i v32 = q % 2 == 0 ?
+                    _mm_unpacklo_epi16(v16[q / 2], zero) :
+                    _mm_unpackhi_epi16(v16[q / 2], zero);
+
+                __m128 numerator = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v32), scale), bias[q]);
+                out32[q] = _mm_cvttps_epi32(_mm_div_ps(numerator, divisor[q]));
+            }
+
+            __m128i out = _mm_packus_epi16(
+                _mm_packs_epi32(out32[0], out32[1]),
+                _mm_packs_epi32(out32[2], out32[3])
+            );
+
+            _mm_storeu_si128((__m128i*) (planes[c] + x), _mm_andnot_si128(transparent, out));
+        }
+    }
+
+    #endif
+
+    for(; x < count; x += 4) {
+        int run = count - x < 4 ? count - x : 4;
+        if(mdif_uniform_run(alpha + x, run, 255))
+            continue;
+
+        for(int i = x; i < x + run; i++)
+            for(int c = 0; c < 3; c++) {
+                unsigned int a = alpha[i], value = a ? (planes[c][i] * 255 + a / 2) / a : 0;
+                planes[c][i] = (unsigned char) (value > 255 ? 255 : value);
+            }
+    }
+}
+
+static mdif_error_t mdif_alpha_pass(
+    mdif_t* image,
+    void (*row)(unsigned char* planes[3], const unsigned char* alpha, int count)
+) {
+    if(!image || !image->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(image->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    unsigned char* planes[3] = {image->red, image->green, image->blue};
+    for(int y = 0; y < image->height; y++) {
+        size_t offset = (size_t) y * image->width;
+        unsigned char* rows[3] = {planes[0] + offset, planes[1] + offset, planes[2] + offset};
+
+        row(rows, image->alpha + offset, image->width);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_premultiply(mdif_t* image) {
+    return mdif_alpha_pass(image, mdif_premultiply_row);
+}
+
+mdif_error_t mdif_unpremultiply(mdif_t* image) {
+    return mdif_alpha_pass(image, mdif_unpremultiply_row);
+}
+
+static unsigned char mdif_blend_value(
+    unsigned int source,
+    unsigned int dest,
+    unsigned int source_alpha,
+    unsigned int dest_alpha,
+    mdif_blend_t mode
+) {
+    unsigned int value;
+
+    switch(mode) {
+        case MDIF_BLEND_ADD:
+            value = source + dest;
+            break;
+
+        case MDIF_BLEND_MULTIPLY:
+            value = source * dest + source * (255 - dest_alpha) + dest * (255 - source_alpha);
+            value = mdif_div255(value > 65535 ? 65535 : value);
+            break;
+
+        case MDIF_BLEND_SCREEN:
+            value = source + dest - mdif_div255(source * dest);
+            break;
+
+        default:
+            value = source + mdif_div255(dest * (255 - source_alpha));
+            break;
+    }
+
+    return (unsigned char) (value > 255 ? 255 : value);
+}
+
+static void mdif_composite_row(
+    unsigned char* dest[4],
+    const unsigned char* source[4],
+    int count,
+    mdif_blend_t mode
+) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    __m128i zero = _mm_setzero_si128(), opaque = _mm_set1_epi8((char) 0xFF);
+
+    for(; x + 16 <= count; x += 16) {
+        __m128i sa = _mm_loadu_si128((const __m128i*) (source[3] + x));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(sa, zero)) == 0xFFFF)
+            continue;
+
+        if(mode == MDIF_BLEND_OVER && _mm_movemask_epi8(_mm_cmpeq_epi8(sa, opaque)) == 0xFFFF) {
+            for(int c = 0; c < 4; c++)
+                memcpy(dest[c] + x, source[c] + x, 16);
+
+            continue;
+        }
+
+        __m128i da = _mm_loadu_si128((const __m128i*) (dest[3] + x)),
+            inverse_sa = _mm_xor_si128(sa, opaque),
+            inverse_da = _mm_xor_si128(da, opaque);
+
+        for(int c = 0; c < 4; c++) {
+            __m128i s = _mm_loadu_si128((const __m128i*) (source[c] + x)),
+                d = _mm_loadu_si128((const __m128i*) (dest[c] + x)), out;
+
+            if(mode == MDIF_BLEND_ADD)
+                out = _mm_adds_epu8(s, d);
+            else if(mode == MDIF_BLEND_MULTIPLY && c < 3) {
+                __m128i halves[2];
+
+                for(int h = 0; h < 2; h++) {
+                    __m128i s16 = h ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero),
+                        d16 = h ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero),
+                        isa16 = h ? _mm_unpackhi_epi8(inverse_sa, zero) : _mm_unpacklo_epi8(inverse_sa, zero),
+                        ida16 = h ? _mm_unpackhi_epi8(inverse_da, zero) : _mm_unpacklo_epi8(inverse_da, zero);
+
+                    __m128i sum = _mm_adds_epu16(
+                        _mm_adds_epu16(_mm_mullo_epi16(s16, d16), _mm_mullo_epi16(s16, ida16)),
+                        _mm_mullo_epi16(d16, isa16)
+                    );
+
+                    halves[h] = mdif_div255_epu16(sum);
+                }
+
+                out = _mm_packus_epi16(halves[0], halves[1]);
+            }
+            else if(mode == MDIF_BLEND_SCREEN && c < 3)
+                out = _mm_adds_epu8(s, _mm_sub_epi8(d, mdif_mul255_epu8(s, d)));
+            else out = _mm_adds_epu8(s, mdif_mul255_epu8(d, inverse_sa));
+
+            _mm_storeu_si128((__m128i*) (dest[c] + x), out);
+        }
+    }
+    #endif
+
+    for(; x < count; x += 4) {
+        int run = count - x < 4 ? count - x : 4;
+        if(mdif_uniform_run(source[3] + x, run, 0))
+            continue;
+
+        if(mode == MDIF_BLEND_OVER && mdif_uniform_run(source[3] + x, run, 255)) {
+            for(int c = 0; c < 4; c++)
+                memcpy(dest[c] + x, source[c] + x, run);
+
+            continue;
+        }
+
+        for(int i = x; i < x + run; i++) {
+            unsigned int sa = source[3][i], da = dest[3][i];
+
+            for(int c = 0; c < 3; c++)
+                dest[c][i] = mdif_blend_value(source[c][i], dest[c][i], sa, da, mode);
+
+            dest[3][i] = mdif_blend_value(sa, da, sa, da,
+                mode == MDIF_BLEND_ADD ? MDIF_BLEND_ADD : MDIF_BLEND_OVER);
+        }
+    }
+}
+
+mdif_error_t mdif_composite(mdif_t* dest, const mdif_t* source, int x, int y, mdif_blend_t mode) {
+    if(!dest || !source || !dest->red || !source->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(dest->layout != MDIF_LAYOUT_RGBA || source->layout != MDIF_LAYOUT_RGBA)
+        return MDIF_ERROR_LAYOUT;
+
+    if(mode < MDIF_BLEND_OVER || mode > MDIF_BLEND_SCREEN)
+        return MDIF_ERROR_IMAGE;
+
+    int left = x < 0 ? -x : 0, top = y < 0 ? -y : 0,
+        right = dest->width - x < source->width ? dest->width - x : source->width,
+        bottom = dest->height - y < source->height ? dest->height - y : source->height;
+
+    if(left >= right || top >= bottom)
+        return MDIF_ERROR_NONE;
+
+    unsigned char *source_planes[4], *dest_planes[4];
+    mdif_planes(source, source_planes);
+    mdif_planes(dest, dest_planes);
+
+    for(int row = top; row < bottom; row++) {
+        size_t source_offset = (size_t) row * source->width + left,
+            dest_offset = (size_t) (row + y) * dest->width + left + x;
+
+        unsigned char* out[4];
+        const unsigned char* in[4];
+
+        for(int c = 0; c < 4; c++) {
+            in[c] = source_planes[c] + source_offset;
+            out[c] = dest_planes[c] + dest_offset;
+        }
+
+        mdif_composite_row(out, in, right - left, mode);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+#ifndef ARDUINO
+
+#define MDIF_SEQUENCE_HEADER_SIZE 18
+
+static bool mdif_rows_equal(const unsigned char* a, const unsigned char* b, int count) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    for(; x + 16 <= count; x += 16) {
+        __m128i equal = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*) (a + x)),
+            _mm_loadu_si128((const __m128i*) (b + x))
+        );
+
+        if(_mm_movemask_epi8(equal) != 0xFFFF)
+            return false;
+    }
+    #endif
+
+    for(; x < count; x++)
+        if(a[x] != b[x])
+            return false;
+
+    return true;
+}
+
+static void mdif_xor_row(unsigned char* out, const unsigned char* a, const unsigned char* b, int count) {
+    int x = 0;
+
+    #ifdef MDIF_SSE2
+    for(; x + 16 <= count; x += 16)
+        _mm_storeu_si128((__m128i*) (out + x), _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*) (a + x)),
+            _mm_loadu_si128((const __m128i*) (b + x))
+        ));
+    #endif
+
+    for(; x < count; x++)
+        out[x] = a[x] ^ b[x];
+}
+
+static size_t mdif_sequence_frame_size(const mdif_sequence_t* sequence, size_t* payload_size) {
+    unsigned char* planes[4];
+    size_t sizes[4], frame_size = 0;
+    mdif_file_planes(&sequence->reference, planes, sizes);
+
+    *payload_size = 0;
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(&sequence->reference, c, &width, &height);
+
+        size_t tiles = (size_t) ((width + sequence->tile - 1) / sequence->tile) *
+            ((height + sequence->tile - 1) / sequence->tile);
+
+        frame_size += sizes[c];
+        *payload_size += sizes[c] + (tiles + 7) / 8;
+    }
+
+    return frame_size;
+}
+
+static size_t mdif_sequence_encode(mdif_sequence_t* sequence, const mdif_t* frame) {
+    unsigned char *current[4], *previous[4];
+    size_t sizes[4];
+
+    mdif_file_planes(frame, current, sizes);
+    mdif_file_planes(&sequence->reference, previous, sizes);
+
+    int tile = sequence->tile;
+    unsigned char* out = sequence->buffer;
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(frame, c, &width, &height);
+
+        int columns = (width + tile - 1) / tile,
+            rows = (height + tile - 1) / tile;
+
+        unsigned char* bitmap = out;
+        memset(bitmap, 0, (columns * rows + 7) / 8);
+        out += (columns * rows + 7) / 8;
+
+        for(int ty = 0; ty < rows; ty++)
+            for(int tx = 0; tx < columns; tx++) {
+                int x = tx * tile, top = ty * tile,
+                    tile_width = width - x < tile ? width - x : tile,
+                    bottom = top + tile < height ? top + tile : height;
+
+                int y = top;
+                while(y < bottom && mdif_rows_equal(
+                    current[c] + (size_t) y * width + x,
+                    previous[c] + (size_t) y * width + x,
+                    tile_width
+                ))
+                    y++;
+
+                if(y == bottom)
+                    continue;
+
+                int index = ty * columns + tx;
+                bitmap[index >> 3] |= (unsigned char) (1 << (index & 7));
+
+                for(y = top; y < bottom; y++, out += tile_width)
+                    mdif_xor_row(
+                        out,
+                        current[c] + (size_t) y * width + x,
+                        previous[c] + (size_t) y * width + x,
+                        tile_width
+                    );
+            }
+    }
+
+    return (size_t) (out - sequence->buffer);
+}
+
+static bool mdif_sequence_apply(mdif_sequence_t* sequence, size_t size) {
+    unsigned char* planes[4];
+    size_t sizes[4];
+    mdif_file_planes(&sequence->reference, planes, sizes);
+
+    int tile = sequence->tile;
+    const unsigned char *data = sequence->buffer, *end = sequence->buffer + size;
+
+    for(int c = 0; c < 4; c++) {
+        if(!sizes[c])
+            continue;
+
+        int width, height;
+        mdif_plane_dims(&sequence->reference, c, &width, &height);
+
+        int columns = (width + tile - 1) / tile,
+            rows = (height + tile - 1) / tile;
+
+        const unsigned char* bitmap = data;
+        if((size_t) (end - data) < (size_t) (columns * rows + 7) / 8)
+            return false;
+
+        data += (columns * rows + 7) / 8;
+        for(int index = 0; index < columns * rows; index++) {
+            if(!(bitmap[index >> 3] & (1 << (index & 7))))
+                continue;
+
+            int x = (index % columns) * tile, top = (index / columns) * tile,
+                tile_width = width - x < tile ? width - x : tile,
+                bottom = top + tile < height ? top + tile : height;
+
+            if((size_t) (end - data) < (size_t) tile_width * (bottom - top))
+                return false;
+
+            for(int y = top; y < bottom; y++, data += tile_width) {
+                unsigned char* row = planes[c] + (size_t) y * width + x;
+                mdif_xor_row(row, row, data, tile_width);
+            }
+        }
+    }
+
+    return data == end;
+}
+
+static void mdif_sequence_release(mdif_sequence_t* sequence) {
+    if(sequence->reference.red)
+        mdif_free(&sequence->reference);
+
+    free(sequence->buffer);
+    free(sequence->offsets);
+    free(sequence->keyframes);
+
+    sequence->handle = NULL;
+    sequence->buffer = NULL;
+    sequence->offsets = NULL;
+    sequence->keyframes = NULL;
+}
+
+static mdif_error_t mdif_sequence_setup(mdif_sequence_t* sequence) {
+    sequence->position = 0;
+    sequence->decoded = 0;
+    sequence->buffer = NULL;
+    sequence->reference.red = sequence->reference.green = NULL;
+    sequence->reference.blue = sequence->reference.alpha = NULL;
+    sequence->reference.pool = NULL;
+
+    mdif_t header;
+    header.width = sequence->width;
+    header.height = sequence->height;
+    header.layout = sequence->layout;
+    header.levels = 0;
+
+    mdif_error_t result = mdif_check_header(&header);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    if(sequence->tile < 1)
+        return MDIF_ERROR_SEQUENCE;
+
+    result = mdif_init_layout(
+        &sequence->reference,
+        sequence->width,
+        sequence->height,
+        (mdif_layout_t) sequence->layout
+    );
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    size_t payload_size;
+    mdif_sequence_frame_size(sequence, &payload_size);
+
+    sequence->buffer = (unsigned char*) malloc(payload_size);
+    if(!sequence->buffer)
+        return MDIF_ERROR_CANNOT_ALLOCATE;
+
+    return MDIF_ERROR_NONE;
+}
+
+static bool mdif_sequence_write_header(mdif_file_t* file, const mdif_sequence_t* sequence, unsigned int index) {
+    unsigned char fields[2] = {sequence->layout, sequence->tile};
+
+    return mdif_file_write(file, "NS", 2) &&
+        mdif_file_write(file, &sequence->width, sizeof(short)) &&
+        mdif_file_write(file, &sequence->height, sizeof(short)) &&
+        mdif_file_write(file, fields, 2) &&
+        mdif_file_write(file, &sequence->interval, sizeof(unsigned short)) &&
+        mdif_file_write(file, &sequence->count, sizeof(unsigned int)) &&
+        mdif_file_write(file, &index, sizeof(unsigned int));
+}
+
+mdif_error_t mdif_sequence_create(
+    mdif_sequence_t* sequence,
+    const char* filename,
+    short width,
+    short height,
+    mdif_layout_t layout,
+    unsigned char tile,
+    unsigned short interval
+) {
+    if(!sequence)
+        return MDIF_ERROR_SEQUENCE;
+
+    sequence->handle = NULL;
+    sequence->writing = true;
+    sequence->width = width;
+    sequence->height = height;
+    sequence->layout = (unsigned char) layout;
+    sequence->tile = tile ? tile : MDIF_SEQUENCE_TILE;
+    sequence->interval = interval;
+    sequence->count = 0;
+    sequence->capacity = 0;
+    sequence->offsets = NULL;
+    sequence->keyframes = NULL;
+
+    if(layout < MDIF_LAYOUT_RGBA || layout > MDIF_LAYOUT_YCBCR420)
+        return MDIF_ERROR_LAYOUT;
+
+    mdif_error_t result = mdif_sequence_setup(sequence);
+    if(result != MDIF_ERROR_NONE) {
+        mdif_sequence_release(sequence);
+        return result;
+    }
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, true)) {
+        mdif_sequence_release(sequence);
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+    }
+
+    sequence->handle = file.handle;
+    if(!mdif_sequence_write_header(&file, sequence, 0)) {
+        mdif_file_close(&file);
+        mdif_sequence_release(sequence);
+
+        return MDIF_ERROR_WRITE;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_sequence_append(mdif_sequence_t* sequence, const mdif_t* frame) {
+    if(!sequence || !sequence->writing || !sequence->handle)
+        return MDIF_ERROR_SEQUENCE;
+
+    if(!frame || !frame->red)
+        return MDIF_ERROR_IMAGE;
+
+    if(frame->width != sequence->width ||
+        frame->height != sequence->height ||
+        frame->layout != sequence->layout)
+        return MDIF_ERROR_SEQUENCE;
+
+    if(sequence->count == sequence->capacity) {
+        unsigned int capacity = sequence->capacity ? 2 * sequence->capacity : 64;
+        unsigned int* offsets = (unsigned int*) realloc(sequence->offsets, capacity * sizeof(unsigned int));
+        if(!offsets)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        sequence->offsets = offsets;
+
+        unsigned char* keyframes = (unsigned char*) realloc(sequence->keyframes, capacity);
+        if(!keyframes)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        sequence->keyframes = keyframes;
+        sequence->capacity = capacity;
+    }
+
+    mdif_file_t file;
+    file.handle = (FILE*) sequence->handle;
+
+    long offset = ftell(file.handle);
+    if(offset < 0)
+        return MDIF_ERROR_WRITE;
+
+    size_t payload_size, frame_size = mdif_sequence_frame_size(sequence, &payload_size);
+    bool keyframe = sequence->count == 0 ||
+        (sequence->interval && sequence->decoded >= sequence->interval);
+
+    size_t size = frame_size;
+    if(!keyframe) {
+        size = mdif_sequence_encode(sequence, frame);
+        keyframe = size >= frame_size / 2;
+    }
+
+    if(keyframe)
+        size = frame_size;
+
+    unsigned char kind = keyframe ? 1 : 0;
+    unsigned int stored_size = (unsigned int) size;
+
+    bool written = mdif_file_write(&file, &kind, 1) &&
+        mdif_file_write(&file, &stored_size, sizeof(unsigned int));
+
+    if(keyframe) {
+        unsigned char *planes[4], *reference[4];
+        size_t sizes[4];
+
+        mdif_file_planes(frame, planes, sizes);
+        mdif_file_planes(&sequence->reference, reference, sizes);
+
+        for(int c = 0; c < 4 && written; c++)
+            if(sizes[c]) {
+                written = mdif_file_write(&file, planes[c], sizes[c]);
+                memcpy(reference[c], planes[c], sizes[c]);
+            }
+
+        sequence->decoded = 1;
+    }
+    else {
+        written = written && mdif_file_write(&file, sequence->buffer, size);
+
+        mdif_sequence_apply(sequence, size);
+        sequence->decoded++;
+    }
+
+    if(!written)
+        return MDIF_ERROR_WRITE;
+
+    sequence->offsets[sequence->count] = (unsigned int) offset;
+    sequence->keyframes[sequence->count] = kind;
+    sequence->count++;
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_sequence_open(mdif_sequence_t* sequence, const char* filename) {
+    if(!sequence)
+        return MDIF_ERROR_SEQUENCE;
+
+    sequence->handle = NULL;
+    sequence->writing = false;
+    sequence->capacity = 0;
+    sequence->offsets = NULL;
+    sequence->keyframes = NULL;
+    sequence->buffer = NULL;
+    sequence->reference.red = NULL;
+
+    mdif_file_t file;
+    if(!mdif_file_open(&file, filename, false))
+        return MDIF_ERROR_INVALID_FILE_HANDLE;
+
+    char signature[2];
+    unsigned char fields[2];
+    unsigned int index = 0;
+
+    if(!mdif_file_read(&file, signature, 2)) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_READ;
+    }
+
+    if(strncmp(signature, "NS", 2) != 0) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_INVALID_SIGNATURE;
+    }
+
+    if(!mdif_file_read(&file, &sequence->width, sizeof(short)) ||
+        !mdif_file_read(&file, &sequence->height, sizeof(short)) ||
+        !mdif_file_read(&file, fields, 2) ||
+        !mdif_file_read(&file, &sequence->interval, sizeof(unsigned short)) ||
+        !mdif_file_read(&file, &sequence->count, sizeof(unsigned int)) ||
+        !mdif_file_read(&file, &index, sizeof(unsigned int))) {
+        mdif_file_close(&file);
+        return MDIF_ERROR_READ;
+    }
+
+    sequence->layout = fields[0];
+    sequence->tile = fields[1];
+
+    unsigned long size = 0;
+    mdif_error_t result = mdif_sequence_setup(sequence);
+    if(result == MDIF_ERROR_NONE && !mdif_file_size(&file, &size))
+        result = MDIF_ERROR_READ;
+
+    if(result == MDIF_ERROR_NONE && (index < MDIF_SEQUENCE_HEADER_SIZE ||
+        index > size || (size - index) / 5 < sequence->count))
+        result = MDIF_ERROR_SEQUENCE;
+
+    if(result == MDIF_ERROR_NONE && sequence->count > 0) {
+        sequence->offsets = (unsigned int*) malloc(sequence->count * sizeof(unsigned int));
+        sequence->keyframes = (unsigned char*) malloc(sequence->count);
+
+        if(!sequence->offsets || !sequence->keyframes)
+            result = MDIF_ERROR_CANNOT_ALLOCATE;
+        else if(!mdif_file_seek(&file, index) ||
+            !mdif_file_read(&file, sequence->offsets, sequence->count * sizeof(unsigned int)) ||
+            !mdif_file_read(&file, sequence->keyframes, sequence->count))
+            result = MDIF_ERROR_READ;
+        else if(!sequence->keyframes[0])
+            result = MDIF_ERROR_SEQUENCE;
+        else sequence->capacity = sequence->count;
+    }
+
+    if(result != MDIF_ERROR_NONE) {
+        mdif_file_close(&file);
+        mdif_sequence_release(sequence);
+
+        return result;
+    }
+
+    sequence->handle = file.handle;
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_sequence_decode(mdif_sequence_t* sequence, unsigned int index) {
+    mdif_file_t file;
+    file.handle = (FILE*) sequence->handle;
+
+    unsigned char kind;
+    unsigned int size;
+
+    sequence->decoded = 0;
+    if(!mdif_file_seek(&file, sequence->offsets[index]) ||
+        !mdif_file_read(&file, &kind, 1) ||
+        !mdif_file_read(&file, &size, sizeof(unsigned int)) ||
+        kind != sequence->keyframes[index])
+        return MDIF_ERROR_READ;
+
+    size_t payload_size, frame_size = mdif_sequence_frame_size(sequence, &payload_size);
+    if(kind) {
+        if(size != frame_size)
+            return MDIF_ERROR_READ;
+
+        mdif_error_t result = mdif_read_planes(&file, &sequence->reference);
+        if(result != MDIF_ERROR_NONE)
+            return result;
+    }
+    else if(size > payload_size ||
+        !mdif_file_read(&file, sequence->buffer, size) ||
+        !mdif_sequence_apply(sequence, size))
+        return MDIF_ERROR_READ;
+
+    sequence->decoded = index + 1;
+    return MDIF_ERROR_NONE;
+}
+
+static mdif_error_t mdif_sequence_prepare(mdif_sequence_t* sequence, unsigned int index) {
+    if(sequence->keyframes[index])
+        return MDIF_ERROR_NONE;
+
+    unsigned int start = index;
+    while(!sequence->keyframes[start])
+        start--;
+
+    if(sequence->decoded > start && sequence->decoded <= index)
+        start = sequence->decoded;
+
+    for(unsigned int i = start; i < index; i++) {
+        mdif_error_t result = mdif_sequence_decode(sequence, i);
+        if(result != MDIF_ERROR_NONE)
+            return result;
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_sequence_read(mdif_sequence_t* sequence, mdif_t* frame) {
+    if(!sequence || sequence->writing || !sequence->handle)
+        return MDIF_ERROR_SEQUENCE;
+
+    if(!frame)
+        return MDIF_ERROR_IMAGE;
+
+    if(sequence->position >= sequence->count)
+        return MDIF_ERROR_SEQUENCE;
+
+    mdif_error_t result = mdif_sequence_prepare(sequence, sequence->position);
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_sequence_decode(sequence, sequence->position);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_reserve_planes(frame, (size_t) sequence->width * sequence->height);
+
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    frame->signature[0] = sequence->reference.signature[0];
+    frame->signature[1] = sequence->reference.signature[1];
+    frame->width = sequence->width;
+    frame->height = sequence->height;
+    frame->layout = sequence->layout;
+    frame->levels = 0;
+
+    unsigned char *planes[4], *reference[4];
+    size_t sizes[4];
+
+    mdif_file_planes(frame, planes, sizes);
+    mdif_file_planes(&sequence->reference, reference, sizes);
+
+    for(int c = 0; c < 4; c++)
+        if(sizes[c])
+            memcpy(planes[c], reference[c], sizes[c]);
+
+    sequence->position++;
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_sequence_seek(mdif_sequence_t* sequence, unsigned int index) {
+    if(!sequence || sequence->writing || !sequence->handle || index >= sequence->count)
+        return MDIF_ERROR_SEQUENCE;
+
+    mdif_error_t result = mdif_sequence_prepare(sequence, index);
+    if(result != MDIF_ERROR_NONE)
+        return result;
+
+    sequence->position = index;
+    return MDIF_ERROR_NONE;
+}
+
+mdif_error_t mdif_sequence_close(mdif_sequence_t* sequence) {
+    if(!sequence || !sequence->handle)
+        return MDIF_ERROR_SEQUENCE;
+
+    mdif_file_t file;
+    file.handle = (FILE*) sequence->handle;
+
+    bool written = true;
+    if(sequence->writing) {
+        long index = ftell(file.handle);
+
+        written = index >= 0 &&
+            (!sequence->count || (
+                mdif_file_write(&file, sequence->offsets, sequence->count * sizeof(unsigned int)) &&
+                mdif_file_write(&file, sequence->keyframes, sequence->count)
+            )) &&
+            mdif_file_seek(&file, 0) &&
+            mdif_sequence_write_header(&file, sequence, (unsigned int) index);
+
+        written = fclose(file.handle) == 0 && written;
+    }
+    else mdif_file_close(&file);
+
+    mdif_sequence_release(sequence);
+    return written ? MDIF_ERROR_NONE : MDIF_ERROR_WRITE;
+}
+
+#endif
+
+const char* mdif_error_message(mdif_error_t error_num) {
+    switch(error_num) {
+        case MDIF_ERROR_IO:
+            return "I/O error";
+
+        case MDIF_ERROR_NONE:
+            return "None";
+
+        case MDIF_ERROR_INVALID_SIGNATURE:
+            return "Invalid MDIF signature";
+
+        case MDIF_ERROR_CANNOT_ALLOCATE:
+            return "Canot allocate memory for channels";
+
+        case MDIF_ERROR_INVALID_WIDTH:
+            return "Invalid image width (> 1024)";
+
+        case MDIF_ERROR_INVALID_HEIGHT:
+            return "Invalid image height (> 1024)";
+
+        case MDIF_ERROR_READ:
+            return "Error reading MDIF file";
+
+        case MDIF_ERROR_WRITE:
+            return "Error writing MDIF file";
+
+        case MDIF_ERROR_INVALID_FILE_HANDLE:
+            return "Invalid file handle";
+
+        case MDIF_ERROR_IMAGE:
+            return "Image error";
+
+        case MDIF_ERROR_GRAYSCALE:
+            return "Invalid grayscale pointer";
+
+        case MDIF_ERROR_POOL:
+            return "Invalid image pool";
+
+        case MDIF_ERROR_ARENA_BUSY:
+            return "Static arena is in use";
+
+        case MDIF_ERROR_KERNEL:
+            return "Invalid convolution kernel or structuring element";
+
+        case MDIF_ERROR_AUGMENT:
+            return "Invalid augmentation operations";
+
+        case MDIF_ERROR_PIPELINE:
+            return "Invalid pipeline";
+
+        case MDIF_ERROR_LAYOUT:
+            return "Unsupported plane layout";
+
+        case MDIF_ERROR_LEVEL:
+            return "Invalid pyramid level";
+
+        case MDIF_ERROR_FACTOR:
+            return "Invalid subsampling factor";
+
+        case MDIF_ERROR_SEQUENCE:
+            return "Invalid frame sequence";
+
+        case MDIF_ERROR_LUT:
+            return "Invalid lookup table";
+
+        case MDIF_ERROR_SIZE:
+            return "File size does not match the image header";
+
+        case MDIF_ERROR_THRESHOLD:
+            return "Invalid threshold or labeling parameters";
+
+        case MDIF_ERROR_COMPONENTS:
+            return "Too many connected components";
+
+        case MDIF_ERROR_FEATURE:
+            return "Invalid feature extraction parameters";
+
+        case MDIF_ERROR_PALETTE:
+            return "Invalid palette size or dithering method";
+
+        case MDIF_ERROR_CACHE:
+            return "Invalid cache";
+
+        case MDIF_ERROR_CACHE_MISS:
+            return "Result not found in the cache";
+    }
+
+    return "Unknown error";
 }
\ No newline at end of file
@@ -1,154 +1,2198 @@
-/* 
- * Copyright 2024 Nathanne Isip
- * 
- * Licensed under the Apache License, Version 2.0 (the "License");
- * you may not use this file except in compliance with the License.
- * You may obtain a copy of the License at
- * 
- *     http://www.apache.org/licenses/LICENSE-2.0
- * 
- * Unless required by applicable law or agreed to in writing, software
- * distributed under the License is distributed on an "AS IS" BASIS,
- * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
- * See the License for the specific language governing permissions and
- * limitations under the License.
- */
-
-/**
- * @file mdif.h
- * @author [Nathanne Isip](https://github.com/nthnn)
- * @brief Minimal Data Image Format (MDIF) Header File
- * 
- * This file contains the data structures and function prototypes for working with the MDIF format.
- * The MDIF format is a lightweight, simple image format designed for use with both desktop environments
- * and microcontroller environments such as the Raspberry Pi Pico and ESP32 family.
- * It supports basic image functionalities such as reading, writing, and converting to grayscale.
- * 
- */
-
-#ifndef MDIF_H
-#define MDIF_H
-
-/**
- * @brief MDIF image structure.
- * 
- * This structure represents an image in the MDIF format. It contains the image signature,
- * width, height, and separate color channels for red, green, blue, and alpha.
- */
-typedef struct mdif_struct {
-    char signature[2];         /**< Signature to identify the file as an MDIF image. */
-
-    short width;               /**< Width of the image. */
-    short height;              /**< Height of the image. */
-
-    unsigned char *red;        /**< Pointer to the red channel data. */
-    unsigned char *blue;       /**< Pointer to the blue channel data. */
-    unsigned char *green;      /**< Pointer to the green channel data. */
-    unsigned char *alpha;      /**< Pointer to the alpha channel data. */
-} mdif_t;
-
-/**
- * @brief MDIF error codes.
- * 
- * This enumeration defines the possible error codes that can be returned by MDIF functions.
- */
-typedef enum mdif_error {
-    MDIF_ERROR_IO,                /**< General I/O error. */
-    MDIF_ERROR_NONE,              /**< No error. */
-    MDIF_ERROR_INVALID_SIGNATURE, /**< Invalid MDIF signature. */
-    MDIF_ERROR_CANNOT_ALLOCATE,   /**< Memory allocation error. */
-    MDIF_ERROR_INVALID_WIDTH,     /**< Invalid image width (greater than 1024). */
-    MDIF_ERROR_INVALID_HEIGHT,    /**< Invalid image height (greater than 1024). */
-    MDIF_ERROR_READ,              /**< Error reading MDIF file. */
-    MDIF_ERROR_WRITE,             /**< Error writing MDIF file. */
-    MDIF_ERROR_INVALID_FILE_HANDLE,/**< Invalid file handle. */
-    MDIF_ERROR_IMAGE,             /**< Generic image error. */
-    MDIF_ERROR_GRAYSCALE          /**< Invalid grayscale pointer. */
-} mdif_error_t;
-
-/**
- * @brief Initialize an MDIF image.
- * 
- * This function initializes an MDIF image structure with the specified width and height.
- * It allocates memory for the red, green, blue, and alpha channels.
- * 
- * @param[in,out] image Pointer to the MDIF image structure to be initialized.
- * @param[in] width Width of the image.
- * @param[in] height Height of the image.
- */
-void mdif_init(mdif_t* image, short width, short height);
-
-/**
- * @brief Free the memory allocated for an MDIF image.
- * 
- * This function frees the memory allocated for the red, green, blue, and alpha channels of an MDIF image.
- * 
- * @param[in,out] image Pointer to the MDIF image structure to be freed.
- */
-void mdif_free(mdif_t* image);
-
-/**
- * @brief Read an MDIF image from a file.
- * 
- * This function reads an MDIF image from the specified file. It reads the image signature,
- * width, height, and color channel data.
- * 
- * @param[in] filename The name of the file to read from.
- * @param[in,out] image Pointer to the MDIF image structure to store the read data.
- * 
- * @return An mdif_error_t error code indicating the success or failure of the operation.
- */
-mdif_error_t mdif_read(const char* filename, mdif_t* image);
-
-/**
- * @brief Write an MDIF image to a file.
- * 
- * This function writes an MDIF image to the specified file. It writes the image signature,
- * width, height, and color channel data.
- * 
- * @param[in] filename The name of the file to write to.
- * @param[in] image Pointer to the MDIF image structure containing the data to be written.
- * 
- * @return An mdif_error_t error code indicating the success or failure of the operation.
- */
-mdif_error_t mdif_write(const char* filename, mdif_t* image);
-
-/**
- * @brief Convert an MDIF image to grayscale.
- * 
- * This function converts an MDIF image to grayscale. It calculates the grayscale value for each pixel
- * based on the red, green, and blue channel values, and stores the result in the provided grayscale array.
- * 
- * @param[in] image Pointer to the MDIF image structure.
- * @param[out] grayscale Pointer to the array to store the grayscale values.
- * 
- * @return An mdif_error_t error code indicating the success or failure of the operation.
- */
-mdif_error_t mdif_grayscale(mdif_t* image, float* grayscale);
-
-/**
- * @brief Perform antialiasing on an MDIF image.
- * 
- * This function performs antialiasing on the given MDIF image using a simple box blur method. 
- * The result is stored in a separate MDIF image structure provided by the user. 
- * The box blur technique averages the pixel values within a 3x3 kernel to smooth out the image.
- * 
- * @param[in] image Pointer to the MDIF image structure that needs to be antialiased.
- * @param[out] aliased_image Pointer to the MDIF image structure where the antialiased image will be stored.
- * 
- * @return An mdif_error_t error code indicating the success or failure of the operation.
- */
-mdif_error_t mdif_antialias(mdif_t* image, mdif_t* aliased_image);
-
-/**
- * @brief Get a human-readable error message.
- * 
- * This function returns a human-readable error message corresponding to the specified MDIF error code.
- * 
- * @param[in] error_num The MDIF error code.
- * 
- * @return A constant string containing the error message.
- */
-const char* mdif_error_message(mdif_error_t error_num);
-
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file mdif.h
+ * @author [Nathanne Isip](https://github.com/nthnn)
+ * @brief Minimal Data Image Format (MDIF) Header File
+ * 
+ * This file contains the data structures and function prototypes for working with the MDIF format.
+ * The MDIF format is a lightweight, simple image format designed for use with both desktop environments
+ * and microcontroller environments such as the Raspberry Pi Pico and ESP32 family.
+ * It supports basic image functionalities such as reading, writing, and converting to grayscale.
+ * 
+ */
+
+#ifndef MDIF_H
+#define MDIF_H
+
+/*
+ * Static allocation mode.
+ *
+ * Defining MDIF_STATIC_ARENA (e.g. through build flags) makes the library take every
+ * channel buffer from a fixed set of equally sized slots instead of the heap, giving
+ * deterministic memory use and no fragmentation on long-running devices. Each slot
+ * holds one image of up to MDIF_MAX_WIDTH x MDIF_MAX_HEIGHT pixels with
+ * MDIF_MAX_CHANNELS bytes per pixel. MDIF_ARENA_SLOTS slots are reserved statically
+ * (placed in PSRAM on ESP32 when MDIF_ARENA_IN_PSRAM is defined), or a region can be
+ * supplied at runtime with mdif_arena_register(). Short-lived row buffers used by
+ * streaming functions come from a separate scratch area of MDIF_ARENA_SCRATCH_BYTES
+ * bytes, released in reverse order of acquisition. Convolution narrows its row band to
+ * what the scratch area can hold and filters in place without taking another slot.
+ */
+#ifdef MDIF_STATIC_ARENA
+#   ifndef MDIF_MAX_WIDTH
+#       define MDIF_MAX_WIDTH       1024
+#   endif
+#   ifndef MDIF_MAX_HEIGHT
+#       define MDIF_MAX_HEIGHT      1024
+#   endif
+#   ifndef MDIF_MAX_CHANNELS
+#       define MDIF_MAX_CHANNELS    4
+#   endif
+#   ifndef MDIF_ARENA_SLOTS
+#       define MDIF_ARENA_SLOTS     2
+#   endif
+
+#   ifndef MDIF_ARENA_SCRATCH_BYTES
+#       define MDIF_ARENA_SCRATCH_BYTES (16ul * MDIF_MAX_WIDTH * MDIF_MAX_CHANNELS)
+#   endif
+
+#   define MDIF_ARENA_MAX_SLOTS     32
+#   define MDIF_ARENA_SLOT_BYTES    \
+        ((unsigned long) MDIF_MAX_WIDTH * MDIF_MAX_HEIGHT * MDIF_MAX_CHANNELS)
+#endif
+
+/**
+ * @brief Plane layouts.
+ * 
+ * YCbCr layouts store full-range JPEG (BT.601) luma in the red plane and the blue-difference and
+ * red-difference chroma in the green and blue planes. They have no alpha plane. In the 4:2:0
+ * layout, the chroma planes hold one sample per 2x2 block of pixels, (width + 1) / 2 samples wide
+ * and (height + 1) / 2 samples high.
+ * 
+ * The indexed layout stores one palette index per pixel in the red plane, and keeps the
+ * palette of MDIF_PALETTE_SIZE entries at the start of the alpha plane as consecutive red,
+ * green, blue and alpha bytes. Its green and blue planes are unused.
+ */
+typedef enum mdif_layout {
+    MDIF_LAYOUT_RGBA,          /**< Red, green, blue and alpha planes at full resolution. */
+    MDIF_LAYOUT_YCBCR444,      /**< Y, Cb and Cr planes at full resolution. */
+    MDIF_LAYOUT_YCBCR420,      /**< Full-resolution Y plane, Cb and Cr planes at half resolution. */
+    MDIF_LAYOUT_INDEXED        /**< Index plane into a palette of up to 256 RGBA colors. */
+} mdif_layout_t;
+
+/**
+ * @brief Number of palette entries of an indexed image.
+ */
+#define MDIF_PALETTE_SIZE       256
+
+/**
+ * @brief MDIF image structure.
+ * 
+ * This structure represents an image in the MDIF format. It contains the image signature,
+ * width, height, and separate color channels for red, green, blue, and alpha.
+ */
+typedef struct mdif_struct {
+    char signature[2];         /**< Signature to identify the file as an MDIF image. */
+
+    short width;               /**< Width of the image. */
+    short height;              /**< Height of the image. */
+    unsigned char layout;      /**< Plane layout of the image (an mdif_layout_t value). */
+    unsigned char levels;      /**< Number of pyramid levels stored after the base planes in the file the image was read from. */
+
+    unsigned char *red;        /**< Pointer to the red channel data. */
+    unsigned char *blue;       /**< Pointer to the blue channel data. */
+    unsigned char *green;      /**< Pointer to the green channel data. */
+    unsigned char *alpha;      /**< Pointer to the alpha channel data. */
+
+    unsigned int capacity;     /**< Number of pixels each channel buffer can hold. */
+    struct mdif_pool_struct *pool; /**< Pool owning the channel buffers, or NULL if heap allocated. */
+} mdif_t;
+
+/**
+ * @brief Smallest size class (as a power of two in pixels) kept by an MDIF pool.
+ */
+#define MDIF_POOL_MIN_SHIFT     6
+
+/**
+ * @brief Number of size classes kept by an MDIF pool.
+ * 
+ * Size classes grow in quarter steps of a power of two, from 64 pixels up to
+ * 1024x1024 pixels, so a pooled plane set never wastes more than 25% of its memory.
+ * In MDIF_STATIC_ARENA builds a class larger than an arena slot is capped at the slot size.
+ */
+#define MDIF_POOL_CLASS_COUNT   57
+
+/**
+ * @brief Pool flag enabling locking around pool operations (desktop only).
+ */
+#define MDIF_POOL_THREAD_SAFE   0x01
+
+/**
+ * @brief MDIF plane set pool structure.
+ * 
+ * A pool recycles the channel buffers of released images, bucketed by size class.
+ * Each plane set is a single allocation holding all four channels, so images acquired
+ * from a pool cost at most one allocation, and none once the pool has been warmed up.
+ */
+typedef struct mdif_pool_struct {
+    void *buckets[MDIF_POOL_CLASS_COUNT]; /**< Free lists of cached plane sets, one per size class. */
+
+    unsigned long cached_bytes;     /**< Number of bytes currently held in the free lists. */
+    unsigned long max_cached_bytes; /**< Maximum number of bytes to keep cached (0 for no limit). */
+
+    unsigned char flags;       /**< Pool flags (e.g. MDIF_POOL_THREAD_SAFE). */
+    void *lock;                /**< Lock used when the pool is thread-safe. */
+} mdif_pool_t;
+
+/**
+ * @brief Callback receiving one output row of a streaming operation.
+ * 
+ * @param[in] y Index of the row within the output image.
+ * @param[in] red Pointer to the red channel data of the row.
+ * @param[in] green Pointer to the green channel data of the row.
+ * @param[in] blue Pointer to the blue channel data of the row.
+ * @param[in] alpha Pointer to the alpha channel data of the row.
+ * @param[in] width Number of pixels in the row.
+ * @param[in] user_data User pointer passed when the stream was initialized.
+ */
+typedef void (*mdif_row_callback_t)(
+    short y,
+    const unsigned char* red,
+    const unsigned char* green,
+    const unsigned char* blue,
+    const unsigned char* alpha,
+    short width,
+    void* user_data
+);
+
+/**
+ * @brief Streaming antialiasing state.
+ * 
+ * Rows are pushed in order from top to bottom, and each blurred row is handed to the
+ * callback as soon as the row below it is known. Only a 3-row ring buffer per channel
+ * and one output row are kept in memory.
+ */
+typedef struct mdif_antialias_stream_struct {
+    short width;               /**< Width of the streamed image. */
+    short height;              /**< Height of the streamed image. */
+    short rows;                /**< Number of rows pushed so far. */
+
+    unsigned char *ring;       /**< Ring buffer of the last three input rows followed by the output row. */
+
+    mdif_row_callback_t callback; /**< Callback receiving the output rows. */
+    void *user_data;           /**< User pointer passed to the callback. */
+} mdif_antialias_stream_t;
+
+/**
+ * @brief Channel selection flags.
+ * 
+ * Processing functions taking a channel mask only modify the selected channels and copy
+ * the others unchanged from the source image.
+ */
+#define MDIF_CHANNEL_RED        0x01
+#define MDIF_CHANNEL_GREEN      0x02
+#define MDIF_CHANNEL_BLUE       0x04
+#define MDIF_CHANNEL_ALPHA      0x08
+#define MDIF_CHANNEL_RGB        0x07
+#define MDIF_CHANNEL_ALL        0x0F
+
+/**
+ * @brief Channel selection flag making mdif_equalize() and mdif_clahe() work on the
+ * luminance instead of separate channels.
+ * 
+ * RGBA images have their color channels scaled by the ratio of the new luminance to the
+ * old one, which keeps their hue. YCbCr images only have their Y plane changed.
+ */
+#define MDIF_CHANNEL_LUMINANCE  0x10
+
+/**
+ * @brief Maximum width and height of a convolution kernel.
+ */
+#define MDIF_KERNEL_MAX_SIZE    15
+
+/**
+ * @brief Maximum width and height of a morphology structuring element.
+ */
+#define MDIF_MORPH_MAX_SIZE     31
+
+/**
+ * @brief Maximum width and height of a HOG cell.
+ */
+#define MDIF_HOG_MAX_CELL       32
+
+/**
+ * @brief Border handling modes.
+ * 
+ * This enumeration defines how pixels outside of the image are sampled by filters.
+ */
+typedef enum mdif_border {
+    MDIF_BORDER_CLAMP,         /**< Repeat the nearest edge pixel. */
+    MDIF_BORDER_REFLECT,       /**< Mirror the image around the edge pixel. */
+    MDIF_BORDER_WRAP,          /**< Wrap around to the opposite edge. */
+    MDIF_BORDER_ZERO           /**< Treat pixels outside of the image as zero. */
+} mdif_border_t;
+
+/**
+ * @brief MDIF convolution kernel structure.
+ * 
+ * This structure holds a 2D kernel with odd width and height, stored row by row.
+ * Each output pixel is the weighted sum of its neighbourhood plus the bias, clamped to 0-255.
+ */
+typedef struct mdif_kernel_struct {
+    unsigned char width;       /**< Width of the kernel (odd, up to MDIF_KERNEL_MAX_SIZE). */
+    unsigned char height;      /**< Height of the kernel (odd, up to MDIF_KERNEL_MAX_SIZE). */
+
+    float weights[MDIF_KERNEL_MAX_SIZE * MDIF_KERNEL_MAX_SIZE]; /**< Kernel weights, row by row. */
+    float bias;                /**< Value added to every weighted sum. */
+} mdif_kernel_t;
+
+/**
+ * @brief Augmentation operation types.
+ * 
+ * The meaning of the [min, max] range an operation draws its amount from depends on its type.
+ */
+typedef enum mdif_augment_type {
+    MDIF_AUGMENT_CROP,            /**< Random crop keeping a fraction [min, max] of each side. */
+    MDIF_AUGMENT_FLIP_HORIZONTAL, /**< Mirror left to right (range unused). */
+    MDIF_AUGMENT_FLIP_VERTICAL,   /**< Mirror top to bottom (range unused). */
+    MDIF_AUGMENT_ROTATE_90,       /**< Rotate by a random multiple of 90 degrees (range unused). */
+    MDIF_AUGMENT_AFFINE,          /**< Rotate around the center by [min, max] degrees. */
+    MDIF_AUGMENT_BRIGHTNESS,      /**< Multiply color by a factor in [min, max]. */
+    MDIF_AUGMENT_CONTRAST,        /**< Scale color around mid-gray by a factor in [min, max]. */
+    MDIF_AUGMENT_SATURATION       /**< Scale color around its luminance by a factor in [min, max]. */
+} mdif_augment_type_t;
+
+/**
+ * @brief Augmentation operation structure.
+ * 
+ * Each operation is applied with the given probability, with its amount drawn uniformly
+ * from [min, max].
+ */
+typedef struct mdif_augment_op_struct {
+    mdif_augment_type_t type;  /**< Type of the operation. */
+    float probability;         /**< Probability of applying the operation (0.0 to 1.0). */
+
+    float min;                 /**< Lower bound of the operation amount. */
+    float max;                 /**< Upper bound of the operation amount. */
+} mdif_augment_op_t;
+
+/**
+ * @brief Per-channel histogram of an MDIF image.
+ */
+typedef struct mdif_histogram_struct {
+    unsigned long counts[4][256]; /**< Pixel counts per value for the red, green, blue and alpha channels. */
+} mdif_histogram_t;
+
+/**
+ * @brief Mergeable statistics accumulator.
+ * 
+ * The accumulator holds exact per-channel histograms over any number of images, so accumulators
+ * filled on different threads or machines can be merged without any loss of precision.
+ */
+typedef struct mdif_stats_struct {
+    unsigned long long images;  /**< Number of accumulated images. */
+    unsigned long long pixels;  /**< Number of accumulated pixels. */
+
+    unsigned long long counts[4][256]; /**< Pixel counts per value for the red, green, blue and alpha channels. */
+} mdif_stats_t;
+
+/**
+ * @brief Summary of one channel of a statistics accumulator.
+ */
+typedef struct mdif_summary_struct {
+    double mean;               /**< Mean channel value (0-255). */
+    double stddev;             /**< Standard deviation of the channel values. */
+
+    unsigned char min;         /**< Smallest channel value. */
+    unsigned char max;         /**< Largest channel value. */
+} mdif_summary_t;
+
+/**
+ * @brief Metric flags for mdif_compare().
+ */
+#define MDIF_METRIC_ERROR       0x01
+#define MDIF_METRIC_SSIM        0x02
+#define MDIF_METRIC_ALL         0x03
+
+/**
+ * @brief Per-plane comparison metrics of two MDIF images.
+ */
+typedef struct mdif_metrics_struct {
+    int max_diff[4];           /**< Largest absolute difference. */
+    double mse[4];             /**< Mean squared error. */
+    double psnr[4];            /**< Peak signal-to-noise ratio in dB (INFINITY for equal planes). */
+    double ssim[4];            /**< Mean structural similarity over 8x8 windows with a stride of 4. */
+} mdif_metrics_t;
+
+/**
+ * @brief Probe flag for mdif_probe_files(): also hash the content of each file.
+ */
+#define MDIF_PROBE_HASH         0x01
+
+/**
+ * @brief Header information of an MDIF file.
+ */
+typedef struct mdif_info_struct {
+    short width;               /**< Width of the image. */
+    short height;              /**< Height of the image. */
+    unsigned char layout;      /**< Plane layout of the image (an mdif_layout_t value). */
+    unsigned char levels;      /**< Number of pyramid levels stored after the base planes. */
+
+    unsigned long size;        /**< Size of the file in bytes. */
+    unsigned long long hash;   /**< mdif_hash64() of the whole file with a seed of 0, or 0 if not computed. */
+} mdif_info_t;
+
+/**
+ * @brief Mask format flags.
+ * 
+ * Masks hold one byte per pixel (0 or 255) by default. Packed masks hold one bit per pixel,
+ * least significant bit first, with every row padded to a whole number of bytes.
+ */
+#define MDIF_MASK_PACKED        0x01
+#define MDIF_MASK_INVERT        0x02
+
+/**
+ * @brief Connected component of a mask.
+ */
+typedef struct mdif_component_struct {
+    short x;                   /**< Left edge of the bounding box. */
+    short y;                   /**< Top edge of the bounding box. */
+    short width;               /**< Width of the bounding box. */
+    short height;              /**< Height of the bounding box. */
+
+    unsigned long area;        /**< Number of pixels of the component. */
+    float centroid_x;          /**< Mean horizontal position of the pixels. */
+    float centroid_y;          /**< Mean vertical position of the pixels. */
+} mdif_component_t;
+
+/**
+ * @brief Maximum number of operations queued on a pipeline.
+ */
+#define MDIF_PIPELINE_MAX_OPS   8
+
+/**
+ * @brief Width and height of the output tiles processed by a pipeline.
+ * 
+ * The intermediate tiles of every stage should fit in the L2 cache together.
+ */
+#ifndef MDIF_PIPELINE_TILE
+#   define MDIF_PIPELINE_TILE   64
+#endif
+
+/**
+ * @brief Pipeline operation types.
+ */
+typedef enum mdif_pipeline_type {
+    MDIF_PIPELINE_ANTIALIAS,   /**< 3x3 box blur of the color channels, as mdif_antialias(). */
+    MDIF_PIPELINE_CONVOLVE,    /**< Convolution with a kernel, as mdif_convolve(). */
+    MDIF_PIPELINE_RESIZE,      /**< Bilinear resize, as mdif_resize(). */
+    MDIF_PIPELINE_GRAYSCALE    /**< Replace the color channels with their 8-bit luminance. */
+} mdif_pipeline_type_t;
+
+/**
+ * @brief Queued pipeline operation.
+ */
+typedef struct mdif_pipeline_op_struct {
+    mdif_pipeline_type_t type; /**< Type of the operation. */
+
+    const mdif_kernel_t *kernel; /**< Convolution kernel, which must stay valid until the pipeline is run. */
+    mdif_border_t border;      /**< Border handling of the convolution. */
+    unsigned char channels;    /**< Channels filtered by the convolution. */
+
+    short width;               /**< Width of the image produced by the operation. */
+    short height;              /**< Height of the image produced by the operation. */
+} mdif_pipeline_op_t;
+
+/**
+ * @brief Deferred image processing pipeline.
+ * 
+ * Operations queued on a pipeline are only recorded. When the pipeline is run, the output is
+ * produced tile by tile, with every operation applied to a tile before moving to the next one,
+ * so no intermediate image is ever allocated and each tile stays in cache across the whole chain.
+ * The borders each stencil needs around a tile are computed automatically.
+ */
+typedef struct mdif_pipeline_struct {
+    const mdif_t *image;       /**< Source image, which must stay valid until the pipeline is run. */
+
+    short width;               /**< Width of the pipeline output. */
+    short height;              /**< Height of the pipeline output. */
+
+    int count;                 /**< Number of queued operations. */
+    mdif_pipeline_op_t ops[MDIF_PIPELINE_MAX_OPS]; /**< Queued operations, in order. */
+
+    const struct mdif_cache_struct *cache; /**< Result cache set with mdif_pipeline_use_cache(), or NULL. */
+} mdif_pipeline_t;
+
+#ifndef ARDUINO
+
+/**
+ * @brief On-disk cache of processing results.
+ * 
+ * Each result is stored in its own file ("NC") named after its 64-bit key, holding the key,
+ * the payload size, the payload and an XXH64 checksum of everything before it. Entries are
+ * written to a temporary file and renamed into place, so concurrent readers in other processes
+ * only ever see complete entries, and a damaged entry is removed instead of being returned.
+ * 
+ * The running size of the cache is kept in a "lock" file of the directory, which is locked
+ * exclusively while entries are added or removed. When it goes over the bound, the least
+ * recently used entries are removed until the cache is back to three quarters of the bound.
+ */
+typedef struct mdif_cache_struct {
+    char *directory;           /**< Cache directory. */
+    unsigned long long max_bytes; /**< Bound on the total size of the entries. */
+} mdif_cache_t;
+
+/**
+ * @brief Default edge length of the square tiles compared between sequence frames.
+ */
+#define MDIF_SEQUENCE_TILE      16
+
+/**
+ * @brief Frame sequence file opened for writing or reading.
+ * 
+ * A sequence file ("NS") stores keyframes as plain planes and every other frame as the XOR
+ * of each changed tile against the previous frame, with one skip bit per tile, followed by
+ * an index of frame offsets.
+ */
+typedef struct mdif_sequence_struct {
+    void *handle;              /**< Underlying file handle. */
+    unsigned char writing;     /**< Nonzero if the sequence was created for writing. */
+
+    short width;               /**< Width of every frame. */
+    short height;              /**< Height of every frame. */
+    unsigned char layout;      /**< Plane layout of every frame. */
+    unsigned char tile;        /**< Edge length of the compared tiles. */
+    unsigned short interval;   /**< Maximum distance between keyframes (0 for no limit). */
+
+    unsigned int count;        /**< Number of frames in the sequence. */
+    unsigned int position;     /**< Index of the next frame to be read. */
+    unsigned int decoded;      /**< Number of frames held in the reference (reading), or since the last keyframe (writing). */
+    unsigned int capacity;     /**< Number of index entries allocated. */
+    unsigned int *offsets;     /**< File offset of every frame. */
+    unsigned char *keyframes;  /**< Keyframe flag of every frame. */
+
+    mdif_t reference;          /**< Last frame written or decoded. */
+    unsigned char *buffer;     /**< Frame payload buffer. */
+} mdif_sequence_t;
+
+#endif
+
+/**
+ * @brief Clockwise rotations supported by mdif_rotate().
+ */
+typedef enum mdif_rotation {
+    MDIF_ROTATE_90,            /**< Quarter turn clockwise. */
+    MDIF_ROTATE_180,           /**< Half turn. */
+    MDIF_ROTATE_270            /**< Quarter turn counter-clockwise. */
+} mdif_rotation_t;
+
+/**
+ * @brief Blend modes supported by mdif_composite().
+ */
+typedef enum mdif_blend {
+    MDIF_BLEND_OVER,           /**< Porter-Duff source-over. */
+    MDIF_BLEND_ADD,            /**< Saturating sum of both images. */
+    MDIF_BLEND_MULTIPLY,       /**< Multiply, darkening the destination. */
+    MDIF_BLEND_SCREEN          /**< Screen, lightening the destination. */
+} mdif_blend_t;
+
+/**
+ * @brief Dithering methods supported by mdif_quantize().
+ */
+typedef enum mdif_dither {
+    MDIF_DITHER_NONE,          /**< Map every pixel to its nearest palette color. */
+    MDIF_DITHER_ORDERED,       /**< 8x8 Bayer matrix offsets added before mapping. */
+    MDIF_DITHER_FLOYD_STEINBERG /**< Floyd-Steinberg error diffusion. */
+} mdif_dither_t;
+
+/**
+ * @brief MDIF error codes.
+ * 
+ * This enumeration defines the possible error codes that can be returned by MDIF functions.
+ */
+typedef enum mdif_error {
+    MDIF_ERROR_IO,                /**< General I/O error. */
+    MDIF_ERROR_NONE,              /**< No error. */
+    MDIF_ERROR_INVALID_SIGNATURE, /**< Invalid MDIF signature. */
+    MDIF_ERROR_CANNOT_ALLOCATE,   /**< Memory allocation error. */
+    MDIF_ERROR_INVALID_WIDTH,     /**< Invalid image width (greater than 1024). */
+    MDIF_ERROR_INVALID_HEIGHT,    /**< Invalid image height (greater than 1024). */
+    MDIF_ERROR_READ,              /**< Error reading MDIF file. */
+    MDIF_ERROR_WRITE,             /**< Error writing MDIF file. */
+    MDIF_ERROR_INVALID_FILE_HANDLE,/**< Invalid file handle. */
+    MDIF_ERROR_IMAGE,             /**< Generic image error. */
+    MDIF_ERROR_GRAYSCALE,         /**< Invalid grayscale pointer. */
+    MDIF_ERROR_POOL,              /**< Invalid or uninitialized pool. */
+    MDIF_ERROR_ARENA_BUSY,        /**< Static arena still has slots in use. */
+    MDIF_ERROR_KERNEL,            /**< Invalid convolution kernel or structuring element. */
+    MDIF_ERROR_AUGMENT,           /**< Invalid augmentation operations. */
+    MDIF_ERROR_PIPELINE,          /**< Invalid or full pipeline. */
+    MDIF_ERROR_LAYOUT,            /**< Unsupported plane layout. */
+    MDIF_ERROR_LEVEL,             /**< Invalid pyramid level count. */
+    MDIF_ERROR_FACTOR,            /**< Invalid subsampling factor. */
+    MDIF_ERROR_SEQUENCE,          /**< Invalid sequence or frame. */
+    MDIF_ERROR_LUT,               /**< Invalid lookup table parameters. */
+    MDIF_ERROR_SIZE,              /**< File size does not match the image header. */
+    MDIF_ERROR_THRESHOLD,         /**< Invalid threshold or labeling parameters. */
+    MDIF_ERROR_COMPONENTS,        /**< More connected components than the output array holds. */
+    MDIF_ERROR_FEATURE,           /**< Invalid feature extraction parameters. */
+    MDIF_ERROR_PALETTE,           /**< Invalid palette size or dithering method. */
+    MDIF_ERROR_CACHE,             /**< Invalid or unusable cache. */
+    MDIF_ERROR_CACHE_MISS         /**< Result not found in the cache. */
+} mdif_error_t;
+
+/**
+ * @brief Initialize an MDIF image.
+ * 
+ * This function initializes an MDIF image structure with the specified width and height.
+ * It allocates memory for the red, green, blue, and alpha channels.
+ * 
+ * @param[in,out] image Pointer to the MDIF image structure to be initialized.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ */
+void mdif_init(mdif_t* image, short width, short height);
+
+/**
+ * @brief Initialize an MDIF image with the given plane layout.
+ * 
+ * @param[in,out] image Pointer to the MDIF image structure to be initialized.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] layout Plane layout of the image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_init_layout(mdif_t* image, short width, short height, mdif_layout_t layout);
+
+/**
+ * @brief Free the memory allocated for an MDIF image.
+ * 
+ * This function frees the memory allocated for the red, green, blue, and alpha channels of an MDIF image.
+ * Images acquired with mdif_init_from_pool() return their channel buffers to the owning pool instead.
+ * 
+ * @param[in,out] image Pointer to the MDIF image structure to be freed.
+ */
+void mdif_free(mdif_t* image);
+
+/**
+ * @brief Read an MDIF image from a file.
+ * 
+ * This function reads an MDIF image from the specified file. It reads the image signature,
+ * width, height, and color channel data. The planes are kept in the layout they are stored in;
+ * use mdif_convert() to get RGBA planes from a YCbCr or indexed image.
+ * 
+ * @param[in] filename The name of the file to read from.
+ * @param[in,out] image Pointer to the MDIF image structure to store the read data.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_read(const char* filename, mdif_t* image);
+
+/**
+ * @brief Read an MDIF image from a file into an already initialized image.
+ * 
+ * This function behaves like mdif_read(), but reuses the channel buffers of an image
+ * previously set up by mdif_init(), mdif_read() or mdif_init_from_pool() whenever the
+ * new dimensions fit in its capacity. Otherwise the buffers are replaced, from the
+ * owning pool if the image came from one.
+ * 
+ * @param[in] filename The name of the file to read from.
+ * @param[in,out] image Pointer to an initialized MDIF image structure to store the read data.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_read_into(const char* filename, mdif_t* image);
+
+/**
+ * @brief Write an MDIF image to a file.
+ * 
+ * This function writes an MDIF image to the specified file. It writes the image signature,
+ * width, height, and color channel data. RGBA images keep the original "NT" header, while
+ * other layouts are written with an extended "NX" header recording the layout. Indexed images
+ * store their index plane followed by the number of palette colors minus one and the colors
+ * themselves, trimmed to the largest index in use.
+ * 
+ * @param[in] filename The name of the file to write to.
+ * @param[in] image Pointer to the MDIF image structure containing the data to be written.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_write(const char* filename, mdif_t* image);
+
+/**
+ * @brief Write an MDIF image to a file together with a mip pyramid.
+ * 
+ * Each level halves the previous one (rounding odd sizes up) by averaging 2x2 blocks, and is
+ * stored after the base planes in the same layout. The number of levels is recorded in the
+ * extended "NX" header, so any level can later be read with mdif_read_level(). Indexed images
+ * can't have levels.
+ * 
+ * Levels are generated one at a time for every plane and written strictly in file order
+ * without seeking, so the function also works on append-only files such as SD card files
+ * opened with FILE_WRITE.
+ * 
+ * @param[in] filename The name of the file to write to.
+ * @param[in] image Pointer to the MDIF image structure containing the data to be written.
+ * @param[in] levels Number of levels to generate, up to the one reaching 1x1 pixels.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_write_pyramid(const char* filename, mdif_t* image, unsigned char levels);
+
+/**
+ * @brief Read one level of the mip pyramid of an MDIF file.
+ * 
+ * This function seeks directly to the requested level, so reading level n only touches
+ * about 1 / 4^n of the bytes of the base image. Level 0 is the base image, and levels past
+ * the last stored one read the smallest stored level. The dimensions of the level read are
+ * stored in the image, and its levels field holds the number of levels in the file.
+ * 
+ * @param[in] filename The name of the file to read from.
+ * @param[in] level Index of the level to read.
+ * @param[out] image Pointer to the MDIF image structure to store the read data.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_read_level(const char* filename, unsigned char level, mdif_t* image);
+
+/**
+ * @brief Read a reduced preview of an MDIF file.
+ * 
+ * This function only reads every factor-th row of each plane, each with a single positioned
+ * read, and averages groups of factor pixels along the row. It works on any file, with or
+ * without a pyramid, reading about 1 / factor of the file and allocating about 1 / factor^2
+ * of the memory of mdif_read(). The image is (width + factor - 1) / factor pixels wide and
+ * (height + factor - 1) / factor pixels high.
+ * 
+ * @param[in] filename The name of the file to read from.
+ * @param[in] factor Subsampling factor (1 or more).
+ * @param[out] image Pointer to the MDIF image structure to store the read data.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_read_subsampled(const char* filename, unsigned char factor, mdif_t* image);
+
+/**
+ * @brief Read the header of an MDIF file without reading its planes.
+ * 
+ * This function only reads the header and the size of the file, and checks that the size
+ * matches the planes and pyramid levels declared in the header. The hash field is set to 0.
+ * 
+ * @param[in] filename The name of the file to probe.
+ * @param[out] info Pointer to the structure receiving the header information.
+ * 
+ * @return An mdif_error_t error code, MDIF_ERROR_SIZE if the file is truncated or has
+ *         trailing data.
+ */
+mdif_error_t mdif_probe(const char* filename, mdif_info_t* info);
+
+/**
+ * @brief Compute the 64-bit xxHash (XXH64) of a block of memory.
+ * 
+ * @param[in] data Pointer to the data.
+ * @param[in] size Size of the data in bytes.
+ * @param[in] seed Hash seed.
+ * 
+ * @return The 64-bit hash of the data.
+ */
+unsigned long long mdif_hash64(const void* data, unsigned long size, unsigned long long seed);
+
+/**
+ * @brief Compute the XXH64 hash of the whole content of a file with a seed of 0.
+ * 
+ * The file is hashed in chunks, without holding it in memory.
+ * 
+ * @param[in] filename The name of the file to hash.
+ * @param[out] hash Pointer to the resulting hash.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_hash_file(const char* filename, unsigned long long* hash);
+
+/**
+ * @brief Probe a list of MDIF files using multiple threads.
+ * 
+ * Each file is probed with mdif_probe(), and hashed with mdif_hash_file() when flags include
+ * MDIF_PROBE_HASH. The information of files that fail is cleared.
+ * 
+ * @param[in] filenames Array of file names.
+ * @param[in] count Number of file names.
+ * @param[out] infos Array of count structures receiving the information of each file.
+ * @param[out] results Optional array of count error codes, one per file (may be NULL).
+ * @param[in] flags MDIF_PROBE_* flags.
+ * @param[in] threads Number of threads (0 for one per processor).
+ * 
+ * @return MDIF_ERROR_NONE if every file was probed, otherwise the error of a failed file.
+ */
+mdif_error_t mdif_probe_files(
+    const char* const* filenames,
+    int count,
+    mdif_info_t* infos,
+    mdif_error_t* results,
+    unsigned char flags,
+    int threads
+);
+
+#ifndef ARDUINO
+
+/**
+ * @brief Overwrite a rectangular region of an existing MDIF file in place.
+ * 
+ * The top-left width x height pixels of the source image replace the region at (x, y) of
+ * the file, and the matching blocks of its pyramid levels are recomputed. Only the affected
+ * row segments of each plane are written, with adjacent segments merged into single
+ * positioned writes, so the cost follows the size of the region rather than the image.
+ * 
+ * The update is crash-safe: the new bytes are first written and flushed to a journal next
+ * to the file (filename + ".journal"), which is applied and then removed. A journal left by
+ * an interrupted update is replayed by mdif_recover(), which this function calls first.
+ * 
+ * For YCbCr 4:2:0 files, x and y must be even, and so must x + width and y + height unless
+ * they reach the right and bottom edges.
+ * 
+ * @param[in] filename The name of the file to update.
+ * @param[in] x Horizontal position of the region.
+ * @param[in] y Vertical position of the region.
+ * @param[in] width Width of the region.
+ * @param[in] height Height of the region.
+ * @param[in] source Pointer to the image holding the new pixels, with the layout of the file.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_write_region(
+    const char* filename,
+    int x,
+    int y,
+    int width,
+    int height,
+    const mdif_t* source
+);
+
+/**
+ * @brief Finish or discard an interrupted mdif_write_region() update of an MDIF file.
+ * 
+ * A complete journal is applied to the file and removed, and a partially written one is
+ * removed without touching the file. Nothing is done when there is no journal.
+ * 
+ * @param[in] filename The name of the MDIF file.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_recover(const char* filename);
+
+#endif
+
+/**
+ * @brief Convert an MDIF image to grayscale.
+ * 
+ * This function converts an MDIF image to grayscale. It calculates the grayscale value for each pixel
+ * based on the red, green, and blue channel values, and stores the result in the provided grayscale array.
+ * For YCbCr images, the luma plane is used directly.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[out] grayscale Pointer to the array to store the grayscale values.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_grayscale(mdif_t* image, float* grayscale);
+
+/**
+ * @brief Extract the 8-bit luminance of an MDIF image.
+ * 
+ * For YCbCr images this is a plain copy of the luma plane. RGBA images are converted with
+ * the same BT.601 weights that JPEG uses.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[out] luminance Pointer to an array of width * height bytes receiving the luminance.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_luminance(const mdif_t* image, unsigned char* luminance);
+
+/**
+ * @brief Convert an MDIF image to the plane layout of another image.
+ * 
+ * The output must be initialized with mdif_init_layout() to the same size and the target layout.
+ * Chroma is averaged over 2x2 blocks when subsampling, and interpolated with the same triangle
+ * filter as libjpeg when upsampling. Indexed images can only be expanded to RGBA or copied to
+ * another indexed image; use mdif_quantize() to get an indexed image.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the converted planes.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_convert(const mdif_t* image, mdif_t* output);
+
+/**
+ * @brief Perform antialiasing on an MDIF image.
+ * 
+ * This function performs antialiasing on the given MDIF image using a simple box blur method. 
+ * The result is stored in a separate MDIF image structure provided by the user. 
+ * The box blur technique averages the pixel values within a 3x3 kernel to smooth out the image.
+ * 
+ * @param[in] image Pointer to the MDIF image structure that needs to be antialiased.
+ * @param[out] aliased_image Pointer to the MDIF image structure where the antialiased image will be stored.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_antialias(mdif_t* image, mdif_t* aliased_image);
+
+/**
+ * @brief Perform antialiasing on an MDIF image in place.
+ * 
+ * This function applies the same 3x3 box blur as mdif_antialias(), overwriting the source
+ * image. Only two rows per channel are buffered, so no second image has to be allocated.
+ * 
+ * @param[in,out] image Pointer to the MDIF image structure to be antialiased.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_antialias_inplace(mdif_t* image);
+
+/**
+ * @brief Perform antialiasing on a band of rows of an MDIF image.
+ * 
+ * This function writes the antialiased rows [y, y + rows) of the image into the top rows of
+ * a preallocated band image of the same width, so large images can be processed band by band.
+ * 
+ * @param[in] image Pointer to the MDIF image structure that needs to be antialiased.
+ * @param[in] y Index of the first row to produce.
+ * @param[in] rows Number of rows to produce.
+ * @param[out] band Pointer to the band image receiving the rows.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_antialias_band(mdif_t* image, short y, short rows, mdif_t* band);
+
+/**
+ * @brief Initialize a streaming antialiasing operation.
+ * 
+ * @param[out] stream Pointer to the stream state to be initialized.
+ * @param[in] width Width of the streamed image.
+ * @param[in] height Height of the streamed image.
+ * @param[in] callback Callback receiving each antialiased row.
+ * @param[in] user_data User pointer passed to the callback.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_antialias_stream_init(
+    mdif_antialias_stream_t* stream,
+    short width,
+    short height,
+    mdif_row_callback_t callback,
+    void* user_data
+);
+
+/**
+ * @brief Push the next input row into a streaming antialiasing operation.
+ * 
+ * The callback is invoked for the previous row, and for this row as well if it is the last one.
+ * 
+ * @param[in,out] stream Pointer to the stream state.
+ * @param[in] red Pointer to the red channel data of the row.
+ * @param[in] green Pointer to the green channel data of the row.
+ * @param[in] blue Pointer to the blue channel data of the row.
+ * @param[in] alpha Pointer to the alpha channel data of the row.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_antialias_stream_push(
+    mdif_antialias_stream_t* stream,
+    const unsigned char* red,
+    const unsigned char* green,
+    const unsigned char* blue,
+    const unsigned char* alpha
+);
+
+/**
+ * @brief Release the buffers of a streaming antialiasing operation.
+ * 
+ * @param[in,out] stream Pointer to the stream state.
+ */
+void mdif_antialias_stream_free(mdif_antialias_stream_t* stream);
+
+/**
+ * @brief Convolve an MDIF image with a 2D kernel.
+ * 
+ * This function filters the selected channels of an image with an arbitrary kernel using
+ * fixed-point arithmetic. Kernels that are the outer product of two 1D kernels (such as
+ * box, Gaussian and Sobel kernels) are detected automatically and applied as two 1D passes.
+ * The output image must be initialized with the same dimensions as the source image, and
+ * may be the source image itself.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] kernel Pointer to the convolution kernel.
+ * @param[in] border Border handling mode.
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_convolve(
+    const mdif_t* image,
+    mdif_t* output,
+    const mdif_kernel_t* kernel,
+    mdif_border_t border,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Convolve an MDIF image with a pair of 1D kernels.
+ * 
+ * This function applies a horizontal kernel followed by a vertical kernel, which is equivalent
+ * to convolving with their outer product at a fraction of the cost.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] kernel_x Weights of the horizontal kernel.
+ * @param[in] size_x Number of weights of the horizontal kernel (odd).
+ * @param[in] kernel_y Weights of the vertical kernel.
+ * @param[in] size_y Number of weights of the vertical kernel (odd).
+ * @param[in] bias Value added to every weighted sum.
+ * @param[in] border Border handling mode.
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_convolve_separable(
+    const mdif_t* image,
+    mdif_t* output,
+    const float* kernel_x,
+    unsigned char size_x,
+    const float* kernel_y,
+    unsigned char size_y,
+    float bias,
+    mdif_border_t border,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Build a normalized box blur kernel.
+ * 
+ * @param[out] kernel Pointer to the kernel to fill.
+ * @param[in] size Width and height of the kernel (odd).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_kernel_box(mdif_kernel_t* kernel, unsigned char size);
+
+/**
+ * @brief Build a normalized Gaussian blur kernel.
+ * 
+ * @param[out] kernel Pointer to the kernel to fill.
+ * @param[in] size Width and height of the kernel (odd).
+ * @param[in] sigma Standard deviation of the Gaussian.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_kernel_gaussian(mdif_kernel_t* kernel, unsigned char size, float sigma);
+
+/**
+ * @brief Build a 3x3 sharpening kernel.
+ * 
+ * @param[out] kernel Pointer to the kernel to fill.
+ * @param[in] amount Strength of the sharpening (1.0 for the classic 5/-1 kernel).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_kernel_sharpen(mdif_kernel_t* kernel, float amount);
+
+/**
+ * @brief Build a 3x3 Sobel edge detection kernel.
+ * 
+ * The kernel is scaled by 1/8 and biased by 128, so that flat areas map to 128 and the full
+ * gradient range fits in a byte.
+ * 
+ * @param[out] kernel Pointer to the kernel to fill.
+ * @param[in] vertical Nonzero for the vertical gradient, zero for the horizontal gradient.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_kernel_sobel(mdif_kernel_t* kernel, unsigned char vertical);
+
+/**
+ * @brief Erode an MDIF image with a rectangular structuring element.
+ * 
+ * This function replaces every pixel of the selected channels with the minimum over a
+ * size_x by size_y rectangle centered on it, with the edge pixels repeated outside of the
+ * image. The rectangle is applied as a horizontal and a vertical pass using the van Herk /
+ * Gil-Werman algorithm, so the cost per pixel does not depend on its size. The output image
+ * must be initialized with the same dimensions as the source image, and may be the source
+ * image itself. Both passes work through row buffers, so no extra plane is allocated in
+ * MDIF_STATIC_ARENA builds.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] size_x Width of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] size_y Height of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_erode(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Dilate an MDIF image with a rectangular structuring element.
+ * 
+ * This function replaces every pixel of the selected channels with the maximum over a
+ * size_x by size_y rectangle centered on it, the same way as mdif_erode().
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] size_x Width of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] size_y Height of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_dilate(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Open an MDIF image with a rectangular structuring element.
+ * 
+ * This function erodes and then dilates the selected channels, which removes bright details
+ * smaller than the structuring element.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] size_x Width of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] size_y Height of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_open(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Close an MDIF image with a rectangular structuring element.
+ * 
+ * This function dilates and then erodes the selected channels, which fills dark details
+ * smaller than the structuring element.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the filtered image.
+ * @param[in] size_x Width of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] size_y Height of the structuring element (odd, up to MDIF_MORPH_MAX_SIZE).
+ * @param[in] channels Mask of the channels to filter (MDIF_CHANNEL_* flags).
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_close(
+    const mdif_t* image,
+    mdif_t* output,
+    unsigned char size_x,
+    unsigned char size_y,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Threshold an 8-bit grayscale image into a mask.
+ * 
+ * Pixels brighter than the level are set in the mask, or pixels at or below the level
+ * with MDIF_MASK_INVERT. The grayscale image is typically the output of mdif_luminance().
+ * 
+ * @param[in] gray Pointer to width * height grayscale values.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] level Threshold level.
+ * @param[out] mask Pointer to the mask receiving the result.
+ * @param[in] flags Mask format flags (MDIF_MASK_* flags).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_threshold(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char level,
+    unsigned char* mask,
+    unsigned char flags
+);
+
+/**
+ * @brief Compute the threshold level of an 8-bit grayscale image with Otsu's method.
+ * 
+ * The level maximizes the between-class variance of the pixels at or below it and the
+ * pixels above it, and can be passed to mdif_threshold(). Uniform images give their
+ * only value, so that the resulting mask is empty.
+ * 
+ * @param[in] gray Pointer to width * height grayscale values.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[out] level Pointer receiving the threshold level.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_threshold_otsu(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char* level
+);
+
+/**
+ * @brief Threshold an 8-bit grayscale image against its local mean.
+ * 
+ * Pixels brighter than the mean of the size by size window around them minus the offset
+ * are set in the mask, or the other pixels with MDIF_MASK_INVERT. Windows are cropped at
+ * the edges of the image. The window sums come from running column sums and their prefix
+ * sums, so the cost per pixel does not depend on the window size and only two rows of
+ * sums are kept in memory.
+ * 
+ * @param[in] gray Pointer to width * height grayscale values.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] size Width and height of the window (odd, at least 3).
+ * @param[in] offset Value subtracted from the local mean (limited to -255 to 255).
+ * @param[out] mask Pointer to the mask receiving the result.
+ * @param[in] flags Mask format flags (MDIF_MASK_* flags).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_threshold_adaptive(
+    const unsigned char* gray,
+    short width,
+    short height,
+    unsigned char size,
+    short offset,
+    unsigned char* mask,
+    unsigned char flags
+);
+
+/**
+ * @brief Find the connected components of a mask.
+ * 
+ * This function labels the runs of set pixels row by row and merges touching runs with a
+ * union-find, so that only the runs of two rows and one slot per run are kept in memory.
+ * Components are reported as soon as they end, sorted by the top and then the left edge of
+ * their bounding boxes. If more components are found than fit in the output array, only
+ * max_components of them are stored.
+ * 
+ * @param[in] mask Pointer to the mask.
+ * @param[in] width Width of the mask.
+ * @param[in] height Height of the mask.
+ * @param[in] flags Mask format flags (only MDIF_MASK_PACKED is used).
+ * @param[in] connectivity 4 to connect pixels through their edges, or 8 to also connect them
+ *                         through their corners.
+ * @param[in] min_area Smallest area of a reported component, to drop noise.
+ * @param[out] components Pointer to the array receiving the components.
+ * @param[in] max_components Number of elements of the components array.
+ * @param[out] count Pointer receiving the number of components found.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation,
+ *         MDIF_ERROR_COMPONENTS if the components did not all fit.
+ */
+mdif_error_t mdif_label(
+    const unsigned char* mask,
+    short width,
+    short height,
+    unsigned char flags,
+    unsigned char connectivity,
+    unsigned long min_area,
+    mdif_component_t* components,
+    int max_components,
+    int* count
+);
+
+/**
+ * @brief Compute the Sobel gradients of the luminance of an MDIF image.
+ * 
+ * The gradients are computed with fixed-point arithmetic on the same luminance as
+ * mdif_luminance(), with the edge pixels repeated outside of the image. The magnitude is
+ * the rounded-down length of the gradient, from 0 to 1442. The orientation is its angle in
+ * 256 steps per turn, measured from the positive x axis towards the positive y axis (down),
+ * and is 0 where the gradient is zero.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[out] magnitude Pointer to an array of width * height values receiving the magnitudes.
+ * @param[out] orientation Pointer to an array of width * height bytes receiving the orientations.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_gradients(const mdif_t* image, unsigned short* magnitude, unsigned char* orientation);
+
+/**
+ * @brief Get the number of values of a HOG descriptor.
+ * 
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] cell Width and height of a cell in pixels (up to MDIF_HOG_MAX_CELL).
+ * @param[in] block Width and height of a block in cells.
+ * @param[in] bins Number of orientation bins (at least 2).
+ * 
+ * @return The number of values written by mdif_hog(), or 0 if the parameters are invalid.
+ */
+unsigned long mdif_hog_size(short width, short height, unsigned char cell, unsigned char block, unsigned char bins);
+
+/**
+ * @brief Compute the histogram of oriented gradients (HOG) descriptor of an MDIF image.
+ * 
+ * The gradients of mdif_gradients() are accumulated per cell into unsigned orientation bins
+ * (0 to 180 degrees), each magnitude being split linearly between the two nearest bins. Cells
+ * that do not fit entirely in the image are ignored. Blocks of block by block cells, taken
+ * with a stride of one cell, are normalized with L2-Hys (L2 normalization, clipping at 0.2
+ * and renormalization).
+ * 
+ * The descriptor is a flat array that can be used directly as the input layer of a Diwa
+ * network: blocks in row-major order, then the cells of each block in row-major order, then
+ * the bins of each cell. Only the histograms of one row of blocks are kept in memory, and
+ * all the per-pixel work is done in fixed point.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[in] cell Width and height of a cell in pixels (up to MDIF_HOG_MAX_CELL).
+ * @param[in] block Width and height of a block in cells.
+ * @param[in] bins Number of orientation bins (at least 2).
+ * @param[out] out Pointer to an array of mdif_hog_size() values receiving the descriptor.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_hog(
+    const mdif_t* image,
+    unsigned char cell,
+    unsigned char block,
+    unsigned char bins,
+    float* out
+);
+
+/**
+ * @brief Apply a list of random augmentation operations to an MDIF image.
+ * 
+ * All geometric operations are composed into a single mapping and all color operations into
+ * a single color matrix, so every output pixel is produced in one pass: sampled from the source
+ * (nearest for crops, flips and quarter turns, bilinear otherwise), then recolored once.
+ * The result is scaled to the dimensions of the preallocated output image, and areas mapped
+ * from outside of the source are transparent. The same seed always gives the same result.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the initialized MDIF image structure receiving the result.
+ * @param[in] ops Array of augmentation operations, applied in order.
+ * @param[in] op_count Number of augmentation operations.
+ * @param[in] seed Seed of the random draws.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_augment(
+    const mdif_t* image,
+    mdif_t* output,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed
+);
+
+/**
+ * @brief Augment a batch of MDIF images in parallel.
+ * 
+ * Each image draws from its own random stream derived from the seed and its index in the batch,
+ * so results are reproducible regardless of the number of threads. The first image of a batch
+ * gets the same result as mdif_augment() with the same seed.
+ * 
+ * @param[in] images Array of source MDIF images.
+ * @param[out] outputs Array of initialized MDIF images receiving the results.
+ * @param[in] count Number of images in the batch.
+ * @param[in] ops Array of augmentation operations, applied in order.
+ * @param[in] op_count Number of augmentation operations.
+ * @param[in] seed Seed of the random draws.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_augment_batch(
+    const mdif_t* images,
+    mdif_t* outputs,
+    int count,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed,
+    int threads
+);
+
+/**
+ * @brief Load and augment a batch of MDIF files in parallel.
+ * 
+ * Each thread reads its files into a single reused image (taken from the pool if one is given)
+ * and augments it straight into the corresponding output, so no per-file image is allocated.
+ * Results match mdif_augment_batch() on the loaded images.
+ * 
+ * @param[in] filenames Array of file names to read.
+ * @param[out] outputs Array of initialized MDIF images receiving the results.
+ * @param[in] count Number of files in the batch.
+ * @param[in] ops Array of augmentation operations, applied in order.
+ * @param[in] op_count Number of augmentation operations.
+ * @param[in] seed Seed of the random draws.
+ * @param[in] pool Optional pool to take the load buffers from (thread-safe when using threads), or NULL.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_augment_files(
+    const char* const* filenames,
+    mdif_t* outputs,
+    int count,
+    const mdif_augment_op_t* ops,
+    int op_count,
+    unsigned long long seed,
+    mdif_pool_t* pool,
+    int threads
+);
+
+/**
+ * @brief Initialize an MDIF plane set pool.
+ * 
+ * @param[out] pool Pointer to the pool structure to be initialized.
+ * @param[in] max_cached_bytes Maximum number of bytes kept in the free lists (0 for no limit).
+ * @param[in] flags Pool flags, MDIF_POOL_THREAD_SAFE to guard the pool with a lock.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pool_init(mdif_pool_t* pool, unsigned long max_cached_bytes, unsigned char flags);
+
+/**
+ * @brief Release all plane sets cached by an MDIF pool.
+ * 
+ * Images still acquired from the pool must be freed before the pool is destroyed.
+ * 
+ * @param[in,out] pool Pointer to the pool to be destroyed.
+ */
+void mdif_pool_destroy(mdif_pool_t* pool);
+
+/**
+ * @brief Preallocate plane sets in an MDIF pool.
+ * 
+ * This function fills the pool with the given number of plane sets fitting the specified
+ * dimensions, so that steady-state processing does not allocate at all.
+ * 
+ * @param[in,out] pool Pointer to the pool.
+ * @param[in] width Width of the images to reserve for.
+ * @param[in] height Height of the images to reserve for.
+ * @param[in] count Number of plane sets to reserve.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pool_reserve(mdif_pool_t* pool, short width, short height, int count);
+
+/**
+ * @brief Initialize an MDIF image with channel buffers taken from a pool.
+ * 
+ * The image keeps a reference to the pool, and mdif_free() hands its plane set back
+ * to the pool instead of releasing it to the heap.
+ * 
+ * @param[in,out] pool Pointer to the pool to acquire the plane set from.
+ * @param[out] image Pointer to the MDIF image structure to be initialized.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_init_from_pool(mdif_pool_t* pool, mdif_t* image, short width, short height);
+
+#ifdef MDIF_STATIC_ARENA
+
+/**
+ * @brief Register a caller-owned memory region as the static arena.
+ * 
+ * The region (e.g. a block of PSRAM) is split into as many slots of MDIF_ARENA_SLOT_BYTES
+ * bytes as fit, replacing the statically reserved slots. It must remain valid for as long
+ * as the library is used, and can only be registered while no slot is in use.
+ * 
+ * @param[in] region Pointer to the memory region.
+ * @param[in] size Size of the region in bytes.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_arena_register(void* region, unsigned long size);
+
+/**
+ * @brief Get the number of free slots in the static arena.
+ * 
+ * @return The number of slots that are not in use.
+ */
+unsigned int mdif_arena_available();
+
+#endif
+
+/**
+ * @brief Compute the per-channel histograms of an MDIF image.
+ * 
+ * Counting is spread over four partial histograms per channel, so consecutive pixels with the
+ * same value do not stall on the same counter.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[out] histogram Pointer to the histogram to fill.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_histogram(const mdif_t* image, mdif_histogram_t* histogram);
+
+/**
+ * @brief Reset a statistics accumulator.
+ * 
+ * @param[out] stats Pointer to the accumulator.
+ */
+void mdif_stats_init(mdif_stats_t* stats);
+
+/**
+ * @brief Accumulate the statistics of an MDIF image.
+ * 
+ * @param[in] image Pointer to the MDIF image structure.
+ * @param[in,out] stats Pointer to the accumulator.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_stats(const mdif_t* image, mdif_stats_t* stats);
+
+/**
+ * @brief Merge a statistics accumulator into another.
+ * 
+ * @param[in,out] stats Pointer to the accumulator receiving the counts.
+ * @param[in] other Pointer to the accumulator to merge.
+ */
+void mdif_stats_merge(mdif_stats_t* stats, const mdif_stats_t* other);
+
+/**
+ * @brief Summarize one channel of a statistics accumulator.
+ * 
+ * @param[in] stats Pointer to the accumulator.
+ * @param[in] channel Index of the channel (0 red, 1 green, 2 blue, 3 alpha).
+ * @param[out] summary Pointer to the summary to fill.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_stats_summary(const mdif_stats_t* stats, int channel, mdif_summary_t* summary);
+
+/**
+ * @brief Accumulate the statistics of a list of MDIF files in parallel.
+ * 
+ * Each thread fills its own accumulator while reusing a single image buffer, and the partial
+ * results are merged into the given accumulator at the end.
+ * 
+ * @param[in] filenames Array of file names to read.
+ * @param[in] count Number of files.
+ * @param[in,out] stats Pointer to the accumulator.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_stats_files(
+    const char* const* filenames,
+    int count,
+    mdif_stats_t* stats,
+    int threads
+);
+
+#ifndef ARDUINO
+
+/**
+ * @brief Save a statistics accumulator to a portable text file.
+ * 
+ * @param[in] filename The name of the file to write to.
+ * @param[in] stats Pointer to the accumulator.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_stats_save(const char* filename, const mdif_stats_t* stats);
+
+/**
+ * @brief Load a statistics accumulator saved by mdif_stats_save().
+ * 
+ * @param[in] filename The name of the file to read from.
+ * @param[out] stats Pointer to the accumulator to fill.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_stats_load(const char* filename, mdif_stats_t* stats);
+
+#endif
+
+/**
+ * @brief Resize an MDIF image with bilinear interpolation.
+ * 
+ * The output size is taken from the preallocated output image. All four channels are resized,
+ * with pixel centers aligned and 8-bit fixed-point weights.
+ * 
+ * @param[in] image Pointer to the source MDIF image structure.
+ * @param[out] output Pointer to the MDIF image structure receiving the resized image.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_resize(const mdif_t* image, mdif_t* output, int threads);
+
+/**
+ * @brief Initialize a pipeline reading from an MDIF image.
+ * 
+ * @param[out] pipeline Pointer to the pipeline to be initialized.
+ * @param[in] image Pointer to the source MDIF image structure.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_init(mdif_pipeline_t* pipeline, const mdif_t* image);
+
+/**
+ * @brief Queue a 3x3 box blur of the color channels.
+ * 
+ * @param[in,out] pipeline Pointer to the pipeline.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_antialias(mdif_pipeline_t* pipeline);
+
+/**
+ * @brief Queue a convolution.
+ * 
+ * The result is identical to the one of mdif_convolve(). The kernel is not copied.
+ * 
+ * @param[in,out] pipeline Pointer to the pipeline.
+ * @param[in] kernel Pointer to the kernel.
+ * @param[in] border Border handling mode.
+ * @param[in] channels Mask of MDIF_CHANNEL_* flags selecting the filtered channels.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_convolve(
+    mdif_pipeline_t* pipeline,
+    const mdif_kernel_t* kernel,
+    mdif_border_t border,
+    unsigned char channels
+);
+
+/**
+ * @brief Queue a bilinear resize.
+ * 
+ * @param[in,out] pipeline Pointer to the pipeline.
+ * @param[in] width Width of the resized image.
+ * @param[in] height Height of the resized image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_resize(mdif_pipeline_t* pipeline, short width, short height);
+
+/**
+ * @brief Queue a grayscale conversion.
+ * 
+ * The red, green and blue channels are all replaced with the luminance of the pixel, rounded
+ * to 8 bits exactly as mdif_luminance() computes it. Alpha is kept.
+ * 
+ * @param[in,out] pipeline Pointer to the pipeline.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_grayscale(mdif_pipeline_t* pipeline);
+
+/**
+ * @brief Run a pipeline into an MDIF image.
+ * 
+ * @param[in] pipeline Pointer to the pipeline.
+ * @param[out] output Pointer to a preallocated MDIF image of the pipeline output size.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_run(const mdif_pipeline_t* pipeline, mdif_t* output, int threads);
+
+/**
+ * @brief Run a pipeline into normalized floating-point planes.
+ * 
+ * Each selected channel is written as its own plane of width * height values, in red, green,
+ * blue, alpha order. A value v becomes (v / 255 - mean) / stddev, with the mean and standard
+ * deviation given per written plane.
+ * 
+ * @param[in] pipeline Pointer to the pipeline.
+ * @param[out] output Pointer to the output planes.
+ * @param[in] channels Mask of MDIF_CHANNEL_* flags selecting the written channels.
+ * @param[in] mean Per-plane means, or NULL for zero.
+ * @param[in] stddev Per-plane standard deviations, or NULL for one.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_run_normalized(
+    const mdif_pipeline_t* pipeline,
+    float* output,
+    unsigned char channels,
+    const float* mean,
+    const float* stddev,
+    int threads
+);
+
+#ifndef ARDUINO
+
+/**
+ * @brief Open an on-disk result cache.
+ * 
+ * The directory is created when it does not exist, but its parent must exist. The same
+ * directory can be shared by any number of threads and processes.
+ * 
+ * @param[out] cache Pointer to the cache to initialize.
+ * @param[in] directory Cache directory.
+ * @param[in] max_bytes Bound on the total size of the cached entries.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_cache_open(mdif_cache_t* cache, const char* directory, unsigned long long max_bytes);
+
+/**
+ * @brief Release a cache opened with mdif_cache_open(). The cached entries are kept.
+ * 
+ * @param[in,out] cache Pointer to the cache.
+ */
+void mdif_cache_close(mdif_cache_t* cache);
+
+/**
+ * @brief Compute the cache key of an operation on the content of a file.
+ * 
+ * The key is the mdif_hash64() of the parameters, seeded with the mdif_hash_file() of the
+ * source, so it changes whenever either the source bytes or the parameters do. The parameters
+ * must not contain padding or pointers.
+ * 
+ * @param[in] filename The name of the source file.
+ * @param[in] params Serialized operation parameters (may be NULL when size is 0).
+ * @param[in] size Size of the parameters in bytes.
+ * @param[out] key Pointer to the resulting key.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_cache_key(
+    const char* filename,
+    const void* params,
+    unsigned long size,
+    unsigned long long* key
+);
+
+/**
+ * @brief Look up a cached result of a known size.
+ * 
+ * A hit also marks the entry as the most recently used one.
+ * 
+ * @param[in] cache Pointer to the cache.
+ * @param[in] key Key of the result.
+ * @param[out] data Buffer receiving the result.
+ * @param[in] size Size of the result in bytes.
+ * 
+ * @return MDIF_ERROR_NONE on a hit, MDIF_ERROR_CACHE_MISS when there is no valid entry of
+ *         this size, or another mdif_error_t error code on failure.
+ */
+mdif_error_t mdif_cache_load(const mdif_cache_t* cache, unsigned long long key, void* data, unsigned long size);
+
+/**
+ * @brief Store a result in the cache, replacing any previous entry with the same key.
+ * 
+ * Results larger than the bound of the cache are not stored.
+ * 
+ * @param[in] cache Pointer to the cache.
+ * @param[in] key Key of the result.
+ * @param[in] data Pointer to the result.
+ * @param[in] size Size of the result in bytes.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_cache_store(
+    const mdif_cache_t* cache,
+    unsigned long long key,
+    const void* data,
+    unsigned long size
+);
+
+/**
+ * @brief Write a cached result to a file.
+ * 
+ * @param[in] cache Pointer to the cache.
+ * @param[in] key Key of the result.
+ * @param[in] filename The name of the file to write to.
+ * 
+ * @return MDIF_ERROR_NONE on a hit, MDIF_ERROR_CACHE_MISS when there is no valid entry, or
+ *         another mdif_error_t error code on failure.
+ */
+mdif_error_t mdif_cache_load_file(const mdif_cache_t* cache, unsigned long long key, const char* filename);
+
+/**
+ * @brief Store the content of a file as a cached result.
+ * 
+ * @param[in] cache Pointer to the cache.
+ * @param[in] key Key of the result.
+ * @param[in] filename The name of the file to read from.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_cache_store_file(const mdif_cache_t* cache, unsigned long long key, const char* filename);
+
+/**
+ * @brief Cache the results of a pipeline.
+ * 
+ * mdif_pipeline_run() and mdif_pipeline_run_normalized() then key their result on the source
+ * planes, the queued operations (including kernel weights) and the output parameters, and
+ * copy it from the cache instead of running the operations when it is found. Results that
+ * are computed are stored. The cache must stay open until the pipeline is run.
+ * 
+ * @param[in,out] pipeline Pointer to the pipeline.
+ * @param[in] cache Pointer to the cache, or NULL to stop caching.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_pipeline_use_cache(mdif_pipeline_t* pipeline, const mdif_cache_t* cache);
+
+#endif
+
+/**
+ * @brief Apply a 256-entry lookup table to each plane of an MDIF image in place.
+ * 
+ * The tables apply to the planes as stored, so for YCbCr layouts the red, green and blue
+ * tables map the Y, Cb and Cr planes. Planes whose table is NULL are left untouched. The
+ * planes are split into chunks that are mapped in parallel. For indexed images, only the
+ * palette colors are mapped.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * @param[in] lut_r Table for the red plane, or NULL.
+ * @param[in] lut_g Table for the green plane, or NULL.
+ * @param[in] lut_b Table for the blue plane, or NULL.
+ * @param[in] lut_a Table for the alpha plane, or NULL.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_apply_lut(
+    mdif_t* image,
+    const unsigned char* lut_r,
+    const unsigned char* lut_g,
+    const unsigned char* lut_b,
+    const unsigned char* lut_a,
+    int threads
+);
+
+/**
+ * @brief Fill a lookup table with the identity mapping.
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ */
+void mdif_lut_identity(unsigned char* lut);
+
+/**
+ * @brief Fill a lookup table with the inverse mapping (255 - v).
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ */
+void mdif_lut_invert(unsigned char* lut);
+
+/**
+ * @brief Fill a lookup table mapping values at or above a threshold to 255, and others to 0.
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ * @param[in] threshold The threshold value.
+ */
+void mdif_lut_threshold(unsigned char* lut, unsigned char threshold);
+
+/**
+ * @brief Fill a lookup table with a gamma curve, 255 * (v / 255)^(1 / gamma).
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ * @param[in] gamma Gamma value, greater than zero (above one brightens).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_lut_gamma(unsigned char* lut, float gamma);
+
+/**
+ * @brief Fill a lookup table with a levels adjustment.
+ * 
+ * Input values are clamped to [in_black, in_white], normalized, raised to 1 / gamma and
+ * scaled to [out_black, out_white]. The output range may be reversed.
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ * @param[in] in_black Input value mapped to out_black.
+ * @param[in] in_white Input value mapped to out_white, greater than in_black.
+ * @param[in] gamma Midtone gamma, greater than zero.
+ * @param[in] out_black Output value for in_black and below.
+ * @param[in] out_white Output value for in_white and above.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_lut_levels(
+    unsigned char* lut,
+    unsigned char in_black,
+    unsigned char in_white,
+    float gamma,
+    unsigned char out_black,
+    unsigned char out_white
+);
+
+/**
+ * @brief Fill a lookup table with a piecewise-linear curve through control points.
+ * 
+ * Values before the first point or after the last one take the output of that point.
+ * 
+ * @param[out] lut Pointer to the 256-entry table.
+ * @param[in] x Input values of the control points, strictly increasing.
+ * @param[in] y Output values of the control points.
+ * @param[in] count Number of control points (1 or more).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_lut_curve(
+    unsigned char* lut,
+    const unsigned char* x,
+    const unsigned char* y,
+    int count
+);
+
+/**
+ * @brief Equalize the histogram of an MDIF image in place.
+ * 
+ * Each selected plane is mapped through its cumulative histogram, stretched so that its
+ * darkest value becomes 0 and its brightest 255. Uniform planes are left untouched.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * @param[in] channels Mask of the planes to equalize (MDIF_CHANNEL_* flags, as stored), or
+ *                     MDIF_CHANNEL_LUMINANCE.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_equalize(mdif_t* image, unsigned char channels, int threads);
+
+/**
+ * @brief Apply contrast-limited adaptive histogram equalization (CLAHE) to an MDIF image in place.
+ * 
+ * Each selected plane is split into a grid of tiles. Every tile gets its own equalization
+ * table from its histogram, whose bins are clipped at clip times their mean count with
+ * the clipped counts spread over all bins, which limits the amplification of noise in flat
+ * areas. Each pixel is then mapped through the tables of the four nearest tile centers,
+ * interpolated bilinearly, so there are no seams between tiles. The tiles are processed in
+ * parallel, and so are the rows of the mapping pass.
+ * 
+ * Every tile of every plane has a 256-byte lookup table. With MDIF_STATIC_ARENA the tables
+ * come from the scratch area, or from a slot when they do not fit there, and the call fails
+ * with MDIF_ERROR_LUT when they do not fit in a slot either.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * @param[in] tiles_x Number of tile columns.
+ * @param[in] tiles_y Number of tile rows.
+ * @param[in] clip Contrast limit as a multiple of the mean bin count (typically 2 to 4), or 0
+ *                 to disable clipping.
+ * @param[in] channels Mask of the planes to process (MDIF_CHANNEL_* flags, as stored), or
+ *                     MDIF_CHANNEL_LUMINANCE.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_clahe(
+    mdif_t* image,
+    unsigned char tiles_x,
+    unsigned char tiles_y,
+    float clip,
+    unsigned char channels,
+    int threads
+);
+
+/**
+ * @brief Quantize an RGBA image in place to the indexed layout.
+ * 
+ * The palette is built by median cut: the pixels are split recursively at the median of
+ * their widest channel, always splitting the box with the largest spread, and every final
+ * box contributes its mean color. Images with no more distinct colors than max_colors keep
+ * them exactly. Fully transparent pixels are merged into a single color. Pixels are then
+ * mapped to their nearest palette color through a 32x32x32 lookup cube caching the last
+ * match in each cell, optionally after ordered or Floyd-Steinberg dithering of the red,
+ * green and blue channels. The planes are reallocated only if they are smaller than the
+ * palette.
+ * 
+ * The pixel colors and then the 160 KB lookup cube share one allocation, so with
+ * MDIF_STATIC_ARENA the call takes a single slot besides the image, and it fails with
+ * MDIF_ERROR_CANNOT_ALLOCATE when MDIF_ARENA_SLOT_BYTES is smaller than the cube.
+ * 
+ * @param[in,out] image Pointer to an RGBA MDIF image.
+ * @param[in] max_colors Largest number of palette colors, from 1 to MDIF_PALETTE_SIZE.
+ * @param[in] dither Dithering method.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_quantize(mdif_t* image, int max_colors, mdif_dither_t dither);
+
+/**
+ * @brief Expand rows of an indexed image to interleaved RGBA bytes.
+ * 
+ * This looks up only the requested rows, so an indexed image can be kept in its compact
+ * form and expanded on demand, for instance one display line at a time. Use mdif_convert()
+ * to expand a whole image to RGBA planes.
+ * 
+ * @param[in] image Pointer to an indexed MDIF image.
+ * @param[in] y First row to expand.
+ * @param[in] rows Number of rows to expand.
+ * @param[out] pixels Pointer to rows * width * 4 bytes receiving red, green, blue and alpha
+ *                    of each pixel.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_expand_rows(const mdif_t* image, short y, short rows, unsigned char* pixels);
+
+/**
+ * @brief Transpose an MDIF image, swapping its rows and columns.
+ * 
+ * Every plane is transposed in cache-sized blocks of 16x16 byte tiles. This works with every
+ * plane layout.
+ * 
+ * @param[in] image Pointer to the source MDIF image.
+ * @param[out] output Pointer to a preallocated MDIF image of height x width pixels.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_transpose(const mdif_t* image, mdif_t* output);
+
+/**
+ * @brief Transpose an MDIF image in place, swapping its width and height.
+ * 
+ * Each plane goes through a temporary buffer the size of the largest plane.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_transpose_inplace(mdif_t* image);
+
+/**
+ * @brief Rotate an MDIF image by a multiple of 90 degrees.
+ * 
+ * @param[in] image Pointer to the source MDIF image.
+ * @param[out] output Pointer to a preallocated MDIF image of the rotated size.
+ * @param[in] rotation The clockwise rotation.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_rotate(const mdif_t* image, mdif_t* output, mdif_rotation_t rotation);
+
+/**
+ * @brief Rotate an MDIF image by a multiple of 90 degrees in place.
+ * 
+ * A half turn needs no extra memory. Quarter turns swap the width and height and go
+ * through a temporary buffer the size of the largest plane.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * @param[in] rotation The clockwise rotation.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_rotate_inplace(mdif_t* image, mdif_rotation_t rotation);
+
+/**
+ * @brief Mirror an MDIF image.
+ * 
+ * @param[in] image Pointer to the source MDIF image.
+ * @param[out] output Pointer to a preallocated MDIF image of the same size.
+ * @param[in] vertical Nonzero to flip top to bottom instead of left to right.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_flip(const mdif_t* image, mdif_t* output, unsigned char vertical);
+
+/**
+ * @brief Mirror an MDIF image in place.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * @param[in] vertical Nonzero to flip top to bottom instead of left to right.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_flip_inplace(mdif_t* image, unsigned char vertical);
+
+/**
+ * @brief Compare two MDIF images plane by plane.
+ * 
+ * The planes are compared as stored, so both images must have the same size and layout, and
+ * indexed images must first be expanded with mdif_convert(). MDIF_METRIC_ERROR computes the
+ * largest absolute difference, the mean squared error and the PSNR, and MDIF_METRIC_SSIM the
+ * windowed SSIM. Both are gathered in a single pass over bands of rows spread over the
+ * threads. Metrics that are not requested, and planes that the layout does not store, are
+ * set to zero.
+ * 
+ * @param[in] a Pointer to the first MDIF image.
+ * @param[in] b Pointer to the second MDIF image.
+ * @param[in] metrics Mask of MDIF_METRIC_* flags.
+ * @param[out] results Pointer to the metrics.
+ * @param[out] diff Pointer to a preallocated MDIF image receiving the absolute differences, or NULL.
+ * @param[in] threads Number of threads to use (0 for one per processor).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_compare(
+    const mdif_t* a,
+    const mdif_t* b,
+    unsigned char metrics,
+    mdif_metrics_t* results,
+    mdif_t* diff,
+    int threads
+);
+
+/**
+ * @brief Multiply the color planes of an MDIF image by its alpha plane, in place.
+ * 
+ * Each color value becomes round(c * a / 255). Runs of fully opaque pixels are skipped.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_premultiply(mdif_t* image);
+
+/**
+ * @brief Divide the color planes of a premultiplied MDIF image by its alpha plane, in place.
+ * 
+ * Each color value becomes min(255, (c * 255 + a / 2) / a), and zero where alpha is zero.
+ * Runs of fully opaque pixels are skipped.
+ * 
+ * @param[in,out] image Pointer to the MDIF image.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_unpremultiply(mdif_t* image);
+
+/**
+ * @brief Composite a premultiplied MDIF image onto another one.
+ * 
+ * The source is placed with its top-left corner at (x, y) on the destination and clipped
+ * to it. Both images must be premultiplied RGBA. Runs of fully transparent source pixels
+ * are skipped, and runs of fully opaque ones are copied in MDIF_BLEND_OVER mode.
+ * 
+ * @param[in,out] dest Pointer to the destination MDIF image.
+ * @param[in] source Pointer to the source MDIF image.
+ * @param[in] x Horizontal position of the source on the destination.
+ * @param[in] y Vertical position of the source on the destination.
+ * @param[in] mode The blend mode.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_composite(mdif_t* dest, const mdif_t* source, int x, int y, mdif_blend_t mode);
+
+#ifndef ARDUINO
+
+/**
+ * @brief Create a frame sequence file.
+ * 
+ * @param[out] sequence Pointer to the sequence to initialize.
+ * @param[in] filename The name of the file to write to.
+ * @param[in] width Width of every frame.
+ * @param[in] height Height of every frame.
+ * @param[in] layout Plane layout of every frame.
+ * @param[in] tile Edge length of the compared tiles (0 for MDIF_SEQUENCE_TILE).
+ * @param[in] interval Maximum distance between keyframes (0 for no limit).
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_create(
+    mdif_sequence_t* sequence,
+    const char* filename,
+    short width,
+    short height,
+    mdif_layout_t layout,
+    unsigned char tile,
+    unsigned short interval
+);
+
+/**
+ * @brief Append a frame to a sequence.
+ * 
+ * Tiles equal to the previous frame are skipped. The frame is stored as a keyframe when it is
+ * the first one, when the keyframe interval is reached, or when its delta would take more than
+ * half of a keyframe.
+ * 
+ * @param[in,out] sequence Pointer to a sequence created with mdif_sequence_create().
+ * @param[in] frame Pointer to the frame, of the sequence size and layout.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_append(mdif_sequence_t* sequence, const mdif_t* frame);
+
+/**
+ * @brief Open a frame sequence file for reading.
+ * 
+ * @param[out] sequence Pointer to the sequence to initialize.
+ * @param[in] filename The name of the file to read from.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_open(mdif_sequence_t* sequence, const char* filename);
+
+/**
+ * @brief Decode the next frame of a sequence.
+ * 
+ * Like mdif_read_into(), the frame planes are reused when they are large enough.
+ * 
+ * @param[in,out] sequence Pointer to a sequence opened with mdif_sequence_open().
+ * @param[in,out] frame Pointer to the MDIF image to store the frame in.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_read(mdif_sequence_t* sequence, mdif_t* frame);
+
+/**
+ * @brief Move a sequence so that the next frame read is the given one.
+ * 
+ * Decoding restarts from the nearest keyframe at or before the frame, unless the frames already
+ * decoded are closer.
+ * 
+ * @param[in,out] sequence Pointer to a sequence opened with mdif_sequence_open().
+ * @param[in] index Index of the frame.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_seek(mdif_sequence_t* sequence, unsigned int index);
+
+/**
+ * @brief Close a sequence.
+ * 
+ * For a written sequence this stores the frame index and completes the file header.
+ * 
+ * @param[in,out] sequence Pointer to the sequence.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+mdif_error_t mdif_sequence_close(mdif_sequence_t* sequence);
+
+#endif
+
+/**
+ * @brief Get a human-readable error message.
+ * 
+ * This function returns a human-readable error message corresponding to the specified MDIF error code.
+ * 
+ * @param[in] error_num The MDIF error code.
+ * 
+ * @return A constant string containing the error message.
+ */
+const char* mdif_error_message(mdif_error_t error_num);
+
 #endif
\ No newline at end of file
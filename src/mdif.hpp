@@ -0,0 +1,482 @@
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file mdif.hpp
+ * @author [Nathanne Isip](https://github.com/nthnn)
+ * @brief Minimal Data Image Format (MDIF) C++ Header File
+ * 
+ * Header-only C++ layer over the MDIF C API. It provides planar image views typed by
+ * channel count and element type, and owning images that release their planes when they
+ * go out of scope. The kernels below are templates, so the channel loop and the element
+ * conversions are resolved at compile time and the inner loops can be unrolled and
+ * vectorized by the compiler.
+ * 
+ * Nothing here throws or calls into the C++ runtime library, and errors are reported as
+ * mdif_error_t codes. Programs linked without libstdc++ (like the MDIF tools) must be
+ * built with -fno-exceptions.
+ */
+
+#ifndef MDIF_HPP
+#define MDIF_HPP
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdif.h"
+
+namespace mdif {
+
+/**
+ * @brief Range and conversion rules of a plane element type.
+ * 
+ * Integer types span [0, max()], floating-point types span [0, 1]. Specialized for
+ * unsigned char, unsigned short and float, and for their const versions.
+ */
+template<typename T>
+struct pixel_traits;
+
+template<>
+struct pixel_traits<unsigned char> {
+    static float max() { return 255.0f; }
+
+    static unsigned char saturate(float value) {
+        return value <= 0.0f ? 0 : value >= 255.0f ? 255 : (unsigned char) (value + 0.5f);
+    }
+};
+
+template<>
+struct pixel_traits<unsigned short> {
+    static float max() { return 65535.0f; }
+
+    static unsigned short saturate(float value) {
+        return value <= 0.0f ? 0 : value >= 65535.0f ? 65535 : (unsigned short) (value + 0.5f);
+    }
+};
+
+template<>
+struct pixel_traits<float> {
+    static float max() { return 1.0f; }
+    static float saturate(float value) { return value; }
+};
+
+template<typename T>
+struct pixel_traits<const T> : pixel_traits<T> {};
+
+/**
+ * @brief Non-owning view of Channels full-resolution planes of T elements.
+ * 
+ * Each plane holds width * height elements in row-major order. A view of const T can be
+ * made from a view of T.
+ */
+template<int Channels, typename T = unsigned char>
+class image_view {
+public:
+    image_view() : width_(0), height_(0) {
+        for(int c = 0; c < Channels; c++)
+            planes_[c] = NULL;
+    }
+
+    image_view(T* const planes[Channels], int width, int height) :
+        width_(width), height_(height) {
+        for(int c = 0; c < Channels; c++)
+            planes_[c] = planes[c];
+    }
+
+    template<typename U>
+    image_view(const image_view<Channels, U>& other) :
+        width_(other.width()), height_(other.height()) {
+        for(int c = 0; c < Channels; c++)
+            planes_[c] = other.plane(c);
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t pixels() const { return (size_t) width_ * height_; }
+    bool empty() const { return !planes_[0]; }
+
+    T* plane(int channel) const { return planes_[channel]; }
+    T* row(int channel, int y) const { return planes_[channel] + (size_t) y * width_; }
+    T& at(int channel, int x, int y) const { return row(channel, y)[x]; }
+
+private:
+    T* planes_[Channels];
+    int width_;
+    int height_;
+};
+
+/**
+ * @brief View of the planes of an MDIF image.
+ * 
+ * Four-channel views map to the red, green, blue and alpha planes of an RGBA image,
+ * three-channel views to the Y, Cb and Cr planes of a YCbCr 4:4:4 image. An empty view is
+ * returned when the image has no planes or a different layout.
+ * 
+ * @param[in] image Pointer to the MDIF image.
+ * 
+ * @return The view of the image planes.
+ */
+template<int Channels>
+image_view<Channels, unsigned char> view_of(const mdif_t* image) {
+    static_assert(Channels == 3 || Channels == 4, "MDIF images have 3 or 4 planes");
+
+    mdif_layout_t layout = Channels == 4 ? MDIF_LAYOUT_RGBA : MDIF_LAYOUT_YCBCR444;
+    if(!image || !image->red || image->layout != layout)
+        return image_view<Channels, unsigned char>();
+
+    unsigned char* planes[4] = {image->red, image->green, image->blue, image->alpha};
+    return image_view<Channels, unsigned char>(planes, image->width, image->height);
+}
+
+/**
+ * @brief Owning planar image of Channels planes of T elements.
+ * 
+ * The planes are held in one heap block, released by the destructor. Images can be moved
+ * but not copied.
+ */
+template<int Channels, typename T = unsigned char>
+class image {
+public:
+    image() : block_(NULL), width_(0), height_(0) {}
+    ~image() { reset(); }
+
+    image(image&& other) : block_(other.block_), width_(other.width_), height_(other.height_) {
+        other.block_ = NULL;
+        other.width_ = other.height_ = 0;
+    }
+
+    image& operator=(image&& other) {
+        if(this != &other) {
+            reset();
+
+            block_ = other.block_;
+            width_ = other.width_;
+            height_ = other.height_;
+
+            other.block_ = NULL;
+            other.width_ = other.height_ = 0;
+        }
+
+        return *this;
+    }
+
+    image(const image&) = delete;
+    image& operator=(const image&) = delete;
+
+    /**
+     * @brief Allocate the planes, releasing any previous ones. The contents are undefined.
+     * 
+     * @param[in] width Width of the image.
+     * @param[in] height Height of the image.
+     * 
+     * @return An mdif_error_t error code indicating the success or failure of the operation.
+     */
+    mdif_error_t create(int width, int height) {
+        if(width < 1)
+            return MDIF_ERROR_INVALID_WIDTH;
+
+        if(height < 1)
+            return MDIF_ERROR_INVALID_HEIGHT;
+
+        reset();
+        block_ = (T*) malloc((size_t) width * height * Channels * sizeof(T));
+
+        if(!block_)
+            return MDIF_ERROR_CANNOT_ALLOCATE;
+
+        width_ = width;
+        height_ = height;
+
+        return MDIF_ERROR_NONE;
+    }
+
+    void reset() {
+        free(block_);
+
+        block_ = NULL;
+        width_ = height_ = 0;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    image_view<Channels, T> view() {
+        T* planes[Channels];
+        for(int c = 0; c < Channels; c++)
+            planes[c] = block_ ? block_ + (size_t) c * width_ * height_ : NULL;
+
+        return image_view<Channels, T>(planes, width_, height_);
+    }
+
+    image_view<Channels, const T> view() const {
+        return const_cast<image*>(this)->view();
+    }
+
+private:
+    T* block_;
+    int width_;
+    int height_;
+};
+
+/**
+ * @brief Owning MDIF image with Channels 8-bit planes.
+ * 
+ * Wraps an mdif_t released with mdif_free() by the destructor, so it can be passed to the
+ * C API through get(). Four-channel images use the RGBA layout and three-channel images
+ * the YCbCr 4:4:4 layout.
+ */
+template<int Channels>
+class image<Channels, unsigned char> {
+    static_assert(Channels == 3 || Channels == 4, "MDIF images have 3 or 4 planes");
+
+public:
+    image() { clear(); }
+    ~image() { reset(); }
+
+    image(image&& other) : image_(other.image_) {
+        other.clear();
+    }
+
+    image& operator=(image&& other) {
+        if(this != &other) {
+            reset();
+
+            image_ = other.image_;
+            other.clear();
+        }
+
+        return *this;
+    }
+
+    image(const image&) = delete;
+    image& operator=(const image&) = delete;
+
+    /**
+     * @brief Allocate the planes, releasing any previous ones. The contents are undefined.
+     * 
+     * @param[in] width Width of the image.
+     * @param[in] height Height of the image.
+     * 
+     * @return An mdif_error_t error code indicating the success or failure of the operation.
+     */
+    mdif_error_t create(int width, int height) {
+        if(width < 1 || width > 32767)
+            return MDIF_ERROR_INVALID_WIDTH;
+
+        if(height < 1 || height > 32767)
+            return MDIF_ERROR_INVALID_HEIGHT;
+
+        reset();
+
+        mdif_error_t result = mdif_init_layout(&image_, (short) width, (short) height, layout());
+        if(result != MDIF_ERROR_NONE)
+            clear();
+
+        return result;
+    }
+
+    /**
+     * @brief Read an MDIF file, reusing the current planes when they are large enough.
+     * 
+     * @param[in] filename Path to the MDIF file.
+     * 
+     * @return An mdif_error_t error code, MDIF_ERROR_LAYOUT if the file does not have
+     *         the layout of this image type.
+     */
+    mdif_error_t read(const char* filename) {
+        mdif_error_t result = mdif_read_into(filename, &image_);
+        if(result == MDIF_ERROR_NONE && image_.layout != layout())
+            result = MDIF_ERROR_LAYOUT;
+
+        if(result != MDIF_ERROR_NONE)
+            reset();
+
+        return result;
+    }
+
+    /**
+     * @brief Write the image to an MDIF file.
+     * 
+     * @param[in] filename Path to the MDIF file.
+     * 
+     * @return An mdif_error_t error code indicating the success or failure of the operation.
+     */
+    mdif_error_t write(const char* filename) {
+        if(!image_.red)
+            return MDIF_ERROR_IMAGE;
+
+        return mdif_write(filename, &image_);
+    }
+
+    void reset() {
+        if(image_.red)
+            mdif_free(&image_);
+
+        clear();
+    }
+
+    int width() const { return image_.red ? image_.width : 0; }
+    int height() const { return image_.red ? image_.height : 0; }
+
+    mdif_t* get() { return &image_; }
+    const mdif_t* get() const { return &image_; }
+
+    image_view<Channels, unsigned char> view() { return view_of<Channels>(&image_); }
+    image_view<Channels, const unsigned char> view() const { return view_of<Channels>(&image_); }
+
+private:
+    static mdif_layout_t layout() {
+        return Channels == 4 ? MDIF_LAYOUT_RGBA : MDIF_LAYOUT_YCBCR444;
+    }
+
+    void clear() {
+        memset(&image_, 0, sizeof(image_));
+    }
+
+    mdif_t image_;
+};
+
+/**
+ * @brief Set every pixel of a view to the same value.
+ * 
+ * @param[in] view Destination view.
+ * @param[in] value Value of each channel.
+ */
+template<int Channels, typename T>
+void fill(const image_view<Channels, T>& view, const T (&value)[Channels]) {
+    size_t count = view.pixels();
+
+    for(int c = 0; c < Channels; c++) {
+        T* plane = view.plane(c);
+        T channel_value = value[c];
+
+        for(size_t i = 0; i < count; i++)
+            plane[i] = channel_value;
+    }
+}
+
+/**
+ * @brief Copy a view into another of the same size.
+ * 
+ * @param[in] source Source view.
+ * @param[in] dest Destination view.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+template<int Channels, typename T>
+mdif_error_t copy(const image_view<Channels, const T>& source, const image_view<Channels, T>& dest) {
+    if(source.width() != dest.width())
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(source.height() != dest.height())
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    for(int c = 0; c < Channels; c++)
+        memcpy(dest.plane(c), source.plane(c), source.pixels() * sizeof(T));
+
+    return MDIF_ERROR_NONE;
+}
+
+template<int Channels, typename T>
+mdif_error_t copy(const image_view<Channels, T>& source, const image_view<Channels, T>& dest) {
+    return copy(image_view<Channels, const T>(source), dest);
+}
+
+/**
+ * @brief Apply a function to every element of a view, writing into another of the same size.
+ * 
+ * The function takes a source element and returns the destination element. The two views
+ * may be the same.
+ * 
+ * @param[in] source Source view.
+ * @param[in] dest Destination view.
+ * @param[in] function Function applied to each element.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+template<int Channels, typename S, typename D, typename F>
+mdif_error_t transform(const image_view<Channels, S>& source, const image_view<Channels, D>& dest, F function) {
+    if(source.width() != dest.width())
+        return MDIF_ERROR_INVALID_WIDTH;
+
+    if(source.height() != dest.height())
+        return MDIF_ERROR_INVALID_HEIGHT;
+
+    size_t count = source.pixels();
+    for(int c = 0; c < Channels; c++) {
+        const S* in = source.plane(c);
+        D* out = dest.plane(c);
+
+        for(size_t i = 0; i < count; i++)
+            out[i] = function(in[i]);
+    }
+
+    return MDIF_ERROR_NONE;
+}
+
+/**
+ * @brief Convert a view to another element type, scaling between the two ranges.
+ * 
+ * Each element becomes source * scale + offset in the [0, 1] range of floating-point
+ * types or the [0, max] range of integer types, saturated and rounded for integer
+ * destinations. A uint8 view converts to float in [0, 1] with the default arguments.
+ * 
+ * @param[in] source Source view.
+ * @param[in] dest Destination view.
+ * @param[in] scale Factor applied in the normalized range.
+ * @param[in] offset Value added in the normalized range.
+ * 
+ * @return An mdif_error_t error code indicating the success or failure of the operation.
+ */
+template<int Channels, typename S, typename D>
+mdif_error_t convert(
+    const image_view<Channels, S>& source,
+    const image_view<Channels, D>& dest,
+    float scale = 1.0f,
+    float offset = 0.0f
+) {
+    float multiplier = scale * pixel_traits<D>::max() / pixel_traits<S>::max(),
+        bias = offset * pixel_traits<D>::max();
+
+    return transform(source, dest, [multiplier, bias](S value) {
+        return pixel_traits<D>::saturate(value * multiplier + bias);
+    });
+}
+
+/**
+ * @brief Sum every channel of a view.
+ * 
+ * @param[in] view Source view.
+ * @param[out] sums Sum of each channel.
+ */
+template<int Channels, typename T>
+void sum(const image_view<Channels, T>& view, double (&sums)[Channels]) {
+    size_t count = view.pixels();
+
+    for(int c = 0; c < Channels; c++) {
+        const T* plane = view.plane(c);
+        double total = 0.0;
+
+        for(size_t i = 0; i < count; i++)
+            total += plane[i];
+
+        sums[c] = total;
+    }
+}
+
+}
+
+#endif
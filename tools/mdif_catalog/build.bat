@@ -0,0 +1 @@
+gcc -static -o ..\..\dist\mdif_catalog.exe -I..\..\src ..\..\src\mdif.cpp mdif_catalog.cpp -lm
\ No newline at end of file
@@ -0,0 +1,2 @@
+mkdir -p ../../dist
+gcc -o ../../dist/mdif_catalog mdif_catalog.cpp ../../src/mdif.cpp -lm -I../../src -pthread
\ No newline at end of file
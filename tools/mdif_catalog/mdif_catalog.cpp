@@ -0,0 +1,323 @@
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#   include <sys/stat.h>
+#endif
+
+#include "mdif.h"
+
+typedef struct file_list_struct {
+    char** names;
+    int count;
+    int capacity;
+} file_list_t;
+
+int file_list_add(file_list_t* list, const char* name, size_t length) {
+    if(list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char** names = (char**) realloc(list->names, capacity * sizeof(char*));
+
+        if(!names)
+            return 1;
+
+        list->names = names;
+        list->capacity = capacity;
+    }
+
+    char* copy = (char*) malloc(length + 1);
+    if(!copy)
+        return 1;
+
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    list->names[list->count++] = copy;
+    return 0;
+}
+
+void file_list_free(file_list_t* list) {
+    for(int i = 0; i < list->count; i++)
+        free(list->names[i]);
+
+    free(list->names);
+}
+
+int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+int is_mdif_file(const char* name) {
+    size_t length = strlen(name);
+    if(length < 5)
+        return 0;
+
+    const char* extension = name + length - 5;
+    const char* expected = ".mdif";
+
+    for(int i = 0; i < 5; i++)
+        if((extension[i] | 0x20) != expected[i])
+            return 0;
+
+    return 1;
+}
+
+char* join_path(const char* directory, const char* name) {
+    size_t directory_length = strlen(directory), name_length = strlen(name);
+    int separator = directory_length > 0 &&
+        directory[directory_length - 1] != '/' &&
+        directory[directory_length - 1] != '\\';
+
+    char* path = (char*) malloc(directory_length + separator + name_length + 1);
+    if(!path)
+        return NULL;
+
+    memcpy(path, directory, directory_length);
+    if(separator)
+        path[directory_length] = '/';
+
+    memcpy(path + directory_length + separator, name, name_length + 1);
+    return path;
+}
+
+int add_path(file_list_t* list, const char* directory, const char* name) {
+    char* path = join_path(directory, name);
+    if(!path)
+        return 1;
+
+    int result = file_list_add(list, path, strlen(path));
+    free(path);
+
+    return result;
+}
+
+int walk_directory(file_list_t* files, const char* root) {
+    file_list_t pending = {NULL, 0, 0};
+    int status = file_list_add(&pending, root, strlen(root));
+
+    while(status == 0 && pending.count > 0) {
+        char* directory = pending.names[--pending.count];
+
+        #ifdef _WIN32
+        char* pattern = (char*) malloc(strlen(directory) + 3);
+        if(!pattern) {
+            free(directory);
+            status = 1;
+            break;
+        }
+
+        sprintf(pattern, "%s\\*", directory);
+
+        WIN32_FIND_DATAA entry;
+        HANDLE handle = FindFirstFileA(pattern, &entry);
+        free(pattern);
+
+        if(handle == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "Can't open %s\n", directory);
+            free(directory);
+            status = 1;
+            break;
+        }
+
+        do {
+            const char* name = entry.cFileName;
+            if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            if(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                status = add_path(&pending, directory, name);
+            else if(is_mdif_file(name))
+                status = add_path(files, directory, name);
+        } while(status == 0 && FindNextFileA(handle, &entry));
+
+        FindClose(handle);
+        #else
+        DIR* handle = opendir(directory);
+        if(!handle) {
+            fprintf(stderr, "Can't open %s\n", directory);
+            free(directory);
+            status = 1;
+            break;
+        }
+
+        struct dirent* entry;
+        while(status == 0 && (entry = readdir(handle)) != NULL) {
+            const char* name = entry->d_name;
+            if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            int directory_entry = entry->d_type == DT_DIR;
+            int file_entry = entry->d_type == DT_REG;
+
+            if(entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                char* path = join_path(directory, name);
+                struct stat info;
+
+                if(!path) {
+                    status = 1;
+                    break;
+                }
+
+                if(stat(path, &info) == 0) {
+                    directory_entry = S_ISDIR(info.st_mode) && entry->d_type != DT_LNK;
+                    file_entry = S_ISREG(info.st_mode);
+                }
+
+                free(path);
+            }
+
+            if(directory_entry)
+                status = add_path(&pending, directory, name);
+            else if(file_entry && is_mdif_file(name))
+                status = add_path(files, directory, name);
+        }
+
+        closedir(handle);
+        #endif
+
+        free(directory);
+    }
+
+    file_list_free(&pending);
+    return status;
+}
+
+int is_directory(const char* path) {
+    #ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+    #else
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+    #endif
+}
+
+void print_usage(const char* program) {
+    fprintf(
+        stderr,
+        "Usage: %s [-j threads] [-H] [-o manifest] <files or directories...>\n"
+        "  -j threads   Number of threads (default: one per processor)\n"
+        "  -H           Hash the content of each file (reads every file in full)\n"
+        "  -o manifest  Write the manifest to a file instead of the standard output\n",
+        program
+    );
+}
+
+int main(int argc, char* argv[]) {
+    file_list_t files = {NULL, 0, 0};
+    const char* output = NULL;
+
+    unsigned char flags = 0;
+    int threads = 0, status = 0, roots = 0;
+
+    for(int i = 1; i < argc && status == 0; i++) {
+        if(strcmp(argv[i], "-H") == 0)
+            flags |= MDIF_PROBE_HASH;
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if(argv[i][0] == '-') {
+            print_usage(argv[0]);
+            file_list_free(&files);
+            return 1;
+        }
+        else {
+            roots++;
+            status = is_directory(argv[i]) ?
+                walk_directory(&files, argv[i]) :
+                file_list_add(&files, argv[i], strlen(argv[i]));
+        }
+    }
+
+    if(roots == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(status != 0) {
+        file_list_free(&files);
+        return 1;
+    }
+
+    qsort(files.names, files.count, sizeof(char*), compare_names);
+
+    mdif_info_t* infos = (mdif_info_t*) malloc((files.count + 1) * sizeof(mdif_info_t));
+    mdif_error_t* results = (mdif_error_t*) malloc((files.count + 1) * sizeof(mdif_error_t));
+
+    if(!infos || !results) {
+        fprintf(stderr, "Error: %s\n", mdif_error_message(MDIF_ERROR_CANNOT_ALLOCATE));
+
+        free(infos);
+        free(results);
+        file_list_free(&files);
+
+        return 1;
+    }
+
+    mdif_probe_files((const char* const*) files.names, files.count, infos, results, flags, threads);
+
+    FILE* manifest = output ? fopen(output, "w") : stdout;
+    if(!manifest) {
+        fprintf(stderr, "Can't open %s\n", output);
+        status = 1;
+    }
+    else {
+        fprintf(manifest, "# path\twidth\theight\tlayout\tlevels\tsize\txxh64\n");
+
+        for(int i = 0; i < files.count; i++) {
+            if(results[i] != MDIF_ERROR_NONE) {
+                fprintf(stderr, "Error: %s: %s\n", files.names[i], mdif_error_message(results[i]));
+                status = 1;
+
+                continue;
+            }
+
+            const mdif_info_t* info = &infos[i];
+            fprintf(
+                manifest, "%s\t%d\t%d\t%d\t%d\t%lu\t",
+                files.names[i],
+                info->width,
+                info->height,
+                info->layout,
+                info->levels,
+                info->size
+            );
+
+            if(flags & MDIF_PROBE_HASH)
+                fprintf(manifest, "%016llx\n", info->hash);
+            else fprintf(manifest, "-\n");
+        }
+
+        if(output && fclose(manifest) != 0) {
+            fprintf(stderr, "Error: %s\n", mdif_error_message(MDIF_ERROR_WRITE));
+            status = 1;
+        }
+    }
+
+    free(infos);
+    free(results);
+    file_list_free(&files);
+
+    return status;
+}
@@ -0,0 +1 @@
+gcc -static -o ..\..\dist\mdif_diff.exe -I..\..\src ..\..\src\mdif.cpp mdif_diff.cpp -lm
\ No newline at end of file
@@ -0,0 +1,2 @@
+mkdir -p ../../dist
+gcc -o ../../dist/mdif_diff mdif_diff.cpp ../../src/mdif.cpp -lm -I../../src -pthread
\ No newline at end of file
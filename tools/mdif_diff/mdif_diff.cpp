@@ -0,0 +1,254 @@
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdif.h"
+
+void print_usage(const char* program) {
+    fprintf(
+        stderr,
+        "Usage: %s [-j threads] [-t tolerance] [-d diff] <first file> <second file>\n"
+        "       %s [-j threads] [-t tolerance] -l pairs\n"
+        "  -j threads    Number of threads (default: one per processor)\n"
+        "  -t tolerance  Largest accepted absolute difference (default: 0)\n"
+        "  -d diff       Write the absolute differences to an MDIF file\n"
+        "  -l pairs      Compare each tab-separated pair of file names in a list\n",
+        program,
+        program
+    );
+}
+
+mdif_error_t expand_indexed(mdif_t* image) {
+    if(image->layout != MDIF_LAYOUT_INDEXED)
+        return MDIF_ERROR_NONE;
+
+    mdif_t converted;
+    mdif_error_t result = mdif_init_layout(&converted, image->width, image->height, MDIF_LAYOUT_RGBA);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_convert(image, &converted);
+
+    mdif_free(image);
+    *image = converted;
+
+    return result;
+}
+
+int compare_files(
+    const char* first,
+    const char* second,
+    mdif_t* a,
+    mdif_t* b,
+    mdif_metrics_t* metrics,
+    const char* diff_file,
+    int threads
+) {
+    mdif_error_t result = mdif_read_into(first, a);
+    if(result == MDIF_ERROR_NONE)
+        result = expand_indexed(a);
+
+    if(result != MDIF_ERROR_NONE) {
+        fprintf(stderr, "Error: %s: %s\n", first, mdif_error_message(result));
+        return 1;
+    }
+
+    result = mdif_read_into(second, b);
+    if(result == MDIF_ERROR_NONE)
+        result = expand_indexed(b);
+
+    if(result != MDIF_ERROR_NONE) {
+        fprintf(stderr, "Error: %s: %s\n", second, mdif_error_message(result));
+        return 1;
+    }
+
+    mdif_t diff;
+    diff.red = NULL;
+
+    if(diff_file) {
+        result = mdif_init_layout(&diff, a->width, a->height, (mdif_layout_t) a->layout);
+
+        if(result != MDIF_ERROR_NONE) {
+            fprintf(stderr, "Error: %s\n", mdif_error_message(result));
+            return 1;
+        }
+    }
+
+    result = mdif_compare(a, b, MDIF_METRIC_ALL, metrics, diff_file ? &diff : NULL, threads);
+    if(result == MDIF_ERROR_NONE && diff_file)
+        result = mdif_write(diff_file, &diff);
+
+    if(diff.red)
+        mdif_free(&diff);
+
+    if(result != MDIF_ERROR_NONE) {
+        fprintf(stderr, "Error: %s / %s: %s\n", first, second, mdif_error_message(result));
+        return 1;
+    }
+
+    return 0;
+}
+
+int within_tolerance(const mdif_metrics_t* metrics, int tolerance) {
+    for(int c = 0; c < 4; c++)
+        if(metrics->max_diff[c] > tolerance)
+            return 0;
+
+    return 1;
+}
+
+int compare_list(const char* filename, int tolerance, int threads) {
+    FILE* file = fopen(filename, "r");
+    if(!file) {
+        fprintf(stderr, "Can't open %s\n", filename);
+        return 2;
+    }
+
+    mdif_t a, b;
+    a.red = a.green = a.blue = a.alpha = NULL;
+    b.red = b.green = b.blue = b.alpha = NULL;
+    a.capacity = b.capacity = 0;
+    a.pool = b.pool = NULL;
+
+    int status = 0;
+    char line[8192];
+
+    printf("First\tSecond\tMaxDiff\tPSNR\tSSIM\r\n");
+    while(fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '\0' || line[0] == '#')
+            continue;
+
+        char* second = strchr(line, '\t');
+        if(!second) {
+            fprintf(stderr, "Error: missing second file name in \"%s\"\n", line);
+            status = 2;
+            continue;
+        }
+
+        *second++ = '\0';
+
+        mdif_metrics_t metrics;
+        if(compare_files(line, second, &a, &b, &metrics, NULL, threads) != 0) {
+            status = 2;
+            continue;
+        }
+
+        int max_diff = 0;
+        double psnr = metrics.psnr[0], ssim = metrics.ssim[0];
+
+        int planes = a.layout == MDIF_LAYOUT_RGBA ? 4 : 3;
+        for(int c = 0; c < planes; c++) {
+            if(metrics.max_diff[c] > max_diff)
+                max_diff = metrics.max_diff[c];
+
+            if(metrics.psnr[c] < psnr)
+                psnr = metrics.psnr[c];
+
+            if(metrics.ssim[c] < ssim)
+                ssim = metrics.ssim[c];
+        }
+
+        printf("%s\t%s\t%d\t%.4f\t%.6f\r\n", line, second, max_diff, psnr, ssim);
+        if(status == 0 && !within_tolerance(&metrics, tolerance))
+            status = 1;
+    }
+
+    fclose(file);
+    if(a.red)
+        mdif_free(&a);
+
+    if(b.red)
+        mdif_free(&b);
+
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    const char* files[2] = {NULL, NULL};
+    const char* diff_file = NULL;
+    const char* list = NULL;
+
+    int count = 0, threads = 0, tolerance = 0;
+    for(int i = 1; i < argc; i++) {
+        if(argv[i][0] == '-' && i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 2;
+        }
+
+        if(strcmp(argv[i], "-j") == 0)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-t") == 0)
+            tolerance = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0)
+            diff_file = argv[++i];
+        else if(strcmp(argv[i], "-l") == 0)
+            list = argv[++i];
+        else if(argv[i][0] == '-' || count == 2) {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else files[count++] = argv[i];
+    }
+
+    if(list && count == 0 && !diff_file)
+        return compare_list(list, tolerance, threads);
+
+    if(list || count != 2) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    mdif_t a, b;
+    a.red = a.green = a.blue = a.alpha = NULL;
+    b.red = b.green = b.blue = b.alpha = NULL;
+    a.capacity = b.capacity = 0;
+    a.pool = b.pool = NULL;
+
+    mdif_metrics_t metrics;
+    int failed = compare_files(files[0], files[1], &a, &b, &metrics, diff_file, threads);
+
+    if(!failed) {
+        const char* rgba[4] = {"red", "green", "blue", "alpha"};
+        const char* ycbcr[3] = {"luma", "cb", "cr"};
+
+        int planes = a.layout == MDIF_LAYOUT_RGBA ? 4 : 3;
+        printf("Channel\tMaxDiff\tMSE\tPSNR\tSSIM\r\n");
+
+        for(int c = 0; c < planes; c++)
+            printf(
+                "%s\t%d\t%.4f\t%.4f\t%.6f\r\n",
+                a.layout == MDIF_LAYOUT_RGBA ? rgba[c] : ycbcr[c],
+                metrics.max_diff[c],
+                metrics.mse[c],
+                metrics.psnr[c],
+                metrics.ssim[c]
+            );
+    }
+
+    if(a.red)
+        mdif_free(&a);
+
+    if(b.red)
+        mdif_free(&b);
+
+    if(failed)
+        return 2;
+
+    return within_tolerance(&metrics, tolerance) ? 0 : 1;
+}
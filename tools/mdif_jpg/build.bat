@@ -1 +1 @@
-gcc -static -o ..\..\dist\mdif_jpg.exe -I..\..\src ..\..\src\mdif.cpp mdif_jpg.cpp -ljpeg
\ No newline at end of file
+gcc -static -o ..\..\dist\mdif_jpg.exe -I..\..\src ..\..\src\mdif.cpp mdif_jpg.cpp -ljpeg -lm
\ No newline at end of file
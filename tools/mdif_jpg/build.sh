@@ -1,2 +1,2 @@
 mkdir -p ../../dist
-gcc -o ../../dist/mdif_jpg mdif_jpg.cpp ../../src/mdif.cpp -ljpeg -I../../src
\ No newline at end of file
+gcc -o ../../dist/mdif_jpg mdif_jpg.cpp ../../src/mdif.cpp -ljpeg -lm -I../../src -pthread
\ No newline at end of file
@@ -21,7 +21,153 @@
 
 #include "mdif.h"
 
-int jpg_to_mdif(const char* infile, const char* output_file) {
+static bool jpg_raw_layout(j_decompress_ptr cinfo, mdif_layout_t* layout) {
+    if(cinfo->num_components != 3 || cinfo->jpeg_color_space != JCS_YCbCr)
+        return false;
+
+    jpeg_component_info* comp = cinfo->comp_info;
+    if(comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 ||
+        comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1)
+        return false;
+
+    if(comp[0].h_samp_factor == 1 && comp[0].v_samp_factor == 1)
+        *layout = MDIF_LAYOUT_YCBCR444;
+    else if(comp[0].h_samp_factor == 2 && comp[0].v_samp_factor == 2)
+        *layout = MDIF_LAYOUT_YCBCR420;
+    else return false;
+
+    return true;
+}
+
+static void jpg_read_raw(j_decompress_ptr cinfo, mdif_t* image) {
+    unsigned char* planes[3] = {image->red, image->green, image->blue};
+    JSAMPARRAY rows[3];
+
+    int widths[3], heights[3];
+    for(int c = 0; c < 3; c++) {
+        jpeg_component_info* comp = &cinfo->comp_info[c];
+
+        widths[c] = c == 0 || image->layout == MDIF_LAYOUT_YCBCR444 ?
+            image->width : (image->width + 1) / 2;
+        heights[c] = c == 0 || image->layout == MDIF_LAYOUT_YCBCR444 ?
+            image->height : (image->height + 1) / 2;
+
+        rows[c] = (*cinfo->mem->alloc_sarray)(
+            (j_common_ptr) cinfo,
+            JPOOL_IMAGE,
+            comp->width_in_blocks * DCTSIZE,
+            comp->v_samp_factor * DCTSIZE
+        );
+    }
+
+    int lines = cinfo->max_v_samp_factor * DCTSIZE;
+    while(cinfo->output_scanline < cinfo->output_height) {
+        int first = cinfo->output_scanline;
+        jpeg_read_raw_data(cinfo, rows, lines);
+
+        for(int c = 0; c < 3; c++) {
+            int count = cinfo->comp_info[c].v_samp_factor * DCTSIZE,
+                base = first * cinfo->comp_info[c].v_samp_factor / cinfo->max_v_samp_factor;
+
+            for(int r = 0; r < count && base + r < heights[c]; r++)
+                memcpy(
+                    planes[c] + (size_t) (base + r) * widths[c],
+                    rows[c][r],
+                    widths[c]
+                );
+        }
+    }
+}
+
+static void jpg_read_ycbcr(j_decompress_ptr cinfo, mdif_t* image) {
+    JSAMPARRAY buffer = (*cinfo->mem->alloc_sarray)(
+        (j_common_ptr) cinfo,
+        JPOOL_IMAGE,
+        cinfo->output_width * cinfo->output_components,
+        1
+    );
+
+    while(cinfo->output_scanline < cinfo->output_height) {
+        size_t offset = (size_t) cinfo->output_scanline * cinfo->output_width;
+        jpeg_read_scanlines(cinfo, buffer, 1);
+
+        for(unsigned int i = 0; i < cinfo->output_width; i++) {
+            image->red[offset + i] = buffer[0][i * 3];
+            image->green[offset + i] = buffer[0][i * 3 + 1];
+            image->blue[offset + i] = buffer[0][i * 3 + 2];
+        }
+    }
+}
+
+static unsigned int jpg_exif16(const unsigned char* data, bool little) {
+    return little ? data[0] | data[1] << 8 : data[0] << 8 | data[1];
+}
+
+static int jpg_orientation(j_decompress_ptr cinfo) {
+    for(jpeg_saved_marker_ptr marker = cinfo->marker_list; marker; marker = marker->next) {
+        const unsigned char* data = marker->data;
+        unsigned int length = marker->data_length;
+
+        if(marker->marker != JPEG_APP0 + 1 || length < 14 || memcmp(data, "Exif\0\0", 6) != 0)
+            continue;
+
+        data += 6;
+        length -= 6;
+
+        bool little = data[0] == 'I';
+        unsigned int offset = (jpg_exif16(data + 4, little) << (little ? 0 : 16)) |
+            (jpg_exif16(data + 6, little) << (little ? 16 : 0));
+
+        if(offset > length - 2)
+            return 1;
+
+        unsigned int count = jpg_exif16(data + offset, little);
+        for(unsigned int i = 0; i < count; i++) {
+            const unsigned char* entry = data + offset + 2 + i * 12;
+            if(entry + 12 > data + length)
+                break;
+
+            if(jpg_exif16(entry, little) == 0x0112) {
+                int orientation = (int) jpg_exif16(entry + 8, little);
+                return orientation >= 1 && orientation <= 8 ? orientation : 1;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static mdif_error_t jpg_orient(mdif_t* image, int orientation) {
+    mdif_error_t result = MDIF_ERROR_NONE;
+
+    switch(orientation) {
+        case 2:
+            return mdif_flip_inplace(image, false);
+
+        case 3:
+            return mdif_rotate_inplace(image, MDIF_ROTATE_180);
+
+        case 4:
+            return mdif_flip_inplace(image, true);
+
+        case 5:
+            return mdif_transpose_inplace(image);
+
+        case 6:
+            return mdif_rotate_inplace(image, MDIF_ROTATE_90);
+
+        case 7:
+            result = mdif_rotate_inplace(image, MDIF_ROTATE_90);
+            return result == MDIF_ERROR_NONE ? mdif_flip_inplace(image, true) : result;
+
+        case 8:
+            return mdif_rotate_inplace(image, MDIF_ROTATE_270);
+    }
+
+    return result;
+}
+
+int jpg_to_mdif(const char* infile, const char* output_file, bool ycbcr, bool orient) {
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
 
@@ -37,7 +183,54 @@ int jpg_to_mdif(const char* infile, const char* output_file) {
     jpeg_create_decompress(&cinfo);
 
     jpeg_stdio_src(&cinfo, input_file);
+    if(orient)
+        jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+
     jpeg_read_header(&cinfo, TRUE);
+    int orientation = orient ? jpg_orientation(&cinfo) : 1;
+
+    mdif_layout_t layout = MDIF_LAYOUT_YCBCR444;
+    if(ycbcr && cinfo.num_components == 3 && cinfo.jpeg_color_space == JCS_YCbCr) {
+        cinfo.out_color_space = JCS_YCbCr;
+        cinfo.raw_data_out = jpg_raw_layout(&cinfo, &layout);
+
+        jpeg_start_decompress(&cinfo);
+
+        mdif_t image;
+        mdif_error_t result = mdif_init_layout(
+            &image,
+            cinfo.output_width,
+            cinfo.output_height,
+            layout
+        );
+
+        if(result == MDIF_ERROR_NONE) {
+            if(cinfo.raw_data_out)
+                jpg_read_raw(&cinfo, &image);
+            else jpg_read_ycbcr(&cinfo, &image);
+
+            jpeg_finish_decompress(&cinfo);
+        }
+        else jpeg_abort_decompress(&cinfo);
+
+        jpeg_destroy_decompress(&cinfo);
+        fclose(input_file);
+
+        if(result == MDIF_ERROR_NONE)
+            result = jpg_orient(&image, orientation);
+
+        if(result == MDIF_ERROR_NONE)
+            result = mdif_write(output_file, &image);
+
+        mdif_free(&image);
+        if(result != MDIF_ERROR_NONE) {
+            fprintf(stderr, "Error: %s\r\n", mdif_error_message(result));
+            return 1;
+        }
+
+        return 0;
+    }
+
     jpeg_start_decompress(&cinfo);
 
     buffer = (*cinfo.mem->alloc_sarray)(
@@ -55,19 +248,20 @@ int jpg_to_mdif(const char* infile, const char* output_file) {
     );
 
     while(cinfo.output_scanline < cinfo.output_height) {
+        unsigned int row = cinfo.output_scanline;
         jpeg_read_scanlines(&cinfo, buffer, 1);
 
         for(unsigned int i = 0; i < cinfo.output_width; i++) {
-            image.red[cinfo.output_scanline * cinfo.output_width + i]
+            image.red[row * cinfo.output_width + i]
                 = buffer[0][i * 3];
 
-            image.green[cinfo.output_scanline * cinfo.output_width + i]
+            image.green[row * cinfo.output_width + i]
                 = buffer[0][i * 3 + 1];
 
-            image.blue[cinfo.output_scanline * cinfo.output_width + i]
+            image.blue[row * cinfo.output_width + i]
                 = buffer[0][i * 3 + 2];
 
-            image.alpha[cinfo.output_scanline * cinfo.output_width + i]
+            image.alpha[row * cinfo.output_width + i]
                 = 255;
         }
     }
@@ -76,7 +270,10 @@ int jpg_to_mdif(const char* infile, const char* output_file) {
     jpeg_destroy_decompress(&cinfo);
     fclose(input_file);
 
-    mdif_error_t result = mdif_write(output_file, &image);
+    mdif_error_t result = jpg_orient(&image, orientation);
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_write(output_file, &image);
+
     if(result != MDIF_ERROR_NONE) {
         fprintf(stderr, "Error: %s\r\n", mdif_error_message(result));
         return 1;
@@ -86,10 +283,63 @@ int jpg_to_mdif(const char* infile, const char* output_file) {
     return 0;
 }
 
+static void jpg_write_raw(j_compress_ptr cinfo, mdif_t* image) {
+    unsigned char* planes[3] = {image->red, image->green, image->blue};
+    JSAMPARRAY rows[3];
+
+    int widths[3], heights[3], padded[3];
+    for(int c = 0; c < 3; c++) {
+        jpeg_component_info* comp = &cinfo->comp_info[c];
+
+        widths[c] = c == 0 || image->layout == MDIF_LAYOUT_YCBCR444 ?
+            image->width : (image->width + 1) / 2;
+        heights[c] = c == 0 || image->layout == MDIF_LAYOUT_YCBCR444 ?
+            image->height : (image->height + 1) / 2;
+        padded[c] = comp->width_in_blocks * DCTSIZE;
+
+        rows[c] = (*cinfo->mem->alloc_sarray)(
+            (j_common_ptr) cinfo,
+            JPOOL_IMAGE,
+            padded[c],
+            comp->v_samp_factor * DCTSIZE
+        );
+    }
+
+    int lines = cinfo->max_v_samp_factor * DCTSIZE;
+    while(cinfo->next_scanline < cinfo->image_height) {
+        for(int c = 0; c < 3; c++) {
+            int count = cinfo->comp_info[c].v_samp_factor * DCTSIZE,
+                base = cinfo->next_scanline * cinfo->comp_info[c].v_samp_factor /
+                    cinfo->max_v_samp_factor;
+
+            for(int r = 0; r < count; r++) {
+                int y = base + r < heights[c] ? base + r : heights[c] - 1;
+                const unsigned char* source = planes[c] + (size_t) y * widths[c];
+
+                memcpy(rows[c][r], source, widths[c]);
+                memset(rows[c][r] + widths[c], source[widths[c] - 1], padded[c] - widths[c]);
+            }
+        }
+
+        jpeg_write_raw_data(cinfo, rows, lines);
+    }
+}
+
 int mdif_to_jpg(const char* input_file, const char* outfile) {
     mdif_t image;
     mdif_error_t result = mdif_read(input_file, &image);
 
+    if(result == MDIF_ERROR_NONE && image.layout == MDIF_LAYOUT_INDEXED) {
+        mdif_t converted;
+        result = mdif_init_layout(&converted, image.width, image.height, MDIF_LAYOUT_RGBA);
+
+        if(result == MDIF_ERROR_NONE)
+            result = mdif_convert(&image, &converted);
+
+        mdif_free(&image);
+        image = converted;
+    }
+
     if(result != MDIF_ERROR_NONE) {
         fprintf(stderr, "Error: %s\r\n", mdif_error_message(result));
         return 1;
@@ -113,9 +363,28 @@ int mdif_to_jpg(const char* input_file, const char* outfile) {
     cinfo.image_width = image.width;
     cinfo.image_height = image.height;
     cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
+    cinfo.in_color_space = image.layout == MDIF_LAYOUT_RGBA ? JCS_RGB : JCS_YCbCr;
 
     jpeg_set_defaults(&cinfo);
+    if(image.layout != MDIF_LAYOUT_RGBA) {
+        int factor = image.layout == MDIF_LAYOUT_YCBCR420 ? 2 : 1;
+
+        cinfo.comp_info[0].h_samp_factor = factor;
+        cinfo.comp_info[0].v_samp_factor = factor;
+        cinfo.raw_data_in = TRUE;
+
+        jpeg_start_compress(&cinfo, TRUE);
+        jpg_write_raw(&cinfo, &image);
+
+        jpeg_finish_compress(&cinfo);
+        fclose(output_file);
+
+        jpeg_destroy_compress(&cinfo);
+        mdif_free(&image);
+
+        return 0;
+    }
+
     jpeg_start_compress(&cinfo, TRUE);
 
     unsigned char* row = (unsigned char*)malloc(image.width * 3);
@@ -146,13 +415,35 @@ int mdif_to_jpg(const char* input_file, const char* outfile) {
 }
 
 int main(int argc, char* argv[]) {
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+    const char* cache_directory = NULL;
+    unsigned long long cache_megabytes = 1024;
+
+    bool ycbcr = false, orient = false, valid = argc >= 3;
+    for(int i = 1; i < argc - 2 && valid; i++) {
+        if(strcmp(argv[i], "-y") == 0)
+            ycbcr = true;
+        else if(strcmp(argv[i], "-o") == 0)
+            orient = true;
+        else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc - 2)
+            cache_directory = argv[++i];
+        else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc - 2) {
+            cache_megabytes = strtoull(argv[++i], NULL, 10);
+            valid = cache_megabytes > 0;
+        }
+        else valid = false;
+    }
+
+    if(!valid) {
+        fprintf(stderr, "Usage: %s [-y] [-o] [-c cache [-m megabytes]] <input file> <output file>\n", argv[0]);
+        fprintf(stderr, "  -y            Keep the YCbCr planes of the JPEG without color conversion\n");
+        fprintf(stderr, "  -o            Apply the EXIF orientation of the JPEG to the pixels\n");
+        fprintf(stderr, "  -c cache      Reuse the output of an earlier identical conversion from a cache directory\n");
+        fprintf(stderr, "  -m megabytes  Size bound of the cache directory (default: 1024)\n");
         return -1;
     }
 
-    const char* infile = argv[1];
-    const char* outfile = argv[2];
+    const char* infile = argv[argc - 2];
+    const char* outfile = argv[argc - 1];
 
     int direction;
     if(strcmp(infile + strlen(infile) - 4, ".jpg") == 0 &&
@@ -166,9 +457,33 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    char params[64];
+    if(direction == 0)
+        snprintf(params, sizeof(params), "mdif_jpg 1 to_mdif %d %d", (int) ycbcr, (int) orient);
+    else snprintf(params, sizeof(params), "mdif_jpg 1 to_jpg");
+
+    mdif_cache_t cache;
+    unsigned long long key = 0;
+    bool cached = false;
+
+    if(cache_directory) {
+        mdif_error_t cache_result = mdif_cache_open(&cache, cache_directory, cache_megabytes << 20);
+        if(cache_result == MDIF_ERROR_NONE) {
+            cached = mdif_cache_key(infile, params, strlen(params), &key) == MDIF_ERROR_NONE;
+
+            if(cached && mdif_cache_load_file(&cache, key, outfile) == MDIF_ERROR_NONE) {
+                mdif_cache_close(&cache);
+
+                printf("Conversion successful (cached).\n");
+                return 0;
+            }
+        }
+        else fprintf(stderr, "Warning: %s: %s\n", cache_directory, mdif_error_message(cache_result));
+    }
+
     int result;
     if(direction == 0)
-        result = jpg_to_mdif(infile, outfile);
+        result = jpg_to_mdif(infile, outfile, ycbcr, orient);
     else if(direction == 1)
         result = mdif_to_jpg(infile, outfile);
     else {
@@ -176,6 +491,16 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if(result == 0 && cached) {
+        mdif_error_t cache_result = mdif_cache_store_file(&cache, key, outfile);
+
+        if(cache_result != MDIF_ERROR_NONE)
+            fprintf(stderr, "Warning: %s: %s\n", cache_directory, mdif_error_message(cache_result));
+    }
+
+    if(cache_directory)
+        mdif_cache_close(&cache);
+
     if(result != 0) {
         fprintf(stderr, "Conversion failed.\n");
         return 1;
@@ -1 +1 @@
-gcc -static -o ..\..\dist\mdif_png.exe -I..\..\src ..\..\src\mdif.cpp mdif_png.cpp -lpng
\ No newline at end of file
+gcc -static -o ..\..\dist\mdif_png.exe -I..\..\src ..\..\src\mdif.cpp mdif_png.cpp -lpng -lz -lm
\ No newline at end of file
@@ -1,2 +1,2 @@
 mkdir -p ../../dist
-gcc -o ../../dist/mdif_png mdif_png.cpp ../../src/mdif.cpp -lpng -I../../src
\ No newline at end of file
+gcc -o ../../dist/mdif_png mdif_png.cpp ../../src/mdif.cpp -lpng -lz -lm -I../../src -pthread
\ No newline at end of file
@@ -18,10 +18,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <png.h>
+#include <zlib.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
 
 #include "mdif.h"
 
-int png_to_mdif(const char* png_filename, const char* mdif_filename) {
+int png_to_mdif(const char* png_filename, const char* mdif_filename, int colors, mdif_dither_t dither) {
     FILE *png_file = fopen(png_filename, "rb");
     if(!png_file) {
         fprintf(stderr, "Error opening PNG file %s\n", png_filename);
@@ -100,7 +108,13 @@ int png_to_mdif(const char* png_filename, const char* mdif_filename) {
     for(int y = 0; y < height; y++)
         free(row_pointers[y]);
 
-    mdif_error_t result = mdif_write(mdif_filename, &mdif_image);
+    mdif_error_t result = MDIF_ERROR_NONE;
+    if(colors > 0)
+        result = mdif_quantize(&mdif_image, colors, dither);
+
+    if(result == MDIF_ERROR_NONE)
+        result = mdif_write(mdif_filename, &mdif_image);
+
     if(result != MDIF_ERROR_NONE) {
         fprintf(stderr, "Error: %s\r\n", mdif_error_message(result));
         return 1;
@@ -122,10 +136,429 @@ int png_to_mdif(const char* png_filename, const char* mdif_filename) {
     return 0;
 }
 
-int mdif_to_png(const char* mdif_filename, const char* png_filename) {
+typedef struct export_preset_struct {
+    const char* name;
+    int level;
+    int filter;
+    int strategy;
+} export_preset_t;
+
+#define EXPORT_FILTER_ADAPTIVE -1
+
+const export_preset_t export_presets[] = {
+    {"fast", 1, 1, Z_RLE},
+    {"default", 6, EXPORT_FILTER_ADAPTIVE, Z_FILTERED},
+    {"small", 9, EXPORT_FILTER_ADAPTIVE, Z_FILTERED}
+};
+
+#define EXPORT_BAND_MIN_BYTES  (256 * 1024)
+#define EXPORT_WINDOW_BYTES    32768
+
+typedef struct export_encoder_struct {
+    const mdif_t* image;
+    const export_preset_t* preset;
+    int threads;
+
+    unsigned char* filtered;
+    size_t row_bytes;
+
+    int bands;
+    unsigned char** outputs;
+    size_t* output_sizes;
+    unsigned long* adlers;
+
+    volatile int failed;
+} export_encoder_t;
+
+typedef void (*export_task_t)(export_encoder_t* encoder, int index);
+
+typedef struct export_worker_struct {
+    export_encoder_t* encoder;
+    export_task_t task;
+    int index;
+} export_worker_t;
+
+#ifdef _WIN32
+DWORD WINAPI export_worker_main(LPVOID context) {
+    export_worker_t* worker = (export_worker_t*) context;
+    worker->task(worker->encoder, worker->index);
+
+    return 0;
+}
+#else
+void* export_worker_main(void* context) {
+    export_worker_t* worker = (export_worker_t*) context;
+    worker->task(worker->encoder, worker->index);
+
+    return NULL;
+}
+#endif
+
+void export_run_parallel(export_encoder_t* encoder, int count, export_task_t task) {
+    export_worker_t workers[64];
+
+    #ifdef _WIN32
+    HANDLE handles[64];
+    #else
+    pthread_t handles[64];
+    #endif
+
+    bool started[64];
+    for(int i = 1; i < count; i++) {
+        workers[i].encoder = encoder;
+        workers[i].task = task;
+        workers[i].index = i;
+
+        #ifdef _WIN32
+        handles[i] = CreateThread(NULL, 0, export_worker_main, &workers[i], 0, NULL);
+        started[i] = handles[i] != NULL;
+        #else
+        started[i] = pthread_create(&handles[i], NULL, export_worker_main, &workers[i]) == 0;
+        #endif
+
+        if(!started[i])
+            task(encoder, i);
+    }
+
+    task(encoder, 0);
+
+    for(int i = 1; i < count; i++)
+        if(started[i]) {
+            #ifdef _WIN32
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+            #else
+            pthread_join(handles[i], NULL);
+            #endif
+        }
+}
+
+int export_processor_count() {
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return (int) info.dwNumberOfProcessors;
+    #else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+    #endif
+}
+
+void export_interleave_row(const mdif_t* image, int y, unsigned char* row) {
+    size_t offset = (size_t) y * image->width;
+
+    for(int x = 0; x < image->width; x++) {
+        row[x * 4]     = image->red[offset + x];
+        row[x * 4 + 1] = image->green[offset + x];
+        row[x * 4 + 2] = image->blue[offset + x];
+        row[x * 4 + 3] = image->alpha[offset + x];
+    }
+}
+
+void export_filter_row(
+    int filter,
+    const unsigned char* row,
+    const unsigned char* previous,
+    size_t length,
+    unsigned char* out
+) {
+    *out++ = (unsigned char) filter;
+
+    switch(filter) {
+        case 0:
+            memcpy(out, row, length);
+            break;
+
+        case 1:
+            memcpy(out, row, 4);
+            for(size_t i = 4; i < length; i++)
+                out[i] = (unsigned char) (row[i] - row[i - 4]);
+            break;
+
+        case 2:
+            for(size_t i = 0; i < length; i++)
+                out[i] = (unsigned char) (row[i] - previous[i]);
+            break;
+
+        case 3:
+            for(size_t i = 0; i < 4; i++)
+                out[i] = (unsigned char) (row[i] - (previous[i] >> 1));
+
+            for(size_t i = 4; i < length; i++)
+                out[i] = (unsigned char) (row[i] - ((row[i - 4] + previous[i]) >> 1));
+            break;
+
+        case 4:
+            for(size_t i = 0; i < 4; i++)
+                out[i] = (unsigned char) (row[i] - previous[i]);
+
+            for(size_t i = 4; i < length; i++) {
+                int left = row[i - 4], up = previous[i], corner = previous[i - 4];
+                int distance_left = abs(up - corner),
+                    distance_up = abs(left - corner),
+                    distance_corner = abs(left + up - 2 * corner);
+
+                int predictor = distance_left <= distance_up && distance_left <= distance_corner ?
+                    left : distance_up <= distance_corner ? up : corner;
+
+                out[i] = (unsigned char) (row[i] - predictor);
+            }
+            break;
+    }
+}
+
+unsigned long export_filter_cost(const unsigned char* filtered, size_t length, unsigned long limit) {
+    unsigned long cost = 0;
+
+    for(size_t i = 1; i <= length && cost < limit; i += 64) {
+        size_t end = i + 64 <= length + 1 ? i + 64 : length + 1;
+
+        for(size_t j = i; j < end; j++)
+            cost += (unsigned long) abs((signed char) filtered[j]);
+    }
+
+    return cost;
+}
+
+void export_filter_task(export_encoder_t* encoder, int index) {
+    const mdif_t* image = encoder->image;
+    size_t length = encoder->row_bytes - 1;
+
+    int first = (int) ((long long) image->height * index / encoder->threads),
+        last = (int) ((long long) image->height * (index + 1) / encoder->threads);
+
+    if(first == last)
+        return;
+
+    unsigned char* buffer = (unsigned char*) malloc(length * 2 + encoder->row_bytes);
+    if(!buffer) {
+        encoder->failed = 1;
+        return;
+    }
+
+    unsigned char *previous = buffer, *row = buffer + length, *candidate = buffer + length * 2;
+    if(first > 0)
+        export_interleave_row(image, first - 1, previous);
+    else memset(previous, 0, length);
+
+    for(int y = first; y < last; y++) {
+        export_interleave_row(image, y, row);
+        unsigned char* out = encoder->filtered + (size_t) y * encoder->row_bytes;
+
+        if(encoder->preset->filter != EXPORT_FILTER_ADAPTIVE)
+            export_filter_row(encoder->preset->filter, row, previous, length, out);
+        else {
+            export_filter_row(0, row, previous, length, out);
+            unsigned long best = export_filter_cost(out, length, (unsigned long) -1);
+
+            for(int filter = 1; filter <= 4; filter++) {
+                export_filter_row(filter, row, previous, length, candidate);
+                unsigned long cost = export_filter_cost(candidate, length, best);
+
+                if(cost < best) {
+                    best = cost;
+                    memcpy(out, candidate, encoder->row_bytes);
+                }
+            }
+        }
+
+        unsigned char* swap = previous;
+        previous = row;
+        row = swap;
+    }
+
+    free(buffer);
+}
+
+void export_band_range(const export_encoder_t* encoder, int band, size_t* begin, size_t* end) {
+    int height = encoder->image->height;
+
+    *begin = (size_t) ((long long) height * band / encoder->bands) * encoder->row_bytes;
+    *end = (size_t) ((long long) height * (band + 1) / encoder->bands) * encoder->row_bytes;
+}
+
+void export_deflate_task(export_encoder_t* encoder, int index) {
+    for(int band = index; band < encoder->bands && !encoder->failed; band += encoder->threads) {
+        size_t begin, end;
+        export_band_range(encoder, band, &begin, &end);
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+
+        if(deflateInit2(
+            &stream,
+            encoder->preset->level,
+            Z_DEFLATED,
+            -15, 8,
+            encoder->preset->strategy
+        ) != Z_OK) {
+            encoder->failed = 1;
+            return;
+        }
+
+        if(begin > 0) {
+            size_t window = begin < EXPORT_WINDOW_BYTES ? begin : EXPORT_WINDOW_BYTES;
+            deflateSetDictionary(&stream, encoder->filtered + begin - window, (uInt) window);
+        }
+
+        size_t capacity = deflateBound(&stream, (uLong) (end - begin)) + 16;
+        unsigned char* output = (unsigned char*) malloc(capacity + 6);
+
+        if(!output) {
+            deflateEnd(&stream);
+            encoder->failed = 1;
+            return;
+        }
+
+        stream.next_in = encoder->filtered + begin;
+        stream.avail_in = (uInt) (end - begin);
+        stream.next_out = output + 2;
+        stream.avail_out = (uInt) capacity;
+
+        int status = deflate(&stream, band == encoder->bands - 1 ? Z_FINISH : Z_SYNC_FLUSH);
+        if(stream.avail_in != 0 || (status != Z_OK && status != Z_STREAM_END))
+            encoder->failed = 1;
+
+        encoder->outputs[band] = output;
+        encoder->output_sizes[band] = capacity - stream.avail_out;
+        encoder->adlers[band] = adler32(adler32(0, NULL, 0), encoder->filtered + begin, (uInt) (end - begin));
+
+        deflateEnd(&stream);
+    }
+}
+
+bool export_write_chunk(FILE* file, const char* type, const unsigned char* data, size_t size) {
+    unsigned char header[8] = {
+        (unsigned char) (size >> 24), (unsigned char) (size >> 16),
+        (unsigned char) (size >> 8), (unsigned char) size,
+        (unsigned char) type[0], (unsigned char) type[1],
+        (unsigned char) type[2], (unsigned char) type[3]
+    };
+
+    unsigned long crc = crc32(crc32(0, NULL, 0), header + 4, 4);
+    if(size > 0)
+        crc = crc32(crc, data, (uInt) size);
+
+    unsigned char trailer[4] = {
+        (unsigned char) (crc >> 24), (unsigned char) (crc >> 16),
+        (unsigned char) (crc >> 8), (unsigned char) crc
+    };
+
+    return fwrite(header, 1, 8, file) == 8 &&
+        (size == 0 || fwrite(data, 1, size, file) == size) &&
+        fwrite(trailer, 1, 4, file) == 4;
+}
+int export_image(const mdif_t* image, const export_preset_t* preset, int threads, FILE* file) {
+    export_encoder_t encoder;
+    memset(&encoder, 0, sizeof(encoder));
+
+    encoder.image = image;
+    encoder.preset = preset;
+    encoder.row_bytes = (size_t) image->width * 4 + 1;
+
+    size_t total = encoder.row_bytes * image->height;
+    int bands = (int) (total / EXPORT_BAND_MIN_BYTES);
+
+    if(threads < 1)
+        threads = export_processor_count();
+
+    if(threads > 64)
+        threads = 64;
+
+    if(bands > threads)
+        bands = threads;
+
+    if(bands < 1)
+        bands = 1;
+
+    encoder.threads = threads < image->height ? threads : image->height;
+    encoder.bands = bands;
+
+    encoder.filtered = (unsigned char*) malloc(total);
+    encoder.outputs = (unsigned char**) calloc(bands, sizeof(unsigned char*));
+    encoder.output_sizes = (size_t*) calloc(bands, sizeof(size_t));
+    encoder.adlers = (unsigned long*) calloc(bands, sizeof(unsigned long));
+
+    int status = 1;
+    if(encoder.filtered && encoder.outputs && encoder.output_sizes && encoder.adlers) {
+        export_run_parallel(&encoder, encoder.threads, export_filter_task);
+
+        encoder.threads = bands;
+        if(!encoder.failed)
+            export_run_parallel(&encoder, bands, export_deflate_task);
+
+        status = encoder.failed;
+    }
+
+    if(status == 0) {
+        const unsigned char levels[4] = {0x01, 0x5E, 0x9C, 0xDA};
+        int level = preset->level;
+
+        encoder.outputs[0][0] = 0x78;
+        encoder.outputs[0][1] = levels[level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3];
+
+        unsigned long adler = encoder.adlers[0];
+        for(int band = 1; band < bands; band++) {
+            size_t begin, end;
+            export_band_range(&encoder, band, &begin, &end);
+
+            adler = adler32_combine(adler, encoder.adlers[band], (z_off_t) (end - begin));
+        }
+
+        unsigned char* tail = encoder.outputs[bands - 1] + 2 + encoder.output_sizes[bands - 1];
+        tail[0] = (unsigned char) (adler >> 24);
+        tail[1] = (unsigned char) (adler >> 16);
+        tail[2] = (unsigned char) (adler >> 8);
+        tail[3] = (unsigned char) adler;
+
+        const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        unsigned char header[13] = {
+            0, 0, (unsigned char) (image->width >> 8), (unsigned char) image->width,
+            0, 0, (unsigned char) (image->height >> 8), (unsigned char) image->height,
+            8, 6, 0, 0, 0
+        };
+
+        bool written = fwrite(signature, 1, 8, file) == 8 &&
+            export_write_chunk(file, "IHDR", header, sizeof(header));
+
+        for(int band = 0; band < bands && written; band++)
+            written = export_write_chunk(
+                file, "IDAT",
+                encoder.outputs[band] + (band == 0 ? 0 : 2),
+                encoder.output_sizes[band] + (band == 0 ? 2 : 0) + (band == bands - 1 ? 4 : 0)
+            );
+
+        if(!written || !export_write_chunk(file, "IEND", NULL, 0))
+            status = 1;
+    }
+
+    for(int band = 0; encoder.outputs && band < bands; band++)
+        free(encoder.outputs[band]);
+
+    free(encoder.filtered);
+    free(encoder.outputs);
+    free(encoder.output_sizes);
+    free(encoder.adlers);
+
+    return status;
+}
+
+int mdif_to_png(const char* mdif_filename, const char* png_filename, const export_preset_t* preset, int threads) {
     mdif_t mdif_image;
 
     mdif_error_t result = mdif_read(mdif_filename, &mdif_image);
+    if(result == MDIF_ERROR_NONE && mdif_image.layout != MDIF_LAYOUT_RGBA) {
+        mdif_t converted;
+        result = mdif_init_layout(&converted, mdif_image.width, mdif_image.height, MDIF_LAYOUT_RGBA);
+
+        if(result == MDIF_ERROR_NONE)
+            result = mdif_convert(&mdif_image, &converted);
+
+        mdif_free(&mdif_image);
+        mdif_image = converted;
+    }
+
     if(result != MDIF_ERROR_NONE) {
         fprintf(stderr, "Error: %s\r\n", mdif_error_message(result));
         return 1;
@@ -143,97 +576,80 @@ int mdif_to_png(const char* mdif_filename, const char* png_filename) {
         return 1;
     }
 
-    png_structp png_ptr = png_create_write_struct(
-        PNG_LIBPNG_VER_STRING,
-        NULL, NULL, NULL
-    );
-    if(!png_ptr) {
-        fclose(png_file);
-        mdif_free(&mdif_image);
-
-        fprintf(
-            stderr,
-            "Error initializing PNG write structure\n"
-        );
-        return 1;
-    }
-
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if(!info_ptr) {
-        fprintf(
-            stderr,
-            "Error initializing PNG info structure\n"
-        );
-
-        png_destroy_write_struct(&png_ptr, NULL);
-        fclose(png_file);
-
-        mdif_free(&mdif_image);
-        return 1;
-    }
+    int status = export_image(&mdif_image, preset, threads, png_file);
+    if(fclose(png_file) != 0)
+        status = 1;
 
-    if(setjmp(png_jmpbuf(png_ptr))) {
+    if(status != 0)
         fprintf(
             stderr,
             "Error during PNG file write.\n"
         );
 
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        mdif_free(&mdif_image);
+    mdif_free(&mdif_image);
+    return status;
+}
 
-        fclose(png_file);
-        return 1;
-    }
+int main(int argc, char *argv[]) {
+    const export_preset_t* preset = &export_presets[1];
+    const char* dithers[3] = {"none", "ordered", "floyd"};
 
-    png_init_io(png_ptr, png_file);
-    png_set_IHDR(
-        png_ptr, info_ptr,
-        mdif_image.width,
-        mdif_image.height,
-        8,
-        PNG_COLOR_TYPE_RGBA,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT
-    );
-    png_write_info(png_ptr, info_ptr);
+    mdif_dither_t dither = MDIF_DITHER_FLOYD_STEINBERG;
+    int threads = 0, colors = 0;
 
-    png_bytep row_pointers[mdif_image.height];
-    for(int y = 0; y < mdif_image.height; y++) {
-        row_pointers[y] = (png_byte *)
-            malloc(4 * mdif_image.width * sizeof(png_byte));
+    const char* cache_directory = NULL;
+    unsigned long long cache_megabytes = 1024;
 
-        for(int x = 0; x < mdif_image.width; x++) {
-            int index = y * mdif_image.width + x;
+    bool valid = argc >= 3;
+    for(int i = 1; i < argc - 2 && valid; i++) {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc - 2)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc - 2) {
+            preset = NULL;
+            i++;
 
-            row_pointers[y][x * 4]      = mdif_image.red[index];
-            row_pointers[y][x * 4 + 1]  = mdif_image.green[index];
-            row_pointers[y][x * 4 + 2]  = mdif_image.blue[index];
-            row_pointers[y][x * 4 + 3]  = mdif_image.alpha[index];
+            for(size_t p = 0; p < sizeof(export_presets) / sizeof(export_presets[0]); p++)
+                if(strcmp(argv[i], export_presets[p].name) == 0)
+                    preset = &export_presets[p];
+
+            valid = preset != NULL;
+        }
+        else if(strcmp(argv[i], "-q") == 0 && i + 1 < argc - 2) {
+            colors = atoi(argv[++i]);
+            valid = colors >= 1 && colors <= MDIF_PALETTE_SIZE;
         }
+        else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc - 2) {
+            valid = false;
+            i++;
+
+            for(int d = 0; d < 3; d++)
+                if(strcmp(argv[i], dithers[d]) == 0) {
+                    dither = (mdif_dither_t) d;
+                    valid = true;
+                }
+        }
+        else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc - 2)
+            cache_directory = argv[++i];
+        else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc - 2) {
+            cache_megabytes = strtoull(argv[++i], NULL, 10);
+            valid = cache_megabytes > 0;
+        }
+        else valid = false;
     }
 
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, NULL);
-
-    for(int y = 0; y < mdif_image.height; y++)
-        free(row_pointers[y]);
-
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(png_file);
-
-    mdif_free(&mdif_image);
-    return 0;
-}
-
-int main(int argc, char *argv[]) {
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+    if(!valid) {
+        fprintf(stderr, "Usage: %s [-p preset] [-j threads] [-q colors [-d dither]] [-c cache [-m megabytes]] <input> <output>\n", argv[0]);
+        fprintf(stderr, "  -p preset     PNG export preset: fast, default or small (default: default)\n");
+        fprintf(stderr, "  -j threads    Number of export threads (default: one per processor)\n");
+        fprintf(stderr, "  -q colors     Store an indexed MDIF image with up to this many palette colors\n");
+        fprintf(stderr, "  -d dither     Dithering when quantizing: none, ordered or floyd (default: floyd)\n");
+        fprintf(stderr, "  -c cache      Reuse the output of an earlier identical conversion from a cache directory\n");
+        fprintf(stderr, "  -m megabytes  Size bound of the cache directory (default: 1024)\n");
         return 1;
     }
 
-    const char* infile = argv[1];
-    const char* outfile = argv[2];
+    const char* infile = argv[argc - 2];
+    const char* outfile = argv[argc - 1];
 
     int direction;
     if(strcmp(infile + strlen(infile) - 4, ".png") == 0 &&
@@ -247,16 +663,50 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    char params[64];
+    if(direction == 0)
+        snprintf(params, sizeof(params), "mdif_png 1 to_mdif %d %d", colors, (int) dither);
+    else snprintf(params, sizeof(params), "mdif_png 1 to_png %s", preset->name);
+
+    mdif_cache_t cache;
+    unsigned long long key = 0;
+    bool cached = false;
+
+    if(cache_directory) {
+        mdif_error_t cache_result = mdif_cache_open(&cache, cache_directory, cache_megabytes << 20);
+        if(cache_result == MDIF_ERROR_NONE) {
+            cached = mdif_cache_key(infile, params, strlen(params), &key) == MDIF_ERROR_NONE;
+
+            if(cached && mdif_cache_load_file(&cache, key, outfile) == MDIF_ERROR_NONE) {
+                mdif_cache_close(&cache);
+
+                printf("Conversion successful (cached).\n");
+                return 0;
+            }
+        }
+        else fprintf(stderr, "Warning: %s: %s\n", cache_directory, mdif_error_message(cache_result));
+    }
+
     int result;
     if(direction == 0)
-        result = png_to_mdif(infile, outfile);
+        result = png_to_mdif(infile, outfile, colors, dither);
     else if(direction == 1)
-        result = mdif_to_png(infile, outfile);
+        result = mdif_to_png(infile, outfile, preset, threads);
     else {
         fprintf(stderr, "Invalid input files specified.\n");
         return 1;
     }
 
+    if(result == 0 && cached) {
+        mdif_error_t cache_result = mdif_cache_store_file(&cache, key, outfile);
+
+        if(cache_result != MDIF_ERROR_NONE)
+            fprintf(stderr, "Warning: %s: %s\n", cache_directory, mdif_error_message(cache_result));
+    }
+
+    if(cache_directory)
+        mdif_cache_close(&cache);
+
     if(result != 0) {
         fprintf(stderr, "Conversion failed.\n");
         return 1;
@@ -0,0 +1 @@
+gcc -static -o ..\..\dist\mdif_stats.exe -I..\..\src ..\..\src\mdif.cpp mdif_stats.cpp -lm
\ No newline at end of file
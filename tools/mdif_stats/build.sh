@@ -0,0 +1,2 @@
+mkdir -p ../../dist
+gcc -o ../../dist/mdif_stats mdif_stats.cpp ../../src/mdif.cpp -lm -I../../src -pthread
\ No newline at end of file
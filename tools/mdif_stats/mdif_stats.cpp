@@ -0,0 +1,183 @@
+/* 
+ * Copyright 2024 Nathanne Isip
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdif.h"
+
+typedef struct file_list_struct {
+    char** names;
+    int count;
+    int capacity;
+} file_list_t;
+
+int file_list_add(file_list_t* list, const char* name, size_t length) {
+    if(list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char** names = (char**) realloc(list->names, capacity * sizeof(char*));
+
+        if(!names)
+            return 1;
+
+        list->names = names;
+        list->capacity = capacity;
+    }
+
+    char* copy = (char*) malloc(length + 1);
+    if(!copy)
+        return 1;
+
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    list->names[list->count++] = copy;
+    return 0;
+}
+
+int file_list_load(file_list_t* list, const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if(!file) {
+        fprintf(stderr, "Can't open %s\n", filename);
+        return 1;
+    }
+
+    char line[4096];
+    while(fgets(line, sizeof(line), file)) {
+        size_t length = strcspn(line, "\t\r\n");
+
+        if(length > 0 && line[0] != '#' && file_list_add(list, line, length) != 0) {
+            fclose(file);
+            return 1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+void file_list_free(file_list_t* list) {
+    for(int i = 0; i < list->count; i++)
+        free(list->names[i]);
+
+    free(list->names);
+}
+
+void print_usage(const char* program) {
+    fprintf(
+        stderr,
+        "Usage: %s [-j threads] [-l list] [-m stats] [-o stats] [files...]\n"
+        "  -j threads  Number of threads (default: one per processor)\n"
+        "  -l list     Read file names from a list or catalog manifest\n"
+        "  -m stats    Merge a saved statistics file\n"
+        "  -o stats    Save the accumulated statistics to a file\n",
+        program
+    );
+}
+
+int main(int argc, char* argv[]) {
+    file_list_t files = {NULL, 0, 0};
+    const char* output = NULL;
+    int threads = 0;
+
+    mdif_stats_t stats;
+    mdif_stats_init(&stats);
+
+    for(int i = 1; i < argc; i++) {
+        if(argv[i][0] == '-' && i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        if(strcmp(argv[i], "-j") == 0)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0)
+            output = argv[++i];
+        else if(strcmp(argv[i], "-l") == 0) {
+            if(file_list_load(&files, argv[++i]) != 0) {
+                file_list_free(&files);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-m") == 0) {
+            mdif_stats_t saved;
+            mdif_error_t result = mdif_stats_load(argv[++i], &saved);
+
+            if(result != MDIF_ERROR_NONE) {
+                fprintf(stderr, "Error: %s: %s\n", argv[i], mdif_error_message(result));
+                file_list_free(&files);
+                return 1;
+            }
+
+            mdif_stats_merge(&stats, &saved);
+        }
+        else if(argv[i][0] == '-') {
+            print_usage(argv[0]);
+            file_list_free(&files);
+            return 1;
+        }
+        else if(file_list_add(&files, argv[i], strlen(argv[i])) != 0) {
+            file_list_free(&files);
+            return 1;
+        }
+    }
+
+    if(files.count == 0 && stats.images == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    mdif_error_t result = mdif_stats_files(
+        (const char* const*) files.names,
+        files.count,
+        &stats,
+        threads
+    );
+
+    file_list_free(&files);
+    if(result != MDIF_ERROR_NONE)
+        fprintf(stderr, "Warning: %s\n", mdif_error_message(result));
+
+    if(output) {
+        mdif_error_t saved = mdif_stats_save(output, &stats);
+
+        if(saved != MDIF_ERROR_NONE) {
+            fprintf(stderr, "Error: %s\n", mdif_error_message(saved));
+            return 1;
+        }
+    }
+
+    const char* names[4] = {"red", "green", "blue", "alpha"};
+    printf("Images:\t%llu\r\nPixels:\t%llu\r\n", stats.images, stats.pixels);
+    printf("Channel\tMean\tStd\tMin\tMax\r\n");
+
+    for(int c = 0; c < 4; c++) {
+        mdif_summary_t summary;
+        mdif_stats_summary(&stats, c, &summary);
+
+        printf(
+            "%s\t%.4f\t%.4f\t%d\t%d\r\n",
+            names[c],
+            summary.mean,
+            summary.stddev,
+            summary.min,
+            summary.max
+        );
+    }
+
+    return result == MDIF_ERROR_NONE ? 0 : 1;
+}
@@ -25,6 +25,17 @@ public:
             &image
         );
 
+        if(result == MDIF_ERROR_NONE && image.layout != MDIF_LAYOUT_RGBA) {
+            mdif_t converted;
+            result = mdif_init_layout(&converted, image.width, image.height, MDIF_LAYOUT_RGBA);
+
+            if(result == MDIF_ERROR_NONE)
+                result = mdif_convert(&image, &converted);
+
+            mdif_free(&image);
+            image = converted;
+        }
+
         if(result != MDIF_ERROR_NONE) {
             QMessageBox::critical(
                 this,